@@ -0,0 +1,856 @@
+// GazeTools.cpp : offline tools for the gaze tracker.
+//
+
+#include "stdafx.h"
+#include "gazeTuner.h"
+#include "cascadeCache.h"
+#include "detectorBench.h"
+#include "eyeSynth.h"
+#include "gazeService.h"
+#include "sharedResultRing.h"
+#include "asyncLog.h"
+#include "depthCodec.h"
+#include "sessionIndex.h"
+#include "metricsStore.h"
+#include "frameFile.h"
+#include "stageStats.h"
+#include "pipelineTrace.h"
+
+#include <string>
+#include <math.h>
+
+namespace {
+
+	void usage()
+	{
+		printf("usage:\n");
+		printf("  GazeTools tune <labels.txt> <out.yml> [budgetMs] [front.csv]\n");
+		printf("      sweeps the GazeParams grid over a labelled image set, prints the\n");
+		printf("      pareto front of pixel error vs. ms/frame and saves the most accurate\n");
+		printf("      setting that fits budgetMs as a config for GazeTracking::initialize\n");
+		printf("  GazeTools synth [-count n] [-width px] [-seed n] [-params file.yml] [-repeats n]\n");
+		printf("                  [-maxError px] [-maxMs ms]\n");
+		printf("      runs the pupil search over generated eye crops with known centres and\n");
+		printf("      prints the pixel error and ms/eye; fails when the mean error or the\n");
+		printf("      time is above the given bound, as a gate for changes to the voting\n");
+		printf("  GazeTools synth -faces <dir> [-count n] [-width px] [-seed n]\n");
+		printf("      writes generated faces (width px wide) and a labels.txt for tune and detect\n");
+		printf("  GazeTools cascade <cascade.xml> [cascade.bin]\n");
+		printf("      precompiles the binary cascade cache so the first start skips the XML\n");
+		printf("  GazeTools detect <labels.txt> <cascade.xml> [more cascades] [-params file.yml]\n");
+		printf("      measures throughput and hit rate of every cascade at full resolution\n");
+		printf("      and through the 2x and 4x pyramid detector on the same images\n");
+		printf("  GazeTools serve <video|pattern|list.txt|file.frames|synthetic[:n]> [-params file.yml]\n");
+		printf("                  [-csv out.csv] [-fps n] [-stats seconds] [-trace out.json]\n");
+		printf("      runs the headless gaze service over a recorded source and writes one\n");
+		printf("      csv row per frame; the exit code is the final tracker status. -stats\n");
+		printf("      logs the stage latencies every interval and the totals at the end,\n");
+		printf("      -trace writes the last stages of every thread for ui.perfetto.dev\n");
+		printf("  GazeTools ring [name] [seconds]\n");
+		printf("      attaches to the shared memory results of a running tracker started\n");
+		printf("      with -SharedRing[:name] and prints one line per second\n");
+		printf("  GazeTools depth <frames.raw> <width> <height> [out.dpc]\n");
+		printf("      compresses raw D13P3 depth frames, checks that every frame decodes\n");
+		printf("      back unchanged and prints the ratio and the encode/decode rates\n");
+		printf("  GazeTools session <file.session> [fromMs] [toMs] [-gaze] [-list]\n");
+		printf("      seeks a recorded session through its index (built on first use)\n");
+		printf("      and summarizes the frames in the range, -gaze only those with pupils\n");
+		printf("  GazeTools frames <file.frames|synthetic[:n]> [out.frames]\n");
+		printf("      reads a frame source as fast as it delivers, prints its rate and\n");
+		printf("      optionally writes the frames to a new frame file\n");
+		printf("  GazeTools metrics <file.metrics> [more files] [-from s] [-to s] [-tracked|-gaze]\n");
+		printf("                    [-hist column lo hi bins] [-check]\n");
+		printf("      aggregates the per frame metrics of one or more sessions written with\n");
+		printf("      -Metrics[:file]; the window is in seconds from the start of each file.\n");
+		printf("      -check fails when a mean or deviation differs from a two pass\n");
+		printf("      recomputation, without files it checks a generated one whose tz moves\n");
+		printf("      by 0.2 mm around 1.5 m\n");
+	}
+
+	const char* kCascadeFile = "res/haarcascade_frontalface_alt.xml";
+
+	int cascade(int argc, char* argv[])
+	{
+		if (argc < 3)
+		{
+			usage();
+			return 1;
+		}
+		std::string xmlFile = argv[2];
+		std::string binFile = argc > 3 ? argv[3] : CachedCascadeClassifier::defaultCacheFile(xmlFile);
+
+		CachedCascadeClassifier classifier;
+		int64 start = cv::getTickCount();
+		if (!classifier.load(xmlFile))
+		{
+			printf("Could not load %s\n", xmlFile.c_str());
+			return 1;
+		}
+		double xmlMs = (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+		if (!classifier.saveBinary(binFile, xmlFile))
+		{
+			printf("Could not write %s (only old style haar cascades are supported)\n", binFile.c_str());
+			return 1;
+		}
+
+		start = cv::getTickCount();
+		if (!classifier.loadBinary(binFile, xmlFile))
+		{
+			printf("Could not read back %s\n", binFile.c_str());
+			return 1;
+		}
+		double binMs = (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+		printf("wrote %s: xml %.2f ms, binary %.2f ms\n", binFile.c_str(), xmlMs, binMs);
+		return 0;
+	}
+
+	int detect(int argc, char* argv[])
+	{
+		if (argc < 4)
+		{
+			usage();
+			return 1;
+		}
+
+		GazeParams params;
+		std::vector<std::string> cascades;
+		for (int i = 3; i < argc; ++i)
+		{
+			std::string arg = argv[i];
+			if (arg == "-params" && i + 1 < argc)
+			{
+				if (!params.load(argv[++i]))
+				{
+					printf("Could not read %s\n", argv[i]);
+					return 1;
+				}
+			}
+			else
+			{
+				cascades.push_back(arg);
+			}
+		}
+
+		std::vector<LabelledImage> images;
+		if (!loadLabelledImages(argv[2], images))
+			return 1;
+		FaceDetectOptions options = params.detectOptions(images[0].image.size());
+		printf("%d images, face size %d..%d px\n", (int)images.size(), options.minSize.width, options.maxSize.width);
+		printf("%-40s %-9s %9s %8s %6s %6s %6s\n", "cascade", "backend", "ms/frame", "fps", "hit", "miss", "wrong");
+
+		for (size_t c = 0; c < cascades.size(); ++c)
+		{
+			CascadeFaceDetector cascadeDetector;
+			if (!cascadeDetector.load(cascades[c]))
+			{
+				printf("Could not load %s\n", cascades[c].c_str());
+				continue;
+			}
+			PyramidFaceDetector pyramidDetector(&cascadeDetector);
+
+			const int factors[] = {1, 2, 4};
+			for (int f = 0; f < 3; ++f)
+			{
+				pyramidDetector.setFactor(factors[f]);
+				FaceDetector& detector = factors[f] > 1 ? (FaceDetector&)pyramidDetector : (FaceDetector&)cascadeDetector;
+				std::string name = std::string(cascadeDetector.name()) + (factors[f] > 1 ? std::string("/") + pyramidDetector.name() : std::string());
+
+				DetectorBenchResult result;
+				benchDetector(detector, name, images, params, 3, result);
+				printf("%-40s %-9s %9.3f %8.1f %6d %6d %6d\n", cascades[c].c_str(), result.name.c_str(),
+					result.msPerFrame, result.framesPerSecond, result.hits, result.misses, result.falseHits);
+			}
+		}
+		return 0;
+	}
+
+	struct CsvRows
+	{
+		FILE* file;
+		LONG rows;			// written by the bus thread, read after stop()
+	};
+
+	void writeServiceRow(PVOID param, const GazeService::ServiceResultBus::ResultPtr& result)
+	{
+		CsvRows* csv = (CsvRows*)param;
+		++csv->rows;
+		fprintf(csv->file, "%u,%d,%d,%d,%d,%d,%d,%d,%d,%d,%.3f,%.3f\n", result->frameId, result->findFace ? 1 : 0,
+			result->faceX, result->faceY, result->faceWidth, result->faceHeight,
+			result->leftX, result->leftY, result->rightX, result->rightY, result->confidence, result->analyzeMs);
+	}
+
+	int serve(int argc, char* argv[])
+	{
+		if (argc < 3)
+		{
+			usage();
+			return 1;
+		}
+		std::string source = argv[2];
+		std::string configFile;
+		std::string csvFile;
+		DWORD intervalMs = 0;
+		DWORD statsMs = 0;
+		std::string traceFile;
+		for (int i = 3; i + 1 < argc; ++i)
+		{
+			std::string arg = argv[i];
+			if (arg == "-params")
+				configFile = argv[++i];
+			else if (arg == "-csv")
+				csvFile = argv[++i];
+			else if (arg == "-fps")
+			{
+				double fps = atof(argv[++i]);
+				intervalMs = fps > 0.0 ? (DWORD)(1000.0 / fps) : 0;
+			}
+			else if (arg == "-stats")
+				statsMs = (DWORD)(atof(argv[++i]) * 1000.0);
+			else if (arg == "-trace")
+				traceFile = argv[++i];
+		}
+
+		GazeService service;
+		CsvRows csv = {NULL, 0};
+		if (!csvFile.empty())
+		{
+			csv.file = fopen(csvFile.c_str(), "w");
+			if (!csv.file)
+			{
+				printf("Could not write %s\n", csvFile.c_str());
+				return 1;
+			}
+			fprintf(csv.file, "frame,face,faceX,faceY,faceW,faceH,leftX,leftY,rightX,rightY,confidence,ms\n");
+			// a recorder must see every frame
+			service.getResultBus().subscribe("csv", writeServiceRow, &csv, 64, GazeService::ServiceResultBus::Lossless, INFINITE);
+		}
+
+		if (statsMs)
+			StageStats::startDump(statsMs);
+		if (!traceFile.empty())
+			PipelineTrace::start();
+		int64 start = cv::getTickCount();
+		if (FAILED(service.start(source, kCascadeFile, configFile, intervalMs)))
+		{
+			printf("Could not start the service: %s\n", trackerStatusName(service.getStatus()));
+			if (csv.file)
+				fclose(csv.file);
+			StageStats::stopDump();
+			return (int)service.getStatus();
+		}
+		service.wait();
+		double ms = (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+		TrackerStatus status = service.getStatus();
+
+		// flushes the csv subscriber before the file is closed
+		service.stop();
+		if (csv.file)
+			fclose(csv.file);
+		StageStats::stopDump();
+		if (!traceFile.empty())
+		{
+			PipelineTrace::stop();
+			PipelineTrace::write(traceFile.c_str());
+		}
+
+		LONG frames = service.getFrameCount();
+		printf("%s: %ld frames in %.1f ms (%.1f fps), cascade load %.1f ms\n", trackerStatusName(status), frames, ms,
+			ms > 0.0 ? frames * 1000.0 / ms : 0.0, service.getLoadMs());
+		if (csv.file && csv.rows != frames)
+		{
+			// the recorder is lossless, a missing row is a bug
+			printf("csv: %ld rows for %ld frames\n", csv.rows, frames);
+			return 1;
+		}
+		return status == TRACKER_SOURCE_FINISHED ? 0 : (int)status;
+	}
+
+	int ring(int argc, char* argv[])
+	{
+		std::string name = argc > 2 ? argv[2] : "FaceTracking";
+		int seconds = argc > 3 ? atoi(argv[3]) : 10;
+
+		SharedResultReader reader;
+		if (!reader.open(name))
+		{
+			printf("No tracker publishes %s\n", name.c_str());
+			return 1;
+		}
+		SharedTrackingRecord record;
+		for (int s = 0; s < seconds; ++s)
+		{
+			unsigned records = 0, tracked = 0;
+			DWORD end = GetTickCount() + 1000;
+			while ((LONG)(end - GetTickCount()) > 0)
+			{
+				if (reader.next(record))
+				{
+					++records;
+					tracked += (record.flags & SHARED_RECORD_TRACKED) ? 1 : 0;
+				}
+				else
+				{
+					Sleep(2);
+				}
+			}
+			printf("%u records, %u tracked, %llu lost", records, tracked, (unsigned long long)reader.getLost());
+			if (records)
+				printf(", frame %u user %u pitch %.1f yaw %.1f roll %.1f", record.frameId, record.userId,
+					record.rotation[0], record.rotation[1], record.rotation[2]);
+			printf("\n");
+		}
+		return 0;
+	}
+
+	int depth(int argc, char* argv[])
+	{
+		if (argc < 5)
+		{
+			usage();
+			return 1;
+		}
+		UINT width = (UINT)atoi(argv[3]);
+		UINT height = (UINT)atoi(argv[4]);
+		if (!width || !height)
+		{
+			usage();
+			return 1;
+		}
+		FILE* in = fopen(argv[2], "rb");
+		if (!in)
+		{
+			printf("Could not read %s\n", argv[2]);
+			return 1;
+		}
+		FILE* out = NULL;
+		if (argc > 5 && !(out = fopen(argv[5], "wb")))
+		{
+			printf("Could not write %s\n", argv[5]);
+			fclose(in);
+			return 1;
+		}
+
+		size_t pixels = (size_t)width * height;
+		std::vector<uint16_t> frame(pixels), decoded(pixels);
+		std::vector<uint8_t> encoded;
+		DepthCodec encoder, decoder;
+		int frames = 0, mismatches = 0;
+		unsigned long long rawBytes = 0, encodedBytes = 0;
+		int64 encodeTicks = 0, decodeTicks = 0;
+		while (fread(&frame[0], sizeof(uint16_t), pixels, in) == pixels)
+		{
+			encoded.clear();
+			int64 start = cv::getTickCount();
+			encoder.encode(&frame[0], width, height, width * sizeof(uint16_t), encoded);
+			int64 middle = cv::getTickCount();
+			bool ok = decoder.decode(&encoded[0], encoded.size(), &decoded[0], width, height, width * sizeof(uint16_t));
+			decodeTicks += cv::getTickCount() - middle;
+			encodeTicks += middle - start;
+
+			mismatches += (ok && decoded == frame) ? 0 : 1;
+			rawBytes += pixels * sizeof(uint16_t);
+			encodedBytes += encoded.size();
+			++frames;
+			if (out)
+				fwrite(&encoded[0], 1, encoded.size(), out);
+		}
+		fclose(in);
+		if (out)
+			fclose(out);
+		if (!frames)
+		{
+			printf("No %ux%u frame in %s\n", width, height, argv[2]);
+			return 1;
+		}
+
+		double frequency = cv::getTickFrequency();
+		printf("%d frames, ratio %.2f:1, encode %.1f fps, decode %.1f fps, %d mismatches\n", frames,
+			(double)rawBytes / encodedBytes, frames * frequency / encodeTicks, frames * frequency / decodeTicks, mismatches);
+		return mismatches ? 1 : 0;
+	}
+
+	int session(int argc, char* argv[])
+	{
+		if (argc < 3)
+		{
+			usage();
+			return 1;
+		}
+		double fromMs = -1.0, toMs = -1.0;
+		uint32_t flags = 0;
+		bool list = false;
+		for (int i = 3; i < argc; ++i)
+		{
+			std::string arg = argv[i];
+			if (arg == "-gaze")
+				flags |= SESSION_FRAME_GAZE;
+			else if (arg == "-list")
+				list = true;
+			else if (fromMs < 0.0)
+				fromMs = atof(argv[i]);
+			else
+				toMs = atof(argv[i]);
+		}
+
+		int64 start = cv::getTickCount();
+		SessionIndex index;
+		if (!index.open(argv[2]))
+		{
+			printf("Could not read %s\n", argv[2]);
+			return 1;
+		}
+		double openMs = (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+		printf("%u frames, %.1f s, index opened in %.2f ms\n", (unsigned)index.size(), index.getDurationMs() / 1000.0, openMs);
+
+		size_t first = fromMs > 0.0 ? index.seekMs(fromMs) : 0;
+		size_t last = toMs >= 0.0 ? index.seekMs(toMs) : index.size();
+		SessionCursor cursor(index, first, last, flags);
+		SessionFrameView view;
+		unsigned matched = 0;
+		double rotation[3] = {0.0, 0.0, 0.0};
+		while (cursor.next(view))
+		{
+			++matched;
+			for (int i = 0; i < 3; ++i)
+				rotation[i] += view.frame->pose.rotation[i];
+			if (list)
+			{
+				printf("%10.1f ms frame %u pitch %6.1f yaw %6.1f roll %6.1f%s\n", index.toMs(view.entry->timestamp),
+					view.frame->frameId, view.frame->pose.rotation[0], view.frame->pose.rotation[1], view.frame->pose.rotation[2],
+					(view.frame->flags & SESSION_FRAME_GAZE) ? " gaze" : "");
+			}
+		}
+		printf("%u of %u frames in range match", matched, (unsigned)(last > first ? last - first : 0));
+		if (matched)
+			printf(", mean pitch %.1f yaw %.1f roll %.1f", rotation[0] / matched, rotation[1] / matched, rotation[2] / matched);
+		printf("\n");
+		return 0;
+	}
+
+	int frames(int argc, char* argv[])
+	{
+		if (argc < 3)
+			return -1;
+		std::string spec = argv[2];
+		if (spec == "synthetic")
+			spec = "synthetic:300";
+		FrameSource* source = createFrameSource(spec, false);
+		if (!source || FAILED(source->open()))
+		{
+			printf("Could not open %s\n", spec.c_str());
+			delete source;
+			return 1;
+		}
+		const FrameSourceConfig& config = source->getConfig();
+		printf("%s source: colour %ux%u, depth %ux%u\n", source->getName(), config.colorWidth, config.colorHeight,
+			config.depthWidth, config.depthHeight);
+
+		FrameFileWriter writer;
+		if (argc > 3 && !writer.open(argv[3], config))
+		{
+			printf("Could not write %s\n", argv[3]);
+			delete source;
+			return 1;
+		}
+		int64 readTicks = 0, writeTicks = 0;
+		unsigned count = 0, tracked = 0;
+		SourceFrame frame;
+		for (;;)
+		{
+			int64 start = cv::getTickCount();
+			HRESULT hr = source->readFrame(frame);
+			readTicks += cv::getTickCount() - start;
+			if (hr != S_OK)
+				break;
+			++count;
+			float none[3] = {0.0f, 0.0f, 0.0f};
+			tracked += frame.closestSkeleton(none) >= 0;
+			if (writer.isOpen())
+			{
+				start = cv::getTickCount();
+				writer.write(frame);
+				writeTicks += cv::getTickCount() - start;
+			}
+		}
+		source->close();
+		delete source;
+
+		double frequency = cv::getTickFrequency();
+		printf("%u frames, %u with a skeleton, read %.1f fps\n", count, tracked, readTicks ? count * frequency / readTicks : 0.0);
+		if (writer.isOpen())
+		{
+			writer.close();
+			printf("wrote %u frames, %llu bytes, %.1f fps%s\n", writer.getFrameCount(), writer.getBytesWritten(),
+				writeTicks ? count * frequency / writeTicks : 0.0, writer.hasFailed() ? ", write failed" : "");
+			return writer.hasFailed() ? 1 : 0;
+		}
+		return 0;
+	}
+
+	// Mean and deviation of one column done the slow way: the mean first,
+	// then the squared deviations from it.
+	void twoPassSummary(const MetricsStore& store, MetricColumn column, const MetricsFilter& filter, double& mean, double& deviation)
+	{
+		double sum = 0.0;
+		uint64_t n = 0;
+		for (int pass = 0; pass < 2; ++pass)
+		{
+			double squares = 0.0;
+			for (size_t i = 0; i < store.getChunkCount(); ++i)
+			{
+				UINT first, last;
+				store.window(i, filter.from, filter.to, first, last);
+				const float* v = store.floats(i, column);
+				const uint32_t* f = store.uints(i, METRIC_FLAGS);
+				for (UINT r = first; r < last; ++r)
+				{
+					if ((f[r] & filter.requiredFlags) != filter.requiredFlags)
+						continue;
+					if (pass == 0)
+					{
+						sum += v[r];
+						++n;
+					}
+					else
+						squares += (v[r] - mean) * (v[r] - mean);
+				}
+			}
+			if (pass == 0)
+				mean = n ? sum / n : 0.0;
+			else
+				deviation = n > 1 ? sqrt(squares / n) : 0.0;
+		}
+	}
+
+	bool checkSummary(const MetricsStore& store, MetricColumn column, const MetricsFilter& filter)
+	{
+		MetricsSummary s;
+		store.summarize(column, filter, s);
+		double mean = 0.0, deviation = 0.0;
+		twoPassSummary(store, column, filter, mean, deviation);
+		// float inputs, so a few ulp of the values and 0.1 % of the spread
+		double meanTolerance = 1e-6 * fabs(mean) + 1e-3 * deviation + 1e-12;
+		double deviationTolerance = 1e-3 * deviation + 1e-7 * fabs(mean) + 1e-12;
+		if (fabs(s.mean() - mean) > meanTolerance || fabs(s.deviation() - deviation) > deviationTolerance)
+		{
+			printf("check: %s mean %.9g deviation %.9g, two pass %.9g %.9g\n", metricColumnName(column),
+				s.mean(), s.deviation(), mean, deviation);
+			return false;
+		}
+		return true;
+	}
+
+	// Several chunks of a face that hardly moves, every tenth frame lost.
+	bool writeCheckMetrics(const std::string& path)
+	{
+		MetricsWriter writer;
+		if (!writer.open(path))
+			return false;
+		cv::RNG rng(7);
+		for (int i = 0; i < 5 * METRICS_CHUNK_ROWS + 123; ++i)
+		{
+			MetricsRow row;
+			row.timestamp = (int64_t)i * 1000;
+			row.frameId = i + 1;
+			row.flags = i % 10 ? METRIC_FLAG_TRACKED : 0;
+			if (row.flags)
+			{
+				row.at(METRIC_TZ) = 1.5f + (float)rng.uniform(-0.0002, 0.0002);
+				row.at(METRIC_TX) = (float)rng.gaussian(0.05);
+				row.at(METRIC_YAW) = 20.0f + (float)rng.gaussian(3.0);
+				row.at(METRIC_FACE_LEFT) = 250.0f + (float)rng.uniform(0, 4);
+			}
+			writer.append(row);
+		}
+		writer.close();
+		return !writer.hasFailed();
+	}
+
+	int metrics(int argc, char* argv[])
+	{
+		std::vector<std::string> files;
+		double fromS = -1.0, toS = -1.0;
+		uint32_t flags = 0;
+		MetricColumn histColumn = METRIC_COLUMN_COUNT;
+		float lo = 0.0f, hi = 0.0f;
+		std::vector<uint64_t> bins;
+		bool check = false;
+		for (int i = 2; i < argc; ++i)
+		{
+			std::string arg = argv[i];
+			if (arg == "-check")
+				check = true;
+			else if (arg == "-from" && i + 1 < argc)
+				fromS = atof(argv[++i]);
+			else if (arg == "-to" && i + 1 < argc)
+				toS = atof(argv[++i]);
+			else if (arg == "-tracked")
+				flags |= METRIC_FLAG_TRACKED;
+			else if (arg == "-gaze")
+				flags |= METRIC_FLAG_GAZE;
+			else if (arg == "-hist" && i + 4 < argc)
+			{
+				histColumn = metricColumnByName(argv[++i]);
+				lo = (float)atof(argv[++i]);
+				hi = (float)atof(argv[++i]);
+				bins.assign(std::max(atoi(argv[++i]), 1), 0);
+				if (histColumn < METRIC_FIRST_FLOAT || histColumn >= METRIC_COLUMN_COUNT || !(hi > lo))
+				{
+					printf("Cannot make a histogram of %s over [%g, %g)\n", argv[i - 3], lo, hi);
+					return 1;
+				}
+			}
+			else
+				files.push_back(arg);
+		}
+		if (files.empty() && check)
+		{
+			files.push_back("check.metrics");
+			if (!writeCheckMetrics(files.back()))
+			{
+				printf("Could not write %s\n", files.back().c_str());
+				return 1;
+			}
+		}
+		if (files.empty())
+			return -1;
+
+		MetricsSummary summaries[METRIC_COLUMN_COUNT];
+		int mismatches = 0;
+		uint64_t rows = 0, selected = 0, tracked = 0;
+		int64 start = cv::getTickCount();
+		for (size_t f = 0; f < files.size(); ++f)
+		{
+			MetricsStore store;
+			if (!store.open(files[f]))
+			{
+				printf("Could not read %s\n", files[f].c_str());
+				return 1;
+			}
+			MetricsFilter filter;
+			double ticks = (double)store.getHeader()->tickFrequency;
+			if (fromS >= 0.0)
+				filter.from = store.getFirstTimestamp() + (int64_t)(fromS * ticks);
+			if (toS >= 0.0)
+				filter.to = store.getFirstTimestamp() + (int64_t)(toS * ticks);
+			filter.requiredFlags = flags;
+
+			MetricsFilter trackedFilter = filter;
+			trackedFilter.requiredFlags = METRIC_FLAG_TRACKED;
+			rows += store.getRowCount();
+			selected += store.count(filter);
+			tracked += store.count(trackedFilter);
+			for (int c = METRIC_FIRST_FLOAT; c < METRIC_COLUMN_COUNT; ++c)
+			{
+				store.summarize((MetricColumn)c, filter, summaries[c]);
+				if (check && !checkSummary(store, (MetricColumn)c, filter))
+					++mismatches;
+			}
+			if (!bins.empty())
+				store.histogram(histColumn, filter, lo, hi, bins);
+			printf("%s: %llu rows, %.1f s\n", files[f].c_str(), store.getRowCount(),
+				(store.getLastTimestamp() - store.getFirstTimestamp()) / ticks);
+		}
+		double scanMs = (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+
+		printf("%llu of %llu rows selected, %llu tracked in the window, scanned in %.2f ms\n",
+			(unsigned long long)selected, (unsigned long long)rows, (unsigned long long)tracked, scanMs);
+		printf("%-12s %10s %10s %10s %10s\n", "column", "mean", "deviation", "min", "max");
+		for (int c = METRIC_FIRST_FLOAT; c < METRIC_COLUMN_COUNT; ++c)
+		{
+			const MetricsSummary& s = summaries[c];
+			printf("%-12s %10.4f %10.4f %10.4f %10.4f\n", metricColumnName(c), s.mean(), s.deviation(), s.min, s.max);
+		}
+		if (!bins.empty())
+		{
+			printf("\n%s:\n", metricColumnName(histColumn));
+			float width = (hi - lo) / bins.size();
+			for (size_t b = 0; b < bins.size(); ++b)
+				printf("  [%10.4f, %10.4f) %llu\n", lo + b * width, lo + (b + 1) * width, (unsigned long long)bins[b]);
+		}
+		if (check)
+			printf("check: %d columns differ from the two pass result\n", mismatches);
+		return mismatches ? 1 : 0;
+	}
+
+	int synth(int argc, char* argv[])
+	{
+		int count = 2000;
+		int width = 0;
+		int repeats = 3;
+		unsigned long seed = 1;
+		double maxError = 0.0;
+		double maxMs = 0.0;
+		std::string faceDir;
+		GazeParams params;
+		for (int i = 2; i + 1 < argc; ++i)
+		{
+			std::string arg = argv[i];
+			if (arg == "-count")
+				count = atoi(argv[++i]);
+			else if (arg == "-width")
+				width = atoi(argv[++i]);
+			else if (arg == "-seed")
+				seed = strtoul(argv[++i], NULL, 10);
+			else if (arg == "-repeats")
+				repeats = atoi(argv[++i]);
+			else if (arg == "-maxError")
+				maxError = atof(argv[++i]);
+			else if (arg == "-maxMs")
+				maxMs = atof(argv[++i]);
+			else if (arg == "-faces")
+				faceDir = argv[++i];
+			else if (arg == "-params")
+			{
+				if (!params.load(argv[++i]))
+				{
+					printf("Could not read %s\n", argv[i]);
+					return 1;
+				}
+			}
+		}
+		if (count <= 0 || width < 0 || (width > 0 && width < 8))
+			return -1;
+
+		EyeSynth synth(seed);
+		if (!faceDir.empty())
+		{
+			width = width ? width : 200;
+			if (!synth.writeFaceSet(faceDir, count, width))
+			{
+				printf("Could not write the faces to %s\n", faceDir.c_str());
+				return 1;
+			}
+			printf("wrote %d faces of %d px and labels.txt to %s\n", count, width, faceDir.c_str());
+			return 0;
+		}
+
+		// crops shaped like the eye regions the tracker cuts from a face;
+		// 60 px is an eye of a face about 170 px wide
+		width = width ? width : 60;
+		int height = width * params.eyePercentHeight / params.eyePercentWidth;
+		GazeTracking tracker;
+		if (!tracker.setParams(params))
+		{
+			printf("Invalid parameters\n");
+			return 1;
+		}
+		std::vector<SyntheticEye> eyes(count);
+		EyeAppearance appearance;
+		for (int i = 0; i < count; ++i)
+		{
+			synth.randomize(appearance);
+			synth.renderEye(appearance, width, height, eyes[i]);
+		}
+
+		EyeBenchResult result;
+		benchEyeCenters(tracker, eyes, repeats, result);
+		printf("%d eyes of %dx%d px, seed %lu, fast eye width %d\n", count, width, height, seed, params.fastEyeWidth);
+		printf("error: mean %.2f px, p95 %.2f px, max %.2f px\n", result.meanError, result.p95Error, result.maxError);
+		printf("speed: %.4f ms/eye, %.0f eyes/s\n", result.msPerEye, result.eyesPerSecond);
+
+		bool pass = true;
+		if (maxError > 0.0 && result.meanError > maxError)
+		{
+			printf("FAIL: mean error %.2f px is above %.2f px\n", result.meanError, maxError);
+			pass = false;
+		}
+		if (maxMs > 0.0 && result.msPerEye > maxMs)
+		{
+			printf("FAIL: %.4f ms/eye is above %.4f ms\n", result.msPerEye, maxMs);
+			pass = false;
+		}
+		return pass ? 0 : 1;
+	}
+
+	int tune(int argc, char* argv[])
+	{
+		if (argc < 4)
+		{
+			usage();
+			return 1;
+		}
+		std::string labelFile = argv[2];
+		std::string outFile = argv[3];
+		double budgetMs = argc > 4 ? atof(argv[4]) : 0.0;
+		std::string csvFile = argc > 5 ? argv[5] : outFile + ".csv";
+
+		GazeTuner tuner;
+		if (!tuner.initialize(kCascadeFile, labelFile))
+			return 1;
+		printf("%d labelled images\n", (int)tuner.imageCount());
+
+		std::vector<TuneSample> samples, front;
+		tuner.sweep(samples);
+		GazeTuner::paretoFront(samples, front);
+		if (front.empty())
+		{
+			printf("No face found in any image\n");
+			return 1;
+		}
+
+		printf("\npareto front:\n");
+		for (size_t i = 0; i < front.size(); ++i)
+		{
+			printf("  width %2d blur %d grad %4.1f post %4.2f: %6.2f px %7.3f ms\n",
+				front[i].params.fastEyeWidth, front[i].params.weightBlurSize, front[i].params.gradientThreshold,
+				front[i].params.enablePostProcess ? front[i].params.postProcessThreshold : 0.0f,
+				front[i].meanError, front[i].msPerFrame);
+		}
+		if (!GazeTuner::writeCsv(csvFile, front))
+			printf("Could not write %s\n", csvFile.c_str());
+
+		const TuneSample* best = GazeTuner::pick(front, budgetMs);
+		if (budgetMs > 0.0 && best->msPerFrame > budgetMs)
+			printf("Nothing fits %.3f ms, using the fastest setting\n", budgetMs);
+		if (!best->params.save(outFile))
+		{
+			printf("Could not write %s\n", outFile.c_str());
+			return 1;
+		}
+		printf("saved %s: %.2f px %.3f ms\n", outFile.c_str(), best->meanError, best->msPerFrame);
+		return 0;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		usage();
+		return 1;
+	}
+
+	// the service and the tracker log from their own threads
+	AsyncLog::start();
+	int result = -1;
+	std::string command = argv[1];
+	if (command == "tune")
+		result = tune(argc, argv);
+	else if (command == "synth")
+		result = synth(argc, argv);
+	else if (command == "cascade")
+		result = cascade(argc, argv);
+	else if (command == "detect")
+		result = detect(argc, argv);
+	else if (command == "serve")
+		result = serve(argc, argv);
+	else if (command == "ring")
+		result = ring(argc, argv);
+	else if (command == "depth")
+		result = depth(argc, argv);
+	else if (command == "session")
+		result = session(argc, argv);
+	else if (command == "frames")
+		result = frames(argc, argv);
+	else if (command == "metrics")
+		result = metrics(argc, argv);
+	AsyncLog::stop();
+
+	if (result < 0)
+	{
+		usage();
+		return 1;
+	}
+	return result;
+}
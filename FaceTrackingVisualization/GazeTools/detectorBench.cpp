@@ -0,0 +1,48 @@
+#include "stdafx.h"
+#include "detectorBench.h"
+
+#include <algorithm>
+
+void benchDetector(FaceDetector& detector, const std::string& name, const std::vector<LabelledImage>& images,
+	const GazeParams& params, int repeats, DetectorBenchResult& result)
+{
+	result = DetectorBenchResult();
+	result.name = name;
+	if (images.empty())
+		return;
+
+	// same grey conversion as GazeTracking::analyze, done up front so only
+	// the detector is timed
+	std::vector<cv::Mat> grays(images.size());
+	std::vector<cv::Mat> channels;
+	for (size_t i = 0; i < images.size(); ++i)
+	{
+		cv::split(images[i].image, channels);
+		grays[i] = channels[images[i].image.channels() > 2 ? 2 : 0].clone();
+	}
+
+	std::vector<cv::Rect> faces;
+	for (size_t i = 0; i < grays.size(); ++i)
+	{
+		detector.detect(grays[i], faces, params.detectOptions(grays[i].size()));
+		if (faces.empty())
+			++result.misses;
+		else if (faces[0].contains(images[i].left) && faces[0].contains(images[i].right))
+			++result.hits;
+		else
+			++result.falseHits;
+	}
+
+	repeats = std::max(repeats, 1);
+	int64 start = cv::getTickCount();
+	for (int r = 0; r < repeats; ++r)
+	{
+		for (size_t i = 0; i < grays.size(); ++i)
+		{
+			detector.detect(grays[i], faces, params.detectOptions(grays[i].size()));
+		}
+	}
+	double totalMs = (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+	result.msPerFrame = totalMs / (repeats * grays.size());
+	result.framesPerSecond = result.msPerFrame > 0.0 ? 1000.0 / result.msPerFrame : 0.0;
+}
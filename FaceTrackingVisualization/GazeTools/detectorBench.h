@@ -0,0 +1,27 @@
+#ifndef DETECTOR_BENCH_H
+#define DETECTOR_BENCH_H
+
+#include "gazeTuner.h"
+#include "faceDetector.h"
+
+#include <string>
+#include <vector>
+
+// Throughput and hit rate of one face detector backend over an image set.
+struct DetectorBenchResult
+{
+	DetectorBenchResult() : msPerFrame(0.0), framesPerSecond(0.0), hits(0), misses(0), falseHits(0) {}
+
+	std::string name;
+	double msPerFrame;
+	double framesPerSecond;
+	int hits;		// biggest face contains both labelled pupils
+	int misses;		// no face found
+	int falseHits;	// a face was found but not around the pupils
+};
+
+// Runs every backend on the same decoded grey images so the numbers compare.
+void benchDetector(FaceDetector& detector, const std::string& name, const std::vector<LabelledImage>& images,
+	const GazeParams& params, int repeats, DetectorBenchResult& result);
+
+#endif
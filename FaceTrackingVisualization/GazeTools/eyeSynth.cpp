@@ -0,0 +1,262 @@
+#include "stdafx.h"
+#include "eyeSynth.h"
+
+#include <algorithm>
+#include <fstream>
+#include <cmath>
+
+namespace {
+
+	// shapes are drawn at kScale times the output size, with kShift
+	// fractional bits so their centres are not snapped to the grid
+	const int kScale = 4;
+	const int kShift = 4;
+
+	cv::Point fixedPoint(const cv::Point2f& p)
+	{
+		return cv::Point(cvRound(p.x * (1 << kShift)), cvRound(p.y * (1 << kShift)));
+	}
+
+	int fixedLength(float length)
+	{
+		return (std::max)(cvRound(length * (1 << kShift)), 1);
+	}
+
+	double distance(const cv::Point& a, const cv::Point2f& b)
+	{
+		double dx = a.x - b.x;
+		double dy = a.y - b.y;
+		return std::sqrt(dx * dx + dy * dy);
+	}
+
+	unsigned char shade(unsigned char level, float factor)
+	{
+		return cv::saturate_cast<unsigned char>(level * factor);
+	}
+}
+
+EyeAppearance::EyeAppearance():gazeX(0.0f), gazeY(0.0f), irisRadius(0.11f), pupilRatio(0.45f), openness(0.5f),
+	brow(false), rotation(0.0f), blur(0.0f), noise(0.0f), skin(180), sclera(230), iris(80), pupil(20)
+{
+}
+
+EyeSynth::EyeSynth(unsigned long long seed):rng(seed)
+{
+}
+
+void EyeSynth::randomize(EyeAppearance& a)
+{
+	a.gazeX = rng.uniform(-0.8f, 0.8f);
+	a.gazeY = rng.uniform(-0.5f, 0.5f);
+	a.irisRadius = rng.uniform(0.09f, 0.13f);
+	a.pupilRatio = rng.uniform(0.3f, 0.55f);
+	a.openness = rng.uniform(0.35f, 0.6f);
+	a.brow = rng.uniform(0, 2) == 1;
+	a.rotation = rng.uniform(-15.0f, 15.0f);
+	a.blur = rng.uniform(0.0f, 1.2f);
+	a.noise = rng.uniform(0.0f, 8.0f);
+	a.skin = (unsigned char)rng.uniform(140, 211);
+	a.sclera = (unsigned char)rng.uniform(200, 247);
+	a.iris = (unsigned char)rng.uniform(40, 111);
+	a.pupil = (unsigned char)rng.uniform(5, 31);
+}
+
+void EyeSynth::drawEye(const EyeAppearance& a, cv::Mat target, cv::Point2f& pupil)
+{
+	float w = (float)target.cols;
+	float h = (float)target.rows;
+	target.setTo(cv::Scalar(a.skin));
+
+	// the opening between the lids, a little below the middle of the region
+	cv::Point2f center(w * 0.5f, h * 0.55f);
+	float halfWidth = w * 0.38f;
+	float halfHeight = halfWidth * a.openness;
+	float irisRadius = a.irisRadius * w;
+	cv::Size axes(fixedLength(halfWidth), fixedLength(halfHeight));
+
+	mask.create(target.size(), CV_8U);
+	mask.setTo(cv::Scalar(0));
+	cv::ellipse(mask, fixedPoint(center), axes, 0.0, 0.0, 360.0, cv::Scalar(255), -1, 8, kShift);
+
+	// the eyeball, of which only the opening is seen; the lids may cover
+	// part of the iris, as they do when looking up or to the corners
+	pupil.x = center.x + a.gazeX * (std::max)(halfWidth - irisRadius * 0.6f, 0.0f);
+	pupil.y = center.y + a.gazeY * halfHeight * 0.5f;
+	layer.create(target.size(), CV_8U);
+	layer.setTo(cv::Scalar(a.sclera));
+	cv::circle(layer, fixedPoint(pupil), fixedLength(irisRadius), cv::Scalar(a.iris), -1, 8, kShift);
+	cv::circle(layer, fixedPoint(pupil), fixedLength(irisRadius), cv::Scalar(shade(a.iris, 0.6f)),
+		(std::max)(cvRound(irisRadius * 0.12f), 1), 8, kShift);
+	cv::circle(layer, fixedPoint(pupil), fixedLength(irisRadius * a.pupilRatio), cv::Scalar(a.pupil), -1, 8, kShift);
+	layer.copyTo(target, mask);
+
+	// lashes along the upper lid, a soft crease along the lower one
+	int lid = (std::max)(cvRound(w * 0.025f), 1);
+	cv::ellipse(target, fixedPoint(center), axes, 0.0, 180.0, 360.0, cv::Scalar(shade(a.skin, 0.25f)), lid, 8, kShift);
+	cv::ellipse(target, fixedPoint(center), axes, 0.0, 0.0, 180.0, cv::Scalar(shade(a.skin, 0.8f)), (std::max)(lid / 2, 1), 8, kShift);
+
+	if (a.brow)
+	{
+		cv::Size browAxes(fixedLength(halfWidth * 1.1f), fixedLength(h * 0.05f));
+		cv::ellipse(target, fixedPoint(cv::Point2f(center.x, h * 0.12f)), browAxes, 0.0, 0.0, 360.0,
+			cv::Scalar(shade(a.skin, 0.35f)), -1, 8, kShift);
+	}
+}
+
+void EyeSynth::degrade(const EyeAppearance& a, const cv::Mat& source, cv::Mat& out, cv::Point2f* points, int count)
+{
+	const cv::Mat* image = &source;
+	if (a.rotation != 0.0f)
+	{
+		// warpAffine maps source to destination with the same matrix
+		cv::Point2f pivot(source.cols * 0.5f - 0.5f, source.rows * 0.5f - 0.5f);
+		cv::Mat m = cv::getRotationMatrix2D(pivot, a.rotation, 1.0);
+		cv::warpAffine(source, rotated, m, source.size(), cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+		for (int i = 0; i < count; ++i)
+		{
+			cv::Point2f p = points[i];
+			points[i].x = (float)(m.at<double>(0, 0) * p.x + m.at<double>(0, 1) * p.y + m.at<double>(0, 2));
+			points[i].y = (float)(m.at<double>(1, 0) * p.x + m.at<double>(1, 1) * p.y + m.at<double>(1, 2));
+		}
+		image = &rotated;
+	}
+
+	// an output pixel averages kScale x kScale canvas pixels, so its centre
+	// sits at canvas coordinate kScale * x + (kScale - 1) / 2
+	cv::resize(*image, out, cv::Size(image->cols / kScale, image->rows / kScale), 0, 0, cv::INTER_AREA);
+	for (int i = 0; i < count; ++i)
+	{
+		points[i].x = (points[i].x - (kScale - 1) * 0.5f) / kScale;
+		points[i].y = (points[i].y - (kScale - 1) * 0.5f) / kScale;
+	}
+
+	if (a.blur > 0.0f)
+	{
+		cv::GaussianBlur(out, out, cv::Size(0, 0), a.blur);
+	}
+	if (a.noise > 0.0f)
+	{
+		noise.create(out.size(), CV_16S);
+		rng.fill(noise, cv::RNG::NORMAL, cv::Scalar(0.0), cv::Scalar(a.noise));
+		out.convertTo(noisy, CV_16S);
+		noisy += noise;
+		noisy.convertTo(out, CV_8U);
+	}
+}
+
+void EyeSynth::renderEye(const EyeAppearance& appearance, int width, int height, SyntheticEye& eye)
+{
+	canvas.create(height * kScale, width * kScale, CV_8U);
+	drawEye(appearance, canvas, eye.pupil);
+	degrade(appearance, canvas, eye.image, &eye.pupil, 1);
+}
+
+void EyeSynth::renderFace(int faceWidth, LabelledImage& face)
+{
+	EyeAppearance a;
+	randomize(a);
+
+	int size = faceWidth * 2;
+	canvas.create(size * kScale, size * kScale, CV_8U);
+	canvas.setTo(cv::Scalar(rng.uniform(30, 100)));
+
+	// the face fills the square a detector would report, centred in the image
+	float fw = (float)(faceWidth * kScale);
+	float x0 = (canvas.cols - fw) * 0.5f;
+	float y0 = (canvas.rows - fw) * 0.5f;
+	float cx = x0 + fw * 0.5f;
+	cv::ellipse(canvas, fixedPoint(cv::Point2f(cx, y0 + fw * 0.55f)), cv::Size(fixedLength(fw * 0.46f), fixedLength(fw * 0.62f)),
+		0.0, 0.0, 360.0, cv::Scalar(a.skin), -1, 8, kShift);
+	cv::line(canvas, fixedPoint(cv::Point2f(cx, y0 + fw * 0.45f)), fixedPoint(cv::Point2f(cx, y0 + fw * 0.66f)),
+		cv::Scalar(shade(a.skin, 0.85f)), (std::max)(cvRound(fw * 0.03f), 1), 8, kShift);
+	cv::ellipse(canvas, fixedPoint(cv::Point2f(cx, y0 + fw * 0.68f)), cv::Size(fixedLength(fw * 0.08f), fixedLength(fw * 0.025f)),
+		0.0, 0.0, 360.0, cv::Scalar(shade(a.skin, 0.6f)), -1, 8, kShift);
+	cv::ellipse(canvas, fixedPoint(cv::Point2f(cx, y0 + fw * 0.8f)), cv::Size(fixedLength(fw * 0.17f), fixedLength(fw * 0.04f)),
+		0.0, 0.0, 360.0, cv::Scalar(shade(a.skin, 0.5f)), -1, 8, kShift);
+
+	// both eyes exactly where GazeTracking::findPupils cuts its regions,
+	// looking the same way; rotation, blur and noise apply to the whole face
+	GazeParams params;
+	int eyeWidth = cvRound(fw * params.eyePercentWidth / 100.0f);
+	int eyeHeight = cvRound(fw * params.eyePercentHeight / 100.0f);
+	int eyeTop = cvRound(y0 + fw * params.eyePercentTop / 100.0f);
+	int eyeSide = cvRound(fw * params.eyePercentSide / 100.0f);
+	cv::Rect regions[2] = {
+		cv::Rect(cvRound(x0) + eyeSide, eyeTop, eyeWidth, eyeHeight),
+		cv::Rect(cvRound(x0 + fw) - eyeWidth - eyeSide, eyeTop, eyeWidth, eyeHeight)
+	};
+	cv::Point2f pupils[2];
+	for (int i = 0; i < 2; ++i)
+	{
+		drawEye(a, canvas(regions[i]), pupils[i]);
+		pupils[i].x += regions[i].x;
+		pupils[i].y += regions[i].y;
+	}
+
+	cv::Mat gray;
+	degrade(a, canvas, gray, pupils, 2);
+	cv::cvtColor(gray, face.image, CV_GRAY2BGR);
+	face.file.clear();
+	face.left = pupils[0];
+	face.right = pupils[1];
+}
+
+bool EyeSynth::writeFaceSet(const std::string& dir, int count, int faceWidth)
+{
+	std::string prefix = dir;
+	if (!prefix.empty() && prefix[prefix.size() - 1] != '/' && prefix[prefix.size() - 1] != '\\')
+		prefix += '/';
+
+	std::ofstream labels((prefix + "labels.txt").c_str());
+	if (!labels)
+		return false;
+	labels << "# generated by GazeTools synth, " << faceWidth << " px faces: image leftX leftY rightX rightY\n";
+
+	LabelledImage face;
+	for (int i = 0; i < count; ++i)
+	{
+		renderFace(faceWidth, face);
+		std::string name = cv::format("face%04d.png", i);
+		// png is lossless, the labels stay exact
+		if (!cv::imwrite(prefix + name, face.image))
+			return false;
+		labels << name << ' ' << face.left.x << ' ' << face.left.y << ' ' << face.right.x << ' ' << face.right.y << '\n';
+	}
+	return labels.good();
+}
+
+void benchEyeCenters(const GazeTracking& tracker, const std::vector<SyntheticEye>& eyes, int repeats,
+	EyeBenchResult& result)
+{
+	result = EyeBenchResult();
+	if (eyes.empty())
+		return;
+
+	GazeScratch scratch;
+	float confidence;
+	std::vector<double> errors(eyes.size());
+	for (size_t i = 0; i < eyes.size(); ++i)
+	{
+		cv::Point found = tracker.findEyeCenter(eyes[i].image, scratch, confidence);
+		errors[i] = distance(found, eyes[i].pupil);
+		result.meanError += errors[i];
+	}
+	result.count = (int)eyes.size();
+	result.meanError /= eyes.size();
+	std::sort(errors.begin(), errors.end());
+	result.p95Error = errors[(std::min)(errors.size() - 1, errors.size() * 95 / 100)];
+	result.maxError = errors.back();
+
+	repeats = (std::max)(repeats, 1);
+	int64 start = cv::getTickCount();
+	for (int r = 0; r < repeats; ++r)
+	{
+		for (size_t i = 0; i < eyes.size(); ++i)
+		{
+			tracker.findEyeCenter(eyes[i].image, scratch, confidence);
+		}
+	}
+	double totalMs = (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+	result.msPerEye = totalMs / (repeats * eyes.size());
+	result.eyesPerSecond = result.msPerEye > 0.0 ? 1000.0 / result.msPerEye : 0.0;
+}
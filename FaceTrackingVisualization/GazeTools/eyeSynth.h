@@ -0,0 +1,96 @@
+#ifndef EYE_SYNTH_H
+#define EYE_SYNTH_H
+
+#include "gazeTuner.h"
+
+#include <string>
+#include <vector>
+
+// How one generated eye looks. EyeSynth::randomize draws every field from a
+// range that covers what the Kinect colour camera shows at tracking distance.
+struct EyeAppearance
+{
+	EyeAppearance();
+
+	float gazeX;			// iris offset in the eye opening, -1 (left corner) .. 1
+	float gazeY;			// -1 (up) .. 1
+	float irisRadius;		// fraction of the crop width
+	float pupilRatio;		// pupil / iris radius
+	float openness;			// eyelid opening height / width
+	bool brow;
+	float rotation;			// head roll in degrees
+	float blur;				// gaussian sigma in output pixels, 0 for none
+	float noise;			// sigma in grey levels, 0 for none
+	unsigned char skin;
+	unsigned char sclera;
+	unsigned char iris;
+	unsigned char pupil;
+};
+
+// A generated eye crop and where its pupil centre really is.
+struct SyntheticEye
+{
+	cv::Mat image;			// 8 bit grey
+	cv::Point2f pupil;		// pixels, sub-pixel exact
+};
+
+// Renders eyes and faces procedurally with exact ground truth, so the pupil
+// search can be benchmarked in bulk and held to an accuracy bound without a
+// recorded data set. Shapes are drawn at 4x and area-downsampled, which
+// anti-aliases the edges and keeps the centres sub-pixel. The same seed
+// gives the same images on every machine.
+class EyeSynth
+{
+public:
+	explicit EyeSynth(unsigned long long seed = 1);
+
+	void randomize(EyeAppearance& appearance);
+
+	// one eye crop of width x height, laid out like the eye regions that
+	// GazeTracking cuts out of a face
+	void renderEye(const EyeAppearance& appearance, int width, int height, SyntheticEye& eye);
+
+	// A frontal face faceWidth pixels wide in a BGR image twice that size,
+	// with random eyes placed where the default GazeParams eye regions look
+	// for them; left and right are the pupil centres in image coordinates.
+	void renderFace(int faceWidth, LabelledImage& face);
+
+	// writes count faces and a labels.txt for loadLabelledImages into dir,
+	// which must exist
+	bool writeFaceSet(const std::string& dir, int count, int faceWidth);
+
+private:
+	// draws the eye without rotation, blur or noise, filling target (a region
+	// of the canvas at kScale); pupil is relative to target
+	void drawEye(const EyeAppearance& appearance, cv::Mat target, cv::Point2f& pupil);
+	// rotation, downsampling, blur and noise, moving the points along
+	void degrade(const EyeAppearance& appearance, const cv::Mat& canvas, cv::Mat& out,
+		cv::Point2f* points, int count);
+
+	cv::RNG rng;
+	cv::Mat canvas;
+	cv::Mat mask;
+	cv::Mat layer;
+	cv::Mat rotated;
+	cv::Mat noise;
+	cv::Mat noisy;
+};
+
+// Pixel error of the pupil search over generated eyes and its throughput.
+struct EyeBenchResult
+{
+	EyeBenchResult() : meanError(0.0), p95Error(0.0), maxError(0.0), msPerEye(0.0), eyesPerSecond(0.0), count(0) {}
+
+	double meanError;		// pixels of the eye crop
+	double p95Error;
+	double maxError;
+	double msPerEye;		// mean GazeTracking::findEyeCenter wall time
+	double eyesPerSecond;
+	int count;
+};
+
+// Accuracy from the first pass, time from repeats passes over all eyes.
+void benchEyeCenters(const GazeTracking& tracker, const std::vector<SyntheticEye>& eyes, int repeats,
+	EyeBenchResult& result);
+
+#endif
@@ -0,0 +1,210 @@
+#include "stdafx.h"
+#include "gazeTuner.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+
+namespace {
+
+	const int kFastEyeWidths[] = {30, 40, 50, 60};
+	const int kBlurSizes[] = {3, 5};
+	const double kGradientThresholds[] = {30.0, 50.0, 70.0};
+	const float kPostProcessThresholds[] = {0.0f, 0.9f, 0.97f};	// 0 disables post processing
+
+	std::string directoryOf(const std::string& path)
+	{
+		size_t pos = path.find_last_of("/\\");
+		return pos == std::string::npos ? std::string() : path.substr(0, pos + 1);
+	}
+
+	double distance(const cv::Point& a, const cv::Point2f& b)
+	{
+		double dx = a.x - b.x;
+		double dy = a.y - b.y;
+		return std::sqrt(dx * dx + dy * dy);
+	}
+
+	bool fasterThan(const TuneSample& a, const TuneSample& b)
+	{
+		if (a.msPerFrame != b.msPerFrame)
+			return a.msPerFrame < b.msPerFrame;
+		return a.meanError < b.meanError;
+	}
+}
+
+GazeTuner::GazeTuner()
+{
+
+}
+
+bool GazeTuner::initialize(const std::string& cascadeFile, const std::string& labelFile)
+{
+	if (!tracker.initialize(cascadeFile))
+	{
+		printf("Could not load face cascade %s\n", cascadeFile.c_str());
+		return false;
+	}
+	return loadLabelledImages(labelFile, images);
+}
+
+bool loadLabelledImages(const std::string& labelFile, std::vector<LabelledImage>& images)
+{
+	std::ifstream in(labelFile.c_str());
+	if (!in)
+	{
+		printf("Could not open label file %s\n", labelFile.c_str());
+		return false;
+	}
+
+	std::string dir = directoryOf(labelFile);
+	std::string line;
+	int lineNo = 0;
+	while (std::getline(in, line))
+	{
+		++lineNo;
+		size_t comment = line.find('#');
+		if (comment != std::string::npos)
+			line.erase(comment);
+
+		std::istringstream fields(line);
+		LabelledImage item;
+		if (!(fields >> item.file))
+			continue;
+		if (!(fields >> item.left.x >> item.left.y >> item.right.x >> item.right.y))
+		{
+			printf("%s:%d: expected 'image lx ly rx ry'\n", labelFile.c_str(), lineNo);
+			continue;
+		}
+
+		// decoded once up front so the sweep times only the tracker
+		item.image = cv::imread(dir + item.file);
+		if (item.image.empty())
+		{
+			printf("%s:%d: could not read %s\n", labelFile.c_str(), lineNo, item.file.c_str());
+			continue;
+		}
+		images.push_back(item);
+	}
+
+	return !images.empty();
+}
+
+bool GazeTuner::evaluate(const GazeParams& params, TuneSample& sample, int repeats)
+{
+	sample = TuneSample();
+	sample.params = params;
+	sample.total = (int)images.size();
+	if (!tracker.setParams(params) || images.empty())
+		return false;
+
+	GazeScratch scratch;
+	GazeResult result;
+
+	// warm up the scratch buffers so the first image is not charged for them
+	tracker.analyze(images[0].image, result, &scratch);
+
+	double errorSum = 0.0;
+	for (size_t i = 0; i < images.size(); ++i)
+	{
+		if (!tracker.analyze(images[i].image, result, &scratch))
+			continue;
+		double err = 0.5 * (distance(result.leftPupil, images[i].left) + distance(result.rightPupil, images[i].right));
+		errorSum += err;
+		sample.maxError = std::max(sample.maxError, err);
+		++sample.found;
+	}
+	sample.meanError = sample.found > 0 ? errorSum / sample.found : 0.0;
+
+	repeats = std::max(repeats, 1);
+	int64 start = cv::getTickCount();
+	for (int r = 0; r < repeats; ++r)
+	{
+		for (size_t i = 0; i < images.size(); ++i)
+		{
+			tracker.analyze(images[i].image, result, &scratch);
+		}
+	}
+	double totalMs = (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+	sample.msPerFrame = totalMs / (repeats * images.size());
+
+	return sample.found > 0;
+}
+
+void GazeTuner::sweep(std::vector<TuneSample>& samples, int repeats)
+{
+	samples.clear();
+	GazeParams params;
+	for (size_t w = 0; w < sizeof(kFastEyeWidths) / sizeof(kFastEyeWidths[0]); ++w)
+	for (size_t b = 0; b < sizeof(kBlurSizes) / sizeof(kBlurSizes[0]); ++b)
+	for (size_t g = 0; g < sizeof(kGradientThresholds) / sizeof(kGradientThresholds[0]); ++g)
+	for (size_t p = 0; p < sizeof(kPostProcessThresholds) / sizeof(kPostProcessThresholds[0]); ++p)
+	{
+		params.fastEyeWidth = kFastEyeWidths[w];
+		params.weightBlurSize = kBlurSizes[b];
+		params.gradientThreshold = kGradientThresholds[g];
+		params.enablePostProcess = kPostProcessThresholds[p] > 0.0f;
+		if (params.enablePostProcess)
+			params.postProcessThreshold = kPostProcessThresholds[p];
+
+		TuneSample sample;
+		if (evaluate(params, sample, repeats))
+		{
+			printf("width %2d blur %d grad %4.1f post %4.2f: %6.2f px %7.3f ms (%d/%d)\n",
+				params.fastEyeWidth, params.weightBlurSize, params.gradientThreshold,
+				params.enablePostProcess ? params.postProcessThreshold : 0.0f,
+				sample.meanError, sample.msPerFrame, sample.found, sample.total);
+			samples.push_back(sample);
+		}
+	}
+}
+
+void GazeTuner::paretoFront(const std::vector<TuneSample>& samples, std::vector<TuneSample>& front)
+{
+	std::vector<TuneSample> sorted(samples);
+	std::sort(sorted.begin(), sorted.end(), fasterThan);
+
+	front.clear();
+	for (size_t i = 0; i < sorted.size(); ++i)
+	{
+		if (front.empty() || sorted[i].meanError < front.back().meanError)
+			front.push_back(sorted[i]);
+	}
+}
+
+const TuneSample* GazeTuner::pick(const std::vector<TuneSample>& front, double budgetMs)
+{
+	if (front.empty())
+		return NULL;
+
+	// the front is sorted by time with falling error, so the last entry
+	// within the budget is the most accurate one
+	const TuneSample* best = &front[0];
+	for (size_t i = 1; i < front.size(); ++i)
+	{
+		if (budgetMs > 0.0 && front[i].msPerFrame > budgetMs)
+			break;
+		best = &front[i];
+	}
+	return best;
+}
+
+bool GazeTuner::writeCsv(const std::string& file, const std::vector<TuneSample>& samples)
+{
+	FILE* fp = fopen(file.c_str(), "w");
+	if (!fp)
+		return false;
+
+	fprintf(fp, "fastEyeWidth,weightBlurSize,gradientThreshold,enablePostProcess,postProcessThreshold,meanErrorPx,maxErrorPx,msPerFrame,found,total\n");
+	for (size_t i = 0; i < samples.size(); ++i)
+	{
+		const TuneSample& s = samples[i];
+		fprintf(fp, "%d,%d,%.1f,%d,%.2f,%.3f,%.3f,%.4f,%d,%d\n",
+			s.params.fastEyeWidth, s.params.weightBlurSize, s.params.gradientThreshold,
+			s.params.enablePostProcess ? 1 : 0, s.params.postProcessThreshold,
+			s.meanError, s.maxError, s.msPerFrame, s.found, s.total);
+	}
+	fclose(fp);
+	return true;
+}
@@ -0,0 +1,64 @@
+#ifndef GAZE_TUNER_H
+#define GAZE_TUNER_H
+
+#include "gazeTracking.h"
+
+#include <string>
+#include <vector>
+
+// One image of the labelled set with its hand marked pupil centres in
+// image coordinates.
+struct LabelledImage
+{
+	std::string file;
+	cv::Mat image;
+	cv::Point2f left;
+	cv::Point2f right;
+};
+
+// Reads a label file with one image per line:
+//     image leftX leftY rightX rightY
+// with the image path relative to the label file, '#' starts a comment.
+bool loadLabelledImages(const std::string& labelFile, std::vector<LabelledImage>& images);
+
+// Accuracy and cost of one parameter set over the labelled images.
+struct TuneSample
+{
+	TuneSample() : meanError(0.0), maxError(0.0), msPerFrame(0.0), found(0), total(0) {}
+
+	GazeParams params;
+	double meanError;	// mean pupil distance in pixels over found faces
+	double maxError;
+	double msPerFrame;	// mean analyze() wall time
+	int found;
+	int total;
+};
+
+// Offline sweep of the GazeParams knobs that trade pupil accuracy for speed.
+class GazeTuner
+{
+public:
+	GazeTuner();
+
+	bool initialize(const std::string& cascadeFile, const std::string& labelFile);
+
+	// evaluates every combination of the grid, repeats is the number of
+	// timed passes over the image set per combination
+	void sweep(std::vector<TuneSample>& samples, int repeats = 3);
+	bool evaluate(const GazeParams& params, TuneSample& sample, int repeats);
+
+	// samples that no other sample beats on both error and time, fastest first
+	static void paretoFront(const std::vector<TuneSample>& samples, std::vector<TuneSample>& front);
+	// most accurate front entry within budgetMs, or the fastest one if none
+	// fits; budgetMs <= 0 means no budget
+	static const TuneSample* pick(const std::vector<TuneSample>& front, double budgetMs);
+	static bool writeCsv(const std::string& file, const std::vector<TuneSample>& samples);
+
+	size_t imageCount() const {return images.size();}
+
+private:
+	GazeTracking tracker;
+	std::vector<LabelledImage> images;
+};
+
+#endif
@@ -0,0 +1,25 @@
+// stdafx.h : include file for standard system include files,
+// or project specific include files that are used frequently, but
+// are changed infrequently
+//
+
+#pragma once
+
+#ifdef _WIN32
+#include "targetver.h"
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
+#endif
+
+// Windows Header Files:
+#include <windows.h>
+#include <tchar.h>
+#else
+// the gaze tools and the headless service also build on Linux
+#include "../SingleFace/portable.h"
+#endif
+
+// C RunTime Header Files
+#include <stdio.h>
+#include <stdlib.h>
@@ -7,6 +7,10 @@
 #include "StdAfx.h"
 #include "FTHelper2.h"
 #include "Visualize.h"
+#include "asyncLog.h"
+#include "nuiFrameSource.h"
+#include "stageStats.h"
+#include "pipelineTrace.h"
 
 #ifdef SAMPLE_OPTIONS
 #include "Options.h"
@@ -17,12 +21,17 @@ PVOID _opt = NULL;
 FTHelper2::FTHelper2()
 {
     m_UserContext = 0;
+    m_source = NULL;
+    m_SourcePresent = FALSE;
+    memset(&m_sourceConfig, 0, sizeof(m_sourceConfig));
+    memset(&m_videoConfig, 0, sizeof(m_videoConfig));
     m_hWnd = NULL;
     m_colorImage = NULL;
     m_depthImage = NULL;
     m_ApplicationIsRunning = false;
-    m_CallBack = NULL;
-    m_CallBackParam = NULL;
+    m_callBackSubscriber = -1;
+    m_status = TRACKER_NOT_STARTED;
+    m_lastHr = S_OK;
     m_UserSelectCallBack = NULL;
     m_UserSelectCallBackParam = NULL;
     m_XCenterFace = 0;
@@ -34,24 +43,40 @@ FTHelper2::FTHelper2()
     m_bNearMode = FALSE;
     m_colorType = NUI_IMAGE_TYPE_COLOR;
     m_colorRes = NUI_IMAGE_RESOLUTION_INVALID;
+    m_frameCount = 0;
     m_bSeatedSkeleton = FALSE;
+    InitializeCriticalSection(&m_videoLock);
+    m_videoFrame = NULL;
+    m_videoCenterX = 0;
+    m_videoCenterY = 0;
 }
 
 FTHelper2::~FTHelper2()
 {
     Stop();
+    delete m_source;
+    if (m_videoFrame)
+    {
+        m_videoFrame->Release();
+    }
+    DeleteCriticalSection(&m_videoLock);
 }
 
 HRESULT FTHelper2::Init(HWND hWnd, UINT nbUsers, FTHelper2CallBack callBack, PVOID callBackParam, FTHelper2UserSelectCallBack userSelectCallBack, PVOID userSelectCallBackParam,
                         NUI_IMAGE_TYPE depthType, NUI_IMAGE_RESOLUTION depthRes, BOOL bNearMode, NUI_IMAGE_TYPE colorType, NUI_IMAGE_RESOLUTION colorRes, BOOL bSeatedSkeleton)
 {
-    if (!hWnd || !callBack)
+    if (nbUsers == 0)
     {
+        m_status = TRACKER_INVALID_ARGUMENT;
         return E_INVALIDARG;
     }
+    // hWnd and callBack are optional, see FTHelper::Init
     m_hWnd = hWnd;
-    m_CallBack = callBack;
-    m_CallBackParam = callBackParam;
+    m_status = TRACKER_STARTING;
+    m_lastHr = S_OK;
+    // latest-wins per application, a user's newest face is all the avatars need
+    m_resultBus.stop();
+    m_callBackSubscriber = callBack ? m_resultBus.subscribe("app", callBack, callBackParam, 2 * nbUsers, FaceResultBus::LatestWins) : -1;
     m_UserSelectCallBack = userSelectCallBack;
     m_UserSelectCallBackParam = userSelectCallBackParam;
     m_nbUsers = nbUsers;
@@ -63,6 +88,11 @@ HRESULT FTHelper2::Init(HWND hWnd, UINT nbUsers, FTHelper2CallBack callBack, PVO
     m_colorType = colorType;
     m_colorRes = colorRes;
     m_hFaceTrackingThread = CreateThread(NULL, 0, FaceTrackingStaticThread, (PVOID)this, 0, 0);
+    if (!m_hFaceTrackingThread)
+    {
+        m_status = TRACKER_OUT_OF_MEMORY;
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
     return S_OK;
 }
 
@@ -71,9 +101,24 @@ HRESULT FTHelper2::Stop()
     m_ApplicationIsRunning = false;
     if (m_hFaceTrackingThread)
     {
-        WaitForSingleObject(m_hFaceTrackingThread, 1000);
+        // Everything below is used by the tracking thread until it ends. An
+        // error message box on that thread sends to our window, so sent
+        // messages are let through while waiting.
+        HANDLE thread = m_hFaceTrackingThread;
+        while (MsgWaitForMultipleObjects(1, &thread, FALSE, INFINITE, QS_SENDMESSAGE) == WAIT_OBJECT_0 + 1)
+        {
+            MSG msg;
+            PeekMessage(&msg, NULL, 0, 0, PM_NOREMOVE);
+        }
+        CloseHandle(thread);
+        m_hFaceTrackingThread = NULL;
     }
-    m_hFaceTrackingThread = 0;
+    if (!trackerStatusIsError(m_status) && m_status != TRACKER_SOURCE_FINISHED)
+    {
+        m_status = TRACKER_STOPPED;
+    }
+    m_resultBus.stop();
+    m_callBackSubscriber = -1;
 
     if (m_UserContext != 0)
     {
@@ -106,7 +151,6 @@ HRESULT FTHelper2::Stop()
         m_depthImage = NULL;
     }
 
-    m_CallBack = NULL;
     return S_OK;
 }
 
@@ -117,37 +161,63 @@ BOOL FTHelper2::SubmitFraceTrackingResult(IFTResult* pResult, UINT userId)
 {
     if (pResult != NULL && SUCCEEDED(pResult->GetStatus()))
     {
-        if (m_CallBack)
+        FLOAT* pSU = NULL;
+        UINT numSU;
+        BOOL suConverged;
+        m_UserContext[userId].m_pFaceTracker->GetShapeUnits(NULL, &pSU, &numSU, &suConverged);
+        FT_CAMERA_CONFIG cameraConfig;
+        if (m_SourcePresent)
+        {
+            cameraConfig = m_videoConfig;
+        }
+        else
+        {
+            cameraConfig.Width = 640;
+            cameraConfig.Height = 480;
+            cameraConfig.FocalLength = 500.0f;
+        }
+        IFTModel* ftModel;
+        HRESULT hr = m_UserContext[userId].m_pFaceTracker->GetFaceModel(&ftModel);
+        if (FAILED(hr))
+        {
+            return FALSE;
+        }
+        // one snapshot per user, the topology is shared by all of them
+        const FaceTopology* topology = FaceTopology::Get(ftModel);
+        FaceGeometry& geometry = m_UserContext[userId].m_geometry;
+        hr = geometry.Compute(ftModel, pResult, pSU, numSU, cameraConfig);
+        geometry.frameId = (UINT)m_frameCount + 1;
+        ftModel->Release();
+        if (FAILED(hr))
+        {
+            return FALSE;
+        }
+
+        // the consumers get their own copy on the bus threads
+        if (m_resultBus.getSubscriberCount() > 0)
+        {
+            std::shared_ptr<UserFaceResult> result = std::make_shared<UserFaceResult>();
+            result->userId = userId;
+            result->topology = topology;
+            result->geometry = geometry;
+            m_resultBus.publish(result);
+        }
+        if (m_sharedRing.isOpen())
         {
-            (*m_CallBack)(m_CallBackParam, userId);
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            geometry.Export(m_sharedRecord);
+            m_sharedRecord.frameId = geometry.frameId;
+            m_sharedRecord.userId = userId;
+            m_sharedRecord.timestamp = now.QuadPart;
+            m_sharedRecord.flags = SHARED_RECORD_TRACKED;
+            m_sharedRing.publish(m_sharedRecord);
         }
 
         if (m_DrawMask)
         {
-            FLOAT* pSU = NULL;
-            UINT numSU;
-            BOOL suConverged;
-            m_UserContext[userId].m_pFaceTracker->GetShapeUnits(NULL, &pSU, &numSU, &suConverged);
-            POINT viewOffset = {0, 0};
-            FT_CAMERA_CONFIG cameraConfig;
-            if (m_KinectSensorPresent)
-            {
-                m_KinectSensor.GetVideoConfiguration(&cameraConfig);
-            }
-            else
-            {
-                cameraConfig.Width = 640;
-                cameraConfig.Height = 480;
-                cameraConfig.FocalLength = 500.0f;
-            }
-            IFTModel* ftModel;
-            HRESULT hr = m_UserContext[userId].m_pFaceTracker->GetFaceModel(&ftModel);
-            if (SUCCEEDED(hr))
-            {
-                DWORD color = s_ColorCode[userId%6];
-                hr = VisualizeFaceModel(m_colorImage, ftModel, &cameraConfig, pSU, 1.0, viewOffset, pResult, color);
-                ftModel->Release();
-            }
+            DWORD color = s_ColorCode[userId%6];
+            hr = VisualizeFaceModel(m_colorImage, topology, geometry, color);
         }
     }
     return TRUE;
@@ -177,66 +247,153 @@ void FTHelper2::SetCenterOfImage(IFTResult* pResult)
     }
 }
 
-// Get a video image and process it.
+// Get a video image and process it. False once a finite source has ended.
 // We employ special code to associate a user ID with a tracker.
 
-void FTHelper2::CheckCameraInput()
+bool FTHelper2::CheckCameraInput()
 {
+    STAGE_TIMER(STAGE_FRAME);
     HRESULT hrFT = E_FAIL;
 
-    if (m_KinectSensorPresent && m_KinectSensor.GetVideoBuffer())
+    SourceFrame frame;
+    HRESULT hrRead;
+    HRESULT hrCopy = E_FAIL;
     {
-        HRESULT hrCopy = m_KinectSensor.GetVideoBuffer()->CopyTo(m_colorImage, NULL, 0, 0);
-        if (SUCCEEDED(hrCopy) && m_KinectSensor.GetDepthBuffer())
+        STAGE_TIMER(STAGE_FRAME_READ);
+        hrRead = m_SourcePresent ? m_source->readFrame(frame) : E_FAIL;
+        if (hrRead == S_OK)
         {
-            hrCopy = m_KinectSensor.GetDepthBuffer()->CopyTo(m_depthImage, NULL, 0, 0);
+            // the stages of this pass carry the frame in the trace
+            TRACE_FRAME(frame.frameId);
+            hrCopy = copyToImage(frame.color, frame.colorStride, m_colorImage);
+            if (SUCCEEDED(hrCopy) && frame.depth && m_depthImage)
+            {
+                hrCopy = copyToImage((const BYTE*)frame.depth, frame.depthStride, m_depthImage);
+            }
         }
+    }
+    if (hrRead == S_FALSE)
+    {
+        return false;
+    }
+    if (hrRead != S_OK)
+    {
+        STAGE_COUNTER(COUNTER_READ_FAILED);
+    }
+    else
+    {
+        STAGE_COUNTER(COUNTER_FRAMES);
         // Do face tracking
         if (SUCCEEDED(hrCopy))
         {
-            FT_SENSOR_DATA sensorData(m_colorImage, m_depthImage, m_KinectSensor.GetZoomFactor(), m_KinectSensor.GetViewOffSet());
+            POINT viewOffset = {m_sourceConfig.viewOffsetX, m_sourceConfig.viewOffsetY};
+            FT_SENSOR_DATA sensorData(m_colorImage, m_depthImage, m_sourceConfig.zoomFactor, &viewOffset);
 
             if (m_UserSelectCallBack != NULL)
             {
-                (*m_UserSelectCallBack)(m_UserSelectCallBackParam, &m_KinectSensor, m_nbUsers, m_UserContext);
+                (*m_UserSelectCallBack)(m_UserSelectCallBackParam, &frame, m_nbUsers, m_UserContext);
             }
             else
             {
-                SelectUserToTrack(&m_KinectSensor, m_nbUsers, m_UserContext);
+                SelectUserToTrack(&frame, m_nbUsers, m_UserContext);
             }
             for (UINT i=0; i<m_nbUsers; i++)
             {
-                if (m_UserContext[i].m_CountUntilFailure == 0 ||
-                    !m_KinectSensor.IsTracked(m_UserContext[i].m_SkeletonId))
+                const SourceSkeleton& skeleton = frame.skeletons[m_UserContext[i].m_SkeletonId];
+                if (m_UserContext[i].m_CountUntilFailure == 0 || !skeleton.tracked)
                 {
                     m_UserContext[i].m_LastTrackSucceeded = false;
                     continue;
                 }
                 FT_VECTOR3D hint[2];
-                hint[0] =  m_KinectSensor.NeckPoint(m_UserContext[i].m_SkeletonId);
-                hint[1] =  m_KinectSensor.HeadPoint(m_UserContext[i].m_SkeletonId);
+                hint[0] = FT_VECTOR3D(skeleton.neck[0], skeleton.neck[1], skeleton.neck[2]);
+                hint[1] = FT_VECTOR3D(skeleton.head[0], skeleton.head[1], skeleton.head[2]);
 
-                if (m_UserContext[i].m_LastTrackSucceeded)
                 {
-                    hrFT = m_UserContext[i].m_pFaceTracker->ContinueTracking(&sensorData, hint, m_UserContext[i].m_pFTResult);
-                }
-                else
-                {
-                    hrFT = m_UserContext[i].m_pFaceTracker->StartTracking(&sensorData, NULL, hint, m_UserContext[i].m_pFTResult);
+                    STAGE_TIMER(STAGE_FACE_TRACK);
+                    if (m_UserContext[i].m_LastTrackSucceeded)
+                    {
+                        hrFT = m_UserContext[i].m_pFaceTracker->ContinueTracking(&sensorData, hint, m_UserContext[i].m_pFTResult);
+                    }
+                    else
+                    {
+                        hrFT = m_UserContext[i].m_pFaceTracker->StartTracking(&sensorData, NULL, hint, m_UserContext[i].m_pFTResult);
+                    }
                 }
                 m_UserContext[i].m_LastTrackSucceeded = SUCCEEDED(hrFT) && SUCCEEDED(m_UserContext[i].m_pFTResult->GetStatus());
                 if (m_UserContext[i].m_LastTrackSucceeded)
                 {
+                    STAGE_COUNTER(COUNTER_TRACKED);
+                    STAGE_TIMER(STAGE_SUBMIT);
                     SubmitFraceTrackingResult(m_UserContext[i].m_pFTResult, i);
                 }
                 else
                 {
+                    STAGE_COUNTER(COUNTER_LOST);
                     m_UserContext[i].m_pFTResult->Reset();
                 }
                 SetCenterOfImage(m_UserContext[i].m_pFTResult);
             }
+            PublishVideoFrame();
         }
     }
+    return true;
+}
+
+// Hands the frame with every user's mask drawn over to the window. The copy
+// is one memcpy under a lock the paint only holds for its own copy.
+void FTHelper2::PublishVideoFrame()
+{
+    EnterCriticalSection(&m_videoLock);
+    if (!m_videoFrame)
+    {
+        m_videoFrame = FTCreateImage();
+    }
+    if (m_videoFrame && SUCCEEDED(m_videoFrame->Allocate(m_colorImage->GetWidth(), m_colorImage->GetHeight(), m_colorImage->GetFormat())))
+    {
+        m_colorImage->CopyTo(m_videoFrame, NULL, 0, 0);
+        m_videoCenterX = m_XCenterFace;
+        m_videoCenterY = m_YCenterFace;
+    }
+    LeaveCriticalSection(&m_videoLock);
+}
+
+BOOL FTHelper2::CopyVideoFrame(IFTImage* target, float* centerX, float* centerY)
+{
+    BOOL copied = FALSE;
+    EnterCriticalSection(&m_videoLock);
+    if (target && m_videoFrame && m_videoFrame->GetWidth() > 0 &&
+        SUCCEEDED(target->Allocate(m_videoFrame->GetWidth(), m_videoFrame->GetHeight(), FTIMAGEFORMAT_UINT8_B8G8R8A8)))
+    {
+        copied = SUCCEEDED(m_videoFrame->CopyTo(target, NULL, 0, 0));
+        *centerX = m_videoCenterX;
+        *centerY = m_videoCenterY;
+    }
+    LeaveCriticalSection(&m_videoLock);
+    return copied;
+}
+
+bool FTHelper2::OpenSharedRing(const std::string& name, UINT capacity)
+{
+    if (m_hFaceTrackingThread)
+    {
+        return false;
+    }
+    memset(&m_sharedRecord, 0, sizeof(m_sharedRecord));
+    return m_sharedRing.create(name, capacity);
+}
+
+// Same as FTHelper::ReportError, the message box only when there is a window.
+DWORD FTHelper2::ReportError(TrackerStatus status, HRESULT hr, LPCWSTR text)
+{
+    m_lastHr = hr;
+    m_status = status;
+    LOG_ERROR("face tracker: {}, hr {}", trackerStatusName(status), LogArg::hex((unsigned)hr));
+    if (m_hWnd && text)
+    {
+        MessageBoxW(m_hWnd, text, L"Face Tracker Initialization Error\n", MB_OK);
+    }
+    return (DWORD)status;
 }
 
 DWORD WINAPI FTHelper2::FaceTrackingStaticThread(PVOID lpParam)
@@ -244,32 +401,53 @@ DWORD WINAPI FTHelper2::FaceTrackingStaticThread(PVOID lpParam)
     FTHelper2* context = static_cast<FTHelper2*>(lpParam);
     if (context)
     {
-        return context->FaceTrackingThread();
+        DWORD result = context->FaceTrackingThread();
+        // on every way out, the early failures included; Stop() frees the rest
+        if (context->m_source)
+        {
+            context->m_source->close();
+        }
+        context->m_SourcePresent = FALSE;
+        return result;
     }
     return 0;
 }
 
 DWORD WINAPI FTHelper2::FaceTrackingThread()
 {
+    AsyncLog::setThreadName("tracking");
+    PipelineTrace::setThreadName("tracking");
     FT_CAMERA_CONFIG videoConfig;
     FT_CAMERA_CONFIG depthConfig;
     FT_CAMERA_CONFIG* pDepthConfig = NULL;
 
-    // Try to get the Kinect camera to work
-    HRESULT hr = m_KinectSensor.Init(m_depthType, m_depthRes, m_bNearMode, FALSE, m_colorType, m_colorRes, m_bSeatedSkeleton);
+    // Try to get the Kinect camera to work, unless another source was set
+    if (!m_source)
+    {
+        m_source = new NuiFrameSource(m_depthType, m_depthRes, m_bNearMode, FALSE, m_colorType, m_colorRes, m_bSeatedSkeleton);
+    }
+    HRESULT hr = m_source->open();
     if (SUCCEEDED(hr))
     {
-        m_KinectSensorPresent = TRUE;
-        m_KinectSensor.GetVideoConfiguration(&videoConfig);
-        m_KinectSensor.GetDepthConfiguration(&depthConfig);
-        pDepthConfig = &depthConfig;
+        m_SourcePresent = TRUE;
+        m_sourceConfig = m_source->getConfig();
+        videoConfig.Width = m_sourceConfig.colorWidth;
+        videoConfig.Height = m_sourceConfig.colorHeight;
+        videoConfig.FocalLength = m_sourceConfig.colorFocalLength;
+        m_videoConfig = videoConfig;
+        if (m_sourceConfig.depthWidth)
+        {
+            depthConfig.Width = m_sourceConfig.depthWidth;
+            depthConfig.Height = m_sourceConfig.depthHeight;
+            depthConfig.FocalLength = m_sourceConfig.depthFocalLength;
+            pDepthConfig = &depthConfig;
+        }
+        LOG_INFO("frame source: {} {}x{}", m_source->getName(), m_sourceConfig.colorWidth, m_sourceConfig.colorHeight);
     }
     else
     {
-        m_KinectSensorPresent = FALSE;
-
-        MessageBoxW(m_hWnd, L"Could not initialize the Kinect sensor.\n", L"Face Tracker Initialization Error\n", MB_OK);
-        return 1;
+        m_SourcePresent = FALSE;
+        return ReportError(TRACKER_SENSOR_FAILED, hr, L"Could not open the frame source.\n");
     }
 
     m_UserContext = new FTHelperContext[m_nbUsers];
@@ -279,8 +457,7 @@ DWORD WINAPI FTHelper2::FaceTrackingThread()
     }
     else
     {
-        MessageBoxW(m_hWnd, L"Could not allocate user context array.\n", L"Face Tracker Initialization Error\n", MB_OK);
-        return 2;
+        return ReportError(TRACKER_OUT_OF_MEMORY, E_OUTOFMEMORY, L"Could not allocate user context array.\n");
     }
 
     for (UINT i=0; i<m_nbUsers;i++)
@@ -289,8 +466,7 @@ DWORD WINAPI FTHelper2::FaceTrackingThread()
         m_UserContext[i].m_pFaceTracker = FTCreateFaceTracker(_opt);
         if (!m_UserContext[i].m_pFaceTracker)
         {
-            MessageBoxW(m_hWnd, L"Could not create the face tracker.\n", L"Face Tracker Initialization Error\n", MB_OK);
-            return 3;
+            return ReportError(TRACKER_CREATE_FAILED, E_FAIL, L"Could not create the face tracker.\n");
         }
 
         hr = m_UserContext[i].m_pFaceTracker->Initialize(&videoConfig, pDepthConfig, NULL, NULL); 
@@ -300,15 +476,14 @@ DWORD WINAPI FTHelper2::FaceTrackingThread()
             GetCurrentDirectoryW(ARRAYSIZE(path), path);
             wsprintf(buffer, L"Could not initialize face tracker (%s) for user %d.\n", path, i);
 
-            MessageBoxW(m_hWnd, buffer, L"Face Tracker Initialization Error\n", MB_OK);
-
-            return 4;
+            return ReportError(TRACKER_INIT_FAILED, hr, buffer);
         }
         m_UserContext[i].m_pFaceTracker->CreateFTResult(&m_UserContext[i].m_pFTResult);
         if (!m_UserContext[i].m_pFTResult)
         {
-            MessageBoxW(m_hWnd, L"Could not initialize the face tracker result for user %d.\n", L"Face Tracker Initialization Error\n", MB_OK);
-            return 5;
+            WCHAR buffer[256];
+            wsprintf(buffer, L"Could not initialize the face tracker result for user %d.\n", i);
+            return ReportError(TRACKER_RESULT_FAILED, E_FAIL, buffer);
         }
         m_UserContext[i].m_LastTrackSucceeded = false;
     }
@@ -317,7 +492,7 @@ DWORD WINAPI FTHelper2::FaceTrackingThread()
     m_colorImage = FTCreateImage();
     if (!m_colorImage || FAILED(hr = m_colorImage->Allocate(videoConfig.Width, videoConfig.Height, FTIMAGEFORMAT_UINT8_B8G8R8X8)))
     {
-        return 6;
+        return ReportError(TRACKER_IMAGE_FAILED, hr, NULL);
     }
 
     if (pDepthConfig)
@@ -325,17 +500,24 @@ DWORD WINAPI FTHelper2::FaceTrackingThread()
         m_depthImage = FTCreateImage();
         if (!m_depthImage || FAILED(hr = m_depthImage->Allocate(depthConfig.Width, depthConfig.Height, FTIMAGEFORMAT_UINT16_D13P3)))
         {
-            return 7;
+            return ReportError(TRACKER_IMAGE_FAILED, hr, NULL);
         }
     }
 
     SetCenterOfImage(NULL);
+    m_status = TRACKER_RUNNING;
 
     while (m_ApplicationIsRunning)
     {
-        CheckCameraInput();
-        InvalidateRect(m_hWnd, NULL, FALSE);
-        UpdateWindow(m_hWnd);
+        if (!CheckCameraInput())
+        {
+            m_status = TRACKER_SOURCE_FINISHED;
+            LOG_INFO("frame source: {} finished", m_source->getName());
+            break;
+        }
+        // the window repaints on its own timer when it sees a new count,
+        // tracking never waits for a paint
+        InterlockedIncrement(&m_frameCount);
         Sleep(16);
     }
     return 0;
@@ -343,17 +525,36 @@ DWORD WINAPI FTHelper2::FaceTrackingThread()
 
 HRESULT FTHelper2::GetCameraConfig(FT_CAMERA_CONFIG* cameraConfig)
 {
-    return m_KinectSensorPresent ? m_KinectSensor.GetVideoConfiguration(cameraConfig) : E_FAIL;
+    if (!cameraConfig)
+    {
+        return E_POINTER;
+    }
+    if (!m_SourcePresent)
+    {
+        return E_FAIL;
+    }
+    *cameraConfig = m_videoConfig;
+    return S_OK;
+}
+
+void FTHelper2::SetFrameSource(FrameSource* source)
+{
+    if (m_hFaceTrackingThread || source == m_source)
+    {
+        return;
+    }
+    delete m_source;
+    m_source = source;
 }
 
-void FTHelper2::SelectUserToTrack(KinectSensor * pKinectSensor,
+void FTHelper2::SelectUserToTrack(const SourceFrame* pFrame,
                                   UINT nbUsers, FTHelperContext* pUserContexts)
 {
     // Initialize an array of the available skeletons
     bool SkeletonIsAvailable[NUI_SKELETON_COUNT];
     for (UINT i=0; i<NUI_SKELETON_COUNT; i++)
     {
-        SkeletonIsAvailable[i] = pKinectSensor->IsTracked(i);
+        SkeletonIsAvailable[i] = pFrame->skeletons[i].tracked;
     }
     // If the user's skeleton is still tracked, mark it unavailable
     // and make sure we will keep associating the user context to that skeleton
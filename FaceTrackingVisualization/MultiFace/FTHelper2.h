@@ -7,6 +7,11 @@
 #pragma once
 #include <FaceTrackLib.h>
 #include "KinectSensor.h"
+#include "faceGeometry.h"
+#include "resultBus.h"
+#include "trackerStatus.h"
+#include "sharedResultRing.h"
+#include "frameSource.h"
 
 struct FTHelperContext
 {
@@ -16,10 +21,21 @@ struct FTHelperContext
     bool                m_LastTrackSucceeded;
     int                 m_CountUntilFailure;
     UINT                m_SkeletonId;
+    FaceGeometry        m_geometry;
 };
 
-typedef void (*FTHelper2CallBack)(PVOID lpParam, UINT userId);
-typedef void (*FTHelper2UserSelectCallBack)(PVOID lpParam, KinectSensor * pKinectSensor, UINT nbUsers, FTHelperContext* pUserContexts);
+// what FTHelper2 publishes for every tracked user and frame
+struct UserFaceResult
+{
+    UINT                userId;
+    const FaceTopology* topology;
+    FaceGeometry        geometry;
+};
+
+typedef ResultBus<UserFaceResult> FaceResultBus;
+// runs on a result bus thread, never on the tracking thread
+typedef FaceResultBus::CallBack FTHelper2CallBack;
+typedef void (*FTHelper2UserSelectCallBack)(PVOID lpParam, const SourceFrame* pFrame, UINT nbUsers, FTHelperContext* pUserContexts);
 
 class FTHelper2
 {
@@ -30,27 +46,41 @@ public:
     HRESULT Init(HWND hWnd, UINT nbUsers, FTHelper2CallBack callBack, PVOID callBackParam, FTHelper2UserSelectCallBack userSelectCallBack, PVOID userSelectCallBackParam,
         NUI_IMAGE_TYPE depthType, NUI_IMAGE_RESOLUTION depthRes, BOOL bNearMode, NUI_IMAGE_TYPE colorType, NUI_IMAGE_RESOLUTION colorRes, BOOL bSeatedSkeletonMode);
     HRESULT Stop();
+    TrackerStatus GetStatus() const         { return(m_status);}
+    HRESULT GetLastHResult() const          { return(m_lastHr);}
     IFTResult* GetResult(UINT userId)       { return(m_UserContext[userId].m_pFTResult);}
-    BOOL IsKinectPresent()                  { return(m_KinectSensorPresent);}
-    IFTImage* GetColorImage()               { return(m_colorImage);}
-    float GetXCenterFace()                  { return(m_XCenterFace);}
-    float GetYCenterFace()                  { return(m_YCenterFace);}
+    BOOL IsKinectPresent()                  { return(m_SourcePresent);}
+    // Copies the last finished video frame, masks drawn, into target, which
+    // is allocated to its size as B8G8R8A8, with the zoom centre that goes
+    // with it. Safe from any thread; FALSE until the first frame.
+    BOOL CopyVideoFrame(IFTImage* target, float* centerX, float* centerY);
     void SetDrawMask(BOOL drawMask)         { m_DrawMask = drawMask;}
     BOOL GetDrawMask()                      { return(m_DrawMask);}
     IFTFaceTracker* GetTracker(UINT userId) { return(m_UserContext[userId].m_pFaceTracker);}
     HRESULT GetCameraConfig(FT_CAMERA_CONFIG* cameraConfig);
+    // number of camera frames processed so far, for the UI to poll
+    LONG GetFrameCount() const  { return(m_frameCount);}
+    FaceResultBus& GetResultBus()           { return(m_resultBus);}
+    // every tracked user and frame also goes to the named shared memory
+    // ring, SharedTrackingRecord::userId tells them apart. Call before Init().
+    bool OpenSharedRing(const std::string& name, UINT capacity = 512);
+    // Frames come from source instead of the Kinect (see createFrameSource).
+    // Takes ownership; call before Init().
+    void SetFrameSource(FrameSource* source);
 
 private:
-    KinectSensor                m_KinectSensor;
-    BOOL                        m_KinectSensorPresent;
+    FrameSource*                m_source;
+    BOOL                        m_SourcePresent;
+    FrameSourceConfig           m_sourceConfig;
+    FT_CAMERA_CONFIG            m_videoConfig;
     UINT                        m_nbUsers;
     FTHelperContext*            m_UserContext;
     HWND                        m_hWnd;
     IFTImage*                   m_colorImage;
     IFTImage*                   m_depthImage;
     bool                        m_ApplicationIsRunning;
-    FTHelper2CallBack           m_CallBack;
-    LPVOID                      m_CallBackParam;
+    FaceResultBus               m_resultBus;
+    int                         m_callBackSubscriber;
     FTHelper2UserSelectCallBack m_UserSelectCallBack;
     LPVOID                      m_UserSelectCallBackParam;
     float                       m_XCenterFace;
@@ -62,13 +92,25 @@ private:
     BOOL                        m_bNearMode;
     NUI_IMAGE_TYPE              m_colorType;
     NUI_IMAGE_RESOLUTION        m_colorRes;
+    volatile LONG               m_frameCount;
+    volatile TrackerStatus      m_status;
+    HRESULT                     m_lastHr;
     BOOL						m_bSeatedSkeleton;
+    SharedResultRing            m_sharedRing;
+    SharedTrackingRecord        m_sharedRecord;
+    // the finished frame for the window, m_colorImage is rewritten meanwhile
+    CRITICAL_SECTION            m_videoLock;
+    IFTImage*                   m_videoFrame;
+    float                       m_videoCenterX;
+    float                       m_videoCenterY;
 
 
     BOOL SubmitFraceTrackingResult(IFTResult* pResult, UINT userId);
     void SetCenterOfImage(IFTResult* pResult);
-    void CheckCameraInput();
+    bool CheckCameraInput();
+    void PublishVideoFrame();
+    DWORD ReportError(TrackerStatus status, HRESULT hr, LPCWSTR text);
     DWORD WINAPI FaceTrackingThread();
     static DWORD WINAPI FaceTrackingStaticThread(PVOID lpParam);
-    static void SelectUserToTrack(KinectSensor * pKinectSensor, UINT nbUsers, FTHelperContext* pUserContexts);
+    static void SelectUserToTrack(const SourceFrame* pFrame, UINT nbUsers, FTHelperContext* pUserContexts);
 };
@@ -11,11 +11,15 @@
 #include "EggAvatar.h"
 #include <FaceTrackLib.h>
 #include "FTHelper2.h"
+#include "asyncLog.h"
+#include "stageStats.h"
+#include "pipelineTrace.h"
 
 class MultiFace
 {
 public:
     MultiFace();
+    ~MultiFace();
 
     int Run(HINSTANCE hInst, PWSTR lpCmdLine, int nCmdShow);
 
@@ -30,15 +34,20 @@ protected:
     BOOL                        PaintWindow(HDC hdc, HWND hWnd);
     BOOL                        ShowVideo(HDC hdc, int width, int height, int originX, int originY);
     BOOL                        ShowEggAvatar(HDC hdc, int width, int height, int originX, int originY, UINT avatarId);
-    static void                 FTHelperCallingBack(LPVOID lpParam, UINT userId);
-    static void                 FTHelperUserSelection(PVOID pVoid, KinectSensor * pKinectSensor, UINT nbUsers, FTHelperContext* pUserContexts);
+    static void                 FTHelperCallingBack(LPVOID lpParam, const FaceResultBus::ResultPtr& result);
+    static void                 FTHelperUserSelection(PVOID pVoid, const SourceFrame* pFrame, UINT nbUsers, FTHelperContext* pUserContexts);
     static int const            MaxLoadStringChars = 100;
+    static UINT_PTR const       RenderTimerId = 1;
+    static UINT const           RenderIntervalMs = 16;
 
     HINSTANCE                   m_hInst;
     HWND                        m_hWnd;
     HACCEL                      m_hAccelTable;
     UINT                        m_nbUsers;
     EggAvatar*                  m_eggavatar;
+    // newest face per user from the bus thread, applied to the avatars on paint
+    CRITICAL_SECTION            m_avatarLock;
+    std::vector<FaceResultBus::ResultPtr> m_latestFaces;
     FTHelper2                   m_FTHelper;
     IFTImage**                  m_pImageBuffer;
     IFTImage*                   m_pVideoBuffer;
@@ -48,6 +57,11 @@ protected:
     NUI_IMAGE_RESOLUTION        m_colorRes;
     BOOL                        m_bNearMode;
     BOOL                        m_bSeatedSkeletonMode;
+    LONG                        m_paintedFrame;
+    std::string                 m_sharedRingName;
+    std::string                 m_sourceSpec;
+    std::string                 m_tracePath;
+    DWORD                       m_statsIntervalMs;
 };
 
 MultiFace::MultiFace(): m_hInst(NULL), 
@@ -62,8 +76,16 @@ MultiFace::MultiFace(): m_hInst(NULL),
     m_depthRes(NUI_IMAGE_RESOLUTION_320x240),
     m_colorRes(NUI_IMAGE_RESOLUTION_640x480),
     m_bNearMode(FALSE),
-    m_bSeatedSkeletonMode(FALSE)
+    m_bSeatedSkeletonMode(FALSE),
+    m_paintedFrame(-1),
+    m_statsIntervalMs(0)
 {
+    InitializeCriticalSection(&m_avatarLock);
+}
+
+MultiFace::~MultiFace()
+{
+    DeleteCriticalSection(&m_avatarLock);
 }
 
 
@@ -94,6 +116,7 @@ BOOL MultiFace::InitInstance(HINSTANCE hInstance, PWSTR lpCmdLine, int nCmdShow)
     ParseCmdString(lpCmdLine);
 
     m_eggavatar = new EggAvatar[m_nbUsers];
+    m_latestFaces.resize(m_nbUsers);
     m_pImageBuffer = new IFTImage*[m_nbUsers];
 
     m_hInst = hInstance; // Store instance handle in our global variable
@@ -132,14 +155,50 @@ BOOL MultiFace::InitInstance(HINSTANCE hInstance, PWSTR lpCmdLine, int nCmdShow)
     ShowWindow(m_hWnd, nCmdShow);
     UpdateWindow(m_hWnd);
 
+    // the window paints at its own pace, see WM_TIMER
+    SetTimer(m_hWnd, RenderTimerId, RenderIntervalMs, NULL);
+
     // Start the face tracking.
+    if (!m_sharedRingName.empty())
+    {
+        m_FTHelper.OpenSharedRing(m_sharedRingName);
+    }
+    if (!m_sourceSpec.empty())
+    {
+        FrameSource* source = createFrameSource(m_sourceSpec, true);
+        if (source)
+        {
+            m_FTHelper.SetFrameSource(source);
+        }
+        else
+        {
+            LOG_ERROR("unknown frame source {}, using the Kinect", m_sourceSpec.c_str());
+        }
+    }
+    if (m_statsIntervalMs)
+    {
+        StageStats::startDump(m_statsIntervalMs);
+    }
+    if (!m_tracePath.empty())
+    {
+        PipelineTrace::setThreadName("ui");
+        PipelineTrace::start();
+    }
     return SUCCEEDED(m_FTHelper.Init(m_hWnd, m_nbUsers, FTHelperCallingBack, this, FTHelperUserSelection, this, m_depthType, m_depthRes, m_bNearMode, m_colorType, m_colorRes, m_bSeatedSkeletonMode));
 }
 
 void MultiFace::UninitInstance()
 {
     // Clean up the memory allocated for Face Tracking and rendering.
+    KillTimer(m_hWnd, RenderTimerId);
     m_FTHelper.Stop();
+    // logs the stage totals of the whole run
+    StageStats::stopDump();
+    if (!m_tracePath.empty())
+    {
+        PipelineTrace::stop();
+        PipelineTrace::write(m_tracePath.c_str());
+    }
 
     if (m_hAccelTable)
     {
@@ -212,7 +271,7 @@ LRESULT CALLBACK MultiFace::WndProcStatic(HWND hWnd, UINT message, WPARAM wParam
 //  PURPOSE:  Processes messages for the main window.
 //
 //  WM_COMMAND  - process the application menu
-//  WM_KEYUP    - Exit in response to ESC key
+//  WM_KEYUP    - Exit in response to ESC key, write the trace on F9
 //  WM_PAINT    - Paint the main window
 //  WM_DESTROY  - post a quit message and return
 LRESULT CALLBACK MultiFace::WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
@@ -244,12 +303,28 @@ LRESULT CALLBACK MultiFace::WndProc(HWND hWnd, UINT message, WPARAM wParam, LPAR
         {
             PostQuitMessage(0);
         }
+        else if (wParam == VK_F9 && PipelineTrace::isEnabled())
+        {
+            // the last events of every thread, tracing goes on
+            PipelineTrace::write(m_tracePath.c_str());
+        }
+        break;
+    case WM_TIMER:
+        // repaint only when the tracking thread has moved on
+        if (wParam == RenderTimerId && m_FTHelper.GetFrameCount() != m_paintedFrame)
+        {
+            InvalidateRect(hWnd, NULL, FALSE);
+        }
         break;
     case WM_PAINT:
-        hdc = BeginPaint(hWnd, &ps);
-        // Draw the avatar window and the video window
-        PaintWindow(hdc, hWnd);
-        EndPaint(hWnd, &ps);
+        {
+            STAGE_TIMER(STAGE_RENDER);
+            m_paintedFrame = m_FTHelper.GetFrameCount();
+            hdc = BeginPaint(hWnd, &ps);
+            // Draw the avatar window and the video window
+            PaintWindow(hdc, hWnd);
+            EndPaint(hWnd, &ps);
+        }
         break;
     case WM_DESTROY:
         PostQuitMessage(0);
@@ -285,12 +360,13 @@ BOOL MultiFace::ShowVideo(HDC hdc, int width, int height, int originX, int origi
 {
     BOOL ret = TRUE;
 
-    // Now, copy a fraction of the camera image into the screen.
-    IFTImage* colorImage = m_FTHelper.GetColorImage();
-    if (colorImage)
+    // Now, copy a fraction of the camera image into the screen. It is the
+    // frame the tracker published last, the tracking thread never writes it.
+    float centerX = 0, centerY = 0;
+    if (m_pVideoBuffer && m_FTHelper.CopyVideoFrame(m_pVideoBuffer, &centerX, &centerY))
     {
-        int iWidth = colorImage->GetWidth();
-        int iHeight = colorImage->GetHeight();
+        int iWidth = m_pVideoBuffer->GetWidth();
+        int iHeight = m_pVideoBuffer->GetHeight();
         if (iWidth > 0 && iHeight > 0)
         {
             int iTop = 0;
@@ -298,48 +374,41 @@ BOOL MultiFace::ShowVideo(HDC hdc, int width, int height, int originX, int origi
             int iLeft = 0;
             int iRight = iWidth;
 
-            // Keep a separate buffer.
-            if (m_pVideoBuffer && SUCCEEDED(m_pVideoBuffer->Allocate(iWidth, iHeight, FTIMAGEFORMAT_UINT8_B8G8R8A8)))
+            // Compute the best approximate copy ratio.
+            float w1 = (float)iHeight * (float)width;
+            float w2 = (float)iWidth * (float)height;
+            if (w2 > w1 && height > 0)
             {
-                // Copy do the video buffer while converting bytes
-                colorImage->CopyTo(m_pVideoBuffer, NULL, 0, 0);
-
-                // Compute the best approximate copy ratio.
-                float w1 = (float)iHeight * (float)width;
-                float w2 = (float)iWidth * (float)height;
-                if (w2 > w1 && height > 0)
+                // video image too wide
+                float wx = w1/height;
+                iLeft = (int)max(0, centerX - wx / 2);
+                iRight = iLeft + (int)wx;
+                if (iRight > iWidth)
                 {
-                    // video image too wide
-                    float wx = w1/height;
-                    iLeft = (int)max(0, m_FTHelper.GetXCenterFace() - wx / 2);
-                    iRight = iLeft + (int)wx;
-                    if (iRight > iWidth)
-                    {
-                        iRight = iWidth;
-                        iLeft = iRight - (int)wx;
-                    }
+                    iRight = iWidth;
+                    iLeft = iRight - (int)wx;
                 }
-                else if (w1 > w2 && width > 0)
+            }
+            else if (w1 > w2 && width > 0)
+            {
+                // video image too narrow
+                float hy = w2/width;
+                iTop = (int)max(0, centerY - hy / 2);
+                iBottom = iTop + (int)hy;
+                if (iBottom > iHeight)
                 {
-                    // video image too narrow
-                    float hy = w2/width;
-                    iTop = (int)max(0, m_FTHelper.GetYCenterFace() - hy / 2);
-                    iBottom = iTop + (int)hy;
-                    if (iBottom > iHeight)
-                    {
-                        iBottom = iHeight;
-                        iTop = iBottom - (int)hy;
-                    }
+                    iBottom = iHeight;
+                    iTop = iBottom - (int)hy;
                 }
+            }
 
-                int const bmpPixSize = m_pVideoBuffer->GetBytesPerPixel();
-                SetStretchBltMode(hdc, HALFTONE);
-                BITMAPINFO bmi = {sizeof(BITMAPINFO), static_cast<LONG>(iWidth), static_cast<LONG>(iHeight), static_cast<WORD>(1), static_cast<WORD>(bmpPixSize * CHAR_BIT), BI_RGB, m_pVideoBuffer->GetStride() * iHeight, 5000, 5000, 0, 0};
-                if (0 == StretchDIBits(hdc, originX, originY, width, height,
-                    iLeft, iBottom, iRight-iLeft, iTop-iBottom, m_pVideoBuffer->GetBuffer(), &bmi, DIB_RGB_COLORS, SRCCOPY))
-                {
-                    ret = FALSE;
-                }
+            int const bmpPixSize = m_pVideoBuffer->GetBytesPerPixel();
+            SetStretchBltMode(hdc, HALFTONE);
+            BITMAPINFO bmi = {sizeof(BITMAPINFO), static_cast<LONG>(iWidth), static_cast<LONG>(iHeight), static_cast<WORD>(1), static_cast<WORD>(bmpPixSize * CHAR_BIT), BI_RGB, m_pVideoBuffer->GetStride() * iHeight, 5000, 5000, 0, 0};
+            if (0 == StretchDIBits(hdc, originX, originY, width, height,
+                iLeft, iBottom, iRight-iLeft, iTop-iBottom, m_pVideoBuffer->GetBuffer(), &bmi, DIB_RGB_COLORS, SRCCOPY))
+            {
+                ret = FALSE;
             }
         }
     }
@@ -356,6 +425,18 @@ BOOL MultiFace::ShowEggAvatar(HDC hdc, int width, int height, int originX, int o
     {
         memset(m_pImageBuffer[avatarId]->GetBuffer(), 0, m_pImageBuffer[avatarId]->GetStride() * height); // clear to black
 
+        // the avatars are only ever touched here, on the UI thread
+        FaceResultBus::ResultPtr face;
+        EnterCriticalSection(&m_avatarLock);
+        face.swap(m_latestFaces[avatarId]);
+        LeaveCriticalSection(&m_avatarLock);
+        if (face)
+        {
+            const FaceGeometry& geometry = face->geometry;
+            m_eggavatar[avatarId].SetCandideAU(geometry.au, geometry.auCount);
+            m_eggavatar[avatarId].SetTranslations(geometry.translation[0], geometry.translation[1], geometry.translation[2]);
+            m_eggavatar[avatarId].SetRotations(geometry.rotation[0], geometry.rotation[1], geometry.rotation[2]);
+        }
         m_eggavatar[avatarId].SetScaleAndTranslationToWindow(height, width);
         m_eggavatar[avatarId].DrawImage(m_pImageBuffer[avatarId]);
 
@@ -398,7 +479,7 @@ BOOL MultiFace::PaintWindow(HDC hdc, HWND hWnd)
 * or set the "count until failure" paarmeter of the user context to zero
 * if the context shall not be tracked.
 */
-void MultiFace::FTHelperUserSelection(PVOID pVoid, KinectSensor * pKinectSensor,
+void MultiFace::FTHelperUserSelection(PVOID pVoid, const SourceFrame* pFrame,
                                       UINT nbUsers, FTHelperContext* pUserContexts)
 {
     MultiFace* pApp = reinterpret_cast<MultiFace*>(pVoid);
@@ -408,7 +489,7 @@ void MultiFace::FTHelperUserSelection(PVOID pVoid, KinectSensor * pKinectSensor,
     bool SkeletonIsAvailable[NUI_SKELETON_COUNT];
     for (UINT i=0; i<NUI_SKELETON_COUNT; i++)
     {
-        SkeletonIsAvailable[i] = pKinectSensor->IsTracked(i);
+        SkeletonIsAvailable[i] = pFrame->skeletons[i].tracked;
     }
     // If the user's skeleton is still tracked, mark it unavailable
     // and make sure we will keep associating the user context to that skeleton
@@ -458,25 +539,16 @@ void MultiFace::FTHelperUserSelection(PVOID pVoid, KinectSensor * pKinectSensor,
 * after a face has been successfully tracked. The code in the call back passes the parameters
 * to the Egg Avatar, so it can be animated.
 */
-void MultiFace::FTHelperCallingBack(PVOID pVoid, UINT userId)
+void MultiFace::FTHelperCallingBack(PVOID pVoid, const FaceResultBus::ResultPtr& result)
 {
     MultiFace* pApp = reinterpret_cast<MultiFace*>(pVoid);
-    if (pApp)
+    if (pApp && result && result->userId < pApp->m_nbUsers)
     {
-        IFTResult* pResult = pApp->m_FTHelper.GetResult(userId);
-        if (pResult && SUCCEEDED(pResult->GetStatus()))
-        {
-            FLOAT* pAU = NULL;
-            UINT numAU;
-            pResult->GetAUCoefficients(&pAU, &numAU);
-            pApp->m_eggavatar[userId].SetCandideAU(pAU, numAU);
-            FLOAT scale;
-            FLOAT rotationXYZ[3];
-            FLOAT translationXYZ[3];
-            pResult->Get3DPose(&scale, rotationXYZ, translationXYZ);
-            pApp->m_eggavatar[userId].SetTranslations(translationXYZ[0], translationXYZ[1], translationXYZ[2]);
-            pApp->m_eggavatar[userId].SetRotations(rotationXYZ[0], rotationXYZ[1], rotationXYZ[2]);
-        }
+        // runs on the result bus thread while the window may be painting, so
+        // only the newest face is kept here for the paint to pick up
+        EnterCriticalSection(&pApp->m_avatarLock);
+        pApp->m_latestFaces[result->userId] = result;
+        LeaveCriticalSection(&pApp->m_avatarLock);
     }
 }
 
@@ -487,6 +559,10 @@ void MultiFace::ParseCmdString(PWSTR lpCmdLine)
     const WCHAR KEY_COLOR[]                                 = L"-Color";
     const WCHAR KEY_NEAR_MODE[]                             = L"-NearMode";
     const WCHAR KEY_SEATED_SKELETON_MODE[]                  = L"-SeatedSkeleton";
+    const WCHAR KEY_SHARED_RING[]                           = L"-SharedRing";
+    const WCHAR KEY_SOURCE[]                                = L"-Source";
+    const WCHAR KEY_STATS[]                                 = L"-Stats";
+    const WCHAR KEY_TRACE[]                                 = L"-Trace";
 
     const WCHAR STR_NUI_IMAGE_TYPE_DEPTH[]                  = L"DEPTH";
     const WCHAR STR_NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX[] = L"PLAYERID";
@@ -505,7 +581,11 @@ void MultiFace::ParseCmdString(PWSTR lpCmdLine)
         TOKEN_DEPTH,
         TOKEN_COLOR,
         TOKEN_NEARMODE,
-        TOKEN_SEATEDSKELETON
+        TOKEN_SEATEDSKELETON,
+        TOKEN_SHAREDRING,
+        TOKEN_SOURCE,
+        TOKEN_STATS,
+        TOKEN_TRACE
     }; 
 
     int argc = 0;
@@ -545,6 +625,52 @@ void MultiFace::ParseCmdString(PWSTR lpCmdLine)
             tokenType = TOKEN_SEATEDSKELETON;
             m_bSeatedSkeletonMode = TRUE;
         }
+        else if(0 == wcsncmp(token, KEY_SHARED_RING, ARRAYSIZE(KEY_SHARED_RING)))
+        {
+            // -SharedRing[:name] publishes every user's results to other processes
+            tokenType = TOKEN_SHAREDRING;
+            m_sharedRingName = "FaceTracking";
+            if((token = wcstok_s(NULL, L":", &context)) != NULL)
+            {
+                char name[MAX_PATH];
+                if(WideCharToMultiByte(CP_ACP, 0, token, -1, name, ARRAYSIZE(name), NULL, NULL) > 1)
+                {
+                    m_sharedRingName = name;
+                }
+            }
+        }
+        else if(0 == wcsncmp(token, KEY_SOURCE, ARRAYSIZE(KEY_SOURCE)))
+        {
+            // -Source:synthetic[:frames] or -Source:file.frames runs without the Kinect
+            tokenType = TOKEN_SOURCE;
+            char spec[MAX_PATH];
+            if(context && *context && WideCharToMultiByte(CP_ACP, 0, context, -1, spec, ARRAYSIZE(spec), NULL, NULL) > 1)
+            {
+                m_sourceSpec = spec;
+            }
+        }
+        else if(0 == wcsncmp(token, KEY_STATS, ARRAYSIZE(KEY_STATS)))
+        {
+            // -Stats[:seconds] logs where the frame time went, every 5 s by default
+            tokenType = TOKEN_STATS;
+            m_statsIntervalMs = 5000;
+            if((token = wcstok_s(NULL, L":", &context)) != NULL && _wtoi(token) > 0)
+            {
+                m_statsIntervalMs = _wtoi(token) * 1000;
+            }
+        }
+        else if(0 == wcsncmp(token, KEY_TRACE, ARRAYSIZE(KEY_TRACE)))
+        {
+            // -Trace[:file] records a timeline of the pipeline threads, written
+            // on F9 and at exit for chrome://tracing or ui.perfetto.dev
+            tokenType = TOKEN_TRACE;
+            char path[MAX_PATH] = "MultiFace.json";
+            if((token = wcstok_s(NULL, L":", &context)) != NULL)
+            {
+                WideCharToMultiByte(CP_ACP, 0, token, -1, path, ARRAYSIZE(path), NULL, NULL);
+            }
+            m_tracePath = path;
+        }
 
         if(tokenType == TOKEN_USERS)
         {
@@ -608,9 +734,14 @@ void MultiFace::ParseCmdString(PWSTR lpCmdLine)
 int APIENTRY wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdLine, int nCmdShow)
 {
     UNREFERENCED_PARAMETER(hPrevInstance);
+    // a windows application has no console, the debugger gets the output
+    AsyncLog::setConsole(false);
+    AsyncLog::start();
     MultiFace app;
 
     HeapSetInformation(NULL, HeapEnableTerminationOnCorruption, NULL, 0);
 
-    return app.Run(hInstance, lpCmdLine, nCmdShow);
+    int result = app.Run(hInstance, lpCmdLine, nCmdShow);
+    AsyncLog::stop();
+    return result;
 }
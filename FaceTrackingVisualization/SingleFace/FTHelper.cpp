@@ -7,13 +7,13 @@
 #include "StdAfx.h"
 #include "FTHelper.h"
 #include "Visualize.h"
+#include "asyncLog.h"
+#include "nuiFrameSource.h"
+#include "stageStats.h"
+#include "pipelineTrace.h"
 
 #include <cmath>
 
-#ifdef _DEBUG
-#include <iostream>
-#endif
-
 #ifdef SAMPLE_OPTIONS
 #include "Options.h"
 #else
@@ -22,8 +22,6 @@ PVOID _opt = NULL;
 
 #include "utilVector.h"
 
-#define FACETRIANGLESINDEXARRAY {69,53,70,70,73,69,74,73,70,74,56,73,68,20,67,68,67,72,72,67,71,71,23,72}
-//#define FACETRIANGLESINDEXARRAY {70,54,71,71,74,70,75,74,71,75,57,74,69,21,68,69,68,73,73,68,72,72,24,73}
 #define ISZERO(x) (fabsf((x))<0.00001)
 #define ISFTVECTOR3DZERO(v) (ISZERO(((FT_VECTOR3D)(v)).x) && ISZERO(((FT_VECTOR3D)(v)).y) && ISZERO(((FT_VECTOR3D)(v)).z))
 
@@ -42,52 +40,6 @@ namespace util{
 		return FT_VECTOR3D(a.x*t, a.y*t, a.z*t);
 	}
 
-	FT_VECTOR3D triangleMap(const POINT& p, const POINT& a, const POINT& b, const POINT& c, const FT_VECTOR3D& d, const FT_VECTOR3D& e, const FT_VECTOR3D& f, float& x, float& y)
-	{
-		x = ((p.x-a.x)*(b.y-a.y)-(p.y-a.y)*(b.x-a.x))*1.0/((c.x-a.x)*(b.y-a.y)-(c.y-a.y)*(b.x-a.x));
-		y = ((p.x-a.x)*(c.y-a.y)-(p.y-a.y)*(c.x-a.x))*1.0/((b.x-a.x)*(c.y-a.y)-(b.y-a.y)*(c.x-a.x));
-		return FT_VECTOR3D(x*(e.x-d.x)+y*(f.x-d.x)+d.x, x*(e.y-d.y)+y*(f.y-d.y)+d.y, x*(e.z-d.z)+y*(f.z-d.z)+d.z);
-	}
-
-	FT_VECTOR3D triangleMap(const POINT& p, const POINT P[3], const FT_VECTOR3D V[3], float& x, float& y)
-	{
-		return triangleMap(p, P[0], P[1], P[2], V[0], V[1], V[2], x ,y);
-	}
-
-	bool PointinTriangle(const POINT &A, const POINT &B, const POINT &C, const POINT &P, float tol = 0.0)
-	{
-		POINT v0 = {C.x-A.x, C.y-A.y};
-		POINT v1 = {B.x-A.x, B.y-A.y};
-		POINT v2 = {P.x-A.x, P.y-A.y};
-
-		LONG dot00 = v0.x*v0.x+v0.y*v0.y ;
-		LONG dot01 = v0.x*v1.x+v0.y*v1.y ;
-		LONG dot02 = v0.x*v2.x+v0.y*v2.y ;
-		LONG dot11 = v1.x*v1.x+v1.y*v1.y ;
-		LONG dot12 = v1.x*v2.x+v1.y*v2.y ;
-
-		double inverDeno = 1.0 / (dot00 * dot11 - dot01 * dot01) ;
-
-		double u = (dot11 * dot02 - dot01 * dot12) * inverDeno ;
-		if (u+tol < 0 || u-tol > 1) // if u out of range, return directly
-		{
-			return false ;
-		}
-
-		double v = (dot00 * dot12 - dot01 * dot02) * inverDeno ;
-		if (v+tol < 0 || v-tol > 1) // if v out of range, return directly
-		{
-			return false ;
-		}
-
-		return u + v + tol <= 1 ;
-	}
-
-	bool PointinTriangle(const POINT &A, const POINT P[3], float tol = 0.0)
-	{
-		return PointinTriangle(P[0], P[1], P[2], A, tol);
-	}
-
 	POINT IntToPOINT(int x, int y)
 	{
 		POINT t;
@@ -144,13 +96,19 @@ namespace util{
 FTHelper::FTHelper()
 {
     m_pFaceTracker = 0;
+    m_source = NULL;
+    m_SourcePresent = FALSE;
+    memset(&m_sourceConfig, 0, sizeof(m_sourceConfig));
+    memset(&m_videoConfig, 0, sizeof(m_videoConfig));
     m_hWnd = NULL;
     m_pFTResult = NULL;
     m_colorImage = NULL;
     m_depthImage = NULL;
     m_ApplicationIsRunning = false;
     m_LastTrackSucceeded = false;
-    m_CallBack = NULL;
+    m_callBackSubscriber = -1;
+    m_status = TRACKER_NOT_STARTED;
+    m_lastHr = S_OK;
     m_XCenterFace = 0;
     m_YCenterFace = 0;
     m_hFaceTrackingThread = NULL;
@@ -162,10 +120,15 @@ FTHelper::FTHelper()
     m_colorType = NUI_IMAGE_TYPE_COLOR;
     m_colorRes = NUI_IMAGE_RESOLUTION_INVALID;
 
-	memset(m_pPts3D, 0, VERTEXCOUNT*sizeof(FT_VECTOR3D));
-	memset(m_pPts2D, 0, VERTEXCOUNT*sizeof(FT_VECTOR2D));
-	m_pTriangles = NULL;
-	m_TriangleCount = 0;
+	m_topology = NULL;
+	m_frameId = 0;
+	m_geometryFresh = false;
+	m_frameCount = 0;
+
+	InitializeCriticalSection(&m_videoLock);
+	m_videoFrame = NULL;
+	m_videoCenterX = 0;
+	m_videoCenterY = 0;
 
 	memset(&m_leftPupil, 0, sizeof(FT_VECTOR3D));
 	memset(&m_rightPupil, 0, sizeof(FT_VECTOR3D));
@@ -173,23 +136,40 @@ FTHelper::FTHelper()
 
 	m_gazeLastState[0].set(0.5,0,69,74,73);
 	m_gazeLastState[1].set(0.5,0,67,72,71);
+
+#ifdef GAZE_TRACKING
+	m_gazeTrack = NULL;
+	m_initTicks = 0;
+	m_firstGazeMs = -1.0;
+#endif
 }
 
 FTHelper::~FTHelper()
 {
     Stop();
+    delete m_source;
+#ifdef GAZE_TRACKING
+	delete m_gazeTrack;
+#endif
+    if (m_videoFrame)
+    {
+        m_videoFrame->Release();
+    }
+    DeleteCriticalSection(&m_videoLock);
 }
 
 HRESULT FTHelper::Init(HWND hWnd, FTHelperCallBack callBack, PVOID callBackParam, 
                        NUI_IMAGE_TYPE depthType, NUI_IMAGE_RESOLUTION depthRes, BOOL bNearMode, BOOL bFallbackToDefault, NUI_IMAGE_TYPE colorType, NUI_IMAGE_RESOLUTION colorRes, BOOL bSeatedSkeletonMode)
 {
-    if (!hWnd || !callBack)
-    {
-        return E_INVALIDARG;
-    }
+    // hWnd and callBack are both optional: without a window errors are only
+    // reported through GetStatus(), without a callback results are read
+    // through GetSnapshot() or a GetResultBus() subscription
     m_hWnd = hWnd;
-    m_CallBack = callBack;
-    m_CallBackParam = callBackParam;
+    m_status = TRACKER_STARTING;
+    m_lastHr = S_OK;
+    // the application only ever wants the newest frame
+    m_resultBus.stop();
+    m_callBackSubscriber = callBack ? m_resultBus.subscribe("app", callBack, callBackParam, 2, TrackingResultBus::LatestWins) : -1;
     m_ApplicationIsRunning = true;
     m_depthType = depthType;
     m_depthRes = depthRes;
@@ -198,12 +178,24 @@ HRESULT FTHelper::Init(HWND hWnd, FTHelperCallBack callBack, PVOID callBackParam
     m_bSeatedSkeletonMode = bSeatedSkeletonMode;
     m_colorType = colorType;
     m_colorRes = colorRes;
-    m_hFaceTrackingThread = CreateThread(NULL, 0, FaceTrackingStaticThread, (PVOID)this, 0, 0);
 
 #ifdef GAZE_TRACKING
-	m_gazeTrack = new GazeTracking();
-	m_gazeTrack->initialize("res/haarcascade_frontalface_alt.xml");
+	// the tracking thread uses m_gazeTrack, so it has to exist first; the
+	// cascade itself loads in the background and analyze() skips frames until then
+	m_initTicks = cv::getTickCount();
+	m_firstGazeMs = -1.0;
+	if (!m_gazeTrack)
+	{
+		m_gazeTrack = new GazeTracking();
+	}
+	m_gazeTrack->initializeAsync("res/haarcascade_frontalface_alt.xml", "res/gazeParams.yml");
 #endif
+    m_hFaceTrackingThread = CreateThread(NULL, 0, FaceTrackingStaticThread, (PVOID)this, 0, 0);
+    if (!m_hFaceTrackingThread)
+    {
+        m_status = TRACKER_OUT_OF_MEMORY;
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
     return S_OK;
 }
 
@@ -212,81 +204,96 @@ HRESULT FTHelper::Stop()
     m_ApplicationIsRunning = false;
     if (m_hFaceTrackingThread)
     {
-        WaitForSingleObject(m_hFaceTrackingThread, 1000);
+        // Everything below is used by the tracking thread until it ends. An
+        // error message box on that thread sends to our window, so sent
+        // messages are let through while waiting.
+        HANDLE thread = m_hFaceTrackingThread;
+        while (MsgWaitForMultipleObjects(1, &thread, FALSE, INFINITE, QS_SENDMESSAGE) == WAIT_OBJECT_0 + 1)
+        {
+            MSG msg;
+            PeekMessage(&msg, NULL, 0, 0, PM_NOREMOVE);
+        }
+        CloseHandle(thread);
+        m_hFaceTrackingThread = NULL;
+    }
+    if (!trackerStatusIsError(m_status) && m_status != TRACKER_SOURCE_FINISHED)
+    {
+        m_status = TRACKER_STOPPED;
     }
-    m_hFaceTrackingThread = 0;
+    // delivers what is still queued, then joins the subscriber threads
+    m_resultBus.stop();
+    m_callBackSubscriber = -1;
+    m_metrics.close();
+    m_frameRecorder.close();
     return S_OK;
 }
 
 BOOL FTHelper::SubmitFraceTrackingResult(IFTResult* pResult)
 {
+    STAGE_TIMER(STAGE_SUBMIT);
     if (pResult != NULL && SUCCEEDED(pResult->GetStatus()))
     {
-        if (m_CallBack)
+        // the model, shape units and projection are fetched once per frame;
+        // the gaze mapping, the renderers and the published snapshot all read m_geometry
+        FLOAT* pSU = NULL;
+        UINT numSU;
+        BOOL suConverged;
+        m_pFaceTracker->GetShapeUnits(NULL, &pSU, &numSU, &suConverged);
+        FT_CAMERA_CONFIG cameraConfig;
+        if (m_SourcePresent)
         {
-            (*m_CallBack)(m_CallBackParam);
+            cameraConfig = m_videoConfig;
         }
-
-        if (m_DrawMask)
+        else
         {
-            FLOAT* pSU = NULL;
-            UINT numSU;
-            BOOL suConverged;
-            m_pFaceTracker->GetShapeUnits(NULL, &pSU, &numSU, &suConverged);
-            POINT viewOffset = {0, 0};
-            FT_CAMERA_CONFIG cameraConfig;
-            if (m_KinectSensorPresent)
-            {
-                m_KinectSensor.GetVideoConfiguration(&cameraConfig);
-            }
-            else
+            cameraConfig.Width = 640;
+            cameraConfig.Height = 480;
+            cameraConfig.FocalLength = 500.0f;
+        }
+        IFTModel* ftModel = NULL;
+        HRESULT hr = m_pFaceTracker->GetFaceModel(&ftModel);
+        if (SUCCEEDED(hr))
+        {
+            if (!m_topology)
             {
-                cameraConfig.Width = 640;
-                cameraConfig.Height = 480;
-                cameraConfig.FocalLength = 500.0f;
+                m_topology = FaceTopology::Get(ftModel);
             }
-            IFTModel* ftModel;
-            HRESULT hr = m_pFaceTracker->GetFaceModel(&ftModel);
-            if (SUCCEEDED(hr))
-            {
-				//////////////////////////////////////////////////////////////////////////
-#ifndef ASSOCIATE			
-				IplImage *img = cvCreateImage(cvSize(m_colorImage->GetWidth(), m_colorImage->GetHeight()), IPL_DEPTH_8U, 4);
-				memcpy(img->imageData, m_colorImage->GetBuffer(), m_colorImage->GetBufferSize());
-				cv::Mat frame(img, true);
-#else
-				cv::Mat frame(m_KinectSensor.GetImage(), true);
-				//cv::flip(frame, frame, 1);
-#endif
-				if(!frame.empty())
+            hr = m_geometry.Compute(ftModel, pResult, pSU, numSU, cameraConfig);
+            m_geometry.frameId = m_frameId;
+            ftModel->Release();
+        }
+        if (FAILED(hr) || !m_topology)
+        {
+            return FALSE;
+        }
+        m_geometryFresh = true;
+
+        if (m_DrawMask)
+        {
+			//////////////////////////////////////////////////////////////////////////
+			// wrap the tracker's color buffer, analyze() only reads it
+			cv::Mat frame(m_colorImage->GetHeight(), m_colorImage->GetWidth(), CV_8UC4, m_colorImage->GetBuffer(), m_colorImage->GetStride());
+			if(!frame.empty())
+			{
+				m_gazeTrack->analyze(frame, m_gazeResult, &m_gazeScratch);
+				if (m_gazeResult.findFace && m_firstGazeMs < 0)
 				{
-					m_gazeTrack->process(frame);
+					m_firstGazeMs = (cv::getTickCount() - m_initTicks) * 1000.0 / cv::getTickFrequency();
+					LOG_INFO("first gaze result after {} ms (cascade {} ms, {})", m_firstGazeMs,
+						m_gazeTrack->getLoadMs(), m_gazeTrack->isLoadedFromCache() ? "cached" : "xml");
 				}
-				//////////////////////////////////////////////////////////////////////////
-            }
+			}
+			//////////////////////////////////////////////////////////////////////////
 
-			FLOAT *pAUs;
-			UINT auCount;
-			hr = m_pFTResult->GetAUCoefficients(&pAUs, &auCount);
-			FLOAT scale, rotationXYZ[3], translationXYZ[3];
-			m_pFTResult->Get3DPose(&scale, rotationXYZ, translationXYZ);
-			ftModel->Get3DShape(pSU, ftModel->GetSUCount(), pAUs, ftModel->GetAUCount(), scale, rotationXYZ, translationXYZ, m_pPts3D, VERTEXCOUNT);
-			ftModel->GetProjectedShape(&cameraConfig, 1.0, viewOffset, pSU, ftModel->GetSUCount(), pAUs, auCount, 
-				scale, rotationXYZ, translationXYZ, m_pPts2D, VERTEXCOUNT);
-			ftModel->GetTriangles(&m_pTriangles, &m_TriangleCount);
-
-			//hr = VisualizeFaceModel(m_colorImage, ftModel, &cameraConfig, pSU, 1.0, viewOffset, pResult, 0x00FFFF00);
-			//VisualizeFaceModel(ftModel, &cameraConfig, pSU, 1.0, viewOffset, 0x00ff0000);
+			m_surfaceIndex.build(m_geometry.pts2D, m_geometry.pts3D, m_topology->GetTriangles(), m_topology->GetTriangleCount());
+
+			//VisualizeFaceModel(m_geometry, 0x00ff0000);
 			m_pupilR = (PointDis(69, 74)+PointDis(70,73)+PointDis(67,72)+PointDis(68,71))/16;
 
-			if(m_gazeTrack->isFindFace())
+			if(m_gazeResult.findFace)
 			{	
 				Map2Dto3D();
-				
-				//static int count = 0;
-				//SaveModel(ftModel, pSU, ftModel->GetSUCount(), pAUs, ftModel->GetAUCount(), 1.0, rotationXYZ, translationXYZ, count++);
 			}
-			ftModel->Release();
         }
     }
     return TRUE;
@@ -316,28 +323,62 @@ void FTHelper::SetCenterOfImage(IFTResult* pResult)
     }
 }
 
-// Get a video image and process it.
-void FTHelper::CheckCameraInput()
+// Get a video image and process it. False once a finite source has ended.
+bool FTHelper::CheckCameraInput()
 {
+    STAGE_TIMER(STAGE_FRAME);
     HRESULT hrFT = E_FAIL;
-
-    if (m_KinectSensorPresent && m_KinectSensor.GetVideoBuffer())
+    // the id of this pass, the snapshot, the geometry and the shared ring
+    // all carry it; m_frameCount goes up once the snapshot is out
+    m_frameId = (UINT)m_frameCount + 1;
+    m_geometryFresh = false;
+
+    SourceFrame frame;
+    HRESULT hrRead;
+    HRESULT hrCopy = E_FAIL;
+    {
+        STAGE_TIMER(STAGE_FRAME_READ);
+        hrRead = m_SourcePresent ? m_source->readFrame(frame) : E_FAIL;
+        if (hrRead == S_OK)
+        {
+            // the stages of this pass carry the frame in the trace
+            TRACE_FRAME(frame.frameId);
+            hrCopy = copyToImage(frame.color, frame.colorStride, m_colorImage);
+            if (SUCCEEDED(hrCopy) && frame.depth && m_depthImage)
+            {
+                hrCopy = copyToImage((const BYTE*)frame.depth, frame.depthStride, m_depthImage);
+            }
+        }
+    }
+    if (hrRead == S_FALSE)
     {
-        HRESULT hrCopy = m_KinectSensor.GetVideoBuffer()->CopyTo(m_colorImage, NULL, 0, 0);
-        if (SUCCEEDED(hrCopy) && m_KinectSensor.GetDepthBuffer())
+        return false;
+    }
+    if (hrRead == S_OK)
+    {
+        STAGE_COUNTER(COUNTER_FRAMES);
+        if (m_frameRecorder.isOpen())
         {
-            hrCopy = m_KinectSensor.GetDepthBuffer()->CopyTo(m_depthImage, NULL, 0, 0);
+            m_frameRecorder.write(frame);
         }
         // Do face tracking
         if (SUCCEEDED(hrCopy))
         {
-            FT_SENSOR_DATA sensorData(m_colorImage, m_depthImage, m_KinectSensor.GetZoomFactor(), m_KinectSensor.GetViewOffSet());
+            POINT viewOffset = {m_sourceConfig.viewOffsetX, m_sourceConfig.viewOffsetY};
+            FT_SENSOR_DATA sensorData(m_colorImage, m_depthImage, m_sourceConfig.zoomFactor, &viewOffset);
 
+            // the skeleton closest to the last head, or to the camera at first
             FT_VECTOR3D* hint = NULL;
-            if (SUCCEEDED(m_KinectSensor.GetClosestHint(m_hint3D)))
+            const float lastHead[3] = {m_hint3D[1].x, m_hint3D[1].y, m_hint3D[1].z};
+            int skeleton = frame.closestSkeleton(lastHead);
+            if (skeleton >= 0)
             {
+                const SourceSkeleton& s = frame.skeletons[skeleton];
+                m_hint3D[0] = FT_VECTOR3D(s.neck[0], s.neck[1], s.neck[2]);
+                m_hint3D[1] = FT_VECTOR3D(s.head[0], s.head[1], s.head[2]);
                 hint = m_hint3D;
             }
+            STAGE_TIMER(STAGE_FACE_TRACK);
             if (m_LastTrackSucceeded)
             {
                 hrFT = m_pFaceTracker->ContinueTracking(&sensorData, hint, m_pFTResult);
@@ -348,17 +389,222 @@ void FTHelper::CheckCameraInput()
             }
         }
     }
+    else
+    {
+        STAGE_COUNTER(COUNTER_READ_FAILED);
+    }
 
     m_LastTrackSucceeded = SUCCEEDED(hrFT) && SUCCEEDED(m_pFTResult->GetStatus());
     if (m_LastTrackSucceeded)
     {
+        STAGE_COUNTER(COUNTER_TRACKED);
         SubmitFraceTrackingResult(m_pFTResult);
     }
     else
     {
+        STAGE_COUNTER(COUNTER_LOST);
         m_pFTResult->Reset();
     }
     SetCenterOfImage(m_pFTResult);
+    if (SUCCEEDED(hrCopy))
+    {
+        PublishVideoFrame();
+    }
+    return true;
+}
+
+// Hands the frame with the mask drawn over to the window. The copy is one
+// memcpy under a lock the paint only holds for its own copy.
+void FTHelper::PublishVideoFrame()
+{
+    EnterCriticalSection(&m_videoLock);
+    if (!m_videoFrame)
+    {
+        m_videoFrame = FTCreateImage();
+    }
+    if (m_videoFrame && SUCCEEDED(m_videoFrame->Allocate(m_colorImage->GetWidth(), m_colorImage->GetHeight(), m_colorImage->GetFormat())))
+    {
+        m_colorImage->CopyTo(m_videoFrame, NULL, 0, 0);
+        m_videoCenterX = m_XCenterFace;
+        m_videoCenterY = m_YCenterFace;
+    }
+    LeaveCriticalSection(&m_videoLock);
+}
+
+BOOL FTHelper::CopyVideoFrame(IFTImage* target, float* centerX, float* centerY)
+{
+    BOOL copied = FALSE;
+    EnterCriticalSection(&m_videoLock);
+    if (target && m_videoFrame && m_videoFrame->GetWidth() > 0 &&
+        SUCCEEDED(target->Allocate(m_videoFrame->GetWidth(), m_videoFrame->GetHeight(), FTIMAGEFORMAT_UINT8_B8G8R8A8)))
+    {
+        copied = SUCCEEDED(m_videoFrame->CopyTo(target, NULL, 0, 0));
+        *centerX = m_videoCenterX;
+        *centerY = m_videoCenterY;
+    }
+    LeaveCriticalSection(&m_videoLock);
+    return copied;
+}
+
+// Copies the tracking thread's working state into the seqlock in one go.
+void FTHelper::PublishSnapshot()
+{
+    STAGE_TIMER(STAGE_PUBLISH);
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    // tracked only when this pass computed the geometry, a result the
+    // tracker accepted but SubmitFraceTrackingResult failed on is lost
+    m_pending.tracked = m_geometryFresh;
+    m_pending.frameId = m_frameId;
+    m_pending.timestamp = now.QuadPart;
+    m_pending.topology = m_topology;
+    if (m_geometryFresh)
+    {
+        m_pending.geometry = m_geometry;
+        m_pending.gazeValid = m_DrawMask && m_gazeResult.findFace;
+        m_pending.leftPupil = m_leftPupil;
+        m_pending.rightPupil = m_rightPupil;
+        m_pending.pupilR = m_pupilR;
+    }
+    else
+    {
+        m_pending.gazeValid = false;
+    }
+    m_published.write(m_pending);
+
+    // one immutable copy per tracked frame, shared by every subscriber
+    if (m_geometryFresh && m_resultBus.getSubscriberCount() > 0)
+    {
+        m_resultBus.publish(std::make_shared<TrackingSnapshot>(m_pending));
+    }
+
+    // other processes get every frame; a lost one is flagged and carries no
+    // geometry, the last good pose must not look like this frame's
+    if (m_sharedRing.isOpen())
+    {
+        if (m_pending.tracked)
+        {
+            m_pending.geometry.Export(m_sharedRecord);
+        }
+        else
+        {
+            memset(&m_sharedRecord, 0, sizeof(m_sharedRecord));
+        }
+        m_sharedRecord.frameId = m_pending.frameId;
+        m_sharedRecord.userId = 0;
+        m_sharedRecord.timestamp = m_pending.timestamp;
+        m_sharedRecord.flags = (m_pending.tracked ? SHARED_RECORD_TRACKED : 0) | (m_pending.gazeValid ? SHARED_RECORD_GAZE : 0);
+        if (m_pending.gazeValid)
+        {
+            m_sharedRecord.leftPupil[0] = m_pending.leftPupil.x;
+            m_sharedRecord.leftPupil[1] = m_pending.leftPupil.y;
+            m_sharedRecord.leftPupil[2] = m_pending.leftPupil.z;
+            m_sharedRecord.rightPupil[0] = m_pending.rightPupil.x;
+            m_sharedRecord.rightPupil[1] = m_pending.rightPupil.y;
+            m_sharedRecord.rightPupil[2] = m_pending.rightPupil.z;
+            m_sharedRecord.pupilRadius = m_pending.pupilR;
+        }
+        m_sharedRing.publish(m_sharedRecord);
+    }
+
+    if (m_metrics.isOpen())
+    {
+        AppendMetrics();
+    }
+}
+
+// One row per frame; a lost frame only has its timestamp and id, the
+// geometry in m_pending is still that of the last tracked one.
+void FTHelper::AppendMetrics()
+{
+    MetricsRow row;
+    row.timestamp = m_pending.timestamp;
+    row.frameId = m_pending.frameId;
+    row.flags = (m_pending.tracked ? METRIC_FLAG_TRACKED : 0) | (m_pending.gazeValid ? METRIC_FLAG_GAZE : 0);
+    if (m_pending.tracked)
+    {
+        const FaceGeometry& g = m_pending.geometry;
+        row.at(METRIC_SCALE) = g.scale;
+        row.at(METRIC_PITCH) = g.rotation[0];
+        row.at(METRIC_YAW) = g.rotation[1];
+        row.at(METRIC_ROLL) = g.rotation[2];
+        row.at(METRIC_TX) = g.translation[0];
+        row.at(METRIC_TY) = g.translation[1];
+        row.at(METRIC_TZ) = g.translation[2];
+        for (UINT i = 0; i < g.auCount && i < METRIC_MAX_AU; ++i)
+        {
+            row.at((MetricColumn)(METRIC_AU0 + i)) = g.au[i];
+        }
+        row.at(METRIC_FACE_LEFT) = (float)g.faceRect.left;
+        row.at(METRIC_FACE_TOP) = (float)g.faceRect.top;
+        row.at(METRIC_FACE_RIGHT) = (float)g.faceRect.right;
+        row.at(METRIC_FACE_BOTTOM) = (float)g.faceRect.bottom;
+    }
+    if (m_pending.gazeValid)
+    {
+        row.at(METRIC_LEFT_PUPIL_X) = m_pending.leftPupil.x;
+        row.at(METRIC_LEFT_PUPIL_Y) = m_pending.leftPupil.y;
+        row.at(METRIC_LEFT_PUPIL_Z) = m_pending.leftPupil.z;
+        row.at(METRIC_RIGHT_PUPIL_X) = m_pending.rightPupil.x;
+        row.at(METRIC_RIGHT_PUPIL_Y) = m_pending.rightPupil.y;
+        row.at(METRIC_RIGHT_PUPIL_Z) = m_pending.rightPupil.z;
+        row.at(METRIC_PUPIL_R) = m_pending.pupilR;
+    }
+    m_metrics.append(row);
+}
+
+bool FTHelper::OpenSharedRing(const std::string& name, UINT capacity)
+{
+    if (m_hFaceTrackingThread)
+    {
+        return false;
+    }
+    memset(&m_sharedRecord, 0, sizeof(m_sharedRecord));
+    return m_sharedRing.create(name, capacity);
+}
+
+void FTHelper::SetFrameSource(FrameSource* source)
+{
+    if (m_hFaceTrackingThread || source == m_source)
+    {
+        return;
+    }
+    delete m_source;
+    m_source = source;
+}
+
+bool FTHelper::RecordFrames(const std::string& path)
+{
+    if (m_hFaceTrackingThread)
+    {
+        return false;
+    }
+    m_frameRecordPath = path;
+    return true;
+}
+
+bool FTHelper::OpenMetrics(const std::string& path)
+{
+    if (m_hFaceTrackingThread)
+    {
+        return false;
+    }
+    return m_metrics.open(path);
+}
+
+// Records why the tracking thread is giving up. Only a windowed application
+// gets a message box, a headless one reads GetStatus()/GetLastHResult().
+DWORD FTHelper::ReportError(TrackerStatus status, HRESULT hr, LPCWSTR text)
+{
+    m_lastHr = hr;
+    m_status = status;
+    LOG_ERROR("face tracker: {}, hr {}", trackerStatusName(status), LogArg::hex((unsigned)hr));
+    if (m_hWnd && text)
+    {
+        MessageBoxW(m_hWnd, text, L"Face Tracker Initialization Error\n", MB_OK);
+    }
+    return (DWORD)status;
 }
 
 DWORD WINAPI FTHelper::FaceTrackingStaticThread(PVOID lpParam)
@@ -366,43 +612,97 @@ DWORD WINAPI FTHelper::FaceTrackingStaticThread(PVOID lpParam)
     FTHelper* context = static_cast<FTHelper*>(lpParam);
     if (context)
     {
-        return context->FaceTrackingThread();
+        DWORD result = context->FaceTrackingThread();
+        // on every way out, the early failures included
+        context->ReleaseTracking();
+        return result;
     }
     return 0;
 }
 
+// Frees what the tracking thread created, on that thread once it is done.
+void FTHelper::ReleaseTracking()
+{
+    if (m_pFaceTracker)
+    {
+        m_pFaceTracker->Release();
+        m_pFaceTracker = NULL;
+    }
+
+    if(m_colorImage)
+    {
+        m_colorImage->Release();
+        m_colorImage = NULL;
+    }
+
+    if(m_depthImage) 
+    {
+        m_depthImage->Release();
+        m_depthImage = NULL;
+    }
+
+    if(m_pFTResult)
+    {
+        m_pFTResult->Release();
+        m_pFTResult = NULL;
+    }
+    if (m_source)
+    {
+        m_source->close();
+    }
+    m_SourcePresent = FALSE;
+}
+
 DWORD WINAPI FTHelper::FaceTrackingThread()
 {
+    AsyncLog::setThreadName("tracking");
+    PipelineTrace::setThreadName("tracking");
     FT_CAMERA_CONFIG videoConfig;
     FT_CAMERA_CONFIG depthConfig;
     FT_CAMERA_CONFIG* pDepthConfig = NULL;
 
-    // Try to get the Kinect camera to work
-    HRESULT hr = m_KinectSensor.Init(m_depthType, m_depthRes, m_bNearMode, m_bFallbackToDefault, m_colorType, m_colorRes, m_bSeatedSkeletonMode);
+    // Try to get the Kinect camera to work, unless another source was set
+    if (!m_source)
+    {
+        m_source = new NuiFrameSource(m_depthType, m_depthRes, m_bNearMode, m_bFallbackToDefault, m_colorType, m_colorRes, m_bSeatedSkeletonMode);
+    }
+    HRESULT hr = m_source->open();
     if (SUCCEEDED(hr))
     {
-        m_KinectSensorPresent = TRUE;
-        m_KinectSensor.GetVideoConfiguration(&videoConfig);
-        m_KinectSensor.GetDepthConfiguration(&depthConfig);
-        pDepthConfig = &depthConfig;
+        m_SourcePresent = TRUE;
+        m_sourceConfig = m_source->getConfig();
+        videoConfig.Width = m_sourceConfig.colorWidth;
+        videoConfig.Height = m_sourceConfig.colorHeight;
+        videoConfig.FocalLength = m_sourceConfig.colorFocalLength;
+        m_videoConfig = videoConfig;
+        if (m_sourceConfig.depthWidth)
+        {
+            depthConfig.Width = m_sourceConfig.depthWidth;
+            depthConfig.Height = m_sourceConfig.depthHeight;
+            depthConfig.FocalLength = m_sourceConfig.depthFocalLength;
+            pDepthConfig = &depthConfig;
+        }
         m_hint3D[0] = m_hint3D[1] = FT_VECTOR3D(0, 0, 0);
+        LOG_INFO("frame source: {} {}x{}", m_source->getName(), m_sourceConfig.colorWidth, m_sourceConfig.colorHeight);
     }
     else
     {
-        m_KinectSensorPresent = FALSE;
+        m_SourcePresent = FALSE;
         WCHAR errorText[MAX_PATH];
         ZeroMemory(errorText, sizeof(WCHAR) * MAX_PATH);
-        wsprintf(errorText, L"Could not initialize the Kinect sensor. hr=0x%x\n", hr);
-        MessageBoxW(m_hWnd, errorText, L"Face Tracker Initialization Error\n", MB_OK);
-        return 1;
+        wsprintf(errorText, L"Could not open the %S frame source. hr=0x%x\n", m_source->getName(), hr);
+        return ReportError(TRACKER_SENSOR_FAILED, hr, errorText);
+    }
+    if (!m_frameRecordPath.empty() && !m_frameRecorder.open(m_frameRecordPath, m_sourceConfig))
+    {
+        LOG_ERROR("cannot record the frames to {}", m_frameRecordPath.c_str());
     }
 
     // Try to start the face tracker.
     m_pFaceTracker = FTCreateFaceTracker(_opt);
     if (!m_pFaceTracker)
     {
-        MessageBoxW(m_hWnd, L"Could not create the face tracker.\n", L"Face Tracker Initialization Error\n", MB_OK);
-        return 2;
+        return ReportError(TRACKER_CREATE_FAILED, E_FAIL, L"Could not create the face tracker.\n");
     }
 
     hr = m_pFaceTracker->Initialize(&videoConfig, pDepthConfig, NULL, NULL); 
@@ -412,23 +712,20 @@ DWORD WINAPI FTHelper::FaceTrackingThread()
         GetCurrentDirectoryW(ARRAYSIZE(path), path);
         wsprintf(buffer, L"Could not initialize face tracker (%s). hr=0x%x", path, hr);
 
-        MessageBoxW(m_hWnd, /*L"Could not initialize the face tracker.\n"*/ buffer, L"Face Tracker Initialization Error\n", MB_OK);
-
-        return 3;
+        return ReportError(TRACKER_INIT_FAILED, hr, buffer);
     }
 
     hr = m_pFaceTracker->CreateFTResult(&m_pFTResult);
     if (FAILED(hr) || !m_pFTResult)
     {
-        MessageBoxW(m_hWnd, L"Could not initialize the face tracker result.\n", L"Face Tracker Initialization Error\n", MB_OK);
-        return 4;
+        return ReportError(TRACKER_RESULT_FAILED, hr, L"Could not initialize the face tracker result.\n");
     }
 
     // Initialize the RGB image.
     m_colorImage = FTCreateImage();
     if (!m_colorImage || FAILED(hr = m_colorImage->Allocate(videoConfig.Width, videoConfig.Height, FTIMAGEFORMAT_UINT8_B8G8R8X8)))
     {
-        return 5;
+        return ReportError(TRACKER_IMAGE_FAILED, hr, NULL);
     }
 
     if (pDepthConfig)
@@ -436,48 +733,43 @@ DWORD WINAPI FTHelper::FaceTrackingThread()
         m_depthImage = FTCreateImage();
         if (!m_depthImage || FAILED(hr = m_depthImage->Allocate(depthConfig.Width, depthConfig.Height, FTIMAGEFORMAT_UINT16_D13P3)))
         {
-            return 6;
+            return ReportError(TRACKER_IMAGE_FAILED, hr, NULL);
         }
     }
 
     SetCenterOfImage(NULL);
+    m_status = TRACKER_RUNNING;
     m_LastTrackSucceeded = false;
 
     while (m_ApplicationIsRunning)
     {
-        CheckCameraInput();
-        InvalidateRect(m_hWnd, NULL, FALSE);
-        UpdateWindow(m_hWnd);
+        if (!CheckCameraInput())
+        {
+            m_status = TRACKER_SOURCE_FINISHED;
+            LOG_INFO("frame source: {} finished", m_source->getName());
+            break;
+        }
+        PublishSnapshot();
+        // the window repaints on its own timer when it sees a new count,
+        // tracking never waits for a paint
+        InterlockedIncrement(&m_frameCount);
         Sleep(16);
     }
-
-    m_pFaceTracker->Release();
-    m_pFaceTracker = NULL;
-
-    if(m_colorImage)
-    {
-        m_colorImage->Release();
-        m_colorImage = NULL;
-    }
-
-    if(m_depthImage) 
-    {
-        m_depthImage->Release();
-        m_depthImage = NULL;
-    }
-
-    if(m_pFTResult)
-    {
-        m_pFTResult->Release();
-        m_pFTResult = NULL;
-    }
-    m_KinectSensor.Release();
     return 0;
 }
 
 HRESULT FTHelper::GetCameraConfig(FT_CAMERA_CONFIG* cameraConfig)
 {
-    return m_KinectSensorPresent ? m_KinectSensor.GetVideoConfiguration(cameraConfig) : E_FAIL;
+    if (!cameraConfig)
+    {
+        return E_POINTER;
+    }
+    if (!m_SourcePresent)
+    {
+        return E_FAIL;
+    }
+    *cameraConfig = m_videoConfig;
+    return S_OK;
 }
 
 HRESULT FTHelper::VisualizeFacetracker(UINT32 color)
@@ -575,119 +867,43 @@ HRESULT FTHelper::VisualizeFacetracker(UINT32 color)
 	return hr;
 }
 
-HRESULT FTHelper::VisualizeFaceModel(IFTModel* pModel, FT_CAMERA_CONFIG const* pCameraConfig, FLOAT const* pSUCoef, FLOAT zoomFactor, POINT viewOffset, UINT32 color)
-
+HRESULT FTHelper::VisualizeFaceModel(const FaceGeometry& geometry, UINT32 color)
 {
-	if (!m_colorImage || !pModel || !pCameraConfig || !pSUCoef || !m_pFTResult)
+	if (!m_colorImage || !m_topology || !geometry.valid)
 	{
 		return E_POINTER;
 	}
 
-
 	HRESULT hr = S_OK;
-	UINT vertexCount = pModel->GetVertexCount();
-	FT_VECTOR2D* pPts2D = reinterpret_cast<FT_VECTOR2D*>(_malloca(sizeof(FT_VECTOR2D) * vertexCount));
-#ifdef _DEBUG	
-	FT_VECTOR3D* pPts3D = reinterpret_cast<FT_VECTOR3D*>(_malloca(sizeof(FT_VECTOR3D) * vertexCount));
-#endif
-	if (pPts2D)
+	UINT vertexCount = m_topology->GetVertexCount();
+	POINT* p3DMdl   = reinterpret_cast<POINT*>(_malloca(sizeof(POINT) * vertexCount));
+	if (p3DMdl)
 	{
-		FLOAT *pAUs;
-		UINT auCount;
-		hr = m_pFTResult->GetAUCoefficients(&pAUs, &auCount);
-		if (SUCCEEDED(hr))
+		for (UINT i = 0; i < vertexCount; ++i)
 		{
-			FLOAT scale, rotationXYZ[3], translationXYZ[3];
-			hr = m_pFTResult->Get3DPose(&scale, rotationXYZ, translationXYZ);
-#ifdef _DEBUG
-			pModel->Get3DShape(pSUCoef, pModel->GetSUCount(), pAUs, pModel->GetAUCount(), scale, rotationXYZ, translationXYZ, pPts3D, vertexCount);
-			std::cout << pPts3D[5].x << ' ' << pPts3D[5].y << ' ' << pPts3D[5].z << std::endl;
-#endif
+			p3DMdl[i].x = LONG(geometry.pts2D[i].x + 0.5f);
+			p3DMdl[i].y = LONG(geometry.pts2D[i].y + 0.5f);
+		}
 
-			if (SUCCEEDED(hr))
-			{
-				hr = pModel->GetProjectedShape(pCameraConfig, zoomFactor, viewOffset, pSUCoef, pModel->GetSUCount(), pAUs, auCount, 
-					scale, rotationXYZ, translationXYZ, pPts2D, vertexCount);
-				if (SUCCEEDED(hr))
-				{
-					POINT* p3DMdl   = reinterpret_cast<POINT*>(_malloca(sizeof(POINT) * vertexCount));
-					if (p3DMdl)
-					{
-						for (UINT i = 0; i < vertexCount; ++i)
-						{
-							p3DMdl[i].x = LONG(pPts2D[i].x + 0.5f);
-							p3DMdl[i].y = LONG(pPts2D[i].y + 0.5f);
-						}
-
-						FT_TRIANGLE* pTriangles;
-						UINT triangleCount;
-						hr = pModel->GetTriangles(&pTriangles, &triangleCount);
-						if (SUCCEEDED(hr))
-						{
-							struct EdgeHashTable
-							{
-								UINT32* pEdges;
-								UINT edgesAlloc;
-
-								void Insert(int a, int b) 
-								{
-									UINT32 v = (min(a, b) << 16) | max(a, b);
-									UINT32 index = (v + (v << 8)) * 49157, i;
-									for (i = 0; i < edgesAlloc - 1 && pEdges[(index + i) & (edgesAlloc - 1)] && v != pEdges[(index + i) & (edgesAlloc - 1)]; ++i)
-									{
-									}
-									pEdges[(index + i) & (edgesAlloc - 1)] = v;
-								}
-							} eht;
-
-							eht.edgesAlloc = 1 << UINT(log(2.f * (1 + vertexCount + triangleCount)) / log(2.f));
-							eht.pEdges = reinterpret_cast<UINT32*>(_malloca(sizeof(UINT32) * eht.edgesAlloc));
-							if (eht.pEdges)
-							{
-								ZeroMemory(eht.pEdges, sizeof(UINT32) * eht.edgesAlloc);
-								for (UINT i = 0; i < triangleCount; ++i)
-								{ 
-									eht.Insert(pTriangles[i].i, pTriangles[i].j);
-									eht.Insert(pTriangles[i].j, pTriangles[i].k);
-									eht.Insert(pTriangles[i].k, pTriangles[i].i);
-								}
-								for (UINT i = 0; i < eht.edgesAlloc; ++i)
-								{
-									if(eht.pEdges[i] != 0)
-									{
-										m_colorImage->DrawLine(p3DMdl[eht.pEdges[i] >> 16], p3DMdl[eht.pEdges[i] & 0xFFFF], color, 1);
-									}
-								}
-								_freea(eht.pEdges);
-							}
-
-							// Render the face rect in magenta
-							RECT rectFace;
-							hr = m_pFTResult->GetFaceRect(&rectFace);
-							if (SUCCEEDED(hr))
-							{
-								POINT leftTop = {rectFace.left, rectFace.top};
-								POINT rightTop = {rectFace.right - 1, rectFace.top};
-								POINT leftBottom = {rectFace.left, rectFace.bottom - 1};
-								POINT rightBottom = {rectFace.right - 1, rectFace.bottom - 1};
-								UINT32 nColor = 0xff00ff;
-								SUCCEEDED(hr = m_colorImage->DrawLine(leftTop, rightTop, nColor, 1)) &&
-									SUCCEEDED(hr = m_colorImage->DrawLine(rightTop, rightBottom, nColor, 1)) &&
-									SUCCEEDED(hr = m_colorImage->DrawLine(rightBottom, leftBottom, nColor, 1)) &&
-									SUCCEEDED(hr = m_colorImage->DrawLine(leftBottom, leftTop, nColor, 1));
-							}
-						}
-
-						_freea(p3DMdl); 
-					}
-					else
-					{
-						hr = E_OUTOFMEMORY;
-					}
-				}
-			}
+		const UINT* pEdges = m_topology->GetEdges();
+		for (UINT i = 0; i < m_topology->GetEdgeCount(); ++i)
+		{
+			m_colorImage->DrawLine(p3DMdl[pEdges[2*i]], p3DMdl[pEdges[2*i+1]], color, 1);
 		}
-		_freea(pPts2D);
+
+		// Render the face rect in magenta
+		const RECT& rectFace = geometry.faceRect;
+		POINT leftTop = {rectFace.left, rectFace.top};
+		POINT rightTop = {rectFace.right - 1, rectFace.top};
+		POINT leftBottom = {rectFace.left, rectFace.bottom - 1};
+		POINT rightBottom = {rectFace.right - 1, rectFace.bottom - 1};
+		UINT32 nColor = 0xff00ff;
+		SUCCEEDED(hr = m_colorImage->DrawLine(leftTop, rightTop, nColor, 1)) &&
+			SUCCEEDED(hr = m_colorImage->DrawLine(rightTop, rightBottom, nColor, 1)) &&
+			SUCCEEDED(hr = m_colorImage->DrawLine(rightBottom, leftBottom, nColor, 1)) &&
+			SUCCEEDED(hr = m_colorImage->DrawLine(leftBottom, leftTop, nColor, 1));
+
+		_freea(p3DMdl); 
 	}
 	else
 	{
@@ -715,166 +931,52 @@ void FTHelper::DrawGazeInImage(POINT pos, int radius, UINT32 color)
 	}
 }
 
-void FTHelper::SaveModel(IFTModel* model, const float* pSUs, UINT32 suCount, const float* pAUs, UINT32 auCount, float scale, const float* rotationXYZ, const float* translationXYZ, int count)
+bool FTHelper::MapImagePointToFace(float x, float y, FT_VECTOR3D& point)
 {
-	UINT32 vertexCount = model->GetVertexCount();//model->GetVertexCount(); 
-	FT_VECTOR3D* pVertices = new FT_VECTOR3D[vertexCount]; 
-	model->Get3DShape(pSUs, suCount, pAUs, auCount, scale, rotationXYZ, translationXYZ, pVertices, vertexCount); 
-	UINT32 triangleCount = 0; 
-	FT_TRIANGLE* pTriangles = NULL; 
-	model->GetTriangles(&pTriangles, &triangleCount); 
-	FILE* fobj = NULL; 
-	char filename[10];
-	sprintf_s(filename, "%d", count);
-	strcat(filename, ".obj");
-	fopen_s(&fobj, filename, "w"); 
-	fprintf(fobj, "# %u vertices, # %u faces\n", vertexCount, triangleCount); 
-	for (UINT32 vi = 0; vi < vertexCount; ++vi) { 
-		fprintf(fobj, "v %f %f %f\n", pVertices[vi].x, pVertices[vi].y, pVertices[vi].z);
-	} 
-	fprintf(fobj, "v %f %f %f\n", m_leftPupil.x+0.05, m_leftPupil.y, m_leftPupil.z);
-	fprintf(fobj, "v %f %f %f\n", m_leftPupil.x-0.05, m_leftPupil.y, m_leftPupil.z);
-	fprintf(fobj, "v %f %f %f\n", m_leftPupil.x, m_leftPupil.y+0.08, m_leftPupil.z);
-	fprintf(fobj, "v %f %f %f\n", m_rightPupil.x+0.05, m_rightPupil.y, m_rightPupil.z);
-	fprintf(fobj, "v %f %f %f\n", m_rightPupil.x-0.05, m_rightPupil.y, m_rightPupil.z);
-	fprintf(fobj, "v %f %f %f\n", m_rightPupil.x, m_rightPupil.y+0.08, m_rightPupil.z);
-	for (UINT32 ti = 0; ti < triangleCount; ++ti) { 
-		fprintf(fobj, "f %d %d %d\n", pTriangles[ti].i+1, pTriangles[ti].j+1, pTriangles[ti].k+1); 
-	} 
-	fprintf(fobj, "f %d %d %d\n", vertexCount+1, vertexCount+2, vertexCount+3);
-	fprintf(fobj, "f %d %d %d\n", vertexCount+4, vertexCount+5, vertexCount+6);
-	fclose(fobj); 
-	delete[] pVertices; 
-	return; 
+	SurfaceHit hit;
+	if (!m_surfaceIndex.query(x, y, hit))
+	{
+		return false;
+	}
+	point = FaceSurfaceIndex::interpolate(hit, m_topology->GetTriangles(), m_geometry.pts3D);
+	return true;
 }
 
 void FTHelper::Map2Dto3D()
 {
-	cv::Point left = m_gazeTrack->getLeftPupil();
-	cv::Point right = m_gazeTrack->getRightPupil();
-	//m_gazeTrack->getLeftPupilXY(leftPupil.x, leftPupil.y);
-	//m_gazeTrack->getRightPupilXY(rightPupil.x, rightPupil.y);
-
-	//int triangles[][3] = {{70,54,71}, {71,74,70}, {75,74,71}, {75,57,74}, {69,21,68}, {69,68,73}, {73,68,72}, {72,24,73}};
-	int triangles[] = FACETRIANGLESINDEXARRAY;
-	POINT pupil[2];
-	pupil[0].x = left.x;
-	pupil[0].y = left.y;
-	pupil[1].x = right.x;
-	pupil[1].y = right.y;
-	
-	bool flags[2] = {false, false};
-	FT_VECTOR3D tmpPupil[2];
-
-	int halflen = sizeof(triangles)/6/sizeof(triangles[0]);
-	//m_pupilR = (PointDis(70, 75)+PointDis(71,74)+PointDis(68,73)+PointDis(69,72))/64;
-
-	/*if(ISFTVECTOR3DZERO(m_leftPupil))
-	{
-		FT_VECTOR3D mapP = util::TIMES(util::PLUS(m_pPts3D[70], m_pPts3D[73]), 0.5);
-		FT_VECTOR3D n = util::Normal(m_pPts3D[70], m_pPts3D[73], m_pPts3D[69]);
-		m_leftPupil = util::PLUS(mapP, util::TIMES(n,-m_pupilR));
-	}
-	if(ISFTVECTOR3DZERO(m_rightPupil))
-	{
-		FT_VECTOR3D mapP = util::TIMES(util::PLUS(m_pPts3D[67], m_pPts3D[72]), 0.5);
-		FT_VECTOR3D n = util::Normal(m_pPts3D[68], m_pPts3D[67], m_pPts3D[72]);
-		m_rightPupil = util::PLUS(mapP, util::TIMES(n,-m_pupilR));
-	}*/
+	cv::Point pupil[2] = {m_gazeResult.leftPupil, m_gazeResult.rightPupil};
+	FT_VECTOR3D* mapped[2] = {&m_leftPupil, &m_rightPupil};
 
 	for(int index = 0; index < 2; index++)
 	{
-		for(int i = index*halflen; i < halflen*(index+1); i++)
+		SurfaceHit hit;
+		if(m_surfaceIndex.query((float)pupil[index].x, (float)pupil[index].y, hit))
 		{
-			POINT p[3];
-			FT_VECTOR3D q[3];
-			float x, y;
-			for(int j = 0; j < 3; j++)
-			{
-				p[j] = util::FloatToPOINT(m_pPts2D[triangles[i*3+j]].x, m_pPts2D[triangles[i*3+j]].y);
-				q[j] = m_pPts3D[triangles[i*3+j]];
-			}
-			//POINT a = util::FloatToPOINT(m_pPts2D[triangles[i*3]].x, m_pPts2D[triangles[i*3]].y);
-			//POINT b = util::FloatToPOINT();
-			//if(util::PointinTriangle())
-			if(util::PointinTriangle(pupil[index], p, 0))
-			{
-				FT_VECTOR3D mapP = util::triangleMap(pupil[index], p, q, x, y);
-				FT_VECTOR3D n = util::Normal(q);
-				//FT_VECTOR3D center(mapP.x+n.x, mapP.y+n.y, mapP.z+n.z);
-#ifdef _DEBUG
-				std::cout << "x:" << x << "\ty:" << y << std::endl;
-#endif // _DEBUG
-
-				m_gazeLastState[index].set(x, y, triangles[i*3], triangles[i*3+1], triangles[i*3+2]);
-				tmpPupil[index] = util::PLUS(mapP, util::TIMES(n, -m_pupilR));
-				std::cout << "index:" << tmpPupil[index].x << ' ' << tmpPupil[index].y << ' ' << tmpPupil[2].z << std::endl;
- 				/*tmpPupil[index].x = center.x+n.x*m_pupilR;
-				tmpPupil[index].y = center.y+n.y*m_pupilR;
-				tmpPupil[index].z = center.z+n.z*m_pupilR;*/
-				flags[index] = true;
-				break;
-			}
+			const FT_TRIANGLE& tri = m_topology->GetTriangles()[hit.triangle];
+			FT_VECTOR3D q[3] = {m_geometry.pts3D[tri.i], m_geometry.pts3D[tri.j], m_geometry.pts3D[tri.k]};
+			FT_VECTOR3D n = util::Normal(q);
+
+			m_gazeLastState[index].set(hit.u, hit.v, tri.i, tri.j, tri.k);
+			*mapped[index] = util::PLUS(FaceSurfaceIndex::interpolate(hit, m_topology->GetTriangles(), m_geometry.pts3D), util::TIMES(n, -m_pupilR));
+		}
+		else
+		{
+			// off the mesh for this frame, keep the last surface position
+			GetPupilFromLastState(*mapped[index], m_gazeLastState[index]);
 		}
 	}
-	if(flags[0])
-	{
-#ifdef _DEBUG
-		std::cout << "Map2Dto3D(): left is OK" << std::endl;
-#endif
-		m_leftPupil = tmpPupil[0];
-	}
-	else
-	{
-		//TODO
-		/*m_leftPupil.x = tmpPupil[0].x;
-		m_leftPupil.y = tmpPupil[0].y;
-		m_leftPupil.z = tmpPupil[0].z;*/
-		GetPupilFromLastState(m_leftPupil, m_gazeLastState[0]);
-	}
-	if(flags[1])
-	{
-#ifdef _DEBUG
-		std::cout << "Map2Dto3D(): right is OK" << std::endl;
-#endif
-		m_rightPupil = tmpPupil[1];
-	}
-	else
-	{
-		//TODO
-		/*m_rightPupil.x = tmpPupil[0].x;
-		m_rightPupil.y = tmpPupil[0].y;
-		m_rightPupil.z = tmpPupil[0].z;*/
-		GetPupilFromLastState(m_rightPupil, m_gazeLastState[1]);
-	}
-#ifdef _DEBUG
-	if(flags[0] || flags[1])
-	{
-		getchar();
-		std::cout << "Map2Dto3D(): left gaze:" << m_gazeTrack->getLeftPupil().x << ' ' << m_gazeTrack->getLeftPupil().y << std::endl;
-		std::cout << "Map2Dto3D(): right gaze:" << m_gazeTrack->getRightPupil().x << ' ' << m_gazeTrack->getRightPupil().y << std::endl;
-		std::cout << "Map2Dto3D(): leftPupil:" << m_leftPupil.x << ' ' << m_leftPupil.y << ' ' << m_leftPupil.z << std::endl;
-		std::cout << "Map2Dto3D(): rightPupil:" << m_rightPupil.x << ' ' << m_rightPupil.y << ' ' << m_rightPupil.z << std::endl;
-		
-		std::cout << m_pPts3D[70-1].x << ' ' << m_pPts3D[70-1].y << ' ' << m_pPts3D[70-1].z << std::endl;
-		std::cout << m_pPts3D[75-1].x << ' ' << m_pPts3D[75-1].y << ' ' << m_pPts3D[75-1].z << std::endl;
-		std::cout << m_pPts3D[74-1].x << ' ' << m_pPts3D[74-1].y << ' ' << m_pPts3D[74-1].z << std::endl;
-		std::cout << m_pPts3D[68-1].x << ' ' << m_pPts3D[68-1].y << ' ' << m_pPts3D[68-1].z << std::endl;
-		std::cout << m_pPts3D[73-1].x << ' ' << m_pPts3D[73-1].y << ' ' << m_pPts3D[73-1].z << std::endl;
-		std::cout << m_pPts3D[72-1].x << ' ' << m_pPts3D[72-1].y << ' ' << m_pPts3D[72-1].z << std::endl;
-		getchar();
-	}
-#endif
+	LOG_TRACE("Map2Dto3D(): leftPupil {} {} {} rightPupil {} {} {}", m_leftPupil.x, m_leftPupil.y, m_leftPupil.z,
+		m_rightPupil.x, m_rightPupil.y, m_rightPupil.z);
 }
 
 float FTHelper::PointDis(int n, int m)
 {
-	return sqrtf((m_pPts3D[n].x-m_pPts3D[m].x)*(m_pPts3D[n].x-m_pPts3D[m].x)+(m_pPts3D[n].y-m_pPts3D[m].y)*(m_pPts3D[n].y-m_pPts3D[m].y)+(m_pPts3D[n].z-m_pPts3D[m].z)*(m_pPts3D[n].z-m_pPts3D[m].z));
+	return sqrtf((m_geometry.pts3D[n].x-m_geometry.pts3D[m].x)*(m_geometry.pts3D[n].x-m_geometry.pts3D[m].x)+(m_geometry.pts3D[n].y-m_geometry.pts3D[m].y)*(m_geometry.pts3D[n].y-m_geometry.pts3D[m].y)+(m_geometry.pts3D[n].z-m_geometry.pts3D[m].z)*(m_geometry.pts3D[n].z-m_geometry.pts3D[m].z));
 }
 
 void FTHelper::GetPupilFromLastState(FT_VECTOR3D& pupil, GaseState& gazeState)
 {
-	pupil.x = m_pPts3D[gazeState.triangle[0]].x+(m_pPts3D[gazeState.triangle[1]].x-m_pPts3D[gazeState.triangle[0]].x)*gazeState.x+(m_pPts3D[gazeState.triangle[2]].x-m_pPts3D[gazeState.triangle[0]].x)*gazeState.y;
-	pupil.y = m_pPts3D[gazeState.triangle[0]].y+(m_pPts3D[gazeState.triangle[1]].y-m_pPts3D[gazeState.triangle[0]].y)*gazeState.x+(m_pPts3D[gazeState.triangle[2]].y-m_pPts3D[gazeState.triangle[0]].y)*gazeState.y;
-	pupil.z = m_pPts3D[gazeState.triangle[0]].z+(m_pPts3D[gazeState.triangle[1]].z-m_pPts3D[gazeState.triangle[0]].z)*gazeState.x+(m_pPts3D[gazeState.triangle[2]].z-m_pPts3D[gazeState.triangle[0]].z)*gazeState.y;
+	pupil.x = m_geometry.pts3D[gazeState.triangle[0]].x+(m_geometry.pts3D[gazeState.triangle[1]].x-m_geometry.pts3D[gazeState.triangle[0]].x)*gazeState.x+(m_geometry.pts3D[gazeState.triangle[2]].x-m_geometry.pts3D[gazeState.triangle[0]].x)*gazeState.y;
+	pupil.y = m_geometry.pts3D[gazeState.triangle[0]].y+(m_geometry.pts3D[gazeState.triangle[1]].y-m_geometry.pts3D[gazeState.triangle[0]].y)*gazeState.x+(m_geometry.pts3D[gazeState.triangle[2]].y-m_geometry.pts3D[gazeState.triangle[0]].y)*gazeState.y;
+	pupil.z = m_geometry.pts3D[gazeState.triangle[0]].z+(m_geometry.pts3D[gazeState.triangle[1]].z-m_geometry.pts3D[gazeState.triangle[0]].z)*gazeState.x+(m_geometry.pts3D[gazeState.triangle[2]].z-m_geometry.pts3D[gazeState.triangle[0]].z)*gazeState.y;
 }
\ No newline at end of file
@@ -9,9 +9,16 @@
 #include "KinectSensor.h"
 
 #include "gazeTracking.h"
-
-#define VERTEXCOUNT 121
-#define TRIANGLECOUNT 206
+#include "faceSurfaceIndex.h"
+#include "faceGeometry.h"
+#include "trackingSnapshot.h"
+#include "seqLock.h"
+#include "resultBus.h"
+#include "trackerStatus.h"
+#include "sharedResultRing.h"
+#include "metricsStore.h"
+#include "frameSource.h"
+#include "frameFile.h"
 
 #define GAZE_TRACKING
 
@@ -22,7 +29,9 @@
 #define min(a,b)    (((a) < (b)) ? (a) : (b))
 #endif
 
-typedef void (*FTHelperCallBack)(PVOID lpParam);
+typedef ResultBus<TrackingSnapshot> TrackingResultBus;
+// runs on a bus thread of its own, never on the tracking thread
+typedef TrackingResultBus::CallBack FTHelperCallBack;
 
 struct GaseState{
 	inline void set(float ox, float oy, int t0, int t1, int t2)
@@ -47,32 +56,69 @@ public:
     HRESULT Init(HWND hWnd, FTHelperCallBack callBack, PVOID callBackParam, 
         NUI_IMAGE_TYPE depthType, NUI_IMAGE_RESOLUTION depthRes, BOOL bNearMode, BOOL bFallbackToDefault, NUI_IMAGE_TYPE colorType, NUI_IMAGE_RESOLUTION colorRes, BOOL bSeatedSkeletonMode);
     HRESULT Stop();
+    // TRACKER_RUNNING once the sensor and tracker are up; an error status
+    // means the tracking thread has ended, GetLastHResult() has the details
+    TrackerStatus GetStatus() const { return(m_status);}
+    HRESULT GetLastHResult() const  { return(m_lastHr);}
     IFTResult* GetResult()      { return(m_pFTResult);}
-    BOOL IsKinectPresent()      { return(m_KinectSensorPresent);}
-    IFTImage* GetColorImage()   { return(m_colorImage);}
-    float GetXCenterFace()      { return(m_XCenterFace);}
-    float GetYCenterFace()      { return(m_YCenterFace);}
+    BOOL IsKinectPresent()      { return(m_SourcePresent);}
+    // Copies the last finished video frame, mask drawn, into target, which
+    // is allocated to its size as B8G8R8A8, with the zoom centre that goes
+    // with it. Safe from any thread; FALSE until the first frame.
+    BOOL CopyVideoFrame(IFTImage* target, float* centerX, float* centerY);
     void SetDrawMask(BOOL drawMask) { m_DrawMask = drawMask;}
     BOOL GetDrawMask()          { return(m_DrawMask);}
     IFTFaceTracker* GetTracker() { return(m_pFaceTracker);}
     HRESULT GetCameraConfig(FT_CAMERA_CONFIG* cameraConfig);
-
-	RECT& GetFaceRect()			{return m_faceRect;}
-
-	FT_VECTOR3D* GetVertices()	{return m_pPts3D;}
-	FT_TRIANGLE* GetTriangles() {return m_pTriangles;}
-	int GetVertexNum()			{return VERTEXCOUNT;}
-	int GetTriangleNum()		{return TRIANGLECOUNT;}
-
+	// number of camera frames processed so far, for the UI to poll
+	LONG GetFrameCount() const	{return m_frameCount;}
+
+	const RECT& GetFaceRect()	{return m_geometry.faceRect;}
+
+	// Consistent copy of the last published frame, safe from any thread and
+	// never blocks the tracker. False only if the tracker kept overwriting it.
+	bool GetSnapshot(TrackingSnapshot& snapshot) const	{return m_published.read(snapshot);}
+
+	// Every tracked frame is published here. Init() subscribes its callback
+	// latest-wins; recorders and the like can add lossless subscribers.
+	TrackingResultBus& GetResultBus()	{return m_resultBus;}
+	int GetCallBackSubscriber()	{return m_callBackSubscriber;}
+
+	// Also publishes every frame to other processes through the named shared
+	// memory ring (see SharedResultReader). Call before Init().
+	bool OpenSharedRing(const std::string& name, UINT capacity = 256);
+	// Appends pose, AUs, face rect and pupils of every frame, lost ones
+	// included, to a column store (see MetricsStore). Call before Init(),
+	// Stop() closes the file.
+	bool OpenMetrics(const std::string& path);
+	const MetricsWriter& GetMetrics() const	{return m_metrics;}
+
+	// Frames come from source instead of the Kinect (see createFrameSource).
+	// Takes ownership; call before Init().
+	void SetFrameSource(FrameSource* source);
+	// Writes every frame the tracker reads to a frame file that can be played
+	// back later. Call before Init(), Stop() closes the file.
+	bool RecordFrames(const std::string& path);
+	const FrameFileWriter& GetFrameRecorder() const	{return m_frameRecorder;}
+
+	// The members below are written in place by the tracking thread and are
+	// only safe to use on that thread.
 	bool isSuccessful()			{return m_LastTrackSucceeded;}
-	float GetPupilR()			{return m_pupilR;}
+	// maps a colour image point onto the face mesh of the last tracked frame
+	bool MapImagePointToFace(float x, float y, FT_VECTOR3D& point);
 
-	FT_VECTOR3D& GetLeftPupil()	{return m_leftPupil;}
-	FT_VECTOR3D& GetRightPupil(){return m_rightPupil;}
+#ifdef GAZE_TRACKING
+	// ms from Init() to the first frame with a gaze result, negative until then
+	double GetFirstGazeMs()		{return m_firstGazeMs;}
+#endif
 
 private:
-    KinectSensor                m_KinectSensor;
-    BOOL                        m_KinectSensorPresent;
+    FrameSource*                m_source;
+    BOOL                        m_SourcePresent;
+    FrameSourceConfig           m_sourceConfig;
+    FT_CAMERA_CONFIG            m_videoConfig;
+    std::string                 m_frameRecordPath;
+    FrameFileWriter             m_frameRecorder;
     IFTFaceTracker*             m_pFaceTracker;
     HWND                        m_hWnd;
     IFTResult*                  m_pFTResult;
@@ -81,8 +127,8 @@ private:
     FT_VECTOR3D                 m_hint3D[2];
     bool                        m_LastTrackSucceeded;
     bool                        m_ApplicationIsRunning;
-    FTHelperCallBack            m_CallBack;
-    LPVOID                      m_CallBackParam;
+    TrackingResultBus           m_resultBus;
+    int                         m_callBackSubscriber;
     float                       m_XCenterFace;
     float                       m_YCenterFace;
     HANDLE                      m_hFaceTrackingThread;
@@ -94,33 +140,54 @@ private:
     BOOL                        m_bSeatedSkeletonMode;
     NUI_IMAGE_TYPE              m_colorType;
     NUI_IMAGE_RESOLUTION        m_colorRes;
+    volatile LONG               m_frameCount;
+    volatile TrackerStatus      m_status;
+    HRESULT                     m_lastHr;
 
 #ifdef GAZE_TRACKING
 	GazeTracking*				m_gazeTrack;
+	GazeResult					m_gazeResult;
+	GazeScratch					m_gazeScratch;
+	int64						m_initTicks;
+	double						m_firstGazeMs;
 #endif
-	RECT						m_faceRect;
-	FT_VECTOR3D					m_pPts3D[VERTEXCOUNT];
-	FT_VECTOR2D					m_pPts2D[VERTEXCOUNT];
-	FT_TRIANGLE*				m_pTriangles;
-	UINT						m_TriangleCount;
+	FaceGeometry				m_geometry;
+	const FaceTopology*			m_topology;
+	UINT						m_frameId;			// of the pass CheckCameraInput is in
+	bool						m_geometryFresh;	// m_geometry was computed in this pass
 	FT_VECTOR3D					m_leftPupil;
 	FT_VECTOR3D					m_rightPupil;
 	float						m_pupilR;
 	GaseState					m_gazeLastState[2];
+	FaceSurfaceIndex			m_surfaceIndex;
+	TrackingSnapshot			m_pending;
+	SeqLock<TrackingSnapshot>	m_published;
+	// the finished frame for the window, m_colorImage is rewritten meanwhile
+	CRITICAL_SECTION			m_videoLock;
+	IFTImage*					m_videoFrame;
+	float						m_videoCenterX;
+	float						m_videoCenterY;
+	SharedResultRing			m_sharedRing;
+	SharedTrackingRecord		m_sharedRecord;
+	MetricsWriter				m_metrics;
 
     BOOL SubmitFraceTrackingResult(IFTResult* pResult);
     void SetCenterOfImage(IFTResult* pResult);
-    void CheckCameraInput();
+    bool CheckCameraInput();
+    void PublishSnapshot();
+    void PublishVideoFrame();
+    void AppendMetrics();
+    DWORD ReportError(TrackerStatus status, HRESULT hr, LPCWSTR text);
     DWORD WINAPI FaceTrackingThread();
     static DWORD WINAPI FaceTrackingStaticThread(PVOID lpParam);
+    void ReleaseTracking();
 
 	void GetVerticesPosition(IFTModel* ftModel);
 
 	//visualization
 	HRESULT VisualizeFacetracker(UINT32 color);
-	HRESULT VisualizeFaceModel(IFTModel* pModel, FT_CAMERA_CONFIG const* pCameraConfig, FLOAT const* pSUCoef, FLOAT zoomFactor, POINT viewOffset, UINT32 color);
+	HRESULT VisualizeFaceModel(const FaceGeometry& geometry, UINT32 color);
 	void DrawGazeInImage(POINT pos, int radius, UINT32 color);
-	void SaveModel(IFTModel* model, const float* pSUs, UINT32 suCount, const float* pAUs, UINT32 auCount, float scale, const float* rotationXYZ, const float* translationXYZ, int count);
 
 	void Map2Dto3D();
 	float PointDis(int n, int m);
@@ -47,9 +47,75 @@ public:
 		wglMakeCurrent( mhDC, mhRC );
 	}
 
+	// Renders into a DIB instead of a window, for running without a display.
+	// This gets the GDI software implementation (GL 1.1, single buffered).
+	bool initOffscreen(int width, int height)
+	{
+		purge();
+
+		mhDC = CreateCompatibleDC( NULL );
+		if ( !mhDC )
+		{
+			return false;
+		}
+
+		BITMAPINFO bmi;
+		ZeroMemory( &bmi, sizeof( bmi ) );
+		bmi.bmiHeader.biSize = sizeof( BITMAPINFOHEADER );
+		bmi.bmiHeader.biWidth = width;
+		bmi.bmiHeader.biHeight = height;
+		bmi.bmiHeader.biPlanes = 1;
+		bmi.bmiHeader.biBitCount = 32;
+		bmi.bmiHeader.biCompression = BI_RGB;
+		mhBitmap = CreateDIBSection( mhDC, &bmi, DIB_RGB_COLORS, &mBits, NULL, 0 );
+		if ( !mhBitmap )
+		{
+			purge();
+			return false;
+		}
+		mhOldBitmap = (HBITMAP)SelectObject( mhDC, mhBitmap );
+
+		PIXELFORMATDESCRIPTOR pfd;
+		ZeroMemory( &pfd, sizeof( pfd ) );
+		pfd.nSize = sizeof( pfd );
+		pfd.nVersion = 1;
+		pfd.dwFlags = PFD_DRAW_TO_BITMAP | PFD_SUPPORT_OPENGL | PFD_SUPPORT_GDI;
+		pfd.iPixelType = PFD_TYPE_RGBA;
+		pfd.cColorBits = 32;
+		pfd.cDepthBits = 16;
+		pfd.iLayerType = PFD_MAIN_PLANE;
+		int format = ChoosePixelFormat( mhDC, &pfd );
+		if ( !format || !SetPixelFormat( mhDC, format, &pfd ) )
+		{
+			purge();
+			return false;
+		}
+
+		mhRC = wglCreateContext( mhDC );
+		if ( !mhRC || !wglMakeCurrent( mhDC, mhRC ) )
+		{
+			purge();
+			return false;
+		}
+		return true;
+	}
+
+	// BGRA pixels of the offscreen target, bottom row first; NULL for a window
+	const void* getPixels() const {return mBits;}
+
 	void Stop(){purge();}
 
-	void SwapBuffer(){SwapBuffers(mhDC);}
+	void SwapBuffer()
+	{
+		if ( mhBitmap )
+		{
+			glFinish();
+		}
+		else
+		{
+			SwapBuffers(mhDC);
+		}
+	}
 
 private:
 
@@ -64,6 +130,15 @@ private:
 		{
 			ReleaseDC( mhWnd, mhDC );
 		}
+		if ( mhBitmap )
+		{
+			SelectObject( mhDC, mhOldBitmap );
+			DeleteObject( mhBitmap );
+		}
+		if ( !mhWnd && mhDC )
+		{
+			DeleteDC( mhDC );
+		}
 		reset();
 	}
 
@@ -72,11 +147,17 @@ private:
 		mhWnd = NULL;
 		mhDC = NULL;
 		mhRC = NULL;
+		mhBitmap = NULL;
+		mhOldBitmap = NULL;
+		mBits = NULL;
 	}
 
 	HWND mhWnd;
 	HDC mhDC;
 	HGLRC mhRC;
+	HBITMAP mhBitmap;
+	HBITMAP mhOldBitmap;
+	void* mBits;
 
 };
 
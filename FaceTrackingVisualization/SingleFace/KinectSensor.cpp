@@ -6,6 +6,8 @@
 
 #include "StdAfx.h"
 #include "KinectSensor.h"
+#include "stageStats.h"
+#include "pipelineTrace.h"
 #include <math.h>
 
 
@@ -285,6 +287,7 @@ DWORD WINAPI KinectSensor::ProcessThread(LPVOID pParam)
     hEvents[1]=pthis->m_hNextDepthFrameEvent;
     hEvents[2]=pthis->m_hNextVideoFrameEvent;
     hEvents[3]=pthis->m_hNextSkeletonEvent;
+    PipelineTrace::setThreadName("sensor");
 
     // Main thread loop
     while (true)
@@ -301,17 +304,23 @@ DWORD WINAPI KinectSensor::ProcessThread(LPVOID pParam)
         // Process signal events
         if (WAIT_OBJECT_0 == WaitForSingleObject(pthis->m_hNextDepthFrameEvent, 0))
         {
+            STAGE_TIMER(STAGE_SENSOR_DEPTH);
             pthis->GotDepthAlert();
-            pthis->m_FramesTotal++;
+            InterlockedIncrement(&pthis->m_FramesTotal);
+            STAGE_COUNTER(COUNTER_SENSOR_DEPTH);
         }
         if (WAIT_OBJECT_0 == WaitForSingleObject(pthis->m_hNextVideoFrameEvent, 0))
         {
+            STAGE_TIMER(STAGE_SENSOR_COLOR);
             pthis->GotVideoAlert();
+            STAGE_COUNTER(COUNTER_SENSOR_COLOR);
         }
         if (WAIT_OBJECT_0 == WaitForSingleObject(pthis->m_hNextSkeletonEvent, 0))
         {
+            STAGE_TIMER(STAGE_SENSOR_SKELETON);
             pthis->GotSkeletonAlert();
-            pthis->m_SkeletonTotal++;
+            InterlockedIncrement(&pthis->m_SkeletonTotal);
+            STAGE_COUNTER(COUNTER_SENSOR_SKELETON);
         }
     }
 
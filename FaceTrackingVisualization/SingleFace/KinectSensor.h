@@ -26,6 +26,9 @@ public:
     float       GetZoomFactor() { return(m_ZoomFactor); };
     POINT*      GetViewOffSet() { return(&m_ViewOffset); };
     HRESULT     GetClosestHint(FT_VECTOR3D* pHint3D);
+    // depth and skeleton frames received since Init(), safe from any thread
+    LONG        GetFramesTotal() const { return(m_FramesTotal); };
+    LONG        GetSkeletonTotal() const { return(m_SkeletonTotal); };
 
     bool        IsTracked(UINT skeletonId) { return(m_SkeletonTracked[skeletonId]);};
     FT_VECTOR3D NeckPoint(UINT skeletonId) { return(m_NeckPoint[skeletonId]);};
@@ -49,8 +52,8 @@ private:
     HANDLE      m_hEvNuiProcessStop;
 
     bool        m_bNuiInitialized; 
-    int         m_FramesTotal;
-    int         m_SkeletonTotal;
+    volatile LONG m_FramesTotal;
+    volatile LONG m_SkeletonTotal;
     
     static DWORD WINAPI ProcessThread(PVOID pParam);
     void GotVideoAlert();
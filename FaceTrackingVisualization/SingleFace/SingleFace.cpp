@@ -13,8 +13,15 @@
 #include <FaceTrackLib.h>
 #include "FTHelper.h"
 #include "GLContext.h"
+#include "faceMeshRenderer.h"
+#include "asyncLog.h"
+#include "sessionRecorder.h"
+#include "meshSequence.h"
+#include "stageStats.h"
+#include "pipelineTrace.h"
 
-#include <iostream>
+#include <vector>
+#include <math.h>
 
 #define USEOPENGL
 
@@ -43,7 +50,17 @@ public:
 		, m_colorRes(NUI_IMAGE_RESOLUTION_1280x960)
         , m_bNearMode(TRUE)
         , m_bSeatedSkeletonMode(FALSE)
-    {}
+        , m_renderBenchmarkFrames(0)
+        , m_statsIntervalMs(0)
+        , m_paintedFrame(-1)
+    {
+        InitializeCriticalSection(&m_avatarLock);
+    }
+
+    ~SingleFace()
+    {
+        DeleteCriticalSection(&m_avatarLock);
+    }
 
     int Run(HINSTANCE hInst, PWSTR lpCmdLine, int nCmdShow);
 
@@ -64,17 +81,27 @@ protected:
 	void						ReSizeGLScene(GLsizei width, GLsizei height);
 	void						InitGL();
 	void						DrawGLScene();
+	void						RenderFaceScene(const FaceTopology* topology, const FT_VECTOR3D* vertices, UINT vertexCount,
+									const FT_VECTOR3D& leftPupil, const FT_VECTOR3D& rightPupil, float pupilR);
+	int							RunRenderBenchmark(int frames);
 
 	GLContext					m_GLContext;
+	FaceMeshRenderer			m_meshRenderer;
+	TrackingSnapshot			m_drawSnapshot;
 #endif	
 
-	static void                 FTHelperCallingBack(LPVOID lpParam);
+	static void                 FTHelperCallingBack(LPVOID lpParam, const TrackingResultBus::ResultPtr& result);
     static int const            MaxLoadStringChars = 100;
+    static UINT_PTR const       RenderTimerId = 1;
+    static UINT const           RenderIntervalMs = 16;
 
     HINSTANCE                   m_hInst;
     HWND                        m_hWnd;
     HACCEL                      m_hAccelTable;
     EggAvatar                   m_eggavatar;
+    // newest result from the bus thread, applied to the avatar on paint
+    CRITICAL_SECTION            m_avatarLock;
+    TrackingResultBus::ResultPtr m_latestResult;
     FTHelper                    m_FTHelper;
     IFTImage*                   m_pImageBuffer;
     IFTImage*                   m_pVideoBuffer;
@@ -87,24 +114,54 @@ protected:
     NUI_IMAGE_RESOLUTION        m_colorRes;
     BOOL                        m_bNearMode;
     BOOL                        m_bSeatedSkeletonMode;
+    int                         m_renderBenchmarkFrames;
+    std::string                 m_sharedRingName;
+    std::string                 m_recordPath;
+    SessionRecorder             m_recorder;
+    std::string                 m_meshSequencePath;
+    MeshSequenceWriter          m_meshSequence;
+    std::string                 m_metricsPath;
+    std::string                 m_sourceSpec;
+    std::string                 m_frameRecordPath;
+    std::string                 m_tracePath;
+    DWORD                       m_statsIntervalMs;
+    LONG                        m_paintedFrame;
 };
 
 #ifdef USEOPENGL
 void SingleFace::DrawGLScene()
 {
-#ifdef GAZE_TRACKING
-	//std::cout << "Draw:" << m_FTHelper.isSuccessful() << std::endl;
-	if(m_FTHelper.isSuccessful())
-		std::cout << "DrawGLScene(): True" << std::endl;
+	// the tracking thread keeps writing, draw from a consistent copy; the
+	// topology is only known once the tracker has produced a face
+	if(!m_FTHelper.GetSnapshot(m_drawSnapshot) || !m_drawSnapshot.topology || !m_drawSnapshot.geometry.valid)
+	{
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		return;
+	}
+
+	const TrackingSnapshot& snapshot = m_drawSnapshot;
+	RenderFaceScene(snapshot.topology, snapshot.geometry.pts3D, snapshot.topology->GetVertexCount(),
+		snapshot.leftPupil, snapshot.rightPupil, snapshot.pupilR);
+
+	if(m_meshRenderer.getFrameCount() == 300)
+	{
+		LOG_DEBUG("DrawGLScene(): {} avg {} ms max {} ms", m_meshRenderer.usesVertexBuffers() ? "VBO" : "vertex arrays",
+			m_meshRenderer.getAverageFrameMs(), m_meshRenderer.getMaxFrameMs());
+		m_meshRenderer.resetStats();
+	}
+}
+
+void SingleFace::RenderFaceScene(const FaceTopology* topology, const FT_VECTOR3D* vertices, UINT vertexCount,
+	const FT_VECTOR3D& leftPupil, const FT_VECTOR3D& rightPupil, float pupilR)
+{
+	m_meshRenderer.beginFrame();
 
 	GLfloat pos[3];
-	pos[0] = (m_FTHelper.GetVertices()[73].x+m_FTHelper.GetVertices()[70].x)*0.5;
-	pos[1] = (m_FTHelper.GetVertices()[73].y+m_FTHelper.GetVertices()[70].y)*0.5;
-	pos[2] = (m_FTHelper.GetVertices()[73].z+m_FTHelper.GetVertices()[70].z)*0.5;
+	pos[0] = (vertices[73].x+vertices[70].x)*0.5f;
+	pos[1] = (vertices[73].y+vertices[70].y)*0.5f;
+	pos[2] = (vertices[73].z+vertices[70].z)*0.5f;
 
-#endif
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);         // Clear The Screen And The Depth Buffer
-	//glLoadIdentity();                           // Reset The Current Modelview Matrix
 
 	glMatrixMode(GL_PROJECTION);                        // Select The Projection Matrix
 	glLoadIdentity();                           // Reset The Projection Matrix
@@ -114,91 +171,96 @@ void SingleFace::DrawGLScene()
 
 	glMatrixMode(GL_MODELVIEW);                     // Select The Modelview Matrix
 	glLoadIdentity();                           // Reset The Modelview Matrix
-	//gluLookAt(0, 0, -1, 0, 0, 0, 0, 1, 0);
-	//gluLookAt(0, 0, -3, 0.059938, -0.240880, 1.064333, 0, 1, 0);
 	gluLookAt(pos[0], pos[1], pos[2]+0.03, pos[0], pos[1], pos[2], 0, 1, 0);
 
-	GLint* triangles;
-	if(sizeof(GLint)*3 == sizeof(FT_TRIANGLE))
-		triangles = (GLint*)m_FTHelper.GetTriangles();
-	else
+	m_meshRenderer.setTopology(topology);
+
+	glPushMatrix();
+	glColor3f(0.0, 1.0, 0.0);
+	m_meshRenderer.drawMesh(vertices, vertexCount);
+
+	glColor3f(0.0, 0.0, 1.0);
+	m_meshRenderer.drawSphere(rightPupil, pupilR);
+
+	glColor3f(1.0, 0.0, 0.0);
+	m_meshRenderer.drawSphere(leftPupil, pupilR);
+
+	glPopMatrix();
+
+	// includes the driver's work, not only the submission
+	glFinish();
+	m_meshRenderer.endFrame();
+}
+
+// -RenderBenchmark[:frames] draws the neutral face model into an offscreen
+// software context and prints the frame times, no sensor or window needed.
+int SingleFace::RunRenderBenchmark(int frames)
+{
+#ifndef _DEBUG
+	if (AttachConsole(ATTACH_PARENT_PROCESS) || AllocConsole())
 	{
-		triangles = new GLint[m_FTHelper.GetTriangleNum()*3];
-		for(int i = 0 ; i < m_FTHelper.GetTriangleNum(); i++)
-		{
-			triangles[3*i] = m_FTHelper.GetTriangles()[i].i;
-			triangles[3*i+1] = m_FTHelper.GetTriangles()[i].j;
-			triangles[3*i+2] = m_FTHelper.GetTriangles()[i].k;
-		}
+		FILE* out = NULL;
+		freopen_s(&out, "CONOUT$", "w", stdout);
 	}
+#endif
 
-	GLfloat* vertices;
-	if(sizeof(GLfloat)*3 == sizeof(FT_VECTOR3D))
-		vertices = (GLfloat*)m_FTHelper.GetVertices();
-	else
+	const int size = 800;
+	IFTFaceTracker* tracker = FTCreateFaceTracker();
+	IFTModel* model = NULL;
+	FT_CAMERA_CONFIG videoConfig = {640, 480, NUI_CAMERA_COLOR_NOMINAL_FOCAL_LENGTH_IN_PIXELS};
+	FT_CAMERA_CONFIG depthConfig = {320, 240, NUI_CAMERA_DEPTH_NOMINAL_FOCAL_LENGTH_IN_PIXELS};
+	if (!tracker || FAILED(tracker->Initialize(&videoConfig, &depthConfig, NULL, NULL)) || FAILED(tracker->GetFaceModel(&model)))
 	{
-		vertices = new GLfloat[m_FTHelper.GetTriangleNum()*3];
-		for(int i = 0; i < m_FTHelper.GetVertexNum(); i++)
+		printf("RenderBenchmark: cannot create the face model\n");
+		if (tracker)
 		{
-			vertices[3*i] = m_FTHelper.GetVertices()[i].x;
-			vertices[3*i+1] = m_FTHelper.GetVertices()[i].y;
-			vertices[3*i+2] = m_FTHelper.GetVertices()[i].z;
+			tracker->Release();
 		}
+		return 1;
 	}
 
-	glPushMatrix();
-	glColor3f(0.0, 1.0, 0.0);
-	//glScalef(5.0, 5.0, 5.0);
-	//glTranslatef(0.0, 0, -1.3);
-	
-	
-
-	//glTranslatef(0, 0, -10);
-	//glScalef(20, 20, 20);
-	//glEnableClientState(GL_VERTEX_ARRAY);
-	//glVertexPointer(3, GL_FLOAT, 3*sizeof(GLfloat), verteices);
-	//glDrawElements(GL_TRIANGLES, 3, GL_INT, triangles);
-	//glDisableClientState(GL_VERTEX_ARRAY);
-
-	glBegin(GL_LINES);
-	for(int i = 0; i < 206; i++)
+	const FaceTopology* topology = FaceTopology::Get(model);
+	std::vector<FLOAT> su(model->GetSUCount(), 0.0f);
+	std::vector<FLOAT> au(model->GetAUCount(), 0.0f);
+	FLOAT rotation[3] = {0, 0, 0};
+	FLOAT translation[3] = {0, 0, 0.5f};
+	UINT vertexCount = model->GetVertexCount();
+	std::vector<FT_VECTOR3D> neutral(vertexCount), vertices(vertexCount);
+	HRESULT hr = topology ? model->Get3DShape(su.empty() ? NULL : &su[0], (UINT)su.size(), au.empty() ? NULL : &au[0], (UINT)au.size(),
+		1.0f, rotation, translation, &neutral[0], vertexCount) : E_FAIL;
+	model->Release();
+	tracker->Release();
+
+	if (FAILED(hr) || !m_GLContext.initOffscreen(size, size))
 	{
-		glVertex3f(vertices[triangles[i*3]*3], vertices[triangles[i*3]*3+1], vertices[triangles[i*3]*3+2]);
-		glVertex3f(vertices[triangles[i*3+1]*3], vertices[triangles[i*3+1]*3+1], vertices[triangles[i*3+1]*3+2]);
-
-		glVertex3f(vertices[triangles[i*3]*3], vertices[triangles[i*3]*3+1], vertices[triangles[i*3]*3+2]);
-		glVertex3f(vertices[triangles[i*3+2]*3], vertices[triangles[i*3+2]*3+1], vertices[triangles[i*3+2]*3+2]);
-
-		glVertex3f(vertices[triangles[i*3+1]*3], vertices[triangles[i*3+1]*3+1], vertices[triangles[i*3+1]*3+2]);
-		glVertex3f(vertices[triangles[i*3+2]*3], vertices[triangles[i*3+2]*3+1], vertices[triangles[i*3+2]*3+2]);
+		printf("RenderBenchmark: cannot set up the offscreen context\n");
+		return 1;
 	}
-	glEnd();
-
+	InitGL();
+	ReSizeGLScene(size, size);
+	m_meshRenderer.init();
 
-	glColor3f(0.0, 0.0, 1.0);
-	glPushMatrix();
-	//glTranslatef(vertices[210], vertices[211], vertices[212]);
-	glTranslatef(m_FTHelper.GetRightPupil().x, m_FTHelper.GetRightPupil().y, m_FTHelper.GetRightPupil().z);
-#ifdef _DEBUG
-	//std::cout << "DrawGLScene(): vert::" << vertices[210] << ' ' << vertices[211] << ' ' << vertices[212] << std::endl;
-	//std::cout << "DrawGLScene(): Draw:" << m_FTHelper.GetRightPupil().x << ' ' << m_FTHelper.GetRightPupil().y << ' ' << m_FTHelper.GetRightPupil().z << std::endl;
-#endif
-	//glutSolidSphere(m_FTHelper.GetPupilR(), 10, 20);
-	glutWireSphere(m_FTHelper.GetPupilR(), 10, 10);
-	glPopMatrix();
+	for (int frame = 0; frame < frames; ++frame)
+	{
+		// a small head motion, so the vertex stream really changes every frame
+		float dx = 0.005f * sinf(frame * 0.05f);
+		for (UINT i = 0; i < vertexCount; ++i)
+		{
+			vertices[i].x = neutral[i].x + dx;
+			vertices[i].y = neutral[i].y;
+			vertices[i].z = neutral[i].z;
+		}
+		FT_VECTOR3D left((vertices[67].x+vertices[72].x)*0.5f, (vertices[67].y+vertices[72].y)*0.5f, (vertices[67].z+vertices[72].z)*0.5f);
+		FT_VECTOR3D right((vertices[69].x+vertices[74].x)*0.5f, (vertices[69].y+vertices[74].y)*0.5f, (vertices[69].z+vertices[74].z)*0.5f);
+		RenderFaceScene(topology, &vertices[0], vertexCount, left, right, 0.006f);
+	}
 
-	glColor3f(1.0, 0.0, 0.0);
-	glPushMatrix();
-	//glTranslatef(vertices[15], vertices[16], vertices[17]);
-	glTranslatef(m_FTHelper.GetLeftPupil().x, m_FTHelper.GetLeftPupil().y, m_FTHelper.GetLeftPupil().z);
-#ifdef _DEBUG
-	//std::cout << "DrawGLScene(): Draw:" << m_FTHelper.GetLeftPupil().x << ' ' << m_FTHelper.GetLeftPupil().y << ' ' << m_FTHelper.GetLeftPupil().z << std::endl;
-#endif
-	//glutSolidSphere(m_FTHelper.GetPupilR(), 10, 20);
-	glutWireSphere(m_FTHelper.GetPupilR(), 10, 10);
-	glPopMatrix();
+	printf("RenderBenchmark: %u frames, %s, avg %.3f ms, max %.3f ms\n", m_meshRenderer.getFrameCount(),
+		m_meshRenderer.usesVertexBuffers() ? "VBO" : "vertex arrays", m_meshRenderer.getAverageFrameMs(), m_meshRenderer.getMaxFrameMs());
 
-	glPopMatrix();
+	m_meshRenderer.release();
+	m_GLContext.Stop();
+	return 0;
 }
 
 void SingleFace::InitGL()
@@ -230,6 +292,15 @@ void SingleFace::ReSizeGLScene(GLsizei width, GLsizei height)
 int SingleFace::Run(HINSTANCE hInst, PWSTR lpCmdLine, int nCmdShow)
 {
     MSG msg = {static_cast<HWND>(0), static_cast<UINT>(0), static_cast<WPARAM>(-1)};
+
+    ParseCmdString(lpCmdLine);
+#ifdef USEOPENGL
+    if (m_renderBenchmarkFrames > 0)
+    {
+        return RunRenderBenchmark(m_renderBenchmarkFrames);
+    }
+#endif
+
     if (InitInstance(hInst, lpCmdLine, nCmdShow))
     {
         // Main message loop:
@@ -251,8 +322,7 @@ int SingleFace::Run(HINSTANCE hInst, PWSTR lpCmdLine, int nCmdShow)
 BOOL SingleFace::InitInstance(HINSTANCE hInstance, PWSTR lpCmdLine, int nCmdShow)
 {
     m_hInst = hInstance; // Store instance handle in our global variable
-
-    ParseCmdString(lpCmdLine);
+    UNREFERENCED_PARAMETER(lpCmdLine);
 
     WCHAR szTitle[MaxLoadStringChars];                  // The title bar text
     LoadString(m_hInst, IDS_APP_TITLE, szTitle, ARRAYSIZE(szTitle));
@@ -289,8 +359,53 @@ BOOL SingleFace::InitInstance(HINSTANCE hInstance, PWSTR lpCmdLine, int nCmdShow
 #ifdef USEOPENGL
 	m_GLContext.init(m_hWnd);
 	InitGL();
+	m_meshRenderer.init();
 #endif
 
+    // the window paints at its own pace, see WM_TIMER
+    SetTimer(m_hWnd, RenderTimerId, RenderIntervalMs, NULL);
+
+    if (!m_sharedRingName.empty())
+    {
+        m_FTHelper.OpenSharedRing(m_sharedRingName);
+    }
+    if (!m_recordPath.empty() && !m_recorder.start(m_FTHelper.GetResultBus(), m_recordPath))
+    {
+        LOG_ERROR("cannot record the session to {}", m_recordPath.c_str());
+    }
+    if (!m_meshSequencePath.empty() && !m_meshSequence.start(m_FTHelper.GetResultBus(), m_meshSequencePath))
+    {
+        LOG_ERROR("cannot write the mesh sequence to {}", m_meshSequencePath.c_str());
+    }
+    if (!m_metricsPath.empty() && !m_FTHelper.OpenMetrics(m_metricsPath))
+    {
+        LOG_ERROR("cannot write the metrics to {}", m_metricsPath.c_str());
+    }
+    if (!m_sourceSpec.empty())
+    {
+        FrameSource* source = createFrameSource(m_sourceSpec, true);
+        if (source)
+        {
+            m_FTHelper.SetFrameSource(source);
+        }
+        else
+        {
+            LOG_ERROR("unknown frame source {}, using the Kinect", m_sourceSpec.c_str());
+        }
+    }
+    if (!m_frameRecordPath.empty())
+    {
+        m_FTHelper.RecordFrames(m_frameRecordPath);
+    }
+    if (m_statsIntervalMs)
+    {
+        StageStats::startDump(m_statsIntervalMs);
+    }
+    if (!m_tracePath.empty())
+    {
+        PipelineTrace::setThreadName("ui");
+        PipelineTrace::start();
+    }
     return SUCCEEDED(m_FTHelper.Init(m_hWnd,
         FTHelperCallingBack,
         this,
@@ -306,7 +421,49 @@ BOOL SingleFace::InitInstance(HINSTANCE hInstance, PWSTR lpCmdLine, int nCmdShow
 void SingleFace::UninitInstance()
 {
     // Clean up the memory allocated for Face Tracking and rendering.
+    KillTimer(m_hWnd, RenderTimerId);
+    TrackingResultBus::Stats stats;
+    if (m_FTHelper.GetResultBus().getStats(m_FTHelper.GetCallBackSubscriber(), stats))
+    {
+        LOG_INFO("result bus: delivered {} dropped {} lag avg {} ms max {} ms", stats.delivered, stats.dropped,
+            stats.averageLagMs, stats.maxLagMs);
+    }
     m_FTHelper.Stop();
+    // logs the stage totals of the whole run
+    StageStats::stopDump();
+    if (!m_tracePath.empty())
+    {
+        PipelineTrace::stop();
+        PipelineTrace::write(m_tracePath.c_str());
+    }
+    if (m_recorder.isRecording())
+    {
+        LOG_INFO("session: {} frames, {} bytes", m_recorder.getFrameCount(), m_recorder.getBytesWritten());
+        m_recorder.stop();
+    }
+    if (m_meshSequence.isRecording())
+    {
+        m_meshSequence.stop();
+        LOG_INFO("mesh sequence: {} frames, {} key frames, {} bytes{}", m_meshSequence.getFrameCount(),
+            m_meshSequence.getKeyframeCount(), m_meshSequence.getBytesWritten(), m_meshSequence.hasFailed() ? ", write failed" : "");
+    }
+    if (!m_metricsPath.empty())
+    {
+        const MetricsWriter& metrics = m_FTHelper.GetMetrics();
+        LOG_INFO("metrics: {} rows, {} bytes{}", metrics.getRowCount(), metrics.getBytesWritten(),
+            metrics.hasFailed() ? ", write failed" : "");
+    }
+    if (!m_frameRecordPath.empty())
+    {
+        const FrameFileWriter& frames = m_FTHelper.GetFrameRecorder();
+        LOG_INFO("frames: {} recorded, {} bytes{}", frames.getFrameCount(), frames.getBytesWritten(),
+            frames.hasFailed() ? ", write failed" : "");
+    }
+
+#ifdef USEOPENGL
+    m_meshRenderer.release();
+    m_GLContext.Stop();
+#endif
 
     if (m_hAccelTable)
     {
@@ -367,7 +524,7 @@ LRESULT CALLBACK SingleFace::WndProcStatic(HWND hWnd, UINT message, WPARAM wPara
 //  PURPOSE:  Processes messages for the main window.
 //
 //  WM_COMMAND  - process the application menu
-//  WM_KEYUP    - Exit in response to ESC key
+//  WM_KEYUP    - Exit in response to ESC key, write the trace on F9
 //  WM_PAINT    - Paint the main window
 //  WM_DESTROY  - post a quit message and return
 LRESULT CALLBACK SingleFace::WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
@@ -399,12 +556,28 @@ LRESULT CALLBACK SingleFace::WndProc(HWND hWnd, UINT message, WPARAM wParam, LPA
         {
             PostQuitMessage(0);
         }
+        else if (wParam == VK_F9 && PipelineTrace::isEnabled())
+        {
+            // the last events of every thread, tracing goes on
+            PipelineTrace::write(m_tracePath.c_str());
+        }
+        break;
+    case WM_TIMER:
+        // repaint only when the tracking thread has moved on
+        if (wParam == RenderTimerId && m_FTHelper.GetFrameCount() != m_paintedFrame)
+        {
+            InvalidateRect(hWnd, NULL, FALSE);
+        }
         break;
     case WM_PAINT:
-        hdc = BeginPaint(hWnd, &ps);
-        // Draw the avatar window and the video window
-        PaintWindow(hdc, hWnd);
-        EndPaint(hWnd, &ps);
+        {
+            STAGE_TIMER(STAGE_RENDER);
+            m_paintedFrame = m_FTHelper.GetFrameCount();
+            hdc = BeginPaint(hWnd, &ps);
+            // Draw the avatar window and the video window
+            PaintWindow(hdc, hWnd);
+            EndPaint(hWnd, &ps);
+        }
         break;
     case WM_DESTROY:
         PostQuitMessage(0);
@@ -443,12 +616,13 @@ BOOL SingleFace::ShowVideo(HDC hdc, int width, int height, int originX, int orig
 {
     BOOL ret = TRUE;
 
-    // Now, copy a fraction of the camera image into the screen.
-    IFTImage* colorImage = m_FTHelper.GetColorImage();
-    if (colorImage)
+    // Now, copy a fraction of the camera image into the screen. It is the
+    // frame the tracker published last, the tracking thread never writes it.
+    float centerX = 0, centerY = 0;
+    if (m_pVideoBuffer && m_FTHelper.CopyVideoFrame(m_pVideoBuffer, &centerX, &centerY))
     {
-        int iWidth = colorImage->GetWidth();
-        int iHeight = colorImage->GetHeight();
+        int iWidth = m_pVideoBuffer->GetWidth();
+        int iHeight = m_pVideoBuffer->GetHeight();
         if (iWidth > 0 && iHeight > 0)
         {
             int iTop = 0;
@@ -456,48 +630,41 @@ BOOL SingleFace::ShowVideo(HDC hdc, int width, int height, int originX, int orig
             int iLeft = 0;
             int iRight = iWidth;
 
-            // Keep a separate buffer.
-            if (m_pVideoBuffer && SUCCEEDED(m_pVideoBuffer->Allocate(iWidth, iHeight, FTIMAGEFORMAT_UINT8_B8G8R8A8)))
+            // Compute the best approximate copy ratio.
+            float w1 = (float)iHeight * (float)width;
+            float w2 = (float)iWidth * (float)height;
+            if (w2 > w1 && height > 0)
             {
-                // Copy do the video buffer while converting bytes
-                colorImage->CopyTo(m_pVideoBuffer, NULL, 0, 0);
-
-                // Compute the best approximate copy ratio.
-                float w1 = (float)iHeight * (float)width;
-                float w2 = (float)iWidth * (float)height;
-                if (w2 > w1 && height > 0)
+                // video image too wide
+                float wx = w1/height;
+                iLeft = (int)max(0, centerX - wx / 2);
+                iRight = iLeft + (int)wx;
+                if (iRight > iWidth)
                 {
-                    // video image too wide
-                    float wx = w1/height;
-                    iLeft = (int)max(0, m_FTHelper.GetXCenterFace() - wx / 2);
-                    iRight = iLeft + (int)wx;
-                    if (iRight > iWidth)
-                    {
-                        iRight = iWidth;
-                        iLeft = iRight - (int)wx;
-                    }
+                    iRight = iWidth;
+                    iLeft = iRight - (int)wx;
                 }
-                else if (w1 > w2 && width > 0)
+            }
+            else if (w1 > w2 && width > 0)
+            {
+                // video image too narrow
+                float hy = w2/width;
+                iTop = (int)max(0, centerY - hy / 2);
+                iBottom = iTop + (int)hy;
+                if (iBottom > iHeight)
                 {
-                    // video image too narrow
-                    float hy = w2/width;
-                    iTop = (int)max(0, m_FTHelper.GetYCenterFace() - hy / 2);
-                    iBottom = iTop + (int)hy;
-                    if (iBottom > iHeight)
-                    {
-                        iBottom = iHeight;
-                        iTop = iBottom - (int)hy;
-                    }
+                    iBottom = iHeight;
+                    iTop = iBottom - (int)hy;
                 }
+            }
 
-                int const bmpPixSize = m_pVideoBuffer->GetBytesPerPixel();
-                SetStretchBltMode(hdc, HALFTONE);
-                BITMAPINFO bmi = {sizeof(BITMAPINFO), iWidth, iHeight, 1, static_cast<WORD>(bmpPixSize * CHAR_BIT), BI_RGB, m_pVideoBuffer->GetStride() * iHeight, 5000, 5000, 0, 0};
-                if (0 == StretchDIBits(hdc, originX, originY, width, height,
-                    iLeft, iBottom, iRight-iLeft, iTop-iBottom, m_pVideoBuffer->GetBuffer(), &bmi, DIB_RGB_COLORS, SRCCOPY))
-                {
-                    ret = FALSE;
-                }
+            int const bmpPixSize = m_pVideoBuffer->GetBytesPerPixel();
+            SetStretchBltMode(hdc, HALFTONE);
+            BITMAPINFO bmi = {sizeof(BITMAPINFO), iWidth, iHeight, 1, static_cast<WORD>(bmpPixSize * CHAR_BIT), BI_RGB, m_pVideoBuffer->GetStride() * iHeight, 5000, 5000, 0, 0};
+            if (0 == StretchDIBits(hdc, originX, originY, width, height,
+                iLeft, iBottom, iRight-iLeft, iTop-iBottom, m_pVideoBuffer->GetBuffer(), &bmi, DIB_RGB_COLORS, SRCCOPY))
+            {
+                ret = FALSE;
             }
         }
     }
@@ -514,6 +681,18 @@ BOOL SingleFace::ShowEggAvatar(HDC hdc, int width, int height, int originX, int
     {
         memset(m_pImageBuffer->GetBuffer(), 0, m_pImageBuffer->GetStride() * height); // clear to black
 
+        // the avatar is only ever touched here, on the UI thread
+        TrackingResultBus::ResultPtr result;
+        EnterCriticalSection(&m_avatarLock);
+        result.swap(m_latestResult);
+        LeaveCriticalSection(&m_avatarLock);
+        if (result && result->geometry.valid)
+        {
+            const FaceGeometry& geometry = result->geometry;
+            m_eggavatar.SetCandideAU(geometry.au, geometry.auCount);
+            m_eggavatar.SetTranslations(geometry.translation[0], geometry.translation[1], geometry.translation[2]);
+            m_eggavatar.SetRotations(geometry.rotation[0], geometry.rotation[1], geometry.rotation[2]);
+        }
         m_eggavatar.SetScaleAndTranslationToWindow(height, width);
         m_eggavatar.DrawImage(m_pImageBuffer);
 
@@ -552,24 +731,18 @@ BOOL SingleFace::PaintWindow(HDC hdc, HWND hWnd)
 * after a face has been successfully tracked. The code in the call back passes the parameters
 * to the Egg Avatar, so it can be animated.
 */
-void SingleFace::FTHelperCallingBack(PVOID pVoid)
+void SingleFace::FTHelperCallingBack(PVOID pVoid, const TrackingResultBus::ResultPtr& result)
 {
     SingleFace* pApp = reinterpret_cast<SingleFace*>(pVoid);
-    if (pApp)
+    if (pApp && result)
     {
-        IFTResult* pResult = pApp->m_FTHelper.GetResult();
-        if (pResult && SUCCEEDED(pResult->GetStatus()))
+        // runs on the result bus thread while the window may be painting, so
+        // only the newest result is kept here for the paint to pick up
+        if (result->geometry.valid)
         {
-            FLOAT* pAU = NULL;
-            UINT numAU;
-            pResult->GetAUCoefficients(&pAU, &numAU);
-            pApp->m_eggavatar.SetCandideAU(pAU, numAU);
-            FLOAT scale;
-            FLOAT rotationXYZ[3];
-            FLOAT translationXYZ[3];
-            pResult->Get3DPose(&scale, rotationXYZ, translationXYZ);
-            pApp->m_eggavatar.SetTranslations(translationXYZ[0], translationXYZ[1], translationXYZ[2]);
-            pApp->m_eggavatar.SetRotations(rotationXYZ[0], rotationXYZ[1], rotationXYZ[2]);
+            EnterCriticalSection(&pApp->m_avatarLock);
+            pApp->m_latestResult = result;
+            LeaveCriticalSection(&pApp->m_avatarLock);
         }
     }
 }
@@ -581,6 +754,16 @@ void SingleFace::ParseCmdString(PWSTR lpCmdLine)
     const WCHAR KEY_NEAR_MODE[]                             = L"-NearMode";
     const WCHAR KEY_DEFAULT_DISTANCE_MODE[]                 = L"-DefaultDistanceMode";
     const WCHAR KEY_SEATED_SKELETON_MODE[]                  = L"-SeatedSkeleton";
+    const WCHAR KEY_RENDER_BENCHMARK[]                      = L"-RenderBenchmark";
+    const WCHAR KEY_SHARED_RING[]                           = L"-SharedRing";
+    const WCHAR KEY_LOG[]                                   = L"-Log";
+    const WCHAR KEY_RECORD[]                                = L"-Record";
+    const WCHAR KEY_MESH_SEQUENCE[]                         = L"-MeshSequence";
+    const WCHAR KEY_METRICS[]                               = L"-Metrics";
+    const WCHAR KEY_SOURCE[]                                = L"-Source";
+    const WCHAR KEY_RECORD_FRAMES[]                         = L"-RecordFrames";
+    const WCHAR KEY_STATS[]                                 = L"-Stats";
+    const WCHAR KEY_TRACE[]                                 = L"-Trace";
 
     const WCHAR STR_NUI_IMAGE_TYPE_DEPTH[]                  = L"DEPTH";
     const WCHAR STR_NUI_IMAGE_TYPE_DEPTH_AND_PLAYER_INDEX[] = L"PLAYERID";
@@ -599,7 +782,17 @@ void SingleFace::ParseCmdString(PWSTR lpCmdLine)
         TOKEN_COLOR,
         TOKEN_NEARMODE,
         TOKEN_DEFAULTDISTANCEMODE,
-        TOKEN_SEATEDSKELETON
+        TOKEN_SEATEDSKELETON,
+        TOKEN_RENDERBENCHMARK,
+        TOKEN_SHAREDRING,
+        TOKEN_LOG,
+        TOKEN_RECORD,
+        TOKEN_MESHSEQUENCE,
+        TOKEN_METRICS,
+        TOKEN_SOURCE,
+        TOKEN_RECORDFRAMES,
+        TOKEN_STATS,
+        TOKEN_TRACE
     }; 
 
     int argc = 0;
@@ -640,6 +833,117 @@ void SingleFace::ParseCmdString(PWSTR lpCmdLine)
             tokenType = TOKEN_SEATEDSKELETON;
             m_bSeatedSkeletonMode = TRUE;
         }
+        else if(0 == wcsncmp(token, KEY_RENDER_BENCHMARK, ARRAYSIZE(KEY_RENDER_BENCHMARK)))
+        {
+            tokenType = TOKEN_RENDERBENCHMARK;
+            m_renderBenchmarkFrames = 1000;
+            if((token = wcstok_s(NULL, L":", &context)) != NULL && _wtoi(token) > 0)
+            {
+                m_renderBenchmarkFrames = _wtoi(token);
+            }
+        }
+        else if(0 == wcsncmp(token, KEY_LOG, ARRAYSIZE(KEY_LOG)))
+        {
+            // -Log[:file] also writes the log to a file
+            tokenType = TOKEN_LOG;
+            char path[MAX_PATH] = "SingleFace.log";
+            if((token = wcstok_s(NULL, L":", &context)) != NULL)
+            {
+                WideCharToMultiByte(CP_ACP, 0, token, -1, path, ARRAYSIZE(path), NULL, NULL);
+            }
+            AsyncLog::openFile(path);
+        }
+        else if(0 == wcsncmp(token, KEY_RECORD, ARRAYSIZE(KEY_RECORD)))
+        {
+            // -Record[:file] writes the tracked frames to a session file
+            tokenType = TOKEN_RECORD;
+            char path[MAX_PATH] = "SingleFace.session";
+            if((token = wcstok_s(NULL, L":", &context)) != NULL)
+            {
+                WideCharToMultiByte(CP_ACP, 0, token, -1, path, ARRAYSIZE(path), NULL, NULL);
+            }
+            m_recordPath = path;
+        }
+        else if(0 == wcsncmp(token, KEY_MESH_SEQUENCE, ARRAYSIZE(KEY_MESH_SEQUENCE)))
+        {
+            // -MeshSequence[:file] writes every tracked mesh for offline rendering
+            tokenType = TOKEN_MESHSEQUENCE;
+            char path[MAX_PATH] = "SingleFace.meshseq";
+            if((token = wcstok_s(NULL, L":", &context)) != NULL)
+            {
+                WideCharToMultiByte(CP_ACP, 0, token, -1, path, ARRAYSIZE(path), NULL, NULL);
+            }
+            m_meshSequencePath = path;
+        }
+        else if(0 == wcsncmp(token, KEY_METRICS, ARRAYSIZE(KEY_METRICS)))
+        {
+            // -Metrics[:file] keeps the per frame pose, AUs and pupils for analysis
+            tokenType = TOKEN_METRICS;
+            char path[MAX_PATH] = "SingleFace.metrics";
+            if((token = wcstok_s(NULL, L":", &context)) != NULL)
+            {
+                WideCharToMultiByte(CP_ACP, 0, token, -1, path, ARRAYSIZE(path), NULL, NULL);
+            }
+            m_metricsPath = path;
+        }
+        else if(0 == wcsncmp(token, KEY_SOURCE, ARRAYSIZE(KEY_SOURCE)))
+        {
+            // -Source:synthetic[:frames] or -Source:file.frames runs without the Kinect;
+            // the rest of the argument is the spec, colons and all
+            tokenType = TOKEN_SOURCE;
+            char spec[MAX_PATH];
+            if(context && *context && WideCharToMultiByte(CP_ACP, 0, context, -1, spec, ARRAYSIZE(spec), NULL, NULL) > 1)
+            {
+                m_sourceSpec = spec;
+            }
+        }
+        else if(0 == wcsncmp(token, KEY_RECORD_FRAMES, ARRAYSIZE(KEY_RECORD_FRAMES)))
+        {
+            // -RecordFrames[:file] keeps the raw colour, depth and skeletons for -Source
+            tokenType = TOKEN_RECORDFRAMES;
+            char path[MAX_PATH] = "SingleFace.frames";
+            if((token = wcstok_s(NULL, L":", &context)) != NULL)
+            {
+                WideCharToMultiByte(CP_ACP, 0, token, -1, path, ARRAYSIZE(path), NULL, NULL);
+            }
+            m_frameRecordPath = path;
+        }
+        else if(0 == wcsncmp(token, KEY_TRACE, ARRAYSIZE(KEY_TRACE)))
+        {
+            // -Trace[:file] records a timeline of the pipeline threads, written
+            // on F9 and at exit for chrome://tracing or ui.perfetto.dev
+            tokenType = TOKEN_TRACE;
+            char path[MAX_PATH] = "SingleFace.json";
+            if((token = wcstok_s(NULL, L":", &context)) != NULL)
+            {
+                WideCharToMultiByte(CP_ACP, 0, token, -1, path, ARRAYSIZE(path), NULL, NULL);
+            }
+            m_tracePath = path;
+        }
+        else if(0 == wcsncmp(token, KEY_STATS, ARRAYSIZE(KEY_STATS)))
+        {
+            // -Stats[:seconds] logs where the frame time went, every 5 s by default
+            tokenType = TOKEN_STATS;
+            m_statsIntervalMs = 5000;
+            if((token = wcstok_s(NULL, L":", &context)) != NULL && _wtoi(token) > 0)
+            {
+                m_statsIntervalMs = _wtoi(token) * 1000;
+            }
+        }
+        else if(0 == wcsncmp(token, KEY_SHARED_RING, ARRAYSIZE(KEY_SHARED_RING)))
+        {
+            // -SharedRing[:name] publishes the results to other processes
+            tokenType = TOKEN_SHAREDRING;
+            m_sharedRingName = "FaceTracking";
+            if((token = wcstok_s(NULL, L":", &context)) != NULL)
+            {
+                char name[MAX_PATH];
+                if(WideCharToMultiByte(CP_ACP, 0, token, -1, name, ARRAYSIZE(name), NULL, NULL) > 1)
+                {
+                    m_sharedRingName = name;
+                }
+            }
+        }
 
         if(tokenType == TOKEN_DEPTH || tokenType == TOKEN_COLOR)
         {
@@ -707,9 +1011,16 @@ int APIENTRY wWinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, PWSTR lpCmdL
 #endif
 
     UNREFERENCED_PARAMETER(hPrevInstance);
+#ifndef _DEBUG
+    // no console to write to, only -Log and the debugger get the output
+    AsyncLog::setConsole(false);
+#endif
+    AsyncLog::start();
     SingleFace app;
 
     HeapSetInformation(NULL, HeapEnableTerminationOnCorruption, NULL, 0);
 
-    return app.Run(hInstance, lpCmdLine, nCmdShow);
+    int result = app.Run(hInstance, lpCmdLine, nCmdShow);
+    AsyncLog::stop();
+    return result;
 }
@@ -6,9 +6,11 @@
 
 #pragma once
 
+#include "faceGeometry.h"
+
 HRESULT VisualizeFacetracker(IFTImage* pColorImg, IFTResult* pAAMRlt, UINT32 color);
 
-HRESULT VisualizeFaceModel(IFTImage* pColorImg, IFTModel* pModel, FT_CAMERA_CONFIG const* pCameraConfig, FLOAT const* pSUCoef, 
-    FLOAT zoomFactor, POINT viewOffset, IFTResult* pAAMRlt, UINT32 color);
+// Draws the mesh edges and face rect of one computed snapshot into pColorImg.
+HRESULT VisualizeFaceModel(IFTImage* pColorImg, const FaceTopology* pTopology, const FaceGeometry& geometry, UINT32 color);
 
 
@@ -0,0 +1,447 @@
+#include "stdafx.h"
+#include "asyncLog.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#ifdef _WIN32
+#define LOG_THREAD_LOCAL __declspec(thread)
+// no snprintf before VS2015
+#define snprintf(buffer, size, ...) _snprintf_s(buffer, size, _TRUNCATE, __VA_ARGS__)
+#else
+#define LOG_THREAD_LOCAL __thread
+#endif
+
+namespace
+{
+	// Single producer, single consumer hand-over of the ring indices. MSVC
+	// volatile accesses already order like acquire/release on x86 and x64,
+	// the barrier only stops the compiler from moving the record writes.
+	template<typename T>
+	inline void storeRelease(volatile T* p, T v)
+	{
+#ifdef _WIN32
+		_ReadWriteBarrier();
+		*p = v;
+#else
+		__atomic_store_n(p, v, __ATOMIC_RELEASE);
+#endif
+	}
+
+	template<typename T>
+	inline T loadAcquire(const volatile T* p)
+	{
+#ifdef _WIN32
+		T v = *p;
+		_ReadWriteBarrier();
+		return v;
+#else
+		return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+	}
+
+	struct LogRecord
+	{
+		LONGLONG ticks;
+		const char* format;
+		unsigned char level;
+		unsigned char argCount;
+		LogArg args[AsyncLog::MaxArgs];
+		char text[AsyncLog::MaxTextBytes];
+	};
+
+	// written by its thread only, read by the flusher only
+	struct ThreadRing
+	{
+		ThreadRing():head(0), tail(0), dropped(0), retired(0), next(NULL)
+		{
+			name[0] = 0;
+		}
+
+		LogRecord records[AsyncLog::RingRecords];
+		volatile unsigned head;		// records written
+		volatile unsigned tail;		// records taken by the flusher
+		volatile unsigned dropped;
+		unsigned id;
+		char name[32];
+		volatile LONG retired;		// its thread ended, a new thread takes it once drained
+		ThreadRing* next;
+	};
+
+	// at thread exit, through the fiber local storage callback
+	void WINAPI retireThread(PVOID data)
+	{
+		if (data)
+		{
+			InterlockedExchange(&((ThreadRing*)data)->retired, 1);
+		}
+	}
+
+	struct PendingRecord
+	{
+		LogRecord record;
+		const ThreadRing* ring;
+
+		bool operator<(const PendingRecord& other) const {return record.ticks < other.record.ticks;}
+	};
+
+	struct LogState
+	{
+		LogState():rings(NULL), ringCount(0), threadCount(0), dropped(0), thread(NULL), running(false), intervalMs(10),
+			console(true), file(NULL)
+		{
+			InitializeCriticalSection(&flushLock);
+			exitHook = FlsAlloc(retireThread);
+			LARGE_INTEGER now;
+			QueryPerformanceCounter(&now);
+			QueryPerformanceFrequency(&frequency);
+			startTicks = now.QuadPart;
+		}
+
+		// rings are never freed, they go from thread to thread
+		PVOID volatile rings;
+		volatile LONG ringCount;
+		volatile LONG threadCount;		// numbers the threads that had a ring
+		volatile LONG dropped;			// records of threads without a ring
+		DWORD exitHook;
+
+		HANDLE thread;
+		volatile bool running;
+		DWORD intervalMs;
+
+		// sinks and the drain itself
+		CRITICAL_SECTION flushLock;
+		bool console;
+		FILE* file;
+		std::vector<PendingRecord> batch;
+
+		LONGLONG startTicks;
+		LARGE_INTEGER frequency;
+	};
+
+	LogState state;
+	LOG_THREAD_LOCAL ThreadRing* threadRing = NULL;
+	LOG_THREAD_LOCAL bool threadDropped = false;
+
+	const char* levelName(int level)
+	{
+		static const char* names[] = {"TRACE", "DEBUG", "INFO ", "WARN ", "ERROR"};
+		return level >= 0 && level <= LOG_LEVEL_ERROR ? names[level] : "?    ";
+	}
+
+	// a ring whose thread ended and whose records are all written out; under
+	// the flush lock, so no drain still formats them with the old name
+	ThreadRing* claimRetired()
+	{
+		ThreadRing* claimed = NULL;
+		EnterCriticalSection(&state.flushLock);
+		for (ThreadRing* ring = (ThreadRing*)state.rings; ring && !claimed; ring = ring->next)
+		{
+			if (ring->retired && ring->tail == ring->head &&
+				InterlockedCompareExchange(&ring->retired, 0, 1) == 1)
+			{
+				ring->name[0] = 0;
+				claimed = ring;
+			}
+		}
+		LeaveCriticalSection(&state.flushLock);
+		return claimed;
+	}
+
+	// NULL once MaxThreads rings are taken
+	ThreadRing* registerThread()
+	{
+		ThreadRing* ring = claimRetired();
+		if (!ring)
+		{
+			if (InterlockedIncrement(&state.ringCount) > AsyncLog::MaxThreads)
+			{
+				InterlockedDecrement(&state.ringCount);
+				threadDropped = true;
+				return NULL;
+			}
+			ring = new ThreadRing();
+			PVOID head;
+			do
+			{
+				head = state.rings;
+				ring->next = (ThreadRing*)head;
+			} while (InterlockedCompareExchangePointer(&state.rings, ring, head) != head);
+		}
+		ring->id = (unsigned)InterlockedIncrement(&state.threadCount);
+		if (state.exitHook != FLS_OUT_OF_INDEXES)
+		{
+			FlsSetValue(state.exitHook, ring);
+		}
+		threadRing = ring;
+		return ring;
+	}
+
+	void appendArg(const LogRecord& r, const LogArg& arg, char* out, size_t size)
+	{
+		switch (arg.type)
+		{
+		case LogArg::Int:		snprintf(out, size, "%lld", arg.i); break;
+		case LogArg::UInt:		snprintf(out, size, "%llu", arg.u); break;
+		case LogArg::Double:	snprintf(out, size, "%g", arg.d); break;
+		case LogArg::Text:		snprintf(out, size, "%s", r.text + arg.u); break;
+		case LogArg::Pointer:	snprintf(out, size, "%p", arg.p); break;
+		case LogArg::Hex:		snprintf(out, size, "0x%llx", arg.u); break;
+		default:				snprintf(out, size, "{}"); break;
+		}
+	}
+
+	// "  1234.567 INFO  [tracking] message"
+	size_t formatRecord(const PendingRecord& pending, char* out, size_t size)
+	{
+		const LogRecord& r = pending.record;
+		double ms = (r.ticks - state.startTicks) * 1000.0 / state.frequency.QuadPart;
+		int n = pending.ring->name[0] ?
+			snprintf(out, size, "%10.3f %s [%s] ", ms, levelName(r.level), pending.ring->name) :
+			snprintf(out, size, "%10.3f %s [T%u] ", ms, levelName(r.level), pending.ring->id);
+		size_t length = n > 0 ? (size_t)n : 0;
+		int arg = 0;
+		for (const char* f = r.format; *f && length + 1 < size; ++f)
+		{
+			if (f[0] == '{' && f[1] == '}' && arg < r.argCount)
+			{
+				appendArg(r, r.args[arg++], out + length, size - length);
+				length += strlen(out + length);
+				++f;
+			}
+			else
+			{
+				out[length++] = *f;
+			}
+		}
+		if (length + 1 >= size)
+		{
+			length = size - 2;
+		}
+		out[length++] = '\n';
+		out[length] = 0;
+		return length;
+	}
+
+	// takes whatever the rings hold right now and writes it in time order
+	void drain()
+	{
+		EnterCriticalSection(&state.flushLock);
+		std::vector<PendingRecord>& batch = state.batch;
+		batch.clear();
+		for (ThreadRing* ring = (ThreadRing*)state.rings; ring; ring = ring->next)
+		{
+			unsigned head = loadAcquire(&ring->head);
+			unsigned tail = ring->tail;
+			for (; tail != head; ++tail)
+			{
+				PendingRecord pending;
+				pending.record = ring->records[tail % AsyncLog::RingRecords];
+				pending.ring = ring;
+				batch.push_back(pending);
+			}
+			storeRelease(&ring->tail, tail);
+		}
+		std::stable_sort(batch.begin(), batch.end());
+
+		char line[512];
+		for (size_t i = 0; i < batch.size(); ++i)
+		{
+			formatRecord(batch[i], line, sizeof(line));
+			if (state.console)
+				fputs(line, stdout);
+			if (state.file)
+				fputs(line, state.file);
+#ifdef _WIN32
+			if (IsDebuggerPresent())
+				OutputDebugStringA(line);
+#endif
+		}
+		if (!batch.empty())
+		{
+			if (state.console)
+				fflush(stdout);
+			if (state.file)
+				fflush(state.file);
+		}
+		LeaveCriticalSection(&state.flushLock);
+	}
+
+	DWORD WINAPI flusherThread(PVOID)
+	{
+		while (state.running)
+		{
+			Sleep(state.intervalMs);
+			drain();
+		}
+		return 0;
+	}
+}
+
+bool AsyncLog::start(DWORD flushIntervalMs)
+{
+	if (state.thread)
+	{
+		return true;
+	}
+	state.intervalMs = flushIntervalMs ? flushIntervalMs : 1;
+	state.running = true;
+	state.thread = CreateThread(NULL, 0, flusherThread, NULL, 0, NULL);
+	if (!state.thread)
+	{
+		state.running = false;
+		return false;
+	}
+	return true;
+}
+
+void AsyncLog::stop()
+{
+	state.running = false;
+	if (state.thread)
+	{
+		WaitForSingleObject(state.thread, INFINITE);
+		CloseHandle(state.thread);
+		state.thread = NULL;
+	}
+	drain();
+}
+
+void AsyncLog::setConsole(bool enable)
+{
+	EnterCriticalSection(&state.flushLock);
+	state.console = enable;
+	LeaveCriticalSection(&state.flushLock);
+}
+
+bool AsyncLog::openFile(const char* path)
+{
+	FILE* file = fopen(path, "a");
+	if (!file)
+	{
+		return false;
+	}
+	EnterCriticalSection(&state.flushLock);
+	if (state.file)
+		fclose(state.file);
+	state.file = file;
+	LeaveCriticalSection(&state.flushLock);
+	return true;
+}
+
+void AsyncLog::closeFile()
+{
+	EnterCriticalSection(&state.flushLock);
+	if (state.file)
+		fclose(state.file);
+	state.file = NULL;
+	LeaveCriticalSection(&state.flushLock);
+}
+
+void AsyncLog::setThreadName(const char* name)
+{
+	ThreadRing* ring = threadRing;
+	if (!ring && (threadDropped || !(ring = registerThread())))
+	{
+		return;
+	}
+	strncpy(ring->name, name ? name : "", sizeof(ring->name) - 1);
+	ring->name[sizeof(ring->name) - 1] = 0;
+}
+
+unsigned long long AsyncLog::getDropped()
+{
+	unsigned long long dropped = (unsigned long long)state.dropped;
+	for (ThreadRing* ring = (ThreadRing*)state.rings; ring; ring = ring->next)
+	{
+		dropped += ring->dropped;
+	}
+	return dropped;
+}
+
+void AsyncLog::push(LogLevel level, const char* format, const LogArg* args, int count)
+{
+	ThreadRing* ring = threadRing;
+	if (!ring && (threadDropped || !(ring = registerThread())))
+	{
+		InterlockedIncrement(&state.dropped);
+		return;
+	}
+	unsigned head = ring->head;
+	if (head - loadAcquire(&ring->tail) >= (unsigned)RingRecords)
+	{
+		ring->dropped = ring->dropped + 1;
+		return;
+	}
+
+	LogRecord& r = ring->records[head % RingRecords];
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	r.ticks = now.QuadPart;
+	r.format = format;
+	r.level = (unsigned char)level;
+	r.argCount = (unsigned char)count;
+	unsigned textBytes = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		r.args[i] = args[i];
+		if (args[i].type == LogArg::Text)
+		{
+			// the caller's string may be gone by the time it is formatted
+			const char* s = args[i].s ? args[i].s : "(null)";
+			unsigned room = MaxTextBytes - textBytes;
+			unsigned length = room ? (unsigned)std::min(strlen(s), (size_t)(room - 1)) : 0;
+			r.args[i].u = room ? textBytes : MaxTextBytes - 1;
+			memcpy(r.text + textBytes, s, length);
+			if (room)
+			{
+				r.text[textBytes + length] = 0;
+				textBytes += length + 1;
+			}
+		}
+	}
+	r.text[MaxTextBytes - 1] = 0;
+	storeRelease(&ring->head, head + 1);
+}
+
+void AsyncLog::write(LogLevel level, const char* format)
+{
+	push(level, format, NULL, 0);
+}
+
+void AsyncLog::write(LogLevel level, const char* format, const LogArg& a0)
+{
+	push(level, format, &a0, 1);
+}
+
+void AsyncLog::write(LogLevel level, const char* format, const LogArg& a0, const LogArg& a1)
+{
+	LogArg args[] = {a0, a1};
+	push(level, format, args, 2);
+}
+
+void AsyncLog::write(LogLevel level, const char* format, const LogArg& a0, const LogArg& a1, const LogArg& a2)
+{
+	LogArg args[] = {a0, a1, a2};
+	push(level, format, args, 3);
+}
+
+void AsyncLog::write(LogLevel level, const char* format, const LogArg& a0, const LogArg& a1, const LogArg& a2, const LogArg& a3)
+{
+	LogArg args[] = {a0, a1, a2, a3};
+	push(level, format, args, 4);
+}
+
+void AsyncLog::write(LogLevel level, const char* format, const LogArg& a0, const LogArg& a1, const LogArg& a2, const LogArg& a3, const LogArg& a4)
+{
+	LogArg args[] = {a0, a1, a2, a3, a4};
+	push(level, format, args, 5);
+}
+
+void AsyncLog::write(LogLevel level, const char* format, const LogArg& a0, const LogArg& a1, const LogArg& a2, const LogArg& a3, const LogArg& a4, const LogArg& a5)
+{
+	LogArg args[] = {a0, a1, a2, a3, a4, a5};
+	push(level, format, args, 6);
+}
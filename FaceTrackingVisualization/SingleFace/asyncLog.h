@@ -0,0 +1,131 @@
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+
+#include "portable.h"
+
+// Logging for the tracking and render threads. A log call copies the format
+// pointer and its raw arguments into a ring buffer owned by the calling
+// thread (no lock, no formatting, no I/O) and returns; a background thread
+// drains every ring, formats each batch in timestamp order and writes it
+// to the console, a file and, on Windows, the debugger. A full ring drops
+// the record and counts it rather than making the caller wait. The ring of
+// a thread that ended goes to the next new thread once it is drained; at
+// most MaxThreads rings are made, the records of threads beyond that are
+// dropped and counted.
+//
+// Formats use {} placeholders, filled in order by the arguments:
+//     LOG_INFO("first gaze result after {} ms", ms);
+// The format must be a string literal. String arguments are copied, up to
+// AsyncLog::MaxTextBytes for all of them together.
+//
+// Levels below ASYNC_LOG_MIN_LEVEL are removed at compile time, the
+// arguments are not even evaluated.
+
+enum LogLevel
+{
+	LOG_LEVEL_TRACE = 0,
+	LOG_LEVEL_DEBUG,
+	LOG_LEVEL_INFO,
+	LOG_LEVEL_WARN,
+	LOG_LEVEL_ERROR
+};
+
+#ifndef ASYNC_LOG_MIN_LEVEL
+#ifdef _DEBUG
+#define ASYNC_LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#else
+#define ASYNC_LOG_MIN_LEVEL LOG_LEVEL_INFO
+#endif
+#endif
+
+// One captured argument, 16 bytes.
+struct LogArg
+{
+	enum Type
+	{
+		None = 0,
+		Int,
+		UInt,
+		Double,
+		Text,		// offset into the record's text area
+		Pointer,
+		Hex
+	};
+
+	LogArg():type(None) {i = 0;}
+	LogArg(int v):type(Int) {i = v;}
+	LogArg(long v):type(Int) {i = v;}
+	LogArg(long long v):type(Int) {i = v;}
+	LogArg(unsigned v):type(UInt) {u = v;}
+	LogArg(unsigned long v):type(UInt) {u = v;}
+	LogArg(unsigned long long v):type(UInt) {u = v;}
+	LogArg(bool v):type(Int) {i = v ? 1 : 0;}
+	LogArg(float v):type(Double) {d = v;}
+	LogArg(double v):type(Double) {d = v;}
+	LogArg(const char* v):type(Text) {s = v;}
+	LogArg(const void* v):type(Pointer) {p = v;}
+
+	// HRESULTs and flags read better in hex
+	static LogArg hex(unsigned long long v)	{LogArg arg(v); arg.type = Hex; return arg;}
+
+	int type;
+	union
+	{
+		long long i;
+		unsigned long long u;
+		double d;
+		const char* s;
+		const void* p;
+	};
+};
+
+class AsyncLog
+{
+public:
+	enum
+	{
+		MaxArgs = 6,
+		MaxTextBytes = 64,
+		RingRecords = 512,		// per thread
+		MaxThreads = 64
+	};
+
+	// Starts the flusher. Records logged before are kept until the first
+	// ring fills up.
+	static bool start(DWORD flushIntervalMs = 10);
+	// Writes out everything logged so far and ends the flusher.
+	static void stop();
+
+	// Sinks, may be changed at any time.
+	static void setConsole(bool enable);
+	static bool openFile(const char* path);
+	static void closeFile();
+
+	// Shown instead of the thread number, call once from the thread itself.
+	static void setThreadName(const char* name);
+
+	// records lost to full rings, or to all MaxThreads rings taken, so far
+	static unsigned long long getDropped();
+
+	static void write(LogLevel level, const char* format);
+	static void write(LogLevel level, const char* format, const LogArg& a0);
+	static void write(LogLevel level, const char* format, const LogArg& a0, const LogArg& a1);
+	static void write(LogLevel level, const char* format, const LogArg& a0, const LogArg& a1, const LogArg& a2);
+	static void write(LogLevel level, const char* format, const LogArg& a0, const LogArg& a1, const LogArg& a2, const LogArg& a3);
+	static void write(LogLevel level, const char* format, const LogArg& a0, const LogArg& a1, const LogArg& a2, const LogArg& a3, const LogArg& a4);
+	static void write(LogLevel level, const char* format, const LogArg& a0, const LogArg& a1, const LogArg& a2, const LogArg& a3, const LogArg& a4, const LogArg& a5);
+
+private:
+	static void push(LogLevel level, const char* format, const LogArg* args, int count);
+};
+
+#define ASYNC_LOG_AT(level, ...) \
+	do { if ((level) >= ASYNC_LOG_MIN_LEVEL) AsyncLog::write((level), __VA_ARGS__); } while (0)
+
+#define LOG_TRACE(...)	ASYNC_LOG_AT(LOG_LEVEL_TRACE, __VA_ARGS__)
+#define LOG_DEBUG(...)	ASYNC_LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)	ASYNC_LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...)	ASYNC_LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...)	ASYNC_LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+#endif
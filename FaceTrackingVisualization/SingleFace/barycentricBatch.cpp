@@ -0,0 +1,138 @@
+#include "stdafx.h"
+#include "barycentricBatch.h"
+
+#include <cmath>
+
+#ifdef BARYCENTRIC_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+	// points on a shared edge must hit one of the two triangles
+	const float kEdgeTolerance = 1e-4f;
+}
+
+void BarycentricBatch::clear()
+{
+	uX.clear(); uY.clear(); uC.clear();
+	vX.clear(); vY.clear(); vC.clear();
+	z.clear(); dzu.clear(); dzv.clear();
+	id.clear();
+}
+
+void BarycentricBatch::reserve(size_t count)
+{
+	uX.reserve(count); uY.reserve(count); uC.reserve(count);
+	vX.reserve(count); vY.reserve(count); vC.reserve(count);
+	z.reserve(count); dzu.reserve(count); dzv.reserve(count);
+	id.reserve(count);
+}
+
+bool BarycentricBatch::add(float ax, float ay, float bx, float by, float cx, float cy, float za, float zb, float zc, int triangleId)
+{
+	float e1x = bx - ax, e1y = by - ay;
+	float e2x = cx - ax, e2y = cy - ay;
+	float det = e1x * e2y - e1y * e2x;
+	if (fabsf(det) < 1e-6f)
+		return false;
+
+	// (u, v) = [e1 e2]^-1 (p - a)
+	float inv = 1.0f / det;
+	float u0 = e2y * inv, u1 = -e2x * inv;
+	float v0 = -e1y * inv, v1 = e1x * inv;
+	uX.push_back(u0); uY.push_back(u1); uC.push_back(-(u0 * ax + u1 * ay));
+	vX.push_back(v0); vY.push_back(v1); vC.push_back(-(v0 * ax + v1 * ay));
+	z.push_back(za); dzu.push_back(zb - za); dzv.push_back(zc - za);
+	id.push_back(triangleId);
+	return true;
+}
+
+void BarycentricBatch::append(const BarycentricBatch& other, size_t i)
+{
+	uX.push_back(other.uX[i]); uY.push_back(other.uY[i]); uC.push_back(other.uC[i]);
+	vX.push_back(other.vX[i]); vY.push_back(other.vY[i]); vC.push_back(other.vC[i]);
+	z.push_back(other.z[i]); dzu.push_back(other.dzu[i]); dzv.push_back(other.dzv[i]);
+	id.push_back(other.id[i]);
+}
+
+void BarycentricBatch::pad()
+{
+	// u is constant -1 everywhere, so the entry is never inside
+	while (id.size() & 3)
+	{
+		uX.push_back(0.0f); uY.push_back(0.0f); uC.push_back(-1.0f);
+		vX.push_back(0.0f); vY.push_back(0.0f); vC.push_back(0.0f);
+		z.push_back(0.0f); dzu.push_back(0.0f); dzv.push_back(0.0f);
+		id.push_back(-1);
+	}
+}
+
+void BarycentricBatch::test(size_t i, float x, float y, BarycentricHit& hit) const
+{
+	float u = uX[i] * x + uY[i] * y + uC[i];
+	float v = vX[i] * x + vY[i] * y + vC[i];
+	if (u < -kEdgeTolerance || v < -kEdgeTolerance || u + v > 1.0f + kEdgeTolerance)
+		return;
+
+	float depth = z[i] + dzu[i] * u + dzv[i] * v;
+	if (hit.id < 0 || depth < hit.depth)
+	{
+		hit.id = id[i];
+		hit.u = u;
+		hit.v = v;
+		hit.depth = depth;
+	}
+}
+
+bool BarycentricBatch::locateScalar(float x, float y, size_t begin, size_t end, BarycentricHit& hit) const
+{
+	hit = BarycentricHit();
+	for (size_t i = begin; i < end; ++i)
+	{
+		test(i, x, y, hit);
+	}
+	return hit.id >= 0;
+}
+
+bool BarycentricBatch::locate(float x, float y, size_t begin, size_t end, BarycentricHit& hit) const
+{
+#ifdef BARYCENTRIC_SSE2
+	hit = BarycentricHit();
+	const __m128 px = _mm_set1_ps(x);
+	const __m128 py = _mm_set1_ps(y);
+	const __m128 low = _mm_set1_ps(-kEdgeTolerance);
+	const __m128 high = _mm_set1_ps(1.0f + kEdgeTolerance);
+
+	for (size_t i = begin; i < end; i += 4)
+	{
+		__m128 u = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&uX[i]), px), _mm_mul_ps(_mm_loadu_ps(&uY[i]), py)), _mm_loadu_ps(&uC[i]));
+		__m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&vX[i]), px), _mm_mul_ps(_mm_loadu_ps(&vY[i]), py)), _mm_loadu_ps(&vC[i]));
+		__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(u, low), _mm_cmpge_ps(v, low)), _mm_cmple_ps(_mm_add_ps(u, v), high));
+
+		// a point is inside one or two triangles of a range, so the few
+		// lanes that pass are finished in scalar code
+		int mask = _mm_movemask_ps(inside);
+		for (int lane = 0; mask; ++lane, mask >>= 1)
+		{
+			if (mask & 1)
+				test(i + lane, x, y, hit);
+		}
+	}
+	return hit.id >= 0;
+#else
+	return locateScalar(x, y, begin, end, hit);
+#endif
+}
+
+void BarycentricBatch::locate(const float* xs, const float* ys, size_t count, BarycentricHit* hits) const
+{
+	size_t end = id.size() & ~(size_t)3;
+	for (size_t p = 0; p < count; ++p)
+	{
+		locate(xs[p], ys[p], 0, end, hits[p]);
+		// an unpadded tail is tested one by one
+		for (size_t i = end; i < id.size(); ++i)
+			test(i, xs[p], ys[p], hits[p]);
+	}
+}
@@ -0,0 +1,57 @@
+#ifndef BARYCENTRIC_BATCH_H
+#define BARYCENTRIC_BATCH_H
+
+#include <cstddef>
+#include <vector>
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define BARYCENTRIC_SSE2
+#endif
+
+// Result of locating one point: p = a + u*(b-a) + v*(c-a) on triangle id.
+struct BarycentricHit
+{
+	BarycentricHit() : id(-1), u(0.0f), v(0.0f), depth(0.0f) {}
+
+	int id;
+	float u;
+	float v;
+	float depth;
+};
+
+// Edge equations of many 2D triangles, one array per coefficient (SoA), so
+// four triangles are tested per SSE2 step. u and v are stored as planes in
+// the image point, u = uX*x + uY*y + uC, which makes the test two
+// multiply-adds per coordinate. Ranges of triangles (e.g. the cells of
+// FaceSurfaceIndex) are padded to four with entries that never hit.
+class BarycentricBatch
+{
+public:
+	void clear();
+	void reserve(size_t count);
+	size_t size() const {return id.size();}
+
+	// false for degenerate (edge on) triangles, nothing is added then
+	bool add(float ax, float ay, float bx, float by, float cx, float cy, float za, float zb, float zc, int triangleId);
+	// copies entry i of another batch
+	void append(const BarycentricBatch& other, size_t i);
+	// pads to a multiple of four entries
+	void pad();
+
+	// nearest (smallest depth) triangle in [begin, end) containing the point;
+	// begin and end must be multiples of four
+	bool locate(float x, float y, size_t begin, size_t end, BarycentricHit& hit) const;
+	// many points against all triangles of the batch
+	void locate(const float* xs, const float* ys, size_t count, BarycentricHit* hits) const;
+
+private:
+	bool locateScalar(float x, float y, size_t begin, size_t end, BarycentricHit& hit) const;
+	void test(size_t i, float x, float y, BarycentricHit& hit) const;
+
+	std::vector<float> uX, uY, uC;
+	std::vector<float> vX, vY, vC;
+	std::vector<float> z, dzu, dzv;
+	std::vector<int> id;
+};
+
+#endif
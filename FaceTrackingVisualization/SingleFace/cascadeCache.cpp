@@ -0,0 +1,333 @@
+#include "stdafx.h"
+#include "cascadeCache.h"
+#include "mappedFile.h"
+
+#include <stdint.h>
+#include <vector>
+
+#ifndef _WIN32
+#include <stdio.h>
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+	const char kMagic[8] = {'G','Z','C','A','S','C','0','1'};
+	const unsigned int kVersion = 1;
+
+	// File layout, all little endian and tightly packed behind the header:
+	//   CacheHeader
+	//   StageRecord[stageCount]
+	//   int classifierNodes[classifierCount]
+	//   NodeRecord[nodeCount]
+	//   float alpha[nodeCount + classifierCount]
+	struct CacheHeader
+	{
+		char magic[8];
+		unsigned int version;
+		unsigned int pointerSize;	// records depend on the CvHaarFeature layout
+		uint64_t sourceSize;
+		uint64_t sourceTime;
+		int windowWidth;
+		int windowHeight;
+		int stageCount;
+		int classifierCount;
+		int nodeCount;
+		int reserved;
+	};
+
+	struct StageRecord
+	{
+		int count;
+		float threshold;
+		int next;
+		int child;
+		int parent;
+	};
+
+	struct NodeRecord
+	{
+		CvHaarFeature feature;
+		float threshold;
+		int left;
+		int right;
+	};
+
+	bool sourceStamp(const std::string& file, uint64_t& size, uint64_t& time)
+	{
+#ifdef _WIN32
+		WIN32_FILE_ATTRIBUTE_DATA attr;
+		if (!GetFileAttributesExA(file.c_str(), GetFileExInfoStandard, &attr))
+			return false;
+		size = ((uint64_t)attr.nFileSizeHigh << 32) | attr.nFileSizeLow;
+		time = ((uint64_t)attr.ftLastWriteTime.dwHighDateTime << 32) | attr.ftLastWriteTime.dwLowDateTime;
+#else
+		// a different clock than on Windows, caches do not move between the two anyway
+		struct stat st;
+		if (stat(file.c_str(), &st) != 0)
+			return false;
+		size = (uint64_t)st.st_size;
+		time = (uint64_t)st.st_mtim.tv_sec * 1000000000ULL + st.st_mtim.tv_nsec;
+#endif
+		return true;
+	}
+
+	// takes count records of recordSize from what is left of the file, false
+	// if they are not all there; the count comes from the file, so no product
+	// is formed before it is known to fit
+	bool takeRecords(size_t& remaining, int64_t count, size_t recordSize)
+	{
+		if (count <= 0 || (uint64_t)count > remaining / recordSize)
+			return false;
+		remaining -= (size_t)count * recordSize;
+		return true;
+	}
+
+	// a child is a node of the same classifier, or an alpha as -index
+	bool validChild(int child, int count)
+	{
+		return child > 0 ? child < count : child >= -count;
+	}
+
+	// the rectangles in use have to lie in the detection window, the detector
+	// reads the integral image through them
+	bool validFeature(const CvHaarFeature& feature, int width, int height)
+	{
+		for (int i = 0; i < CV_HAAR_FEATURE_MAX; ++i)
+		{
+			const CvRect& r = feature.rect[i].r;
+			if (feature.rect[i].weight == 0.0f)
+				continue;
+			if (r.x < 0 || r.y < 0 || r.width <= 0 || r.height <= 0 ||
+				r.width > width - r.x || r.height > height - r.y)
+				return false;
+		}
+		return true;
+	}
+
+	// a stage link is -1 or another stage
+	bool validStage(int stage, int stageCount)
+	{
+		return stage >= -1 && stage < stageCount;
+	}
+
+	// replaces dst in one step, readers see the old or the new cache, never half of one
+	bool replaceFile(const std::string& src, const std::string& dst)
+	{
+#ifdef _WIN32
+		if (MoveFileExA(src.c_str(), dst.c_str(), MOVEFILE_REPLACE_EXISTING))
+			return true;
+		DeleteFileA(src.c_str());
+#else
+		if (rename(src.c_str(), dst.c_str()) == 0)
+			return true;
+		remove(src.c_str());
+#endif
+		return false;
+	}
+}
+
+CachedCascadeClassifier::CachedCascadeClassifier():loadedFromCache(false)
+{
+
+}
+
+bool CachedCascadeClassifier::loadCached(const std::string& xmlFile, const std::string& cacheFile)
+{
+	std::string binFile = cacheFile.empty() ? defaultCacheFile(xmlFile) : cacheFile;
+	if (loadBinary(binFile, xmlFile))
+		return true;
+
+	if (!load(xmlFile))
+		return false;
+
+	// only old style haar cascades have a binary image, a failed write
+	// just means the next start parses the XML again
+	if (!oldCascade.empty())
+		saveBinary(binFile, xmlFile);
+	return true;
+}
+
+bool CachedCascadeClassifier::saveBinary(const std::string& cacheFile, const std::string& xmlFile) const
+{
+	const CvHaarClassifierCascade* cascade = oldCascade;
+	if (!cascade)
+		return false;
+
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.version = kVersion;
+	header.pointerSize = sizeof(void*);
+	if (!sourceStamp(xmlFile, header.sourceSize, header.sourceTime))
+		return false;
+	header.windowWidth = cascade->orig_window_size.width;
+	header.windowHeight = cascade->orig_window_size.height;
+	header.stageCount = cascade->count;
+
+	std::vector<StageRecord> stages(cascade->count);
+	std::vector<int> classifierNodes;
+	std::vector<NodeRecord> nodes;
+	std::vector<float> alphas;
+	for (int i = 0; i < cascade->count; ++i)
+	{
+		const CvHaarStageClassifier& stage = cascade->stage_classifier[i];
+		stages[i].count = stage.count;
+		stages[i].threshold = stage.threshold;
+		stages[i].next = stage.next;
+		stages[i].child = stage.child;
+		stages[i].parent = stage.parent;
+		for (int j = 0; j < stage.count; ++j)
+		{
+			const CvHaarClassifier& classifier = stage.classifier[j];
+			classifierNodes.push_back(classifier.count);
+			for (int k = 0; k < classifier.count; ++k)
+			{
+				NodeRecord node;
+				node.feature = classifier.haar_feature[k];
+				node.threshold = classifier.threshold[k];
+				node.left = classifier.left[k];
+				node.right = classifier.right[k];
+				nodes.push_back(node);
+			}
+			alphas.insert(alphas.end(), classifier.alpha, classifier.alpha + classifier.count + 1);
+		}
+	}
+	header.classifierCount = (int)classifierNodes.size();
+	header.nodeCount = (int)nodes.size();
+
+	// write next to the target and swap it in, so a crash never leaves a
+	// truncated cache behind
+	std::string tmpFile = cacheFile + ".tmp";
+	FILE* fp = fopen(tmpFile.c_str(), "wb");
+	if (!fp)
+		return false;
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	ok = ok && (stages.empty() || fwrite(&stages[0], sizeof(StageRecord), stages.size(), fp) == stages.size());
+	ok = ok && (classifierNodes.empty() || fwrite(&classifierNodes[0], sizeof(int), classifierNodes.size(), fp) == classifierNodes.size());
+	ok = ok && (nodes.empty() || fwrite(&nodes[0], sizeof(NodeRecord), nodes.size(), fp) == nodes.size());
+	ok = ok && (alphas.empty() || fwrite(&alphas[0], sizeof(float), alphas.size(), fp) == alphas.size());
+	ok = (fclose(fp) == 0) && ok;
+
+	if (!ok)
+	{
+		remove(tmpFile.c_str());
+		return false;
+	}
+	return replaceFile(tmpFile, cacheFile);
+}
+
+bool CachedCascadeClassifier::loadBinary(const std::string& cacheFile, const std::string& xmlFile)
+{
+	loadedFromCache = false;
+
+	uint64_t sourceSize, sourceTime;
+	if (!sourceStamp(xmlFile, sourceSize, sourceTime))
+		return false;
+
+	MappedFile view;
+	if (!view.open(cacheFile) || view.bytes() < sizeof(CacheHeader))
+		return false;
+
+	const CacheHeader& header = *(const CacheHeader*)view.begin();
+	if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.version != kVersion ||
+		header.pointerSize != sizeof(void*) || header.sourceSize != sourceSize || header.sourceTime != sourceTime ||
+		header.windowWidth <= 0 || header.windowHeight <= 0)
+		return false;
+
+	// every count read from the file is checked against the bytes left before
+	// it is used; a damaged cache fails here and the XML is parsed instead
+	size_t remaining = view.bytes() - sizeof(CacheHeader);
+	if (!takeRecords(remaining, header.stageCount, sizeof(StageRecord)) ||
+		!takeRecords(remaining, header.classifierCount, sizeof(int)) ||
+		!takeRecords(remaining, header.nodeCount, sizeof(NodeRecord)) ||
+		!takeRecords(remaining, (int64_t)header.nodeCount + header.classifierCount, sizeof(float)) ||
+		remaining != 0)
+		return false;
+
+	const StageRecord* stages = (const StageRecord*)(view.begin() + sizeof(CacheHeader));
+	const int* classifierNodes = (const int*)(stages + header.stageCount);
+	const NodeRecord* nodes = (const NodeRecord*)(classifierNodes + header.classifierCount);
+	const float* alphas = (const float*)(nodes + header.nodeCount);
+
+	// the per stage and per classifier counts have to add up to the header,
+	// each one within what the ones before left over, and every link has to
+	// stay inside its array, all before anything is allocated
+	int classifierTotal = 0, nodeTotal = 0;
+	for (int i = 0; i < header.stageCount; ++i)
+	{
+		const StageRecord& stage = stages[i];
+		if (stage.count <= 0 || stage.count > header.classifierCount - classifierTotal ||
+			!validStage(stage.next, header.stageCount) || !validStage(stage.child, header.stageCount) ||
+			!validStage(stage.parent, header.stageCount))
+			return false;
+		classifierTotal += stage.count;
+	}
+	for (int j = 0; j < header.classifierCount; ++j)
+	{
+		int count = classifierNodes[j];
+		if (count <= 0 || count > header.nodeCount - nodeTotal)
+			return false;
+		for (int k = 0; k < count; ++k)
+		{
+			const NodeRecord& node = nodes[nodeTotal + k];
+			if (!validChild(node.left, count) || !validChild(node.right, count) ||
+				!validFeature(node.feature, header.windowWidth, header.windowHeight))
+				return false;
+		}
+		nodeTotal += count;
+	}
+	if (classifierTotal != header.classifierCount || nodeTotal != header.nodeCount)
+		return false;
+
+	// Same block layout as cvLoad so cvReleaseHaarClassifierCascade can free it:
+	// the stage array follows the cascade, each stage owns its classifier array
+	// and each classifier one block for features, thresholds, children and alphas.
+	size_t cascadeBytes = sizeof(CvHaarClassifierCascade) + header.stageCount * sizeof(CvHaarStageClassifier);
+	CvHaarClassifierCascade* cascade = (CvHaarClassifierCascade*)cvAlloc(cascadeBytes);
+	memset(cascade, 0, cascadeBytes);
+	cascade->flags = CV_HAAR_MAGIC_VAL;
+	cascade->count = header.stageCount;
+	cascade->orig_window_size = cvSize(header.windowWidth, header.windowHeight);
+	cascade->stage_classifier = (CvHaarStageClassifier*)(cascade + 1);
+
+	for (int i = 0; i < header.stageCount; ++i)
+	{
+		CvHaarStageClassifier& stage = cascade->stage_classifier[i];
+		stage.count = stages[i].count;
+		stage.threshold = stages[i].threshold;
+		stage.next = stages[i].next;
+		stage.child = stages[i].child;
+		stage.parent = stages[i].parent;
+		stage.classifier = (CvHaarClassifier*)cvAlloc(stage.count * sizeof(CvHaarClassifier));
+		memset(stage.classifier, 0, stage.count * sizeof(CvHaarClassifier));
+
+		for (int j = 0; j < stage.count; ++j)
+		{
+			CvHaarClassifier& classifier = stage.classifier[j];
+			int count = *classifierNodes++;
+			classifier.count = count;
+			classifier.haar_feature = (CvHaarFeature*)cvAlloc(count * (sizeof(CvHaarFeature) + sizeof(float) + 2 * sizeof(int)) + (count + 1) * sizeof(float));
+			classifier.threshold = (float*)(classifier.haar_feature + count);
+			classifier.left = (int*)(classifier.threshold + count);
+			classifier.right = classifier.left + count;
+			classifier.alpha = (float*)(classifier.right + count);
+
+			for (int k = 0; k < count; ++k, ++nodes)
+			{
+				classifier.haar_feature[k] = nodes->feature;
+				classifier.threshold[k] = nodes->threshold;
+				classifier.left[k] = nodes->left;
+				classifier.right[k] = nodes->right;
+			}
+			memcpy(classifier.alpha, alphas, (count + 1) * sizeof(float));
+			alphas += count + 1;
+		}
+	}
+
+	data = Data();
+	featureEvaluator.release();
+	oldCascade = cv::Ptr<CvHaarClassifierCascade>(cascade);
+	loadedFromCache = true;
+	return true;
+}
@@ -0,0 +1,35 @@
+#ifndef CASCADE_CACHE_H
+#define CASCADE_CACHE_H
+
+#include <opencv2/objdetect/objdetect.hpp>
+
+#include <string>
+
+// cv::CascadeClassifier that keeps a precompiled binary image of an old style
+// haar cascade next to the XML file. Parsing the XML takes most of the start
+// up time, the binary image is memory-mapped and copied straight into the
+// CvHaarClassifierCascade that cvLoad would have produced.
+class CachedCascadeClassifier : public cv::CascadeClassifier
+{
+public:
+	CachedCascadeClassifier();
+
+	// Loads xmlFile through its cache (xmlFile + ".bin" when cacheFile is
+	// empty). The cache is rebuilt when it is missing, unreadable or older
+	// than the XML. Cascades in the new XML format are loaded directly.
+	bool loadCached(const std::string& xmlFile, const std::string& cacheFile = std::string());
+
+	// Writes the binary image of the loaded cascade, stamped with xmlFile.
+	bool saveBinary(const std::string& cacheFile, const std::string& xmlFile) const;
+	// Fails if the file is not a cache of the current xmlFile.
+	bool loadBinary(const std::string& cacheFile, const std::string& xmlFile);
+
+	bool fromCache() const {return loadedFromCache;}
+
+	static std::string defaultCacheFile(const std::string& xmlFile) {return xmlFile + ".bin";}
+
+private:
+	bool loadedFromCache;
+};
+
+#endif
@@ -0,0 +1,490 @@
+#include "stdafx.h"
+#include "depthCodec.h"
+
+#include <string.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define DEPTH_CODEC_SSE2
+#endif
+
+namespace
+{
+	// a residual with a longer unary part is stored as 16 raw bits
+	const unsigned RICE_LIMIT = 24;
+	const unsigned RICE_MAX_K = 14;
+
+	inline unsigned lowestZeroBit(uint32_t v)
+	{
+		// v always has a zero at or below RICE_LIMIT
+		uint32_t ones = ~v | (1u << RICE_LIMIT);
+#ifdef _WIN32
+		unsigned long index;
+		_BitScanForward(&index, ones);
+		return (unsigned)index;
+#else
+		return (unsigned)__builtin_ctz(ones);
+#endif
+	}
+
+	inline uint16_t zigzag(int r)
+	{
+		return (uint16_t)(((unsigned)r << 1) ^ (unsigned)(r >> 31));
+	}
+
+	inline int unzigzag(uint16_t z)
+	{
+		return (int)(z >> 1) ^ -(int)(z & 1);
+	}
+
+	// Mean of the recent residuals picks the Rice parameter, halved every
+	// 32 pixels so it follows the noise across the frame.
+	struct RiceState
+	{
+		RiceState():sum(4), count(1) {}
+
+		unsigned k() const
+		{
+			unsigned k = 0;
+			while ((count << k) < sum && k < RICE_MAX_K)
+				++k;
+			return k;
+		}
+
+		void update(uint32_t z)
+		{
+			sum += z;
+			if (++count == 32)
+			{
+				sum = (sum + 1) >> 1;
+				count = 16;
+			}
+		}
+
+		uint32_t sum;
+		uint32_t count;
+	};
+
+	class BitWriter
+	{
+	public:
+		explicit BitWriter(uint8_t* buffer):begin(buffer), out(buffer), acc(0), count(0) {}
+
+		// n <= 25
+		void put(uint32_t value, unsigned n)
+		{
+			acc |= (uint64_t)value << count;
+			count += n;
+			if (count >= 32)
+			{
+				uint32_t word = (uint32_t)acc;
+				memcpy(out, &word, 4);
+				out += 4;
+				acc >>= 32;
+				count -= 32;
+			}
+		}
+
+		size_t finish()
+		{
+			for (; count > 0; count = count > 8 ? count - 8 : 0)
+			{
+				*out++ = (uint8_t)acc;
+				acc >>= 8;
+			}
+			return out - begin;
+		}
+
+	private:
+		uint8_t* begin;
+		uint8_t* out;
+		uint64_t acc;
+		unsigned count;
+	};
+
+	class BitReader
+	{
+	public:
+		BitReader(const uint8_t* data, size_t size):begin(data), p(data), end(data + size), acc(0), count(0), padding(0) {}
+
+		// at least 33 bits available afterwards
+		void refill()
+		{
+			if (count > 32)
+				return;
+			if (end - p >= 4)
+			{
+				uint32_t word;
+				memcpy(&word, p, 4);
+				acc |= (uint64_t)word << count;
+				p += 4;
+				count += 32;
+				return;
+			}
+			// the tail, zeros past the end are caught by overrun()
+			while (count <= 32)
+			{
+				if (p < end)
+					acc |= (uint64_t)*p++ << count;
+				else
+					++padding;
+				count += 8;
+			}
+		}
+
+		uint32_t peek() const	{return (uint32_t)acc;}
+
+		void skip(unsigned n)
+		{
+			acc >>= n;
+			count -= n;
+		}
+
+		uint32_t get(unsigned n)
+		{
+			uint32_t v = (uint32_t)acc & ((1u << n) - 1);
+			skip(n);
+			return v;
+		}
+
+		bool overrun() const
+		{
+			return (size_t)(p - begin) * 8 + padding * 8 - count > (size_t)(end - begin) * 8;
+		}
+
+	private:
+		const uint8_t* begin;
+		const uint8_t* p;
+		const uint8_t* end;
+		uint64_t acc;
+		unsigned count;
+		size_t padding;
+	};
+
+	inline void encodeResidual(BitWriter& bits, RiceState& rice, uint16_t z)
+	{
+		unsigned k = rice.k();
+		uint32_t q = z >> k;
+		if (q < RICE_LIMIT)
+		{
+			bits.put((1u << q) - 1, q + 1);
+			if (k)
+				bits.put(z & ((1u << k) - 1), k);
+		}
+		else
+		{
+			bits.put((1u << RICE_LIMIT) - 1, RICE_LIMIT);
+			bits.put(z, 16);
+		}
+		rice.update(z);
+	}
+
+	inline uint16_t decodeResidual(BitReader& bits, RiceState& rice)
+	{
+		unsigned k = rice.k();
+		bits.refill();
+		unsigned q = lowestZeroBit(bits.peek());
+		uint16_t z;
+		if (q < RICE_LIMIT)
+		{
+			bits.skip(q + 1);
+			bits.refill();
+			z = (uint16_t)((q << k) | (k ? bits.get(k) : 0));
+		}
+		else
+		{
+			bits.skip(RICE_LIMIT);
+			bits.refill();
+			z = (uint16_t)bits.get(16);
+		}
+		rice.update(z);
+		return z;
+	}
+
+	// D13P3 pixels into depth and player index
+	void splitRow(const uint16_t* row, int16_t* depth, uint8_t* player, UINT width)
+	{
+		UINT x = 0;
+#ifdef DEPTH_CODEC_SSE2
+		const __m128i mask = _mm_set1_epi16(7);
+		const __m128i zero = _mm_setzero_si128();
+		for (; x + 8 <= width; x += 8)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(row + x));
+			_mm_storeu_si128((__m128i*)(depth + x), _mm_srli_epi16(v, 3));
+			_mm_storel_epi64((__m128i*)(player + x), _mm_packus_epi16(_mm_and_si128(v, mask), zero));
+		}
+#endif
+		for (; x < width; ++x)
+		{
+			depth[x] = (int16_t)(row[x] >> 3);
+			player[x] = (uint8_t)(row[x] & 7);
+		}
+	}
+
+	void mergeRow(const int16_t* depth, const uint8_t* player, uint16_t* row, UINT width)
+	{
+		UINT x = 0;
+#ifdef DEPTH_CODEC_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		for (; x + 8 <= width; x += 8)
+		{
+			__m128i d = _mm_slli_epi16(_mm_loadu_si128((const __m128i*)(depth + x)), 3);
+			__m128i p = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(player + x)), zero);
+			_mm_storeu_si128((__m128i*)(row + x), _mm_or_si128(d, p));
+		}
+#endif
+		// shifted unsigned as the SSE2 loop does, corrupt input may be negative
+		for (; x < width; ++x)
+		{
+			row[x] = (uint16_t)((uint16_t)depth[x] << 3 | player[x]);
+		}
+	}
+
+	// residuals against the row above, zigzagged; false if all are zero
+	bool predictRow(const int16_t* depth, const int16_t* above, uint16_t* residuals, UINT width)
+	{
+		UINT x = 0;
+		uint16_t any = 0;
+#ifdef DEPTH_CODEC_SSE2
+		__m128i anyVector = _mm_setzero_si128();
+		for (; x + 8 <= width; x += 8)
+		{
+			__m128i r = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(depth + x)), _mm_loadu_si128((const __m128i*)(above + x)));
+			__m128i z = _mm_xor_si128(_mm_slli_epi16(r, 1), _mm_srai_epi16(r, 15));
+			_mm_storeu_si128((__m128i*)(residuals + x), z);
+			anyVector = _mm_or_si128(anyVector, z);
+		}
+		any = _mm_movemask_epi8(_mm_cmpeq_epi8(anyVector, _mm_setzero_si128())) != 0xFFFF;
+#endif
+		for (; x < width; ++x)
+		{
+			residuals[x] = zigzag(depth[x] - above[x]);
+			any |= residuals[x];
+		}
+		return any != 0;
+	}
+
+	void reconstructRow(const uint16_t* residuals, const int16_t* above, int16_t* depth, UINT width)
+	{
+		UINT x = 0;
+#ifdef DEPTH_CODEC_SSE2
+		const __m128i one = _mm_set1_epi16(1);
+		const __m128i zero = _mm_setzero_si128();
+		for (; x + 8 <= width; x += 8)
+		{
+			__m128i z = _mm_loadu_si128((const __m128i*)(residuals + x));
+			__m128i r = _mm_xor_si128(_mm_srli_epi16(z, 1), _mm_sub_epi16(zero, _mm_and_si128(z, one)));
+			_mm_storeu_si128((__m128i*)(depth + x), _mm_add_epi16(_mm_loadu_si128((const __m128i*)(above + x)), r));
+		}
+#endif
+		for (; x < width; ++x)
+		{
+			depth[x] = (int16_t)(above[x] + unzigzag(residuals[x]));
+		}
+	}
+
+	// the first row has nothing above, it is predicted from the left
+	bool predictFirstRow(const int16_t* depth, uint16_t* residuals, UINT width)
+	{
+		uint16_t any = 0;
+		int left = 0;
+		for (UINT x = 0; x < width; ++x)
+		{
+			residuals[x] = zigzag(depth[x] - left);
+			left = depth[x];
+			any |= residuals[x];
+		}
+		return any != 0;
+	}
+
+	void reconstructFirstRow(const uint16_t* residuals, int16_t* depth, UINT width)
+	{
+		int left = 0;
+		for (UINT x = 0; x < width; ++x)
+		{
+			left = (int16_t)(left + unzigzag(residuals[x]));
+			depth[x] = (int16_t)left;
+		}
+	}
+
+	size_t encodePlayers(const uint8_t* players, size_t count, uint8_t* out)
+	{
+		uint8_t* begin = out;
+		size_t i = 0;
+		while (i < count)
+		{
+			uint8_t value = players[i];
+			size_t j = i + 1;
+#ifdef DEPTH_CODEC_SSE2
+			const __m128i v = _mm_set1_epi8((char)value);
+			while (j + 16 <= count && _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(players + j)), v)) == 0xFFFF)
+			{
+				j += 16;
+			}
+#endif
+			while (j < count && players[j] == value)
+			{
+				++j;
+			}
+			*out++ = value;
+			for (size_t run = j - i - 1; ; run >>= 7)
+			{
+				if (run < 0x80)
+				{
+					*out++ = (uint8_t)run;
+					break;
+				}
+				*out++ = (uint8_t)(run | 0x80);
+			}
+			i = j;
+		}
+		return out - begin;
+	}
+
+	bool decodePlayers(const uint8_t* data, size_t size, uint8_t* players, size_t count)
+	{
+		const uint8_t* end = data + size;
+		size_t i = 0;
+		while (i < count && data < end)
+		{
+			uint8_t value = *data++;
+			size_t run = 0;
+			for (unsigned shift = 0; ; shift += 7)
+			{
+				if (data >= end || shift > 28)
+					return false;
+				uint8_t b = *data++;
+				run |= (size_t)(b & 0x7F) << shift;
+				if (!(b & 0x80))
+					break;
+			}
+			if (value > 7 || run >= count - i)
+			{
+				return false;
+			}
+			memset(players + i, value, run + 1);
+			i += run + 1;
+		}
+		return i == count && data == end;
+	}
+}
+
+bool DepthCodec::encode(const uint16_t* pixels, UINT width, UINT height, UINT stride, std::vector<uint8_t>& out)
+{
+	if (!pixels || !width || !height || width > 0xFFFF || height > 0xFFFF || stride < width * sizeof(uint16_t))
+	{
+		return false;
+	}
+	size_t count = (size_t)width * height;
+	// worst cases: 40 bits a pixel plus a flag a row, two bytes a player run
+	size_t depthBound = (count * 40 + height) / 8 + 8;
+	size_t playerBound = count * 2 + 8;
+	size_t start = out.size();
+	out.resize(start + sizeof(DepthFrameHeader) + depthBound + playerBound);
+
+	depth[0].resize(width);
+	depth[1].resize(width);
+	residuals.resize(width);
+	players.resize(count);
+
+	BitWriter bits(&out[start + sizeof(DepthFrameHeader)]);
+	RiceState rice;
+	for (UINT y = 0; y < height; ++y)
+	{
+		const uint16_t* row = (const uint16_t*)((const uint8_t*)pixels + (size_t)y * stride);
+		int16_t* current = &depth[y & 1][0];
+		splitRow(row, current, &players[(size_t)y * width], width);
+		bool changed = y == 0 ? predictFirstRow(current, &residuals[0], width) :
+			predictRow(current, &depth[(y + 1) & 1][0], &residuals[0], width);
+		bits.put(changed ? 1 : 0, 1);
+		if (changed)
+		{
+			for (UINT x = 0; x < width; ++x)
+			{
+				encodeResidual(bits, rice, residuals[x]);
+			}
+		}
+	}
+	size_t depthBytes = bits.finish();
+	size_t playerBytes = encodePlayers(&players[0], count, &out[start + sizeof(DepthFrameHeader) + depthBytes]);
+
+	DepthFrameHeader header;
+	header.magic = DEPTH_CODEC_MAGIC;
+	header.width = (uint16_t)width;
+	header.height = (uint16_t)height;
+	header.depthBytes = (uint32_t)depthBytes;
+	header.playerBytes = (uint32_t)playerBytes;
+	memcpy(&out[start], &header, sizeof(header));
+	out.resize(start + sizeof(header) + depthBytes + playerBytes);
+	return true;
+}
+
+size_t DepthCodec::peek(const uint8_t* data, size_t size, UINT* width, UINT* height)
+{
+	DepthFrameHeader header;
+	if (!data || size < sizeof(header))
+	{
+		return 0;
+	}
+	memcpy(&header, data, sizeof(header));
+	size_t total = sizeof(header) + (size_t)header.depthBytes + header.playerBytes;
+	if (header.magic != DEPTH_CODEC_MAGIC || total > size)
+	{
+		return 0;
+	}
+	if (width)
+		*width = header.width;
+	if (height)
+		*height = header.height;
+	return total;
+}
+
+bool DepthCodec::decode(const uint8_t* data, size_t size, uint16_t* pixels, UINT width, UINT height, UINT stride)
+{
+	UINT frameWidth = 0, frameHeight = 0;
+	if (!pixels || !peek(data, size, &frameWidth, &frameHeight) || frameWidth != width || frameHeight != height ||
+		stride < width * sizeof(uint16_t))
+	{
+		return false;
+	}
+	DepthFrameHeader header;
+	memcpy(&header, data, sizeof(header));
+	const uint8_t* depthData = data + sizeof(header);
+	size_t count = (size_t)width * height;
+
+	players.resize(count);
+	if (!decodePlayers(depthData + header.depthBytes, header.playerBytes, &players[0], count))
+	{
+		return false;
+	}
+
+	depth[0].resize(width);
+	depth[1].resize(width);
+	residuals.resize(width);
+	BitReader bits(depthData, header.depthBytes);
+	RiceState rice;
+	for (UINT y = 0; y < height; ++y)
+	{
+		int16_t* current = &depth[y & 1][0];
+		const int16_t* above = &depth[(y + 1) & 1][0];
+		bits.refill();
+		if (bits.get(1))
+		{
+			for (UINT x = 0; x < width; ++x)
+			{
+				residuals[x] = decodeResidual(bits, rice);
+			}
+		}
+		else
+		{
+			memset(&residuals[0], 0, width * sizeof(uint16_t));
+		}
+		if (y == 0)
+			reconstructFirstRow(&residuals[0], current, width);
+		else
+			reconstructRow(&residuals[0], above, current, width);
+		mergeRow(current, &players[(size_t)y * width], (uint16_t*)((uint8_t*)pixels + (size_t)y * stride), width);
+	}
+	return !bits.overrun();
+}
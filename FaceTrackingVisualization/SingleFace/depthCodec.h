@@ -0,0 +1,53 @@
+#ifndef DEPTH_CODEC_H
+#define DEPTH_CODEC_H
+
+#include "portable.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// Lossless compression of FTIMAGEFORMAT_UINT16_D13P3 depth frames (13 bit
+// depth above a 3 bit player index) for recordings.
+//
+// The player indices are split off into a byte plane and run length coded,
+// they are zero almost everywhere. Each depth row is predicted by the row
+// above it (the first row by its left neighbour) and the residuals are
+// Rice coded with a parameter that follows the local noise, rows without
+// any change cost one bit. Splitting, prediction and reconstruction run on
+// SSE2 eight pixels at a time, only the bit coder is scalar.
+//
+// An encoded frame is self-contained: a DepthFrameHeader, the depth bits,
+// then the player runs.
+
+#define DEPTH_CODEC_MAGIC	0x31435044u		// "DPC1"
+
+struct DepthFrameHeader
+{
+	uint32_t magic;
+	uint16_t width;
+	uint16_t height;
+	uint32_t depthBytes;
+	uint32_t playerBytes;
+};
+
+// Keeps its scratch rows between frames, use one per thread.
+class DepthCodec
+{
+public:
+	// Appends the encoded frame to out. stride is in bytes.
+	bool encode(const uint16_t* pixels, UINT width, UINT height, UINT stride, std::vector<uint8_t>& out);
+	// Decodes one frame of exactly width x height, false on corrupt or
+	// truncated data.
+	bool decode(const uint8_t* data, size_t size, uint16_t* pixels, UINT width, UINT height, UINT stride);
+
+	// Size of an encoded frame and its dimensions, without decoding it.
+	static size_t peek(const uint8_t* data, size_t size, UINT* width, UINT* height);
+
+private:
+	std::vector<int16_t> depth[2];		// this row and the one above
+	std::vector<uint16_t> residuals;
+	std::vector<uint8_t> players;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#include "stdafx.h"
+#include "gazeTracking.h"
+#include "eyeCenterKernel.h"
+
+template<int Width, int BlurSize>
+void EyeCenterKernel<Width, BlurSize>::run(const cv::Mat& eyeROI, double gradientThreshold, double weightDivisor, GazeScratch& s, cv::Mat& out)
+{
+	CV_Assert(eyeROI.type() == CV_8U && eyeROI.cols == Width && eyeROI.rows > 1);
+	const int rows = eyeROI.rows;
+
+	//-- Find the gradient
+	s.gradientX.create(rows, Width, CV_64F);
+	s.gradientY.create(rows, Width, CV_64F);
+	s.mags.create(rows, Width, CV_64F);
+	for (int y = 0; y < rows; ++y) {
+		const uchar *Mr = eyeROI.ptr<uchar>(y);
+		const uchar *Mp = eyeROI.ptr<uchar>(y > 0 ? y-1 : y);
+		const uchar *Mn = eyeROI.ptr<uchar>(y < rows-1 ? y+1 : y);
+		const double yScale = (y > 0 && y < rows-1) ? 0.5 : 1.0;
+		double *Xr = s.gradientX.ptr<double>(y);
+		double *Yr = s.gradientY.ptr<double>(y);
+		double *Gr = s.mags.ptr<double>(y);
+
+		Xr[0] = Mr[1] - Mr[0];
+		for (int x = 1; x < Width - 1; ++x) {
+			Xr[x] = (Mr[x+1] - Mr[x-1])*0.5;
+		}
+		Xr[Width-1] = Mr[Width-1] - Mr[Width-2];
+
+		for (int x = 0; x < Width; ++x) {
+			Yr[x] = (Mn[x] - Mp[x])*yScale;
+			Gr[x] = sqrt(Xr[x]*Xr[x] + Yr[x]*Yr[x]);
+		}
+	}
+
+	//-- Normalize and threshold the gradient
+	cv::Scalar stdMagnGrad, meanMagnGrad;
+	cv::meanStdDev(s.mags, meanMagnGrad, stdMagnGrad);
+	const double gradientThresh = gradientThreshold * stdMagnGrad[0] / sqrt((double)rows*Width) + meanMagnGrad[0];
+	for (int y = 0; y < rows; ++y) {
+		double *Xr = s.gradientX.ptr<double>(y), *Yr = s.gradientY.ptr<double>(y);
+		const double *Gr = s.mags.ptr<double>(y);
+		for (int x = 0; x < Width; ++x) {
+			const double keep = Gr[x] > gradientThresh ? 1.0/Gr[x] : 0.0;
+			Xr[x] *= keep;
+			Yr[x] *= keep;
+		}
+	}
+
+	//-- Create a blurred and inverted image for weighting
+	GaussianBlur(eyeROI, s.weight, cv::Size(BlurSize, BlurSize), 0, 0);
+	for (int y = 0; y < rows; ++y) {
+		uchar *Wr = s.weight.ptr<uchar>(y);
+		for (int x = 0; x < Width; ++x) {
+			Wr[x] = (uchar)(255 - Wr[x]);
+		}
+	}
+
+	//-- Vote for every possible centre
+	// (d.g)^2/|d|^2 is the squared clamped dot product of the normalised
+	// displacement, which avoids a sqrt and a branch per centre.
+	s.outSum.create(rows, Width, CV_64F);
+	s.outSum.setTo(cv::Scalar::all(0));
+	const double invDivisor = 1.0/weightDivisor;
+	for (int y = 0; y < rows; ++y) {
+		const uchar *Wr = s.weight.ptr<uchar>(y);
+		const double *Xr = s.gradientX.ptr<double>(y), *Yr = s.gradientY.ptr<double>(y);
+		for (int x = 0; x < Width; ++x) {
+			const double gx = Xr[x], gy = Yr[x];
+			if (gx == 0.0 && gy == 0.0) {
+				continue;
+			}
+			const double w = Wr[x]*invDivisor;
+			for (int cy = 0; cy < rows; ++cy) {
+				double *Or = s.outSum.ptr<double>(cy);
+				const double dy = y - cy;
+				const double dy2 = dy*dy;
+				const double gyDy = gy*dy;
+				for (int cx = 0; cx < Width; ++cx) {
+					const double dx = x - cx;
+					const double dot = dx*gx + gyDy;
+					const double d2 = dx*dx + dy2;
+					Or[cx] += dot > 0.0 ? dot*dot/d2*w : 0.0;
+				}
+			}
+		}
+	}
+
+	// scale all the values down, basically averaging them
+	s.outSum.convertTo(out, CV_32F, 1.0/(rows*Width));
+}
+
+namespace {
+
+	struct KernelEntry
+	{
+		int width;
+		int blurSize;
+		EyeCenterKernelFn fn;
+	};
+
+	// Sizes worth a specialisation: the default 50/5 plus the faster and the
+	// finer operating points.
+	const KernelEntry kKernels[] = {
+		{30, 3, &EyeCenterKernel<30, 3>::run},
+		{30, 5, &EyeCenterKernel<30, 5>::run},
+		{40, 3, &EyeCenterKernel<40, 3>::run},
+		{40, 5, &EyeCenterKernel<40, 5>::run},
+		{50, 3, &EyeCenterKernel<50, 3>::run},
+		{50, 5, &EyeCenterKernel<50, 5>::run},
+		{60, 3, &EyeCenterKernel<60, 3>::run},
+		{60, 5, &EyeCenterKernel<60, 5>::run},
+	};
+}
+
+EyeCenterKernelFn selectEyeCenterKernel(int fastEyeWidth, int weightBlurSize)
+{
+	for (size_t i = 0; i < sizeof(kKernels)/sizeof(kKernels[0]); ++i)
+	{
+		if (kKernels[i].width == fastEyeWidth && kKernels[i].blurSize == weightBlurSize)
+		{
+			return kKernels[i].fn;
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,26 @@
+#ifndef EYE_CENTER_KERNEL_H
+#define EYE_CENTER_KERNEL_H
+
+#include <opencv2/core/core.hpp>
+
+struct GazeScratch;
+
+// Computes the averaged centre voting objective of an eye patch that was
+// already scaled to the fast eye width. Same maths as the generic path in
+// GazeTracking::findEyeCenter, but the patch width and the weight blur size
+// are template parameters so the per-centre loops have a fixed trip count.
+template<int Width, int BlurSize>
+struct EyeCenterKernel
+{
+	enum { kWidth = Width, kBlurSize = BlurSize };
+
+	static void run(const cv::Mat& eyeROI, double gradientThreshold, double weightDivisor, GazeScratch& s, cv::Mat& out);
+};
+
+typedef void (*EyeCenterKernelFn)(const cv::Mat& eyeROI, double gradientThreshold, double weightDivisor, GazeScratch& s, cv::Mat& out);
+
+// Returns the pre-instantiated kernel matching the parameters, or NULL when
+// there is none and the generic path has to be used.
+EyeCenterKernelFn selectEyeCenterKernel(int fastEyeWidth, int weightBlurSize);
+
+#endif
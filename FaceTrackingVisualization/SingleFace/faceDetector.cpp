@@ -0,0 +1,82 @@
+#include "stdafx.h"
+#include "faceDetector.h"
+
+#include <algorithm>
+
+int faceSizeAtDistance(float focalLength, float faceWidth, float distance)
+{
+	if (distance <= 0.0f)
+		return 0;
+	return (int)(focalLength * faceWidth / distance + 0.5f);
+}
+
+bool CascadeFaceDetector::load(const std::string& file)
+{
+	return cascade.loadCached(file);
+}
+
+const char* CascadeFaceDetector::name() const
+{
+	if (cascade.empty())
+		return "none";
+	if (cascade.isOldFormatCascade())
+		return "haar";
+	return cascade.getFeatureType() == cv::FeatureEvaluator::LBP ? "lbp" : "haar";
+}
+
+void CascadeFaceDetector::detect(const cv::Mat& gray, std::vector<cv::Rect>& faces, const FaceDetectOptions& options)
+{
+	faces.clear();
+	cascade.detectMultiScale(gray, faces, options.scaleFactor, options.minNeighbors,
+		CV_HAAR_SCALE_IMAGE|CV_HAAR_FIND_BIGGEST_OBJECT, options.minSize, options.maxSize);
+}
+
+PyramidFaceDetector::PyramidFaceDetector(FaceDetector* innerDetector, int factor):inner(innerDetector),factor(factor)
+{
+
+}
+
+const char* PyramidFaceDetector::name() const
+{
+	return factor >= 4 ? "pyramid4" : "pyramid2";
+}
+
+void PyramidFaceDetector::detect(const cv::Mat& gray, std::vector<cv::Rect>& faces, const FaceDetectOptions& options)
+{
+	faces.clear();
+	if (factor <= 1)
+	{
+		inner->detect(gray, faces, options);
+		return;
+	}
+
+	// coarse pass, the cascade window limits how small the scaled face may get
+	cv::resize(gray, small, cv::Size(gray.cols / factor, gray.rows / factor), 0, 0, cv::INTER_AREA);
+	FaceDetectOptions coarseOptions(options);
+	coarseOptions.minSize = cv::Size(std::max(options.minSize.width / factor, 20), std::max(options.minSize.height / factor, 20));
+	if (options.maxSize.area() > 0)
+		coarseOptions.maxSize = cv::Size(options.maxSize.width / factor, options.maxSize.height / factor);
+	inner->detect(small, coarse, coarseOptions);
+
+	const cv::Rect frameRect(0, 0, gray.cols, gray.rows);
+	for (size_t i = 0; i < coarse.size(); ++i)
+	{
+		cv::Rect box(coarse[i].x * factor, coarse[i].y * factor, coarse[i].width * factor, coarse[i].height * factor);
+
+		// the coarse box is off by up to one scale step plus the downscale
+		// rounding, search a quarter of its size around it
+		int margin = box.width / 4;
+		cv::Rect window = cv::Rect(box.x - margin, box.y - margin, box.width + 2 * margin, box.height + 2 * margin) & frameRect;
+
+		FaceDetectOptions fineOptions(options);
+		fineOptions.minSize = cv::Size(box.width * 4 / 5, box.height * 4 / 5);
+		fineOptions.maxSize = window.size();
+		inner->detect(gray(window), refined, fineOptions);
+
+		if (!refined.empty())
+		{
+			box = refined[0] + window.tl();
+		}
+		faces.push_back(box & frameRect);
+	}
+}
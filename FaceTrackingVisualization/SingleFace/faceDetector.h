@@ -0,0 +1,78 @@
+#ifndef FACE_DETECTOR_H
+#define FACE_DETECTOR_H
+
+#include "cascadeCache.h"
+
+#include <string>
+#include <vector>
+
+// Search settings shared by all detector backends.
+struct FaceDetectOptions
+{
+	FaceDetectOptions() : scaleFactor(1.1), minNeighbors(2), minSize(150, 150), maxSize() {}
+
+	double scaleFactor;
+	int minNeighbors;
+	cv::Size minSize;
+	cv::Size maxSize;	// empty means no limit
+};
+
+// Nominal focal length of the Kinect colour camera at 640x480, in pixels.
+const float kNominalFocalLength640 = 531.15f;
+
+// Expected size in pixels of a face of faceWidth metres at distance metres.
+int faceSizeAtDistance(float focalLength, float faceWidth, float distance);
+
+// Finds the biggest face in a grey image. Implementations are not required
+// to be reentrant, GazeTracking serialises calls.
+class FaceDetector
+{
+public:
+	virtual ~FaceDetector() {}
+
+	virtual const char* name() const = 0;
+	virtual bool empty() const = 0;
+	virtual void detect(const cv::Mat& gray, std::vector<cv::Rect>& faces, const FaceDetectOptions& options) = 0;
+};
+
+// Haar or LBP cascade, whichever the model file contains. Old style haar
+// cascades go through the binary cache.
+class CascadeFaceDetector : public FaceDetector
+{
+public:
+	bool load(const std::string& file);
+
+	const char* name() const;
+	bool empty() const {return cascade.empty();}
+	void detect(const cv::Mat& gray, std::vector<cv::Rect>& faces, const FaceDetectOptions& options);
+
+	CachedCascadeClassifier& getCascade() {return cascade;}
+
+private:
+	CachedCascadeClassifier cascade;
+};
+
+// Runs the inner detector on a 2x or 4x downscaled image, then refines every
+// hit at full resolution in a window around the scaled up box. The coarse
+// box is kept when the refinement finds nothing.
+class PyramidFaceDetector : public FaceDetector
+{
+public:
+	explicit PyramidFaceDetector(FaceDetector* innerDetector, int factor = 2);
+
+	void setFactor(int newFactor) {factor = newFactor;}
+	int getFactor() const {return factor;}
+
+	const char* name() const;
+	bool empty() const {return !inner || inner->empty();}
+	void detect(const cv::Mat& gray, std::vector<cv::Rect>& faces, const FaceDetectOptions& options);
+
+private:
+	FaceDetector* inner;
+	int factor;
+	cv::Mat small;
+	std::vector<cv::Rect> coarse;
+	std::vector<cv::Rect> refined;
+};
+
+#endif
@@ -0,0 +1,139 @@
+#include "stdafx.h"
+#include "faceGeometry.h"
+#include "sharedResultRing.h"
+
+FaceTopology::FaceTopology():m_vertexCount(0)
+{
+
+}
+
+bool FaceTopology::Init(IFTModel* model)
+{
+	FT_TRIANGLE* pTriangles = NULL;
+	UINT triangleCount = 0;
+	if (!model || FAILED(model->GetTriangles(&pTriangles, &triangleCount)) || !pTriangles)
+	{
+		return false;
+	}
+	m_vertexCount = model->GetVertexCount();
+	m_triangles.assign(pTriangles, pTriangles + triangleCount);
+	if (m_vertexCount > VERTEXCOUNT || m_vertexCount > 0xFFFF)
+	{
+		return false;
+	}
+
+	// each interior edge is shared by two triangles, keep one copy of it
+	std::vector<UINT> keys;
+	keys.reserve(triangleCount * 3);
+	for (UINT t = 0; t < triangleCount; ++t)
+	{
+		UINT v[3] = {(UINT)pTriangles[t].i, (UINT)pTriangles[t].j, (UINT)pTriangles[t].k};
+		for (int e = 0; e < 3; ++e)
+		{
+			UINT a = v[e], b = v[(e + 1) % 3];
+			keys.push_back(a < b ? (a << 16) | b : (b << 16) | a);
+		}
+	}
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+	m_edges.resize(keys.size() * 2);
+	for (size_t n = 0; n < keys.size(); ++n)
+	{
+		m_edges[2 * n] = keys[n] >> 16;
+		m_edges[2 * n + 1] = keys[n] & 0xFFFF;
+	}
+	return true;
+}
+
+BOOL CALLBACK FaceTopology::InitOnceCallback(PINIT_ONCE initOnce, PVOID parameter, PVOID* context)
+{
+	UNREFERENCED_PARAMETER(initOnce);
+	FaceTopology* topology = new FaceTopology();
+	if (!topology->Init(static_cast<IFTModel*>(parameter)))
+	{
+		delete topology;
+		return FALSE;
+	}
+	*context = topology;
+	return TRUE;
+}
+
+const FaceTopology* FaceTopology::Get(IFTModel* model)
+{
+	// lives until the process exits, every FaceGeometry refers to it
+	static INIT_ONCE initOnce = INIT_ONCE_STATIC_INIT;
+	PVOID context = NULL;
+	if (!InitOnceExecuteOnce(&initOnce, InitOnceCallback, model, &context))
+	{
+		return NULL;
+	}
+	return static_cast<const FaceTopology*>(context);
+}
+
+FaceGeometry::FaceGeometry()
+{
+	memset(this, 0, sizeof(*this));
+}
+
+HRESULT FaceGeometry::Compute(IFTModel* model, IFTResult* result, const FLOAT* pSU, UINT numSU, const FT_CAMERA_CONFIG& config)
+{
+	valid = false;
+	if (!model || !result || !pSU)
+	{
+		return E_POINTER;
+	}
+	if (model->GetVertexCount() > VERTEXCOUNT)
+	{
+		return E_UNEXPECTED;
+	}
+
+	FLOAT* pAUs = NULL;
+	UINT numAU = 0;
+	HRESULT hr = result->GetAUCoefficients(&pAUs, &numAU);
+	if (FAILED(hr) || FAILED(hr = result->Get3DPose(&scale, rotation, translation)))
+	{
+		return hr;
+	}
+	result->GetFaceRect(&faceRect);
+	cameraConfig = config;
+
+	suCount = numSU < FACE_MAX_SU ? numSU : FACE_MAX_SU;
+	memcpy(su, pSU, suCount * sizeof(FLOAT));
+	auCount = numAU < FACE_MAX_AU ? numAU : FACE_MAX_AU;
+	memcpy(au, pAUs, auCount * sizeof(FLOAT));
+
+	POINT viewOffset = {0, 0};
+	UINT vertexCount = model->GetVertexCount();
+	hr = model->Get3DShape(pSU, model->GetSUCount(), pAUs, model->GetAUCount(), scale, rotation, translation, pts3D, vertexCount);
+	if (SUCCEEDED(hr))
+	{
+		hr = model->GetProjectedShape(&cameraConfig, 1.0, viewOffset, pSU, model->GetSUCount(), pAUs, numAU,
+			scale, rotation, translation, pts2D, vertexCount);
+	}
+	valid = SUCCEEDED(hr);
+	return hr;
+}
+
+void FaceGeometry::Export(SharedTrackingRecord& record) const
+{
+	record.scale = scale;
+	for (int i = 0; i < 3; ++i)
+	{
+		record.rotation[i] = rotation[i];
+		record.translation[i] = translation[i];
+	}
+	record.faceRect[0] = faceRect.left;
+	record.faceRect[1] = faceRect.top;
+	record.faceRect[2] = faceRect.right;
+	record.faceRect[3] = faceRect.bottom;
+	record.auCount = auCount < SHARED_RING_MAX_AU ? auCount : SHARED_RING_MAX_AU;
+	memcpy(record.au, au, record.auCount * sizeof(float));
+	record.vertexCount = VERTEXCOUNT < SHARED_RING_MAX_VERTICES ? VERTEXCOUNT : SHARED_RING_MAX_VERTICES;
+	for (UINT i = 0; i < record.vertexCount; ++i)
+	{
+		record.vertices[i][0] = pts3D[i].x;
+		record.vertices[i][1] = pts3D[i].y;
+		record.vertices[i][2] = pts3D[i].z;
+	}
+}
@@ -0,0 +1,77 @@
+#ifndef FACE_GEOMETRY_H
+#define FACE_GEOMETRY_H
+
+#include <FaceTrackLib.h>
+
+#include <vector>
+#include <algorithm>
+
+#define VERTEXCOUNT 121
+#define TRIANGLECOUNT 206
+
+#define FACE_MAX_SU 16
+#define FACE_MAX_AU 16
+
+struct SharedTrackingRecord;
+
+// The face model's triangle list never changes while the process runs, so it
+// is read from the SDK once and shared read-only by every thread.
+class FaceTopology
+{
+public:
+	// The first call copies the topology out of model, later calls ignore it.
+	// Returns NULL only if that first copy failed.
+	static const FaceTopology* Get(IFTModel* model);
+
+	UINT GetVertexCount() const			{return m_vertexCount;}
+	UINT GetTriangleCount() const		{return (UINT)m_triangles.size();}
+	const FT_TRIANGLE* GetTriangles() const {return m_triangles.empty() ? NULL : &m_triangles[0];}
+
+	// every mesh edge once, as vertex index pairs, for the wireframe renderers
+	UINT GetEdgeCount() const			{return (UINT)m_edges.size() / 2;}
+	const UINT* GetEdges() const		{return m_edges.empty() ? NULL : &m_edges[0];}
+
+private:
+	FaceTopology();
+	bool Init(IFTModel* model);
+	static BOOL CALLBACK InitOnceCallback(PINIT_ONCE initOnce, PVOID parameter, PVOID* context);
+
+	UINT m_vertexCount;
+	std::vector<FT_TRIANGLE> m_triangles;
+	std::vector<UINT> m_edges;
+};
+
+// Everything the consumers of one tracked frame need, computed once from the
+// SDK. Plain data of fixed size, so it can be copied between threads as a
+// whole.
+struct FaceGeometry
+{
+	FaceGeometry();
+
+	// Fills the snapshot from one tracking result; pSU are the tracker's
+	// current shape units. The 2D points are projected into the colour image
+	// without zoom or offset.
+	HRESULT Compute(IFTModel* model, IFTResult* result, const FLOAT* pSU, UINT numSU, const FT_CAMERA_CONFIG& config);
+	// Copies pose, AUs and 3D vertices into the shared memory record layout;
+	// frame id, timestamp, flags and pupils are left to the caller.
+	void Export(SharedTrackingRecord& record) const;
+
+	bool valid;
+	UINT frameId;
+
+	FLOAT scale;
+	FLOAT rotation[3];
+	FLOAT translation[3];
+	RECT faceRect;
+	FT_CAMERA_CONFIG cameraConfig;
+
+	UINT suCount;
+	FLOAT su[FACE_MAX_SU];
+	UINT auCount;
+	FLOAT au[FACE_MAX_AU];
+
+	FT_VECTOR3D pts3D[VERTEXCOUNT];
+	FT_VECTOR2D pts2D[VERTEXCOUNT];
+};
+
+#endif
@@ -0,0 +1,268 @@
+#include "stdafx.h"
+#include "faceMeshRenderer.h"
+#include "faceGeometry.h"
+
+#include <math.h>
+
+// GL 1.5 buffer objects are not in the Windows gl.h, they come through
+// wglGetProcAddress (or the ARB names on older drivers)
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER					0x8892
+#define GL_ELEMENT_ARRAY_BUFFER			0x8893
+#define GL_STREAM_DRAW					0x88E0
+#define GL_STATIC_DRAW					0x88E4
+#endif
+
+namespace
+{
+	typedef ptrdiff_t GLsizeiptrType;
+	typedef ptrdiff_t GLintptrType;
+
+	typedef void (APIENTRY *GenBuffersProc)(GLsizei n, GLuint* buffers);
+	typedef void (APIENTRY *DeleteBuffersProc)(GLsizei n, const GLuint* buffers);
+	typedef void (APIENTRY *BindBufferProc)(GLenum target, GLuint buffer);
+	typedef void (APIENTRY *BufferDataProc)(GLenum target, GLsizeiptrType size, const GLvoid* data, GLenum usage);
+	typedef void (APIENTRY *BufferSubDataProc)(GLenum target, GLintptrType offset, GLsizeiptrType size, const GLvoid* data);
+
+	GenBuffersProc glGenBuffersPtr = NULL;
+	DeleteBuffersProc glDeleteBuffersPtr = NULL;
+	BindBufferProc glBindBufferPtr = NULL;
+	BufferDataProc glBufferDataPtr = NULL;
+	BufferSubDataProc glBufferSubDataPtr = NULL;
+
+	PROC getProc(const char* name, const char* arbName)
+	{
+		PROC proc = wglGetProcAddress(name);
+		// some drivers return small integers instead of NULL on failure
+		if ((INT_PTR)proc >= -1 && (INT_PTR)proc <= 3)
+		{
+			proc = wglGetProcAddress(arbName);
+		}
+		if ((INT_PTR)proc >= -1 && (INT_PTR)proc <= 3)
+		{
+			proc = NULL;
+		}
+		return proc;
+	}
+
+	// everything is uploaded by offset 0 of the bound buffer
+	const GLvoid* bufferOffset(size_t offset)
+	{
+		return reinterpret_cast<const GLvoid*>(offset);
+	}
+}
+
+FaceMeshRenderer::FaceMeshRenderer():initialized(false), useVbo(false), topology(NULL), edgeIndexCount(0), edgeBuffer(0),
+	vertexBuffer(0), vertexBufferSize(0), sphereVertexBuffer(0), sphereIndexBuffer(0)
+{
+	QueryPerformanceFrequency(&frequency);
+	frameStart.QuadPart = 0;
+	resetStats();
+}
+
+FaceMeshRenderer::~FaceMeshRenderer()
+{
+	// the context may already be gone here, release() is the clean way out
+}
+
+bool FaceMeshRenderer::loadBufferFunctions()
+{
+	glGenBuffersPtr = (GenBuffersProc)getProc("glGenBuffers", "glGenBuffersARB");
+	glDeleteBuffersPtr = (DeleteBuffersProc)getProc("glDeleteBuffers", "glDeleteBuffersARB");
+	glBindBufferPtr = (BindBufferProc)getProc("glBindBuffer", "glBindBufferARB");
+	glBufferDataPtr = (BufferDataProc)getProc("glBufferData", "glBufferDataARB");
+	glBufferSubDataPtr = (BufferSubDataProc)getProc("glBufferSubData", "glBufferSubDataARB");
+	return glGenBuffersPtr && glDeleteBuffersPtr && glBindBufferPtr && glBufferDataPtr && glBufferSubDataPtr;
+}
+
+bool FaceMeshRenderer::init(int sphereSlices, int sphereStacks)
+{
+	if (!wglGetCurrentContext())
+	{
+		return false;
+	}
+	release();
+
+	useVbo = loadBufferFunctions();
+	buildSphere(sphereSlices, sphereStacks);
+
+	if (useVbo)
+	{
+		GLuint buffers[4];
+		glGenBuffersPtr(4, buffers);
+		edgeBuffer = buffers[0];
+		vertexBuffer = buffers[1];
+		sphereVertexBuffer = buffers[2];
+		sphereIndexBuffer = buffers[3];
+
+		glBindBufferPtr(GL_ARRAY_BUFFER, sphereVertexBuffer);
+		glBufferDataPtr(GL_ARRAY_BUFFER, sphereVertices.size() * sizeof(GLfloat), &sphereVertices[0], GL_STATIC_DRAW);
+		glBindBufferPtr(GL_ELEMENT_ARRAY_BUFFER, sphereIndexBuffer);
+		glBufferDataPtr(GL_ELEMENT_ARRAY_BUFFER, sphereIndices.size() * sizeof(GLuint), &sphereIndices[0], GL_STATIC_DRAW);
+		glBindBufferPtr(GL_ARRAY_BUFFER, 0);
+		glBindBufferPtr(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+	initialized = true;
+	return true;
+}
+
+void FaceMeshRenderer::release()
+{
+	if (useVbo && edgeBuffer)
+	{
+		GLuint buffers[4] = {edgeBuffer, vertexBuffer, sphereVertexBuffer, sphereIndexBuffer};
+		glDeleteBuffersPtr(4, buffers);
+	}
+	edgeBuffer = vertexBuffer = sphereVertexBuffer = sphereIndexBuffer = 0;
+	vertexBufferSize = 0;
+	edgeIndexCount = 0;
+	topology = NULL;
+	useVbo = false;
+	initialized = false;
+}
+
+void FaceMeshRenderer::buildSphere(int slices, int stacks)
+{
+	// unit sphere with the same line layout as glutWireSphere
+	slices = slices < 3 ? 3 : slices;
+	stacks = stacks < 2 ? 2 : stacks;
+	const float pi = 3.14159265f;
+
+	sphereVertices.clear();
+	sphereIndices.clear();
+	for (int st = 0; st <= stacks; ++st)
+	{
+		float phi = pi * st / stacks;
+		for (int sl = 0; sl < slices; ++sl)
+		{
+			float theta = 2.0f * pi * sl / slices;
+			sphereVertices.push_back(sinf(phi) * cosf(theta));
+			sphereVertices.push_back(sinf(phi) * sinf(theta));
+			sphereVertices.push_back(cosf(phi));
+		}
+	}
+	for (int st = 0; st <= stacks; ++st)
+	{
+		for (int sl = 0; sl < slices; ++sl)
+		{
+			GLuint v = st * slices + sl;
+			// latitude rings, the poles collapse to a point and are skipped
+			if (st > 0 && st < stacks)
+			{
+				sphereIndices.push_back(v);
+				sphereIndices.push_back(st * slices + (sl + 1) % slices);
+			}
+			// meridians
+			if (st < stacks)
+			{
+				sphereIndices.push_back(v);
+				sphereIndices.push_back(v + slices);
+			}
+		}
+	}
+}
+
+void FaceMeshRenderer::setTopology(const FaceTopology* faceTopology)
+{
+	if (!initialized || faceTopology == topology)
+	{
+		return;
+	}
+	topology = faceTopology;
+	edgeIndexCount = topology ? (GLsizei)topology->GetEdgeCount() * 2 : 0;
+	if (useVbo && edgeIndexCount)
+	{
+		glBindBufferPtr(GL_ELEMENT_ARRAY_BUFFER, edgeBuffer);
+		glBufferDataPtr(GL_ELEMENT_ARRAY_BUFFER, edgeIndexCount * sizeof(GLuint), topology->GetEdges(), GL_STATIC_DRAW);
+		glBindBufferPtr(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+}
+
+void FaceMeshRenderer::drawMesh(const FT_VECTOR3D* vertices, UINT vertexCount)
+{
+	if (!initialized || !edgeIndexCount || !vertices)
+	{
+		return;
+	}
+
+	glEnableClientState(GL_VERTEX_ARRAY);
+	if (useVbo)
+	{
+		GLsizei size = (GLsizei)(vertexCount * sizeof(FT_VECTOR3D));
+		glBindBufferPtr(GL_ARRAY_BUFFER, vertexBuffer);
+		if (size != vertexBufferSize)
+		{
+			glBufferDataPtr(GL_ARRAY_BUFFER, size, vertices, GL_STREAM_DRAW);
+			vertexBufferSize = size;
+		}
+		else
+		{
+			// orphan the old storage so the driver does not wait for last frame's draw
+			glBufferDataPtr(GL_ARRAY_BUFFER, size, NULL, GL_STREAM_DRAW);
+			glBufferSubDataPtr(GL_ARRAY_BUFFER, 0, size, vertices);
+		}
+		glVertexPointer(3, GL_FLOAT, sizeof(FT_VECTOR3D), bufferOffset(0));
+		glBindBufferPtr(GL_ELEMENT_ARRAY_BUFFER, edgeBuffer);
+		glDrawElements(GL_LINES, edgeIndexCount, GL_UNSIGNED_INT, bufferOffset(0));
+		glBindBufferPtr(GL_ELEMENT_ARRAY_BUFFER, 0);
+		glBindBufferPtr(GL_ARRAY_BUFFER, 0);
+	}
+	else
+	{
+		glVertexPointer(3, GL_FLOAT, sizeof(FT_VECTOR3D), vertices);
+		glDrawElements(GL_LINES, edgeIndexCount, GL_UNSIGNED_INT, topology->GetEdges());
+	}
+	glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+void FaceMeshRenderer::drawSphere(const FT_VECTOR3D& center, float radius)
+{
+	if (!initialized)
+	{
+		return;
+	}
+
+	glPushMatrix();
+	glTranslatef(center.x, center.y, center.z);
+	glScalef(radius, radius, radius);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	if (useVbo)
+	{
+		glBindBufferPtr(GL_ARRAY_BUFFER, sphereVertexBuffer);
+		glVertexPointer(3, GL_FLOAT, 0, bufferOffset(0));
+		glBindBufferPtr(GL_ELEMENT_ARRAY_BUFFER, sphereIndexBuffer);
+		glDrawElements(GL_LINES, (GLsizei)sphereIndices.size(), GL_UNSIGNED_INT, bufferOffset(0));
+		glBindBufferPtr(GL_ELEMENT_ARRAY_BUFFER, 0);
+		glBindBufferPtr(GL_ARRAY_BUFFER, 0);
+	}
+	else
+	{
+		glVertexPointer(3, GL_FLOAT, 0, &sphereVertices[0]);
+		glDrawElements(GL_LINES, (GLsizei)sphereIndices.size(), GL_UNSIGNED_INT, &sphereIndices[0]);
+	}
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glPopMatrix();
+}
+
+void FaceMeshRenderer::beginFrame()
+{
+	QueryPerformanceCounter(&frameStart);
+}
+
+void FaceMeshRenderer::endFrame()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	lastFrameMs = (now.QuadPart - frameStart.QuadPart) * 1000.0 / frequency.QuadPart;
+	totalFrameMs += lastFrameMs;
+	maxFrameMs = lastFrameMs > maxFrameMs ? lastFrameMs : maxFrameMs;
+	++frameCount;
+}
+
+void FaceMeshRenderer::resetStats()
+{
+	lastFrameMs = 0.0;
+	totalFrameMs = 0.0;
+	maxFrameMs = 0.0;
+	frameCount = 0;
+}
@@ -0,0 +1,73 @@
+#ifndef FACE_MESH_RENDERER_H
+#define FACE_MESH_RENDERER_H
+
+#include <windows.h>
+#include <GL/gl.h>
+#include <FaceTrackLib.h>
+
+#include <vector>
+
+class FaceTopology;
+
+// Retained-mode wireframe of the face mesh and the two pupil spheres. The
+// edge indices and the sphere mesh are uploaded once, only the vertices are
+// streamed each frame. Uses vertex buffer objects when the driver has them
+// and plain client-side vertex arrays otherwise (e.g. the GDI software GL of
+// an offscreen context), so the output is the same either way.
+class FaceMeshRenderer
+{
+public:
+	FaceMeshRenderer();
+	~FaceMeshRenderer();
+
+	// needs the target GL context to be current
+	bool init(int sphereSlices = 10, int sphereStacks = 10);
+	// frees the buffers, call while the context is still current
+	void release();
+	bool usesVertexBuffers() const {return useVbo;}
+
+	// uploads the edge list of topology the first time it is seen
+	void setTopology(const FaceTopology* topology);
+
+	void drawMesh(const FT_VECTOR3D* vertices, UINT vertexCount);
+	void drawSphere(const FT_VECTOR3D& center, float radius);
+
+	// frame timing, one frame runs from beginFrame() to endFrame()
+	void beginFrame();
+	void endFrame();
+	double getLastFrameMs() const		{return lastFrameMs;}
+	double getAverageFrameMs() const	{return frameCount ? totalFrameMs / frameCount : 0.0;}
+	double getMaxFrameMs() const		{return maxFrameMs;}
+	unsigned getFrameCount() const		{return frameCount;}
+	void resetStats();
+
+private:
+	FaceMeshRenderer(const FaceMeshRenderer&);
+	FaceMeshRenderer& operator=(const FaceMeshRenderer&);
+
+	bool loadBufferFunctions();
+	void buildSphere(int slices, int stacks);
+
+	bool initialized;
+	bool useVbo;
+
+	const FaceTopology* topology;
+	GLsizei edgeIndexCount;
+	GLuint edgeBuffer;
+	GLuint vertexBuffer;
+	GLsizei vertexBufferSize;
+
+	std::vector<GLfloat> sphereVertices;
+	std::vector<GLuint> sphereIndices;
+	GLuint sphereVertexBuffer;
+	GLuint sphereIndexBuffer;
+
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER frameStart;
+	double lastFrameMs;
+	double totalFrameMs;
+	double maxFrameMs;
+	unsigned frameCount;
+};
+
+#endif
@@ -0,0 +1,158 @@
+#include "stdafx.h"
+#include "faceSurfaceIndex.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace {
+
+	int clampCell(float c, int count)
+	{
+		int i = (int)c;
+		return i < 0 ? 0 : (i >= count ? count - 1 : i);
+	}
+}
+
+FaceSurfaceIndex::FaceSurfaceIndex():originX(0.0f),originY(0.0f),cellScaleX(0.0f),cellScaleY(0.0f),gridWidth(0),gridHeight(0)
+{
+
+}
+
+void FaceSurfaceIndex::clear()
+{
+	triangles.clear();
+	bounds.clear();
+	cells.clear();
+	cellStart.clear();
+}
+
+void FaceSurfaceIndex::build(const FT_VECTOR2D* pts2D, const FT_VECTOR3D* pts3D, const FT_TRIANGLE* mesh, UINT triangleCount)
+{
+	clear();
+	if (!pts2D || !pts3D || !mesh || triangleCount == 0)
+		return;
+
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+	triangles.reserve(triangleCount);
+	for (UINT t = 0; t < triangleCount; ++t)
+	{
+		const FT_VECTOR2D& a = pts2D[mesh[t].i];
+		const FT_VECTOR2D& b = pts2D[mesh[t].j];
+		const FT_VECTOR2D& c = pts2D[mesh[t].k];
+		if (!triangles.add(a.x, a.y, b.x, b.y, c.x, c.y, pts3D[mesh[t].i].z, pts3D[mesh[t].j].z, pts3D[mesh[t].k].z, (int)t))
+			continue;	// edge on, covers no pixels
+
+		Bounds box;
+		box.x0 = std::min(a.x, std::min(b.x, c.x));
+		box.y0 = std::min(a.y, std::min(b.y, c.y));
+		box.x1 = std::max(a.x, std::max(b.x, c.x));
+		box.y1 = std::max(a.y, std::max(b.y, c.y));
+		bounds.push_back(box);
+
+		minX = std::min(minX, box.x0);
+		minY = std::min(minY, box.y0);
+		maxX = std::max(maxX, box.x1);
+		maxY = std::max(maxY, box.y1);
+	}
+	if (bounds.empty())
+		return;
+
+	// about one triangle per cell keeps the lists short without many empty cells
+	int side = std::max(1, (int)ceil(sqrt((double)bounds.size())));
+	gridWidth = side;
+	gridHeight = side;
+	originX = minX;
+	originY = minY;
+	cellScaleX = gridWidth / std::max(maxX - minX, 1e-3f);
+	cellScaleY = gridHeight / std::max(maxY - minY, 1e-3f);
+
+	// two passes over the bounding boxes: count, then fill (CSR layout)
+	int cellTotal = gridWidth * gridHeight;
+	cellCount.assign(cellTotal + 1, 0);
+	for (int pass = 0; pass < 2; ++pass)
+	{
+		for (size_t e = 0; e < bounds.size(); ++e)
+		{
+			int x0 = clampCell((bounds[e].x0 - originX) * cellScaleX, gridWidth);
+			int x1 = clampCell((bounds[e].x1 - originX) * cellScaleX, gridWidth);
+			int y0 = clampCell((bounds[e].y0 - originY) * cellScaleY, gridHeight);
+			int y1 = clampCell((bounds[e].y1 - originY) * cellScaleY, gridHeight);
+			for (int y = y0; y <= y1; ++y)
+			{
+				for (int x = x0; x <= x1; ++x)
+				{
+					int cell = y * gridWidth + x;
+					if (pass == 0)
+						++cellCount[cell + 1];
+					else
+						cellTriangles[cellFill[cell]++] = (int)e;
+				}
+			}
+		}
+
+		if (pass == 0)
+		{
+			for (int cell = 0; cell < cellTotal; ++cell)
+				cellCount[cell + 1] += cellCount[cell];
+			cellTriangles.resize(cellCount[cellTotal]);
+			cellFill.assign(cellCount.begin(), cellCount.end() - 1);
+		}
+	}
+
+	// copy the equations into per cell runs padded for the SIMD test
+	cells.reserve(cellTriangles.size() + 3 * cellTotal);
+	cellStart.resize(cellTotal + 1);
+	for (int cell = 0; cell < cellTotal; ++cell)
+	{
+		cellStart[cell] = (int)cells.size();
+		for (int i = cellCount[cell]; i < cellCount[cell + 1]; ++i)
+			cells.append(triangles, cellTriangles[i]);
+		cells.pad();
+	}
+	cellStart[cellTotal] = (int)cells.size();
+}
+
+bool FaceSurfaceIndex::cellOf(float x, float y, int& cell) const
+{
+	if (cellStart.empty())
+		return false;
+	float cx = (x - originX) * cellScaleX;
+	float cy = (y - originY) * cellScaleY;
+	if (cx < 0.0f || cy < 0.0f || cx > (float)gridWidth || cy > (float)gridHeight)
+		return false;
+	cell = clampCell(cy, gridHeight) * gridWidth + clampCell(cx, gridWidth);
+	return true;
+}
+
+bool FaceSurfaceIndex::query(float x, float y, SurfaceHit& hit) const
+{
+	hit = SurfaceHit();
+	int cell;
+	BarycentricHit found;
+	if (!cellOf(x, y, cell) || !cells.locate(x, y, cellStart[cell], cellStart[cell + 1], found))
+		return false;
+
+	hit.triangle = found.id;
+	hit.u = found.u;
+	hit.v = found.v;
+	hit.depth = found.depth;
+	return true;
+}
+
+void FaceSurfaceIndex::query(const float* xs, const float* ys, size_t count, SurfaceHit* hits) const
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		query(xs[i], ys[i], hits[i]);
+	}
+}
+FT_VECTOR3D FaceSurfaceIndex::interpolate(const SurfaceHit& hit, const FT_TRIANGLE* triangles, const FT_VECTOR3D* pts3D)
+{
+	const FT_VECTOR3D& a = pts3D[triangles[hit.triangle].i];
+	const FT_VECTOR3D& b = pts3D[triangles[hit.triangle].j];
+	const FT_VECTOR3D& c = pts3D[triangles[hit.triangle].k];
+	return FT_VECTOR3D(a.x + (b.x - a.x) * hit.u + (c.x - a.x) * hit.v,
+		a.y + (b.y - a.y) * hit.u + (c.y - a.y) * hit.v,
+		a.z + (b.z - a.z) * hit.u + (c.z - a.z) * hit.v);
+}
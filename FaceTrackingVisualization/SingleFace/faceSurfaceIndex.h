@@ -0,0 +1,66 @@
+#ifndef FACE_SURFACE_INDEX_H
+#define FACE_SURFACE_INDEX_H
+
+#include <FaceTrackLib.h>
+#include "barycentricBatch.h"
+
+#include <vector>
+
+// Location of an image point on the projected face mesh. With a, b, c the
+// vertices of the triangle the point is a + u*(b-a) + v*(c-a).
+struct SurfaceHit
+{
+	SurfaceHit() : triangle(-1), u(0.0f), v(0.0f), depth(0.0f) {}
+
+	int triangle;
+	float u;
+	float v;
+	float depth;	// camera space z interpolated at the point
+};
+
+// Uniform grid over the projected triangles of one frame. build() bins every
+// triangle by its bounding box, a query only tests the triangles of a single
+// cell. Each cell holds its own padded copy of the edge equations, so the
+// test runs four triangles at a time. Where the projection overlaps (nose
+// over cheek) the hit nearest to the camera wins.
+class FaceSurfaceIndex
+{
+public:
+	FaceSurfaceIndex();
+
+	void build(const FT_VECTOR2D* pts2D, const FT_VECTOR3D* pts3D, const FT_TRIANGLE* mesh, UINT triangleCount);
+	void clear();
+	bool empty() const {return cellStart.empty();}
+
+	bool query(float x, float y, SurfaceHit& hit) const;
+	// count points at once, e.g. every pixel of a face region
+	void query(const float* xs, const float* ys, size_t count, SurfaceHit* hits) const;
+
+	// point of the 3D mesh at hit
+	static FT_VECTOR3D interpolate(const SurfaceHit& hit, const FT_TRIANGLE* triangles, const FT_VECTOR3D* pts3D);
+
+private:
+	struct Bounds
+	{
+		float x0, y0, x1, y1;
+	};
+
+	bool cellOf(float x, float y, int& cell) const;
+
+	BarycentricBatch triangles;		// one entry per non degenerate triangle
+	std::vector<Bounds> bounds;
+	BarycentricBatch cells;			// entries grouped by cell, each group padded to four
+	std::vector<int> cellStart;		// gridWidth*gridHeight+1 offsets into cells
+	std::vector<int> cellCount;
+	std::vector<int> cellTriangles;	// scratch: entry indices grouped by cell
+	std::vector<int> cellFill;
+
+	float originX;
+	float originY;
+	float cellScaleX;	// cells per pixel
+	float cellScaleY;
+	int gridWidth;
+	int gridHeight;
+};
+
+#endif
@@ -0,0 +1,232 @@
+#include "stdafx.h"
+#include "frameFile.h"
+
+#include <string.h>
+
+FrameFileWriter::FrameFileWriter():file(NULL), frames(0), bytes(0), failed(false)
+{
+	memset(&config, 0, sizeof(config));
+}
+
+FrameFileWriter::~FrameFileWriter()
+{
+	close();
+}
+
+bool FrameFileWriter::open(const std::string& path, const FrameSourceConfig& sourceConfig)
+{
+	close();
+	if (!sourceConfig.colorWidth || !sourceConfig.colorHeight || !(file = fopen(path.c_str(), "wb")))
+	{
+		return false;
+	}
+	config = sourceConfig;
+	FrameFileHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = FRAME_FILE_MAGIC;
+	header.version = FRAME_FILE_VERSION;
+	header.colorWidth = config.colorWidth;
+	header.colorHeight = config.colorHeight;
+	header.depthWidth = config.depthWidth;
+	header.depthHeight = config.depthHeight;
+	header.colorFocalLength = config.colorFocalLength;
+	header.depthFocalLength = config.depthFocalLength;
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	header.tickFrequency = frequency.QuadPart;
+	frames = 0;
+	bytes = sizeof(header);
+	failed = fwrite(&header, sizeof(header), 1, file) != 1;
+	return !failed;
+}
+
+void FrameFileWriter::close()
+{
+	if (file)
+	{
+		failed = fclose(file) != 0 || failed;
+		file = NULL;
+	}
+}
+
+bool FrameFileWriter::write(const SourceFrame& frame)
+{
+	if (!file || failed || !frame.color)
+	{
+		return false;
+	}
+	encoded.clear();
+	bool hasDepth = frame.depth && config.depthWidth && config.depthHeight;
+	if (hasDepth && !codec.encode(frame.depth, config.depthWidth, config.depthHeight, frame.depthStride, encoded))
+	{
+		return false;
+	}
+
+	FrameRecordHeader record;
+	memset(&record, 0, sizeof(record));
+	record.magic = FRAME_RECORD_MAGIC;
+	record.frameId = frame.frameId;
+	record.timestamp = frame.timestamp;
+	record.colorBytes = config.colorWidth * config.colorHeight * 4;
+	record.depthBytes = (uint32_t)encoded.size();
+	for (int i = 0; i < FRAME_SOURCE_SKELETONS; ++i)
+	{
+		const SourceSkeleton& s = frame.skeletons[i];
+		if (s.tracked)
+		{
+			record.skeletonMask |= 1u << i;
+			memcpy(record.skeletons[i], s.head, sizeof(s.head));
+			memcpy(record.skeletons[i] + 3, s.neck, sizeof(s.neck));
+		}
+	}
+
+	bool ok = fwrite(&record, sizeof(record), 1, file) == 1;
+	size_t rowBytes = config.colorWidth * 4;
+	for (UINT y = 0; ok && y < config.colorHeight; ++y)
+	{
+		ok = fwrite(frame.color + (size_t)y * frame.colorStride, 1, rowBytes, file) == rowBytes;
+	}
+	ok = ok && (encoded.empty() || fwrite(&encoded[0], 1, encoded.size(), file) == encoded.size());
+	if (!ok)
+	{
+		failed = true;
+		return false;
+	}
+	++frames;
+	bytes += sizeof(record) + record.colorBytes + record.depthBytes;
+	return true;
+}
+
+FrameFilePlayer::FrameFilePlayer(const std::string& filePath, bool playRealtime, bool playLoop)
+	:path(filePath), realtime(playRealtime), loop(playLoop), file(NULL), tickFrequency(0), frameId(0),
+	started(false), firstRecorded(0), firstPlayed(0)
+{
+	memset(&config, 0, sizeof(config));
+}
+
+FrameFilePlayer::~FrameFilePlayer()
+{
+	close();
+}
+
+HRESULT FrameFilePlayer::open()
+{
+	close();
+	if (!(file = fopen(path.c_str(), "rb")))
+	{
+		return E_FAIL;
+	}
+	FrameFileHeader header;
+	bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+		header.magic == FRAME_FILE_MAGIC && header.version == FRAME_FILE_VERSION &&
+		header.colorWidth && header.colorWidth <= 4096 && header.colorHeight && header.colorHeight <= 4096 &&
+		header.depthWidth <= 4096 && header.depthHeight <= 4096 && header.tickFrequency > 0;
+	if (!ok)
+	{
+		close();
+		return E_FAIL;
+	}
+	config.colorWidth = header.colorWidth;
+	config.colorHeight = header.colorHeight;
+	config.colorFocalLength = header.colorFocalLength;
+	config.depthWidth = header.depthWidth;
+	config.depthHeight = header.depthHeight;
+	config.depthFocalLength = header.depthFocalLength;
+	config.zoomFactor = 1.0f;
+	tickFrequency = header.tickFrequency;
+	color.resize(config.colorWidth * config.colorHeight * 4);
+	depth.resize(config.depthWidth * config.depthHeight);
+	frameId = 0;
+	started = false;
+	return S_OK;
+}
+
+void FrameFilePlayer::close()
+{
+	if (file)
+	{
+		fclose(file);
+		file = NULL;
+	}
+}
+
+// false at the end of the file; a record cut short or damaged ends it too
+bool FrameFilePlayer::readRecord(FrameRecordHeader& record)
+{
+	if (fread(&record, sizeof(record), 1, file) != 1 || record.magic != FRAME_RECORD_MAGIC ||
+		record.colorBytes != color.size() || (record.depthBytes && depth.empty()) || record.depthBytes > 64 * 1024 * 1024)
+	{
+		return false;
+	}
+	encoded.resize(record.depthBytes);
+	if (fread(&color[0], 1, color.size(), file) != color.size() ||
+		(record.depthBytes && fread(&encoded[0], 1, encoded.size(), file) != encoded.size()))
+	{
+		return false;
+	}
+	return !record.depthBytes ||
+		codec.decode(&encoded[0], encoded.size(), &depth[0], config.depthWidth, config.depthHeight, config.depthWidth * sizeof(uint16_t));
+}
+
+void FrameFilePlayer::pace(int64_t recorded)
+{
+	if (!realtime)
+	{
+		return;
+	}
+	LARGE_INTEGER now, frequency;
+	QueryPerformanceCounter(&now);
+	QueryPerformanceFrequency(&frequency);
+	if (!started)
+	{
+		started = true;
+		firstRecorded = recorded;
+		firstPlayed = now.QuadPart;
+		return;
+	}
+	double dueMs = (recorded - firstRecorded) * 1000.0 / tickFrequency;
+	double playedMs = (now.QuadPart - firstPlayed) * 1000.0 / frequency.QuadPart;
+	if (dueMs > playedMs)
+	{
+		Sleep((DWORD)(dueMs - playedMs));
+	}
+}
+
+HRESULT FrameFilePlayer::readFrame(SourceFrame& frame)
+{
+	if (!file)
+	{
+		return E_FAIL;
+	}
+	FrameRecordHeader record;
+	if (!readRecord(record))
+	{
+		if (!loop || !frameId || fseek(file, sizeof(FrameFileHeader), SEEK_SET) != 0)
+		{
+			return S_FALSE;
+		}
+		started = false;
+		if (!readRecord(record))
+		{
+			return S_FALSE;
+		}
+	}
+	pace(record.timestamp);
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	frame.frameId = ++frameId;
+	frame.timestamp = now.QuadPart;
+	frame.color = &color[0];
+	frame.colorStride = config.colorWidth * 4;
+	frame.depth = record.depthBytes ? &depth[0] : NULL;
+	frame.depthStride = config.depthWidth * sizeof(uint16_t);
+	for (int i = 0; i < FRAME_SOURCE_SKELETONS; ++i)
+	{
+		SourceSkeleton& s = frame.skeletons[i];
+		s.tracked = (record.skeletonMask >> i) & 1;
+		memcpy(s.head, record.skeletons[i], sizeof(s.head));
+		memcpy(s.neck, record.skeletons[i] + 3, sizeof(s.neck));
+	}
+	return S_OK;
+}
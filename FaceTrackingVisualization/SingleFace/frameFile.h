@@ -0,0 +1,116 @@
+#ifndef FRAME_FILE_H
+#define FRAME_FILE_H
+
+#include "frameSource.h"
+#include "depthCodec.h"
+
+#include <stdio.h>
+#include <vector>
+
+// Raw sensor frames on disk, to replay a session through the trackers
+// exactly as the camera delivered it. A FrameFileHeader, then per frame a
+// FrameRecordHeader, the colour pixels as they are (width * 4 bytes a row)
+// and the depth compressed with DepthCodec.
+
+#define FRAME_FILE_MAGIC		0x52465446u		// "FTFR"
+#define FRAME_RECORD_MAGIC		0x314d5246u		// "FRM1"
+#define FRAME_FILE_VERSION		1u
+
+// 64 bytes
+struct FrameFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t colorWidth;
+	uint32_t colorHeight;
+	uint32_t depthWidth;
+	uint32_t depthHeight;
+	float colorFocalLength;
+	float depthFocalLength;
+	int64_t tickFrequency;
+	uint32_t reserved[6];
+};
+
+// 176 bytes
+struct FrameRecordHeader
+{
+	uint32_t magic;
+	uint32_t frameId;
+	int64_t timestamp;				// as recorded
+	uint32_t colorBytes;
+	uint32_t depthBytes;
+	uint32_t skeletonMask;			// bit i: skeleton i is tracked
+	uint32_t reserved;
+	float skeletons[FRAME_SOURCE_SKELETONS][6];		// head xyz, neck xyz
+};
+
+// Writes on the calling thread; a 640x480 frame is about 1.3 MB, so this is
+// meant for capturing test sessions rather than hours of tracking.
+class FrameFileWriter
+{
+public:
+	FrameFileWriter();
+	~FrameFileWriter();
+
+	bool open(const std::string& path, const FrameSourceConfig& config);
+	void close();
+	bool isOpen() const	{return file != NULL;}
+
+	bool write(const SourceFrame& frame);
+
+	UINT getFrameCount() const	{return frames;}
+	unsigned long long getBytesWritten() const	{return bytes;}
+	bool hasFailed() const	{return failed;}
+
+private:
+	FrameFileWriter(const FrameFileWriter&);
+	FrameFileWriter& operator=(const FrameFileWriter&);
+
+	FILE* file;
+	FrameSourceConfig config;
+	DepthCodec codec;
+	std::vector<uint8_t> encoded;
+	UINT frames;
+	unsigned long long bytes;
+	bool failed;
+};
+
+class FrameFilePlayer : public FrameSource
+{
+public:
+	// realtime keeps the recorded frame intervals, loop starts over at the end
+	explicit FrameFilePlayer(const std::string& path, bool realtime = false, bool loop = false);
+	~FrameFilePlayer();
+
+	HRESULT open();
+	void close();
+	const FrameSourceConfig& getConfig() const	{return config;}
+	HRESULT readFrame(SourceFrame& frame);
+	const char* getName() const	{return "file";}
+
+private:
+	FrameFilePlayer(const FrameFilePlayer&);
+	FrameFilePlayer& operator=(const FrameFilePlayer&);
+
+	bool readRecord(FrameRecordHeader& record);
+	void pace(int64_t recorded);
+
+	std::string path;
+	bool realtime;
+	bool loop;
+	FILE* file;
+	FrameSourceConfig config;
+	int64_t tickFrequency;			// of the recording
+	DepthCodec codec;
+	std::vector<BYTE> color;
+	std::vector<uint16_t> depth;
+	std::vector<uint8_t> encoded;
+	UINT frameId;
+
+	// first frame since open or the last loop, both clocks
+	bool started;
+	int64_t firstRecorded;
+	LONGLONG firstPlayed;
+};
+
+#endif
@@ -0,0 +1,47 @@
+#include "stdafx.h"
+#include "frameSource.h"
+#include "frameFile.h"
+#include "syntheticFrameSource.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+int SourceFrame::closestSkeleton(const float lastHead[3]) const
+{
+	bool fromCamera = lastHead[0] == 0 && lastHead[1] == 0 && lastHead[2] == 0;
+	int selected = -1;
+	float smallest = 0;
+	for (int i = 0; i < FRAME_SOURCE_SKELETONS; ++i)
+	{
+		const SourceSkeleton& s = skeletons[i];
+		if (!s.tracked)
+		{
+			continue;
+		}
+		float d = fromCamera ? s.head[2] :
+			fabs(s.head[0] - lastHead[0]) + fabs(s.head[1] - lastHead[1]) + fabs(s.head[2] - lastHead[2]);
+		if (selected < 0 || d < smallest)
+		{
+			smallest = d;
+			selected = i;
+		}
+	}
+	return selected;
+}
+
+FrameSource* createFrameSource(const std::string& spec, bool realtime)
+{
+	const std::string synthetic = "synthetic";
+	if (spec.compare(0, synthetic.size(), synthetic) == 0 &&
+		(spec.size() == synthetic.size() || spec[synthetic.size()] == ':'))
+	{
+		UINT frames = spec.size() > synthetic.size() ? (UINT)atoi(spec.c_str() + synthetic.size() + 1) : 0;
+		return new SyntheticFrameSource(frames, realtime ? 33 : 0);
+	}
+	const std::string suffix = ".frames";
+	if (spec.size() > suffix.size() && spec.compare(spec.size() - suffix.size(), suffix.size(), suffix) == 0)
+	{
+		return new FrameFilePlayer(spec, realtime);
+	}
+	return NULL;
+}
@@ -0,0 +1,81 @@
+#ifndef FRAME_SOURCE_H
+#define FRAME_SOURCE_H
+
+#include "portable.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+// Where the trackers get their camera frames from. The Kinect is one
+// source (NuiFrameSource); a recorded frame file (FrameFilePlayer) and a
+// generated scene (SyntheticFrameSource) are others, so the tracking and
+// gaze code can run, be benchmarked and be load tested without a sensor
+// or the Kinect runtime. Only NuiFrameSource needs the Kinect SDK.
+
+#define FRAME_SOURCE_SKELETONS	6		// NUI_SKELETON_COUNT
+
+struct FrameSourceConfig
+{
+	UINT colorWidth;				// B8G8R8X8, 4 bytes a pixel
+	UINT colorHeight;
+	float colorFocalLength;			// pixels
+	UINT depthWidth;				// D13P3, 0 x 0 if the source has no depth
+	UINT depthHeight;
+	float depthFocalLength;
+	float zoomFactor;				// of the colour image, 1 without zoom
+	LONG viewOffsetX;
+	LONG viewOffsetY;
+};
+
+// camera space, m
+struct SourceSkeleton
+{
+	bool tracked;
+	float head[3];
+	float neck[3];
+};
+
+// One frame as the source delivers it. The pixels belong to the source and
+// stay valid until its next readFrame() or close().
+struct SourceFrame
+{
+	SourceFrame()
+	{
+		memset(this, 0, sizeof(*this));
+	}
+
+	// Tracked skeleton whose head is closest to lastHead, or to the camera
+	// if lastHead is all zero; -1 if none is tracked.
+	int closestSkeleton(const float lastHead[3]) const;
+
+	UINT frameId;					// frames delivered by this source, 1 based
+	LONGLONG timestamp;				// QueryPerformanceCounter at delivery
+	const BYTE* color;
+	UINT colorStride;				// bytes
+	const uint16_t* depth;			// NULL without depth
+	UINT depthStride;
+	SourceSkeleton skeletons[FRAME_SOURCE_SKELETONS];
+};
+
+class FrameSource
+{
+public:
+	virtual ~FrameSource() {}
+
+	virtual HRESULT open() = 0;
+	virtual void close() = 0;
+	// valid after a successful open()
+	virtual const FrameSourceConfig& getConfig() const = 0;
+	// S_OK with a frame, S_FALSE once a finite source has no more frames.
+	// A live source hands out its latest frame, a recorded one the next.
+	virtual HRESULT readFrame(SourceFrame& frame) = 0;
+	virtual const char* getName() const = 0;
+};
+
+// Sources that need no SDK, by name: "synthetic[:frames]" or a recorded
+// ".frames" file. realtime paces them like a camera, otherwise they run as
+// fast as they are read. NULL for anything else.
+FrameSource* createFrameSource(const std::string& spec, bool realtime);
+
+#endif
@@ -0,0 +1,240 @@
+#include "stdafx.h"
+#include "gazeService.h"
+#include "asyncLog.h"
+#include "stageStats.h"
+#include "pipelineTrace.h"
+
+#include <fstream>
+
+namespace
+{
+	std::string directoryOf(const std::string& file)
+	{
+		size_t slash = file.find_last_of("/\\");
+		return slash == std::string::npos ? std::string() : file.substr(0, slash + 1);
+	}
+
+	bool endsWith(const std::string& s, const char* suffix)
+	{
+		size_t n = strlen(suffix);
+		return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+	}
+}
+
+GazeService::GazeService():frameIntervalMs(0), frameSource(NULL), nextImage(0), thread(NULL), running(false),
+	status(TRACKER_NOT_STARTED), frameCount(0)
+{
+}
+
+GazeService::~GazeService()
+{
+	stop();
+	resultBus.stop();
+}
+
+HRESULT GazeService::start(const std::string& source, const std::string& cascade, const std::string& config, DWORD intervalMs)
+{
+	if (source.empty() || cascade.empty())
+	{
+		status = TRACKER_INVALID_ARGUMENT;
+		return E_INVALIDARG;
+	}
+	stop();
+
+	sourceName = source;
+	cascadeFile = cascade;
+	configFile = config;
+	frameIntervalMs = intervalMs;
+	frameCount = 0;
+	status = TRACKER_STARTING;
+	running = true;
+	thread = CreateThread(NULL, 0, serviceStaticThread, (PVOID)this, 0, 0);
+	if (!thread)
+	{
+		running = false;
+		status = TRACKER_OUT_OF_MEMORY;
+		return E_OUTOFMEMORY;
+	}
+	return S_OK;
+}
+
+void GazeService::stop()
+{
+	running = false;
+	if (thread)
+	{
+		WaitForSingleObject(thread, INFINITE);
+		CloseHandle(thread);
+		thread = NULL;
+	}
+	if (status == TRACKER_STARTING || status == TRACKER_RUNNING)
+	{
+		status = TRACKER_STOPPED;
+	}
+	// delivers what is still queued; the subscribers stay for the next start()
+	resultBus.flush();
+	capture.release();
+	delete frameSource;
+	frameSource = NULL;
+	imageFiles.clear();
+}
+
+bool GazeService::wait(DWORD ms)
+{
+	if (!thread)
+	{
+		return true;
+	}
+	return WaitForSingleObject(thread, ms) == WAIT_OBJECT_0;
+}
+
+bool GazeService::openSource()
+{
+	imageFiles.clear();
+	nextImage = 0;
+	// the service paces itself, the source runs unpaced
+	delete frameSource;
+	frameSource = createFrameSource(sourceName, false);
+	if (frameSource)
+	{
+		return SUCCEEDED(frameSource->open());
+	}
+	if (endsWith(sourceName, ".txt"))
+	{
+		std::ifstream in(sourceName.c_str());
+		if (!in)
+		{
+			return false;
+		}
+		std::string dir = directoryOf(sourceName);
+		std::string line;
+		while (std::getline(in, line))
+		{
+			size_t comment = line.find('#');
+			if (comment != std::string::npos)
+				line.erase(comment);
+			size_t end = line.find_first_of(" \t\r");
+			if (end != std::string::npos)
+				line.erase(end);
+			if (!line.empty())
+				imageFiles.push_back(dir + line);
+		}
+		return !imageFiles.empty();
+	}
+	return capture.open(sourceName);
+}
+
+bool GazeService::readFrame(cv::Mat& frame)
+{
+	if (frameSource)
+	{
+		// wraps the source's buffer, valid until the next read
+		SourceFrame sourceFrame;
+		if (frameSource->readFrame(sourceFrame) != S_OK)
+			return false;
+		const FrameSourceConfig& config = frameSource->getConfig();
+		frame = cv::Mat(config.colorHeight, config.colorWidth, CV_8UC4, (void*)sourceFrame.color, sourceFrame.colorStride);
+		return true;
+	}
+	if (!imageFiles.empty())
+	{
+		// unreadable images are skipped, not fatal
+		while (nextImage < imageFiles.size())
+		{
+			frame = cv::imread(imageFiles[nextImage++]);
+			if (!frame.empty())
+				return true;
+		}
+		return false;
+	}
+	return capture.read(frame) && !frame.empty();
+}
+
+void GazeService::run()
+{
+	AsyncLog::setThreadName("gaze service");
+	PipelineTrace::setThreadName("gaze service");
+	if (!gaze.initialize(cascadeFile, configFile))
+	{
+		LOG_ERROR("gaze service: cannot load cascade {}", cascadeFile.c_str());
+		status = TRACKER_CASCADE_FAILED;
+		return;
+	}
+	if (!openSource())
+	{
+		LOG_ERROR("gaze service: cannot open source {}", sourceName.c_str());
+		status = TRACKER_SENSOR_FAILED;
+		return;
+	}
+	LOG_INFO("gaze service: cascade loaded in {} ms, reading {}", gaze.getLoadMs(), sourceName.c_str());
+	status = TRACKER_RUNNING;
+
+	cv::Mat frame;
+	GazeResult gazeResult;
+	GazeServiceResult result;
+	DWORD nextFrameTick = GetTickCount();
+	while (running)
+	{
+		bool read;
+		{
+			STAGE_TIMER(STAGE_FRAME_READ);
+			read = readFrame(frame);
+		}
+		if (!read)
+		{
+			status = TRACKER_SOURCE_FINISHED;
+			break;
+		}
+		STAGE_COUNTER(COUNTER_FRAMES);
+		TRACE_FRAME(frameCount + 1);
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+
+		gaze.analyze(frame, gazeResult, &scratch);
+
+		result.frameId = (UINT)InterlockedIncrement(&frameCount);
+		result.timestamp = now.QuadPart;
+		result.findFace = gazeResult.findFace;
+		result.faceX = gazeResult.faceRect.x;
+		result.faceY = gazeResult.faceRect.y;
+		result.faceWidth = gazeResult.faceRect.width;
+		result.faceHeight = gazeResult.faceRect.height;
+		result.leftX = gazeResult.leftPupil.x;
+		result.leftY = gazeResult.leftPupil.y;
+		result.rightX = gazeResult.rightPupil.x;
+		result.rightY = gazeResult.rightPupil.y;
+		result.confidence = gazeResult.confidence;
+		result.analyzeMs = gazeResult.totalMs;
+
+		{
+			STAGE_TIMER(STAGE_PUBLISH);
+			published.write(result);
+			if (resultBus.getSubscriberCount() > 0)
+			{
+				resultBus.publish(std::make_shared<GazeServiceResult>(result));
+			}
+		}
+
+		if (frameIntervalMs)
+		{
+			nextFrameTick += frameIntervalMs;
+			LONG wait = (LONG)(nextFrameTick - GetTickCount());
+			if (wait > 0)
+			{
+				Sleep((DWORD)wait);
+			}
+			else
+			{
+				// fell behind, do not try to catch up with a burst
+				nextFrameTick = GetTickCount();
+			}
+		}
+	}
+}
+
+DWORD WINAPI GazeService::serviceStaticThread(PVOID lpParam)
+{
+	GazeService* context = static_cast<GazeService*>(lpParam);
+	context->run();
+	return (DWORD)context->status;
+}
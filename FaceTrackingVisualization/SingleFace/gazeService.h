@@ -0,0 +1,99 @@
+#ifndef GAZE_SERVICE_H
+#define GAZE_SERVICE_H
+
+#include "portable.h"
+#include "gazeTracking.h"
+#include "trackerStatus.h"
+#include "seqLock.h"
+#include "resultBus.h"
+#include "frameSource.h"
+
+#include <string>
+#include <vector>
+
+// One analysed frame. Plain data so it can go through the seqlock as is.
+struct GazeServiceResult
+{
+	GazeServiceResult()
+	{
+		memset(this, 0, sizeof(*this));
+	}
+
+	UINT frameId;				// frames read from the source so far, 1 based
+	LONGLONG timestamp;			// QueryPerformanceCounter when the frame was read
+	bool findFace;
+	int faceX, faceY, faceWidth, faceHeight;
+	int leftX, leftY;			// pupil centres in frame coordinates
+	int rightX, rightY;
+	float confidence;
+	double analyzeMs;
+};
+
+// Headless gaze tracking: no window, no message boxes, no Kinect. Frames
+// come from a file source, results go out through a result bus and a
+// seqlock snapshot, failures through getStatus(). Builds on Windows and,
+// through portable.h, on Linux.
+//
+// The source is either a video file / image sequence pattern that
+// cv::VideoCapture can open ("clip.avi", "frames/%04d.png"), a text file
+// (.txt) with one image path per line relative to the file, or one of the
+// sensor-free frame sources ("synthetic[:frames]", a recorded ".frames"
+// file, see createFrameSource).
+class GazeService
+{
+public:
+	typedef ResultBus<GazeServiceResult> ServiceResultBus;
+
+	GazeService();
+	~GazeService();
+
+	// Returns at once, the cascade and the source are opened on the service
+	// thread. frameIntervalMs paces the source like a live camera, 0 runs
+	// as fast as the tracker allows.
+	HRESULT start(const std::string& source, const std::string& cascadeFile, const std::string& configFile = std::string(), DWORD frameIntervalMs = 0);
+	// Ends the service thread and waits until the subscribers have every
+	// result; they stay subscribed, the destructor ends them.
+	void stop();
+
+	// Blocks until the source is exhausted or the service failed, false on timeout.
+	bool wait(DWORD ms = INFINITE);
+
+	TrackerStatus getStatus() const	{return status;}
+	LONG getFrameCount() const		{return frameCount;}
+	double getLoadMs() const		{return gaze.getLoadMs();}
+
+	bool getSnapshot(GazeServiceResult& result) const	{return published.read(result);}
+	// every frame is published, subscribe before start() to see all of them
+	ServiceResultBus& getResultBus()	{return resultBus;}
+
+private:
+	GazeService(const GazeService&);
+	GazeService& operator=(const GazeService&);
+
+	bool openSource();
+	bool readFrame(cv::Mat& frame);
+	void run();
+	static DWORD WINAPI serviceStaticThread(PVOID lpParam);
+
+	std::string sourceName;
+	std::string cascadeFile;
+	std::string configFile;
+	DWORD frameIntervalMs;
+
+	cv::VideoCapture capture;
+	FrameSource* frameSource;
+	std::vector<std::string> imageFiles;
+	size_t nextImage;
+
+	GazeTracking gaze;
+	GazeScratch scratch;
+
+	HANDLE thread;
+	volatile bool running;
+	volatile TrackerStatus status;
+	volatile LONG frameCount;
+	SeqLock<GazeServiceResult> published;
+	ServiceResultBus resultBus;
+};
+
+#endif
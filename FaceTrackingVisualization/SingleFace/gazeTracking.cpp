@@ -325,30 +325,291 @@
 
 #include "stdafx.h"
 #include "gazeTracking.h"
+#include "stageStats.h"
 #include <vector>
 #include <queue>
 
-GazeTracking::GazeTracking():kEyePercentTop(25),kEyePercentSide(13),
-	kEyePercentHeight(30),kEyePercentWidth(35), 
-	kFastEyeWidth(50), kWeightBlurSize(5),
-	kWeightDivisor(150.0), kGradientThreshold(50.0),
-	kPostProcessThreshold(0.97), kSmoothFaceImage(false),
-	kSmoothFaceFactor(0.005),kEnableEyeCorner(false),
-	kEnablePostProcess(true)
+namespace {
+
+	double elapsedMs(int64 from)
+	{
+		return (cv::getTickCount() - from) * 1000.0 / cv::getTickFrequency();
+	}
+
+	template<typename T>
+	void readParam(const cv::FileNode& node, const char* name, T& value)
+	{
+		cv::FileNode n = node[name];
+		if (!n.empty())
+		{
+			n >> value;
+		}
+	}
+
+	void readParam(const cv::FileNode& node, const char* name, bool& value)
+	{
+		int v = value ? 1 : 0;
+		readParam(node, name, v);
+		value = v != 0;
+	}
+}
+
+GazeParams::GazeParams():eyePercentTop(25),eyePercentSide(13),
+	eyePercentHeight(30),eyePercentWidth(35),
+	smoothFaceImage(false),smoothFaceFactor(0.005f),
+	fastEyeWidth(50), weightBlurSize(5),
+	weightDivisor(150.0f), gradientThreshold(50.0),
+	enablePostProcess(true), postProcessThreshold(0.97f),
+	enableEyeCorner(false),
+	detectDownscale(1), detectScaleFactor(1.1), detectMinNeighbors(2),
+	faceWidth(0.0f), minUserDistance(0.25f), maxUserDistance(0.55f), focalLength(0.0f)
+{
+}
+
+bool GazeParams::isValid() const
+{
+	return eyePercentWidth > 0 && eyePercentHeight > 0 &&
+		eyePercentTop >= 0 && eyePercentSide >= 0 &&
+		eyePercentSide + eyePercentWidth <= 100 && eyePercentTop + eyePercentHeight <= 100 &&
+		fastEyeWidth >= 8 && weightBlurSize > 0 && (weightBlurSize & 1) == 1 &&
+		weightDivisor > 0.0f && postProcessThreshold > 0.0f && postProcessThreshold <= 1.0f &&
+		(detectDownscale == 1 || detectDownscale == 2 || detectDownscale == 4) &&
+		detectScaleFactor > 1.0 && detectMinNeighbors >= 0 && faceWidth >= 0.0f &&
+		minUserDistance > 0.0f && maxUserDistance > minUserDistance && focalLength >= 0.0f;
+}
+
+FaceDetectOptions GazeParams::detectOptions(const cv::Size& frameSize) const
+{
+	FaceDetectOptions options;
+	options.scaleFactor = detectScaleFactor;
+	options.minNeighbors = detectMinNeighbors;
+	if (faceWidth <= 0.0f)
+	{
+		// the fixed 150 px minimum and no maximum, at any frame size
+		return options;
+	}
+	float f = (focalLength > 0.0f ? focalLength : kNominalFocalLength640) * frameSize.width / 640.0f;
+	int minFace = faceSizeAtDistance(f, faceWidth, maxUserDistance);
+	int maxFace = std::min(faceSizeAtDistance(f, faceWidth, minUserDistance), std::min(frameSize.width, frameSize.height));
+	options.minSize = cv::Size(minFace, minFace);
+	options.maxSize = cv::Size(maxFace, maxFace);
+	return options;
+}
+
+// Reads a YAML or XML file written by save(). Keys that are missing keep
+// their current value, so a file may override only a few knobs.
+bool GazeParams::load(const std::string& file)
+{
+	GazeParams p(*this);
+	try
+	{
+		cv::FileStorage fs(file, cv::FileStorage::READ);
+		if (!fs.isOpened())
+		{
+			return false;
+		}
+		cv::FileNode root = fs.root();
+		readParam(root, "eyePercentTop", p.eyePercentTop);
+		readParam(root, "eyePercentSide", p.eyePercentSide);
+		readParam(root, "eyePercentHeight", p.eyePercentHeight);
+		readParam(root, "eyePercentWidth", p.eyePercentWidth);
+		readParam(root, "smoothFaceImage", p.smoothFaceImage);
+		readParam(root, "smoothFaceFactor", p.smoothFaceFactor);
+		readParam(root, "fastEyeWidth", p.fastEyeWidth);
+		readParam(root, "weightBlurSize", p.weightBlurSize);
+		readParam(root, "weightDivisor", p.weightDivisor);
+		readParam(root, "gradientThreshold", p.gradientThreshold);
+		readParam(root, "enablePostProcess", p.enablePostProcess);
+		readParam(root, "postProcessThreshold", p.postProcessThreshold);
+		readParam(root, "enableEyeCorner", p.enableEyeCorner);
+		readParam(root, "cascadeFile", p.cascadeFile);
+		readParam(root, "detectDownscale", p.detectDownscale);
+		readParam(root, "detectScaleFactor", p.detectScaleFactor);
+		readParam(root, "detectMinNeighbors", p.detectMinNeighbors);
+		readParam(root, "faceWidth", p.faceWidth);
+		readParam(root, "minUserDistance", p.minUserDistance);
+		readParam(root, "maxUserDistance", p.maxUserDistance);
+		readParam(root, "focalLength", p.focalLength);
+	}
+	catch (const cv::Exception&)
+	{
+		return false;
+	}
+
+	if (!p.isValid())
+	{
+		return false;
+	}
+	*this = p;
+	return true;
+}
+
+bool GazeParams::save(const std::string& file) const
 {
+	try
+	{
+		cv::FileStorage fs(file, cv::FileStorage::WRITE);
+		if (!fs.isOpened())
+		{
+			return false;
+		}
+		fs << "eyePercentTop" << eyePercentTop;
+		fs << "eyePercentSide" << eyePercentSide;
+		fs << "eyePercentHeight" << eyePercentHeight;
+		fs << "eyePercentWidth" << eyePercentWidth;
+		fs << "smoothFaceImage" << (int)smoothFaceImage;
+		fs << "smoothFaceFactor" << smoothFaceFactor;
+		fs << "fastEyeWidth" << fastEyeWidth;
+		fs << "weightBlurSize" << weightBlurSize;
+		fs << "weightDivisor" << weightDivisor;
+		fs << "gradientThreshold" << gradientThreshold;
+		fs << "enablePostProcess" << (int)enablePostProcess;
+		fs << "postProcessThreshold" << postProcessThreshold;
+		fs << "enableEyeCorner" << (int)enableEyeCorner;
+		fs << "cascadeFile" << cascadeFile;
+		fs << "detectDownscale" << detectDownscale;
+		fs << "detectScaleFactor" << detectScaleFactor;
+		fs << "detectMinNeighbors" << detectMinNeighbors;
+		fs << "faceWidth" << faceWidth;
+		fs << "minUserDistance" << minUserDistance;
+		fs << "maxUserDistance" << maxUserDistance;
+		fs << "focalLength" << focalLength;
+	}
+	catch (const cv::Exception&)
+	{
+		return false;
+	}
+	return true;
+}
 
+GazeTracking::Model::Model(const GazeParams& modelParams, const std::shared_ptr<CascadeFaceDetector>& modelCascade, double modelLoadMs, bool modelFromCache)
+	:params(modelParams), cascade(modelCascade), pyramid(modelCascade.get(), modelParams.detectDownscale),
+	loadMs(modelLoadMs), fromCache(modelFromCache)
+{
+	eyeCenterKernel = selectEyeCenterKernel(params.fastEyeWidth, params.weightBlurSize);
+}
+
+FaceDetector* GazeTracking::Model::detector() const
+{
+	if (params.detectDownscale > 1)
+		return &pyramid;
+	return cascade.get();
+}
+
+GazeTracking::GazeTracking():ready(0),loaderThread(NULL)
+{
+	InitializeCriticalSection(&cascadeLock);
+	InitializeSRWLock(&modelLock);
+	model = ModelPtr(new Model(GazeParams(), std::make_shared<CascadeFaceDetector>(), 0.0, false));
 }
 
 GazeTracking::~GazeTracking()
 {
+	if (loaderThread)
+	{
+		WaitForSingleObject(loaderThread, INFINITE);
+		CloseHandle(loaderThread);
+	}
+	DeleteCriticalSection(&cascadeLock);
+}
+
+bool GazeTracking::initialize(cv::String xmlFile, const std::string& configFile)
+{
+	int64 start = cv::getTickCount();
+
+	GazeParams fileParams;
+	bool fromFile = !configFile.empty() && fileParams.load(configFile) && fileParams.isValid();
+	std::string cascadeFile = fromFile ? fileParams.cascadeFile : getParams().cascadeFile;
+
+	// loaded aside, analyze() goes on with the current cascade meanwhile
+	std::shared_ptr<CascadeFaceDetector> cascade = std::make_shared<CascadeFaceDetector>();
+	if (!cascade->load(cascadeFile.empty() ? std::string(xmlFile) : cascadeFile))
+	{
+		return false;
+	}
+	// the first detection builds the internal cascade tables, do it here
+	// rather than on the first real frame
+	std::vector<cv::Rect> none;
+	FaceDetectOptions warmUp;
+	cascade->detect(cv::Mat::zeros(160, 160, CV_8U), none, warmUp);
+
+	// without a config file the parameters are the latest, setParams() may
+	// have run during the load
+	double ms = elapsedMs(start);
+	ModelPtr previous;
+	AcquireSRWLockExclusive(&modelLock);
+	previous = model;
+	model = ModelPtr(new Model(fromFile ? fileParams : previous->params, cascade, ms, cascade->getCascade().fromCache()));
+	ReleaseSRWLockExclusive(&modelLock);
+	InterlockedExchange(&ready, 1);
+	return true;
+}
+
+bool GazeTracking::initializeAsync(cv::String xmlFile, const std::string& configFile)
+{
+	if (loaderThread)
+	{
+		WaitForSingleObject(loaderThread, INFINITE);
+		CloseHandle(loaderThread);
+		loaderThread = NULL;
+	}
+	pendingXmlFile = xmlFile;
+	pendingConfigFile = configFile;
+	loaderThread = CreateThread(NULL, 0, loaderStaticThread, (PVOID)this, 0, 0);
+	return loaderThread != NULL;
+}
+
+DWORD WINAPI GazeTracking::loaderStaticThread(PVOID lpParam)
+{
+	GazeTracking* context = static_cast<GazeTracking*>(lpParam);
+	return context->initialize(context->pendingXmlFile, context->pendingConfigFile) ? 0 : 1;
+}
+
+bool GazeTracking::setParams(const GazeParams& newParams)
+{
+	if (!newParams.isValid())
+	{
+		return false;
+	}
+	// same cascade, a reload happens in initialize() only; read and swapped
+	// under one lock so a reload finishing meanwhile is not undone
+	ModelPtr previous;
+	AcquireSRWLockExclusive(&modelLock);
+	previous = model;
+	model = ModelPtr(new Model(newParams, previous->cascade, previous->loadMs, previous->fromCache));
+	ReleaseSRWLockExclusive(&modelLock);
+	return true;
+}
+
+GazeParams GazeTracking::getParams() const
+{
+	return currentModel()->params;
+}
 
+double GazeTracking::getLoadMs() const
+{
+	return currentModel()->loadMs;
+}
+
+bool GazeTracking::isLoadedFromCache() const
+{
+	return currentModel()->fromCache;
 }
 
-bool GazeTracking::initialize(cv::String xmlFile)
+const char* GazeTracking::getDetectorName() const
 {
-	return faceCascade.load(xmlFile);
+	return currentModel()->detector()->name();
 }
 
+GazeTracking::ModelPtr GazeTracking::currentModel() const
+{
+	AcquireSRWLockShared(&modelLock);
+	ModelPtr current = model;
+	ReleaseSRWLockShared(&modelLock);
+	return current;
+}
+
+
 void GazeTracking::process(IplImage* image)
 {
 	cv::Mat frame(image, true);
@@ -357,95 +618,125 @@ void GazeTracking::process(IplImage* image)
 
 void GazeTracking::process(cv::Mat& frame)
 {
-	std::vector<cv::Rect> faces;
-	std::vector<cv::Mat> rgbChannels(frame.channels());
-	cv::split(frame, rgbChannels);
-	cv::Mat frameGray = rgbChannels[2];
+	analyze(frame, lastResult, &scratch);
+}
+
+bool GazeTracking::analyze(const cv::Mat& frame, GazeResult& result, GazeScratch* scratchIn) const
+{
+	STAGE_TIMER(STAGE_GAZE);
+	int64 start = cv::getTickCount();
+	GazeScratch localScratch;
+	GazeScratch& s = scratchIn ? *scratchIn : localScratch;
+
+	result = GazeResult();
+	if (frame.empty() || !isReady())
+	{
+		return false;
+	}
+
+	// one configuration for the whole frame, however often it is swapped meanwhile
+	ModelPtr m = currentModel();
+	cv::split(frame, s.channels);
+	const cv::Mat& frameGray = s.channels[frame.channels() > 2 ? 2 : 0];
 
-	findFace = false;
-	faceCascade.detectMultiScale( frameGray, faces, 1.1, 2, 0|CV_HAAR_SCALE_IMAGE|CV_HAAR_FIND_BIGGEST_OBJECT, cv::Size(150, 150) );
-	if(faces.size() > 0)
+	s.faces.clear();
 	{
-		findFace = true;
-		findPupils(frameGray, faces[0]);
+		STAGE_TIMER(STAGE_GAZE_DETECT);
+		EnterCriticalSection(&cascadeLock);
+		m->detector()->detect(frameGray, s.faces, m->params.detectOptions(frameGray.size()));
+		LeaveCriticalSection(&cascadeLock);
 	}
+	result.detectMs = elapsedMs(start);
+
+	if(s.faces.size() > 0)
+	{
+		STAGE_COUNTER(COUNTER_GAZE_FACES);
+		result.findFace = true;
+		findPupils(*m, frameGray, s.faces[0], result, s);
+	}
+	else
+	{
+		STAGE_COUNTER(COUNTER_GAZE_MISSES);
+	}
+	result.totalMs = elapsedMs(start);
+	return result.findFace;
 }
 
 void GazeTracking::getLeftPupilXY(int& x, int& y)
 {
-	x = leftPupil.x + faceRect.x;
-	y = leftPupil.y + faceRect.y;
+	x = lastResult.leftPupil.x;
+	y = lastResult.leftPupil.y;
 }
 
 void GazeTracking::getRightPupilXY(int& x, int& y)
 {
-	x = rightPupil.x + faceRect.x;
-	y = rightPupil.y + faceRect.y;
+	x = lastResult.rightPupil.x;
+	y = lastResult.rightPupil.y;
 }
 
 cv::Point GazeTracking::getLeftPupil()
 {
-	cv::Point point;
-	point.x = leftPupil.x + faceRect.x;
-	point.y = leftPupil.y + faceRect.y;
-	return point;
+	return lastResult.leftPupil;
 }
 
 cv::Point GazeTracking::getRightPupil()
 {
-	cv::Point point;
-	point.x = rightPupil.x + faceRect.x;
-	point.y = rightPupil.y + faceRect.y;
-	return point;
+	return lastResult.rightPupil;
 }
 
 void GazeTracking::getLeftPupilXYInImage(int& x, int& y)
 {
-	x = leftPupil.x;
-	y = leftPupil.y;
+	x = lastResult.leftPupilInFace.x;
+	y = lastResult.leftPupilInFace.y;
 }
 
 void GazeTracking::getRightPupilXYInImage(int& x, int& y)
 {
-	x = rightPupil.x;
-	y = rightPupil.y;
+	x = lastResult.rightPupilInFace.x;
+	y = lastResult.rightPupilInFace.y;
 }
 
 cv::Point GazeTracking::getLeftPupilInImage()
 {
-	return leftPupil;
+	return lastResult.leftPupilInFace;
 }
 
 cv::Point GazeTracking::getRightPupilInImage()
 {
-	return rightPupil;
+	return lastResult.rightPupilInFace;
 }
 
-int GazeTracking::round(double x)
+int GazeTracking::round(double x) const
 {
 	return (int)(x+0.5);
 }
 
-void GazeTracking::findPupils(cv::Mat& frameGray, cv::Rect& face)
+void GazeTracking::findPupils(const Model& m, const cv::Mat& frameGray, const cv::Rect& face, GazeResult& result, GazeScratch& s) const
 {
-	faceRect = face;
-	faceROI = frameGray(face);
-	if (kSmoothFaceImage) {
-		double sigma = kSmoothFaceFactor * face.width;
-		GaussianBlur( faceROI, faceROI, cv::Size( 0, 0 ), sigma);
+	const GazeParams& params = m.params;
+	result.faceRect = face;
+	s.faceROI = frameGray(face);
+	if (params.smoothFaceImage) {
+		double sigma = params.smoothFaceFactor * face.width;
+		GaussianBlur( s.faceROI, s.faceROI, cv::Size( 0, 0 ), sigma);
 	}
 	//-- Find eye regions and draw them
-	int eyeRegionWidth = face.width * (kEyePercentWidth/100.0);
-	int eyeRegionHeight = face.width * (kEyePercentHeight/100.0);
-	int eyeRegionTop = face.height * (kEyePercentTop/100.0);
-	cv::Rect leftEyeRegion(face.width*(kEyePercentSide/100.0),
+	int eyeRegionWidth = face.width * (params.eyePercentWidth/100.0);
+	int eyeRegionHeight = face.width * (params.eyePercentHeight/100.0);
+	int eyeRegionTop = face.height * (params.eyePercentTop/100.0);
+	cv::Rect leftEyeRegion(face.width*(params.eyePercentSide/100.0),
 		eyeRegionTop,eyeRegionWidth,eyeRegionHeight);
-	cv::Rect rightEyeRegion(face.width - eyeRegionWidth - face.width*(kEyePercentSide/100.0),
+	cv::Rect rightEyeRegion(face.width - eyeRegionWidth - face.width*(params.eyePercentSide/100.0),
 		eyeRegionTop,eyeRegionWidth,eyeRegionHeight);
 
 	//-- Find Eye Centers
-	leftPupil = findEyeCenter(faceROI,leftEyeRegion,"Left Eye");
-	rightPupil = findEyeCenter(faceROI,rightEyeRegion,"Right Eye");
+	int64 start = cv::getTickCount();
+	cv::Point leftPupil = findEyeCenter(m,s.faceROI,leftEyeRegion,s,result.leftConfidence);
+	result.leftEyeMs = elapsedMs(start);
+	start = cv::getTickCount();
+	cv::Point rightPupil = findEyeCenter(m,s.faceROI,rightEyeRegion,s,result.rightConfidence);
+	result.rightEyeMs = elapsedMs(start);
+	result.confidence = std::min(result.leftConfidence, result.rightConfidence);
 	// get corner regions
 	cv::Rect leftCornerRegion(leftEyeRegion);
 	leftCornerRegion.width -= leftPupil.x;
@@ -462,8 +753,13 @@ void GazeTracking::findPupils(cv::Mat& frameGray, cv::Rect& face)
 	leftPupil.x += leftEyeRegion.x;
 	leftPupil.y += leftEyeRegion.y;
 
+	result.leftPupilInFace = leftPupil;
+	result.rightPupilInFace = rightPupil;
+	result.leftPupil = cv::Point(leftPupil.x + face.x, leftPupil.y + face.y);
+	result.rightPupil = cv::Point(rightPupil.x + face.x, rightPupil.y + face.y);
+
 	//-- Find Eye Corners
-	/*if (kEnableEyeCorner) {
+	/*if (params.enableEyeCorner) {
 		cv::Point leftCorner = findEyeCorner(faceROI(leftCornerRegion), false);
 		leftCorner.x += leftCornerRegion.x;
 		leftCorner.y += leftCornerRegion.y;
@@ -473,27 +769,69 @@ void GazeTracking::findPupils(cv::Mat& frameGray, cv::Rect& face)
 	}*/
 }
 
-cv::Point GazeTracking::findEyeCenter(cv::Mat face, cv::Rect eye, std::string debugWindow)
+cv::Point GazeTracking::findEyeCenter(const Model& m, const cv::Mat& face, const cv::Rect& eye, GazeScratch& s, float& confidence) const
 {
+	STAGE_TIMER(STAGE_GAZE_EYE);
+	const GazeParams& params = m.params;
 	cv::Mat eyeROIUnscaled = face(eye);
-	cv::Mat eyeROI;
-	scaleToFastSize(eyeROIUnscaled, eyeROI);
+	scaleToFastSize(m, eyeROIUnscaled, s.eyeROI);
+
+	cv::Mat& out = s.out;
+	if (m.eyeCenterKernel && s.eyeROI.cols == params.fastEyeWidth && s.eyeROI.rows > 1)
+	{
+		m.eyeCenterKernel(s.eyeROI, params.gradientThreshold, params.weightDivisor, s, out);
+	}
+	else
+	{
+		computeCenterObjective(m, s.eyeROI, s, out);
+	}
+
+	//imshow(debugWindow,out);
+	//-- Find the maximum point
+	cv::Point maxP;
+	double maxVal;
+	cv::minMaxLoc(out, NULL,&maxVal,NULL,&maxP);
+	//-- Flood fill the edges
+	if(params.enablePostProcess) {
+		//double floodThresh = computeDynamicThreshold(out, 1.5);
+		double floodThresh = maxVal * params.postProcessThreshold;
+		cv::threshold(out, s.floodClone, floodThresh, 0.0f, cv::THRESH_TOZERO);
+		floodKillEdges(s.floodClone, s.mask);
+		//imshow(debugWindow + " Mask",mask);
+		//imshow(debugWindow,out);
+		// redo max
+		cv::minMaxLoc(out, NULL,&maxVal,NULL,&maxP,s.mask);
+	}
+	confidence = (float)maxVal;
+	return unscalePoint(m,maxP,eye);
+}
+
+cv::Point GazeTracking::findEyeCenter(const cv::Mat& eyeGray, GazeScratch& s, float& confidence) const
+{
+	return findEyeCenter(*currentModel(), eyeGray, cv::Rect(0, 0, eyeGray.cols, eyeGray.rows), s, confidence);
+}
 
+// Generic centre voting for parameter sets without a specialised kernel.
+void GazeTracking::computeCenterObjective(const Model& m, const cv::Mat& eyeROI, GazeScratch& s, cv::Mat& out) const
+{
+	const GazeParams& params = m.params;
 	//-- Find the gradient
-	cv::Mat gradientX = computeMatXGradient(eyeROI);
-	cv::Mat gradientY = computeMatXGradient(eyeROI.t()).t();
+	computeMatXGradient(eyeROI, s.gradientX);
+	computeMatYGradient(eyeROI, s.gradientY);
+	cv::Mat& gradientX = s.gradientX;
+	cv::Mat& gradientY = s.gradientY;
 
 	//-- Normalize and threshold the gradient
 	// compute all the magnitudes
-	cv::Mat mags = matrixMagnitude(gradientX, gradientY);
+	matrixMagnitude(gradientX, gradientY, s.mags);
 
 	//compute the threshold
-	double gradientThresh = computeDynamicThreshold(mags, kGradientThreshold);
+	double gradientThresh = computeDynamicThreshold(s.mags, params.gradientThreshold);
 
 	//normalize
 	for (int y = 0; y < eyeROI.rows; ++y) {
 		double *Xr = gradientX.ptr<double>(y), *Yr = gradientY.ptr<double>(y);
-		const double *Mr = mags.ptr<double>(y);
+		const double *Mr = s.mags.ptr<double>(y);
 		for (int x = 0; x < eyeROI.cols; ++x) {
 			double gX = Xr[x], gY = Yr[x];
 			double magnitude = Mr[x];
@@ -508,8 +846,8 @@ cv::Point GazeTracking::findEyeCenter(cv::Mat face, cv::Rect eye, std::string de
 	}
 
 	//-- Create a blurred and inverted image for weighting
-	cv::Mat weight;
-	GaussianBlur( eyeROI, weight, cv::Size( kWeightBlurSize, kWeightBlurSize ), 0, 0 );
+	cv::Mat& weight = s.weight;
+	GaussianBlur( eyeROI, weight, cv::Size( params.weightBlurSize, params.weightBlurSize ), 0, 0 );
 	for (int y = 0; y < weight.rows; ++y) {
 		unsigned char *row = weight.ptr<unsigned char>(y);
 		for (int x = 0; x < weight.cols; ++x) {
@@ -518,7 +856,8 @@ cv::Point GazeTracking::findEyeCenter(cv::Mat face, cv::Rect eye, std::string de
 	}
 
 	//-- Run the algorithm!
-	cv::Mat outSum = cv::Mat::zeros(eyeROI.rows,eyeROI.cols,CV_64F);
+	s.outSum.create(eyeROI.rows,eyeROI.cols,CV_64F);
+	s.outSum.setTo(cv::Scalar::all(0));
 	// for each possible center
 	//printf("Eye Size: %ix%i\n",outSum.cols,outSum.rows);
 	for (int y = 0; y < weight.rows; ++y) {
@@ -529,37 +868,18 @@ cv::Point GazeTracking::findEyeCenter(cv::Mat face, cv::Rect eye, std::string de
 			if (gX == 0.0 && gY == 0.0) {
 				continue;
 			}
-			testPossibleCentersFormula(x, y, Wr[x], gX, gY, outSum);
+			testPossibleCentersFormula(m, x, y, Wr[x], gX, gY, s.outSum);
 		}
 	}
 
 	// scale all the values down, basically averaging them
 	double numGradients = (weight.rows*weight.cols);
-	cv::Mat out;
-	outSum.convertTo(out, CV_32F,1.0/numGradients);
-	//imshow(debugWindow,out);
-	//-- Find the maximum point
-	cv::Point maxP;
-	double maxVal;
-	cv::minMaxLoc(out, NULL,&maxVal,NULL,&maxP);
-	//-- Flood fill the edges
-	if(kEnablePostProcess) {
-		cv::Mat floodClone;
-		//double floodThresh = computeDynamicThreshold(out, 1.5);
-		double floodThresh = maxVal * kPostProcessThreshold;
-		cv::threshold(out, floodClone, floodThresh, 0.0f, cv::THRESH_TOZERO);
-		cv::Mat mask = floodKillEdges(floodClone);
-		//imshow(debugWindow + " Mask",mask);
-		//imshow(debugWindow,out);
-		// redo max
-		cv::minMaxLoc(out, NULL,&maxVal,NULL,&maxP,mask);
-	}
-	return unscalePoint(maxP,eye);
+	s.outSum.convertTo(out, CV_32F,1.0/numGradients);
 }
 
-cv::Point GazeTracking::unscalePoint(cv::Point p, cv::Rect origSize) 
+cv::Point GazeTracking::unscalePoint(const Model& m, cv::Point p, cv::Rect origSize) const
 {
-	float ratio = (((float)kFastEyeWidth)/origSize.width);
+	float ratio = (((float)m.params.fastEyeWidth)/origSize.width);
 	/*int x = round(p.x / ratio);
 	int y = round(p.y / ratio);*/
 	int x = round(p.x / ratio);
@@ -567,12 +887,13 @@ cv::Point GazeTracking::unscalePoint(cv::Point p, cv::Rect origSize)
 	return cv::Point(x,y);
 }
 
-// returns a mask
-cv::Mat GazeTracking::floodKillEdges(cv::Mat &mat) 
+// fills mask with the points not reachable from the border
+void GazeTracking::floodKillEdges(cv::Mat &mat, cv::Mat &mask) const
 {
 	rectangle(mat,cv::Rect(0,0,mat.cols,mat.rows),255);
 
-	cv::Mat mask(mat.rows, mat.cols, CV_8U, 255);
+	mask.create(mat.rows, mat.cols, CV_8U);
+	mask.setTo(cv::Scalar::all(255));
 	std::queue<cv::Point> toDo;
 	toDo.push(cv::Point(0,0));
 	while (!toDo.empty()) {
@@ -594,20 +915,20 @@ cv::Mat GazeTracking::floodKillEdges(cv::Mat &mat)
 		mat.at<float>(p) = 0.0f;
 		mask.at<uchar>(p) = 0;
 	}
-	return mask;
 }
-bool GazeTracking::floodShouldPushPoint(const cv::Point &np, const cv::Mat &mat) 
+bool GazeTracking::floodShouldPushPoint(const cv::Point &np, const cv::Mat &mat) const
 {
 	return inMat(np, mat.rows, mat.cols);
 }
 
-bool GazeTracking::inMat(cv::Point p,int rows,int cols) 
+bool GazeTracking::inMat(cv::Point p,int rows,int cols) const
 {
 	return p.x >= 0 && p.x < cols && p.y >= 0 && p.y < rows;
 }
 
-void GazeTracking::testPossibleCentersFormula(int x, int y, unsigned char weight,double gx, double gy, cv::Mat &out) 
+void GazeTracking::testPossibleCentersFormula(const Model& m, int x, int y, unsigned char weight,double gx, double gy, cv::Mat &out) const
 {
+	const float weightDivisor = m.params.weightDivisor;
 	// for all possible centers
 	for (int cy = 0; cy < out.rows; ++cy) {
 		double *Or = out.ptr<double>(cy);
@@ -625,12 +946,12 @@ void GazeTracking::testPossibleCentersFormula(int x, int y, unsigned char weight
 			double dotProduct = dx*gx + dy*gy;
 			dotProduct = std::max(0.0,dotProduct);
 			// square and multiply by the weight
-			Or[cx] += dotProduct * dotProduct * (weight/kWeightDivisor);
+			Or[cx] += dotProduct * dotProduct * (weight/weightDivisor);
 		}
 	}
 }
 
-double GazeTracking::computeDynamicThreshold(const cv::Mat &mat, double stdDevFactor) 
+double GazeTracking::computeDynamicThreshold(const cv::Mat &mat, double stdDevFactor) const
 {
 	cv::Scalar stdMagnGrad, meanMagnGrad;
 	cv::meanStdDev(mat, meanMagnGrad, stdMagnGrad);
@@ -638,8 +959,9 @@ double GazeTracking::computeDynamicThreshold(const cv::Mat &mat, double stdDevFa
 	return stdDevFactor * stdDev + meanMagnGrad[0];
 }
 
-cv::Mat GazeTracking::matrixMagnitude(const cv::Mat &matX, const cv::Mat &matY) {
-	cv::Mat mags(matX.rows,matX.cols,CV_64F);
+void GazeTracking::matrixMagnitude(const cv::Mat &matX, const cv::Mat &matY, cv::Mat &mags) const
+{
+	mags.create(matX.rows,matX.cols,CV_64F);
 	for (int y = 0; y < matX.rows; ++y) {
 		const double *Xr = matX.ptr<double>(y), *Yr = matY.ptr<double>(y);
 		double *Mr = mags.ptr<double>(y);
@@ -649,17 +971,17 @@ cv::Mat GazeTracking::matrixMagnitude(const cv::Mat &matX, const cv::Mat &matY)
 			Mr[x] = magnitude;
 		}
 	}
-	return mags;
 }
 
-void GazeTracking::scaleToFastSize(const cv::Mat &src,cv::Mat &dst) 
+void GazeTracking::scaleToFastSize(const Model& m, const cv::Mat &src,cv::Mat &dst) const
 {
-	cv::resize(src, dst, cv::Size(kFastEyeWidth,(((float)kFastEyeWidth)/src.cols) * src.rows));
+	const int fastEyeWidth = m.params.fastEyeWidth;
+	cv::resize(src, dst, cv::Size(fastEyeWidth,(((float)fastEyeWidth)/src.cols) * src.rows));
 }
 
-cv::Mat GazeTracking::computeMatXGradient(const cv::Mat &mat) 
+void GazeTracking::computeMatXGradient(const cv::Mat &mat, cv::Mat &out) const
 {
-	cv::Mat out(mat.rows,mat.cols,CV_64F);
+	out.create(mat.rows,mat.cols,CV_64F);
 
 	for (int y = 0; y < mat.rows; ++y) {
 		const uchar *Mr = mat.ptr<uchar>(y);
@@ -671,6 +993,22 @@ cv::Mat GazeTracking::computeMatXGradient(const cv::Mat &mat)
 		}
 		Or[mat.cols-1] = Mr[mat.cols-1] - Mr[mat.cols-2];
 	}
+}
+
+// Same central difference as computeMatXGradient but along the columns, which
+// spares the two transposes the Y gradient used to need.
+void GazeTracking::computeMatYGradient(const cv::Mat &mat, cv::Mat &out) const
+{
+	out.create(mat.rows,mat.cols,CV_64F);
+
+	for (int y = 0; y < mat.rows; ++y) {
+		const uchar *Mp = mat.ptr<uchar>(y > 0 ? y-1 : y);
+		const uchar *Mn = mat.ptr<uchar>(y < mat.rows-1 ? y+1 : y);
+		double scale = (y > 0 && y < mat.rows-1) ? 0.5 : 1.0;
+		double *Or = out.ptr<double>(y);
 
-	return out;
+		for (int x = 0; x < mat.cols; ++x) {
+			Or[x] = (Mn[x] - Mp[x])*scale;
+		}
+	}
 }
@@ -103,19 +103,158 @@
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include <memory>
 #include <string>
+#include <vector>
+
+#include "portable.h"
+#include "eyeCenterKernel.h"
+#include "faceDetector.h"
 //#define ROUND(x) ((int)(x+0.5))
 
+// Tuning knobs of the pupil search. The defaults are the values the tracker
+// always shipped with; other operating points are produced offline by the
+// GazeTools tuner and loaded through GazeTracking::initialize.
+struct GazeParams
+{
+	GazeParams();
+
+	bool isValid() const;
+	bool load(const std::string& file);
+	bool save(const std::string& file) const;
+
+	// Size constants
+	int eyePercentTop;
+	int eyePercentSide;
+	int eyePercentHeight;
+	int eyePercentWidth;
+
+	//Preprocessing
+	bool smoothFaceImage;
+	float smoothFaceFactor;
+
+	// Algorithm Parameters
+	int fastEyeWidth;
+	int weightBlurSize;
+	float weightDivisor;
+	double gradientThreshold;
+
+	//Postprocessing
+	bool enablePostProcess;
+	float postProcessThreshold;
+
+	// Eye Corner
+	bool enableEyeCorner;
+
+	// Face detection
+	std::string cascadeFile;	// overrides the file given to initialize(), e.g. an LBP cascade
+	int detectDownscale;		// 1 = full resolution, 2 or 4 = pyramid detector
+	double detectScaleFactor;
+	int detectMinNeighbors;
+	// With faceWidth set the face size range is derived from where the user
+	// is expected to stand: the smallest face searched for is faceWidth at
+	// maxUserDistance, the largest faceWidth at minUserDistance. A 0.155 m
+	// face between 0.25 and 0.55 m is 150..329 px at 640 wide but 299..658 px
+	// at 1280, which misses users beyond 0.55 m. 0, the default, keeps the
+	// fixed 150 px minimum and no maximum at every frame size.
+	float faceWidth;			// metres, 0 for the fixed minimum
+	float minUserDistance;		// metres
+	float maxUserDistance;		// metres
+	float focalLength;			// pixels at 640 wide, 0 uses the nominal Kinect value
+
+	FaceDetectOptions detectOptions(const cv::Size& frameSize) const;
+};
+
+// Everything one analyze() call found in a frame. Plain value type, so it can
+// be copied to other threads without touching the detector again.
+struct GazeResult
+{
+	GazeResult() : findFace(false), leftConfidence(0.0f), rightConfidence(0.0f), confidence(0.0f),
+		detectMs(0.0), leftEyeMs(0.0), rightEyeMs(0.0), totalMs(0.0) {}
+
+	bool findFace;
+	cv::Rect faceRect;
+
+	// pupil centres relative to faceRect
+	cv::Point leftPupilInFace;
+	cv::Point rightPupilInFace;
+	// pupil centres in frame coordinates
+	cv::Point leftPupil;
+	cv::Point rightPupil;
+
+	// peak of the centre voting objective for each eye, confidence is the weaker of the two
+	float leftConfidence;
+	float rightConfidence;
+	float confidence;
+
+	// stage timings in milliseconds
+	double detectMs;
+	double leftEyeMs;
+	double rightEyeMs;
+	double totalMs;
+};
+
+// Working buffers of one analyze() call. Keep one per thread and pass it in
+// every frame so the matrices are reused instead of reallocated.
+struct GazeScratch
+{
+	std::vector<cv::Mat> channels;
+	std::vector<cv::Rect> faces;
+	cv::Mat faceROI;
+	cv::Mat eyeROI;
+	cv::Mat gradientX;
+	cv::Mat gradientY;
+	cv::Mat mags;
+	cv::Mat weight;
+	cv::Mat outSum;
+	cv::Mat out;
+	cv::Mat floodClone;
+	cv::Mat mask;
+};
+
 class GazeTracking{
 public:
 	GazeTracking();
 	~GazeTracking();
 
-	bool initialize(cv::String xmlFile);
+	// configFile is an optional GazeParams file written by the GazeTools
+	// tuner; the current parameters are kept when it is empty or cannot be
+	// read. May be called again while other threads analyze: they go on
+	// with the previous cascade and parameters until the new ones are
+	// loaded, and keep them if loading fails.
+	bool initialize(cv::String xmlFile, const std::string& configFile = std::string());
+	// Same as initialize() on a background thread. analyze() returns false
+	// until the first load isReady(); the destructor waits for the loader.
+	bool initializeAsync(cv::String xmlFile, const std::string& configFile = std::string());
+	bool isReady() const {return ready != 0;}
+
+	// cascade (and config) load time of the last initialize, and whether the
+	// binary cascade cache was used for it
+	double getLoadMs() const;
+	bool isLoadedFromCache() const;
+	const char* getDetectorName() const;
 
+	// Takes effect from the next analyze() call, calls already running
+	// finish with the parameters they started with.
+	bool setParams(const GazeParams& newParams);
+	GazeParams getParams() const;
+
+	// Reentrant analysis: the detector is not modified, all per-call state lives
+	// in scratch (a temporary one is used when scratch is NULL).
+	bool analyze(const cv::Mat& frame, GazeResult& result, GazeScratch* scratch = NULL) const;
+
+	// Single threaded convenience wrappers kept for existing callers; they
+	// store the last result in the instance.
 	void process(cv::Mat& frame);
 	void process(IplImage* image);
 
+	const GazeResult& getLastResult() const {return lastResult;}
+
+	// Pupil search alone on an 8 bit grey eye crop, the path findPupils takes
+	// for each eye region, without face detection. Lets the centre voting be
+	// benchmarked and checked against generated eyes with known centres.
+	cv::Point findEyeCenter(const cv::Mat& eyeGray, GazeScratch& s, float& confidence) const;
+
 	cv::Point getLeftPupil();
 	cv::Point getRightPupil();
 	cv::Point getLeftPupilInImage();
@@ -126,66 +265,80 @@ public:
 	void getLeftPupilXYInImage(int& x, int& y);
 	void getRightPupilXYInImage(int& x, int& y);
 
-	cv::Mat& getFace(){return faceROI;}
-	cv::Rect& GetFaceRect(){return faceRect;}
-	bool isFindFace(){return findFace;}
+	cv::Mat& getFace(){return scratch.faceROI;}
+	cv::Rect& GetFaceRect(){return lastResult.faceRect;}
+	bool isFindFace(){return lastResult.findFace;}
 
 private:
-	void findPupils(cv::Mat& frameGray, cv::Rect& face);
+	// One consistent configuration: the parameters, the voting kernel chosen
+	// for them and the detectors. initialize() and setParams() build a new
+	// one and swap it in whole; analyze() holds on to the one it started
+	// with, so it never mixes the parameters of one with the cascade of
+	// another.
+	struct Model
+	{
+		Model(const GazeParams& modelParams, const std::shared_ptr<CascadeFaceDetector>& modelCascade, double modelLoadMs, bool modelFromCache);
 
-	cv::Point findEyeCenter(cv::Mat face, cv::Rect eye, std::string debugWindow);
+		FaceDetector* detector() const;
 
-	cv::Point unscalePoint(cv::Point p, cv::Rect origSize);
-	// returns a mask
-	cv::Mat floodKillEdges(cv::Mat &mat);
+		GazeParams params;
+		// specialised voting kernel for the parameters, NULL if none
+		EyeCenterKernelFn eyeCenterKernel;
+		// shared by the models setParams() makes from this one
+		std::shared_ptr<CascadeFaceDetector> cascade;
+		mutable PyramidFaceDetector pyramid;
+		double loadMs;
+		bool fromCache;
+	};
+	typedef std::shared_ptr<const Model> ModelPtr;
 
-	bool floodShouldPushPoint(const cv::Point &np, const cv::Mat &mat);
+	ModelPtr currentModel() const;
 
-	bool inMat(cv::Point p,int rows,int cols);
+	void findPupils(const Model& m, const cv::Mat& frameGray, const cv::Rect& face, GazeResult& result, GazeScratch& s) const;
 
-	void testPossibleCentersFormula(int x, int y, unsigned char weight,double gx, double gy, cv::Mat &out);
+	cv::Point findEyeCenter(const Model& m, const cv::Mat& face, const cv::Rect& eye, GazeScratch& s, float& confidence) const;
+	void computeCenterObjective(const Model& m, const cv::Mat& eyeROI, GazeScratch& s, cv::Mat& out) const;
 
-	double computeDynamicThreshold(const cv::Mat &mat, double stdDevFactor);
+	cv::Point unscalePoint(const Model& m, cv::Point p, cv::Rect origSize) const;
+	// returns a mask
+	void floodKillEdges(cv::Mat &mat, cv::Mat &mask) const;
 
-	cv::Mat matrixMagnitude(const cv::Mat &matX, const cv::Mat &matY);
+	bool floodShouldPushPoint(const cv::Point &np, const cv::Mat &mat) const;
 
-	void scaleToFastSize(const cv::Mat &src,cv::Mat &dst);
+	bool inMat(cv::Point p,int rows,int cols) const;
 
-	cv::Mat computeMatXGradient(const cv::Mat &mat);
+	void testPossibleCentersFormula(const Model& m, int x, int y, unsigned char weight,double gx, double gy, cv::Mat &out) const;
 
-	int round(double x);
+	double computeDynamicThreshold(const cv::Mat &mat, double stdDevFactor) const;
 
-	cv::CascadeClassifier faceCascade;
-	cv::Mat faceROI;
-	cv::Point leftPupil;
-	cv::Point rightPupil;
+	void matrixMagnitude(const cv::Mat &matX, const cv::Mat &matY, cv::Mat &mags) const;
 
-	cv::Rect faceRect;
+	void scaleToFastSize(const Model& m, const cv::Mat &src,cv::Mat &dst) const;
 
-	bool findFace;
+	void computeMatXGradient(const cv::Mat &mat, cv::Mat &out) const;
+	void computeMatYGradient(const cv::Mat &mat, cv::Mat &out) const;
 
-	// Size constants
-	const int kEyePercentTop;
-	const int kEyePercentSide;
-	const int kEyePercentHeight;
-	const int kEyePercentWidth; 
+	int round(double x) const;
 
-	//Preprocessing
-	const bool kSmoothFaceImage;
-	const float kSmoothFaceFactor;
+	static DWORD WINAPI loaderStaticThread(PVOID lpParam);
 
-	// Algorithm Parameters
-	const int kFastEyeWidth;
-	const int kWeightBlurSize;
-	const float kWeightDivisor;
-	const double kGradientThreshold;
+	// cv::CascadeClassifier keeps per-call state inside the cascade, so
+	// concurrent analyze() calls take turns on the detection step only.
+	mutable CRITICAL_SECTION cascadeLock;
 
-	//Postprocessing
-	const bool kEnablePostProcess;
-	const float kPostProcessThreshold;
+	// held only to copy or replace the pointer; the old model goes with the
+	// last analyze() that still holds it
+	mutable SRWLOCK modelLock;
+	ModelPtr model;
 
-	// Eye Corner
-	const bool kEnableEyeCorner;
+	volatile LONG ready;
+	HANDLE loaderThread;
+	std::string pendingXmlFile;
+	std::string pendingConfigFile;
+
+	// state behind the single threaded wrappers
+	GazeResult lastResult;
+	GazeScratch scratch;
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,89 @@
+#include "stdafx.h"
+#include "mappedFile.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile() : file(INVALID_HANDLE_VALUE), mapping(NULL), data(NULL), size(0)
+{
+}
+
+void MappedFile::close()
+{
+	if (data) UnmapViewOfFile(data);
+	if (mapping) CloseHandle(mapping);
+	if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	file = INVALID_HANDLE_VALUE;
+	mapping = NULL;
+	data = NULL;
+	size = 0;
+}
+
+bool MappedFile::open(const std::string& path, Access access)
+{
+	close();
+	DWORD hint = access == Random ? FILE_FLAG_RANDOM_ACCESS : FILE_FLAG_SEQUENTIAL_SCAN;
+	file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, hint, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	// a 32 bit process cannot map more than its address space anyway
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0 || (ULONGLONG)fileSize.QuadPart > (SIZE_T)-1)
+	{
+		close();
+		return false;
+	}
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	data = mapping ? (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+	if (!data)
+	{
+		close();
+		return false;
+	}
+	size = (size_t)fileSize.QuadPart;
+	return true;
+}
+#else
+MappedFile::MappedFile() : data(NULL), size(0)
+{
+}
+
+void MappedFile::close()
+{
+	if (data) munmap((void*)data, size);
+	data = NULL;
+	size = 0;
+}
+
+bool MappedFile::open(const std::string& path, Access access)
+{
+	close();
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		::close(fd);
+		return false;
+	}
+	void* view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// the mapping stays valid without the descriptor
+	::close(fd);
+	if (view == MAP_FAILED)
+		return false;
+	madvise(view, (size_t)st.st_size, access == Random ? MADV_RANDOM : MADV_SEQUENTIAL);
+	data = (const char*)view;
+	size = (size_t)st.st_size;
+	return true;
+}
+#endif
+
+MappedFile::~MappedFile()
+{
+	close();
+}
@@ -0,0 +1,42 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include "portable.h"
+
+#include <string>
+
+// Read only view of a whole file, released on close or destruction. The
+// pages are loaded by the OS as they are touched, so opening a large file
+// costs nothing until it is read.
+class MappedFile
+{
+public:
+	enum Access
+	{
+		Sequential,		// read once front to back
+		Random			// seeks and jumps around
+	};
+
+	MappedFile();
+	~MappedFile();
+
+	bool open(const std::string& path, Access access = Sequential);
+	void close();
+
+	bool isOpen() const		{return data != NULL;}
+	const char* begin() const	{return data;}
+	size_t bytes() const	{return size;}
+
+private:
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+#endif
+	const char* data;
+	size_t size;
+};
+
+#endif
@@ -0,0 +1,456 @@
+#include "stdafx.h"
+#include "meshSequence.h"
+
+#include <math.h>
+#include <string.h>
+
+#ifndef _WIN32
+#define _fseeki64 fseeko
+#define _ftelli64 ftello
+#endif
+
+namespace
+{
+	inline int32_t quantize(float v, float step)
+	{
+		return (int32_t)floor(v / (double)step + 0.5);
+	}
+
+	size_t padded(size_t bytes)
+	{
+		return (bytes + 3) & ~(size_t)3;
+	}
+}
+
+MeshSequenceWriter::MeshSequenceWriter():bus(NULL), subscriber(-1), file(NULL), keyframeInterval(30), quantStep(1e-5f),
+	headerWritten(false), pointCount(0), sinceKeyframe(0), keyframes(0), offset(0),
+	filling(0), writing(-1), running(false), failed(false), thread(NULL)
+{
+	memset(pupils, 0, sizeof(pupils));
+	InitializeCriticalSection(&cs);
+	InitializeConditionVariable(&changed);
+}
+
+MeshSequenceWriter::~MeshSequenceWriter()
+{
+	stop();
+	DeleteCriticalSection(&cs);
+}
+
+bool MeshSequenceWriter::start(Bus& resultBus, const std::string& path, UINT interval, float step)
+{
+	stop();
+	if (step <= 0.0f || fopen_s(&file, path.c_str(), "wb") != 0 || !file)
+	{
+		file = NULL;
+		return false;
+	}
+	// the buffers are already large, write them straight through
+	setvbuf(file, NULL, _IONBF, 0);
+	keyframeInterval = interval ? interval : 1;
+	quantStep = step;
+	headerWritten = false;
+	keyframes = 0;
+	offset = 0;
+	index.clear();
+	for (int i = 0; i < 2; ++i)
+	{
+		buffers[i].clear();
+		buffers[i].reserve(BufferBytes + 64 * 1024);
+	}
+	filling = 0;
+	writing = -1;
+	failed = false;
+	running = true;
+	thread = CreateThread(NULL, 0, writerStaticThread, (PVOID)this, 0, NULL);
+	if (!thread)
+	{
+		running = false;
+		fclose(file);
+		file = NULL;
+		return false;
+	}
+
+	bus = &resultBus;
+	subscriber = bus->subscribe("mesh sequence", onResult, this, 256, Bus::Lossless);
+	if (subscriber < 0)
+	{
+		bus = NULL;
+		stop();
+		return false;
+	}
+	return true;
+}
+
+void MeshSequenceWriter::stop()
+{
+	if (bus)
+	{
+		// returns once the queued frames are encoded
+		bus->unsubscribe(subscriber);
+		bus = NULL;
+		subscriber = -1;
+	}
+	if (thread)
+	{
+		if (!buffers[filling].empty())
+		{
+			handOver();
+		}
+		EnterCriticalSection(&cs);
+		running = false;
+		LeaveCriticalSection(&cs);
+		WakeAllConditionVariable(&changed);
+		WaitForSingleObject(thread, INFINITE);
+		CloseHandle(thread);
+		thread = NULL;
+	}
+	if (file)
+	{
+		if (headerWritten)
+		{
+			MeshIndexTrailer trailer;
+			trailer.indexOffset = offset;
+			trailer.frameCount = (uint32_t)index.size();
+			trailer.magic = MESH_INDEX_MAGIC;
+			size_t bytes = index.size() * sizeof(MeshIndexEntry);
+			if ((bytes && fwrite(&index[0], 1, bytes, file) != bytes) ||
+				fwrite(&trailer, sizeof(trailer), 1, file) != 1)
+			{
+				failed = true;
+			}
+		}
+		fclose(file);
+		file = NULL;
+	}
+}
+
+void MeshSequenceWriter::onResult(PVOID param, const Bus::ResultPtr& result)
+{
+	static_cast<MeshSequenceWriter*>(param)->encode(*result);
+}
+
+void MeshSequenceWriter::append(const void* data, size_t bytes)
+{
+	std::vector<char>& buffer = buffers[filling];
+	buffer.insert(buffer.end(), (const char*)data, (const char*)data + bytes);
+	offset += bytes;
+}
+
+void MeshSequenceWriter::handOver()
+{
+	EnterCriticalSection(&cs);
+	// only waits when the disk is slower than the tracker
+	while (writing >= 0)
+	{
+		SleepConditionVariableCS(&changed, &cs, INFINITE);
+	}
+	writing = filling;
+	filling ^= 1;
+	LeaveCriticalSection(&cs);
+	WakeAllConditionVariable(&changed);
+	buffers[filling].clear();
+}
+
+DWORD WINAPI MeshSequenceWriter::writerThread()
+{
+	EnterCriticalSection(&cs);
+	for (;;)
+	{
+		while (running && writing < 0)
+		{
+			SleepConditionVariableCS(&changed, &cs, INFINITE);
+		}
+		if (writing < 0)
+		{
+			break;
+		}
+		std::vector<char>& buffer = buffers[writing];
+		LeaveCriticalSection(&cs);
+		bool ok = fwrite(&buffer[0], 1, buffer.size(), file) == buffer.size();
+		EnterCriticalSection(&cs);
+		failed = failed || !ok;
+		writing = -1;
+		WakeAllConditionVariable(&changed);
+	}
+	LeaveCriticalSection(&cs);
+	return 0;
+}
+
+DWORD WINAPI MeshSequenceWriter::writerStaticThread(PVOID lpParam)
+{
+	return static_cast<MeshSequenceWriter*>(lpParam)->writerThread();
+}
+
+void MeshSequenceWriter::writeHeader(const TrackingSnapshot& snapshot)
+{
+	const FaceTopology* topology = snapshot.topology;
+	UINT triangleCount = topology->GetTriangleCount();
+	size_t triangleBytes = (size_t)triangleCount * 3 * sizeof(uint16_t);
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	MeshSequenceHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = MESH_SEQUENCE_MAGIC;
+	header.version = MESH_SEQUENCE_VERSION;
+	header.headerSize = (uint32_t)((sizeof(header) + triangleBytes + 7) & ~(size_t)7);
+	header.vertexCount = topology->GetVertexCount();
+	header.pointCount = header.vertexCount + 2;
+	header.triangleCount = triangleCount;
+	header.keyframeInterval = keyframeInterval;
+	header.quantStep = quantStep;
+	header.tickFrequency = frequency.QuadPart;
+	append(&header, sizeof(header));
+
+	const FT_TRIANGLE* triangles = topology->GetTriangles();
+	for (UINT t = 0; t < triangleCount; ++t)
+	{
+		uint16_t indices[3] = {(uint16_t)triangles[t].i, (uint16_t)triangles[t].j, (uint16_t)triangles[t].k};
+		append(indices, sizeof(indices));
+	}
+	static const char padding[8] = {0};
+	append(padding, header.headerSize - sizeof(header) - triangleBytes);
+
+	pointCount = header.pointCount;
+	previous.assign(pointCount * 3, 0);
+	current.assign(pointCount * 3, 0);
+	sinceKeyframe = keyframeInterval;
+	headerWritten = true;
+}
+
+void MeshSequenceWriter::encode(const TrackingSnapshot& snapshot)
+{
+	if (!file || !snapshot.tracked || !snapshot.geometry.valid || !snapshot.topology)
+	{
+		return;
+	}
+	if (!headerWritten)
+	{
+		writeHeader(snapshot);
+	}
+
+	if (snapshot.gazeValid)
+	{
+		pupils[0] = snapshot.leftPupil;
+		pupils[1] = snapshot.rightPupil;
+	}
+	UINT vertexCount = pointCount - 2;
+	for (UINT p = 0; p < pointCount; ++p)
+	{
+		const FT_VECTOR3D& v = p < vertexCount ? snapshot.geometry.pts3D[p] : pupils[p - vertexCount];
+		current[3 * p] = quantize(v.x, quantStep);
+		current[3 * p + 1] = quantize(v.y, quantStep);
+		current[3 * p + 2] = quantize(v.z, quantStep);
+	}
+
+	bool key = sinceKeyframe >= keyframeInterval;
+	if (!key)
+	{
+		payload.assign(padded(current.size() * sizeof(int16_t)), 0);
+		int16_t* deltas = (int16_t*)&payload[0];
+		for (size_t i = 0; i < current.size() && !key; ++i)
+		{
+			int32_t d = current[i] - previous[i];
+			key = d < -32768 || d > 32767;
+			deltas[i] = (int16_t)d;
+		}
+	}
+	if (key)
+	{
+		payload.resize(current.size() * sizeof(int32_t));
+		memcpy(&payload[0], &current[0], payload.size());
+		sinceKeyframe = 0;
+		++keyframes;
+	}
+	++sinceKeyframe;
+	previous.swap(current);
+
+	MeshFrameHeader frame;
+	memset(&frame, 0, sizeof(frame));
+	frame.kind = key ? MESH_FRAME_KEY : MESH_FRAME_DELTA;
+	frame.flags = snapshot.gazeValid ? MESH_FRAME_GAZE : 0;
+	frame.frameId = snapshot.frameId;
+	frame.timestamp = snapshot.timestamp;
+	frame.payloadBytes = (uint32_t)payload.size();
+
+	MeshIndexEntry entry;
+	entry.offset = offset;
+	entry.frameId = frame.frameId;
+	entry.kind = frame.kind;
+	entry.flags = frame.flags;
+	index.push_back(entry);
+
+	append(&frame, sizeof(frame));
+	append(&payload[0], payload.size());
+	if (buffers[filling].size() >= BufferBytes)
+	{
+		handOver();
+	}
+}
+
+MeshSequenceReader::MeshSequenceReader():file(NULL), decoded(-1)
+{
+	memset(&header, 0, sizeof(header));
+}
+
+MeshSequenceReader::~MeshSequenceReader()
+{
+	close();
+}
+
+void MeshSequenceReader::close()
+{
+	if (file)
+	{
+		fclose(file);
+		file = NULL;
+	}
+	memset(&header, 0, sizeof(header));
+	triangles.clear();
+	index.clear();
+	state.clear();
+	decoded = -1;
+}
+
+bool MeshSequenceReader::open(const std::string& path)
+{
+	close();
+	if (fopen_s(&file, path.c_str(), "rb") != 0 || !file)
+	{
+		file = NULL;
+		return false;
+	}
+	bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+		header.magic == MESH_SEQUENCE_MAGIC && header.version == MESH_SEQUENCE_VERSION &&
+		header.pointCount >= header.vertexCount && header.pointCount <= MESH_MAX_POINTS && header.quantStep > 0.0f;
+	int64_t end = ok && _fseeki64(file, 0, SEEK_END) == 0 ? _ftelli64(file) : -1;
+	// the counts come from the file: the triangles have to fit in the header
+	// and the header in the file before anything is allocated for them
+	ok = ok && end >= (int64_t)header.headerSize &&
+		header.headerSize >= sizeof(header) + (uint64_t)header.triangleCount * 3 * sizeof(uint16_t);
+	if (ok && header.triangleCount)
+	{
+		triangles.resize((size_t)header.triangleCount * 3);
+		ok = _fseeki64(file, sizeof(header), SEEK_SET) == 0 &&
+			fread(&triangles[0], sizeof(uint16_t), triangles.size(), file) == triangles.size();
+	}
+	if (!ok || !buildIndex())
+	{
+		close();
+		return false;
+	}
+	state.assign((size_t)header.pointCount * 3, 0);
+	return true;
+}
+
+bool MeshSequenceReader::buildIndex()
+{
+	if (_fseeki64(file, 0, SEEK_END) != 0)
+	{
+		return false;
+	}
+	int64_t end = _ftelli64(file);
+
+	MeshIndexTrailer trailer;
+	if (end >= (int64_t)(header.headerSize + sizeof(trailer)) &&
+		_fseeki64(file, end - sizeof(trailer), SEEK_SET) == 0 && fread(&trailer, sizeof(trailer), 1, file) == 1 &&
+		trailer.magic == MESH_INDEX_MAGIC &&
+		trailer.indexOffset <= (uint64_t)end &&
+		trailer.indexOffset + (uint64_t)trailer.frameCount * sizeof(MeshIndexEntry) + sizeof(trailer) == (uint64_t)end)
+	{
+		index.resize(trailer.frameCount);
+		return trailer.frameCount == 0 || (_fseeki64(file, trailer.indexOffset, SEEK_SET) == 0 &&
+			fread(&index[0], sizeof(MeshIndexEntry), index.size(), file) == index.size());
+	}
+
+	// no index: walk the frame headers, a torn last frame is left out
+	int64_t position = header.headerSize;
+	MeshFrameHeader frame;
+	while (position + (int64_t)sizeof(frame) <= end && _fseeki64(file, position, SEEK_SET) == 0 &&
+		fread(&frame, sizeof(frame), 1, file) == 1 &&
+		(frame.kind == MESH_FRAME_KEY || frame.kind == MESH_FRAME_DELTA) &&
+		position + (int64_t)sizeof(frame) + frame.payloadBytes <= end)
+	{
+		MeshIndexEntry entry;
+		entry.offset = (uint64_t)position;
+		entry.frameId = frame.frameId;
+		entry.kind = frame.kind;
+		entry.flags = frame.flags;
+		index.push_back(entry);
+		position += sizeof(frame) + frame.payloadBytes;
+	}
+	return true;
+}
+
+bool MeshSequenceReader::decode(UINT frame)
+{
+	MeshFrameHeader frameHeader;
+	if (_fseeki64(file, (int64_t)index[frame].offset, SEEK_SET) != 0 ||
+		fread(&frameHeader, sizeof(frameHeader), 1, file) != 1)
+	{
+		return false;
+	}
+	size_t values = state.size();
+	size_t expected = frameHeader.kind == MESH_FRAME_KEY ? values * sizeof(int32_t) : padded(values * sizeof(int16_t));
+	if (frameHeader.payloadBytes != expected)
+	{
+		return false;
+	}
+	payload.resize(expected);
+	if (fread(&payload[0], 1, expected, file) != expected)
+	{
+		return false;
+	}
+	if (frameHeader.kind == MESH_FRAME_KEY)
+	{
+		memcpy(&state[0], &payload[0], values * sizeof(int32_t));
+	}
+	else
+	{
+		const int16_t* deltas = (const int16_t*)&payload[0];
+		for (size_t i = 0; i < values; ++i)
+		{
+			state[i] += deltas[i];
+		}
+	}
+	decoded = (int)frame;
+	return true;
+}
+
+bool MeshSequenceReader::readFrame(UINT frame, FT_VECTOR3D* points, UINT pointCount)
+{
+	if (!file || frame >= index.size() || !points || pointCount < header.pointCount)
+	{
+		return false;
+	}
+	UINT key = frame;
+	while (key > 0 && index[key].kind != MESH_FRAME_KEY)
+	{
+		--key;
+	}
+	if (index[key].kind != MESH_FRAME_KEY)
+	{
+		return false;
+	}
+	// carry on from the frame decoded last if it lies on the way
+	UINT next = (decoded >= (int)key && decoded <= (int)frame) ? (UINT)decoded + 1 : key;
+	for (UINT f = next; f <= frame; ++f)
+	{
+		if (!decode(f))
+		{
+			decoded = -1;
+			return false;
+		}
+	}
+
+	float step = header.quantStep;
+	for (UINT p = 0; p < header.pointCount; ++p)
+	{
+		points[p].x = state[3 * p] * step;
+		points[p].y = state[3 * p + 1] * step;
+		points[p].z = state[3 * p + 2] * step;
+	}
+	return true;
+}
@@ -0,0 +1,189 @@
+#ifndef MESH_SEQUENCE_H
+#define MESH_SEQUENCE_H
+
+#include "trackingSnapshot.h"
+#include "resultBus.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Full per-frame vertex data for offline rendering. The file starts with
+// the topology, then holds one frame after the other: every point is
+// quantized to a grid of quantStep metres, a key frame stores the grid
+// coordinates, the frames in between store 16 bit differences to the frame
+// before. A key frame is written every keyframeInterval frames and whenever
+// a difference does not fit. The index at the end of the file gives every
+// frame's offset, so a reader seeks to the key frame at or before a frame
+// and decodes forward from there.
+//
+// Points are the mesh vertices followed by the left and the right pupil;
+// frames without a gaze result repeat the last pupils and lack
+// MESH_FRAME_GAZE.
+
+#define MESH_SEQUENCE_MAGIC		0x534D5446u		// "FTMS"
+#define MESH_SEQUENCE_VERSION	1u
+#define MESH_INDEX_MAGIC		0x58444E49u		// "INDX"
+// the triangles index the vertices in 16 bits, the pupils come on top
+#define MESH_MAX_POINTS			(65536 + 2)
+
+enum MeshFrameKind
+{
+	MESH_FRAME_KEY		= 1,
+	MESH_FRAME_DELTA	= 2
+};
+
+enum MeshFrameFlags
+{
+	MESH_FRAME_GAZE		= 1
+};
+
+// 64 bytes, followed by triangleCount * 3 uint16_t vertex indices; the
+// frames start at headerSize
+struct MeshSequenceHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t headerSize;
+	uint32_t vertexCount;
+	uint32_t pointCount;			// vertexCount + 2 pupils
+	uint32_t triangleCount;
+	uint32_t keyframeInterval;
+	float quantStep;				// metres per grid unit
+	int64_t tickFrequency;
+	uint32_t reserved[6];
+};
+
+// 24 bytes, followed by payloadBytes: pointCount * 3 int32_t grid
+// coordinates for a key frame, int16_t differences for a delta frame,
+// padded to 4 bytes
+struct MeshFrameHeader
+{
+	uint16_t kind;
+	uint16_t flags;
+	uint32_t frameId;
+	int64_t timestamp;
+	uint32_t payloadBytes;
+	uint32_t reserved;
+};
+
+struct MeshIndexEntry
+{
+	uint64_t offset;
+	uint32_t frameId;
+	uint16_t kind;
+	uint16_t flags;
+};
+
+// last 16 bytes of the file
+struct MeshIndexTrailer
+{
+	uint64_t indexOffset;
+	uint32_t frameCount;
+	uint32_t magic;
+};
+
+// Encodes on the bus thread of a lossless subscription and hands full
+// buffers to a writer thread of its own, so neither the tracker nor the
+// encoder waits for the disk unless both buffers are full.
+class MeshSequenceWriter
+{
+public:
+	typedef ResultBus<TrackingSnapshot> Bus;
+
+	enum
+	{
+		BufferBytes = 1 << 20
+	};
+
+	MeshSequenceWriter();
+	~MeshSequenceWriter();
+
+	// quantStep 0.01 mm keeps a difference of 32767 units at 33 cm per frame
+	bool start(Bus& bus, const std::string& path, UINT keyframeInterval = 30, float quantStep = 1e-5f);
+	// Writes what is still queued, the index and closes the file.
+	void stop();
+	bool isRecording() const	{return file != NULL;}
+
+	UINT getFrameCount() const	{return (UINT)index.size();}
+	UINT getKeyframeCount() const	{return keyframes;}
+	unsigned long long getBytesWritten() const	{return offset;}
+	bool hasFailed() const	{return failed;}
+
+private:
+	MeshSequenceWriter(const MeshSequenceWriter&);
+	MeshSequenceWriter& operator=(const MeshSequenceWriter&);
+
+	static void onResult(PVOID param, const Bus::ResultPtr& result);
+	void encode(const TrackingSnapshot& snapshot);
+	void writeHeader(const TrackingSnapshot& snapshot);
+	void append(const void* data, size_t bytes);
+	void handOver();
+	DWORD WINAPI writerThread();
+	static DWORD WINAPI writerStaticThread(PVOID lpParam);
+
+	Bus* bus;
+	int subscriber;
+	FILE* file;
+	UINT keyframeInterval;
+	float quantStep;
+	bool headerWritten;
+	UINT pointCount;
+	UINT sinceKeyframe;
+	UINT keyframes;
+	std::vector<int32_t> previous;		// grid coordinates of the last frame
+	std::vector<int32_t> current;
+	std::vector<char> payload;
+	FT_VECTOR3D pupils[2];
+	std::vector<MeshIndexEntry> index;
+	unsigned long long offset;
+
+	// double buffering between the encoder and the writer thread
+	CRITICAL_SECTION cs;
+	CONDITION_VARIABLE changed;
+	std::vector<char> buffers[2];
+	int filling;
+	int writing;		// -1 while the writer has nothing to do
+	bool running;
+	bool failed;
+	HANDLE thread;
+};
+
+class MeshSequenceReader
+{
+public:
+	MeshSequenceReader();
+	~MeshSequenceReader();
+
+	// Works on files without an index too (a recording that was cut short),
+	// the frames are then found by walking the file once.
+	bool open(const std::string& path);
+	void close();
+
+	const MeshSequenceHeader& getHeader() const	{return header;}
+	const uint16_t* getTriangles() const	{return triangles.empty() ? NULL : &triangles[0];}
+	UINT getFrameCount() const	{return (UINT)index.size();}
+	const MeshIndexEntry* getEntry(UINT frame) const	{return frame < index.size() ? &index[frame] : NULL;}
+
+	// Decodes frame into points, pointCount of them. Reading frames in
+	// order decodes each one once; a jump starts at the key frame before.
+	bool readFrame(UINT frame, FT_VECTOR3D* points, UINT pointCount);
+
+private:
+	MeshSequenceReader(const MeshSequenceReader&);
+	MeshSequenceReader& operator=(const MeshSequenceReader&);
+
+	bool buildIndex();
+	bool decode(UINT frame);
+
+	FILE* file;
+	MeshSequenceHeader header;
+	std::vector<uint16_t> triangles;
+	std::vector<MeshIndexEntry> index;
+	std::vector<int32_t> state;
+	std::vector<char> payload;
+	int decoded;		// frame held in state, -1 for none
+};
+
+#endif
@@ -0,0 +1,542 @@
+#include "stdafx.h"
+#include "metricsStore.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <algorithm>
+#include <emmintrin.h>
+
+namespace
+{
+	const char* const columnNames[METRIC_COLUMN_COUNT] =
+	{
+		"timestamp", "frame", "flags",
+		"scale", "pitch", "yaw", "roll", "tx", "ty", "tz",
+		"au0", "au1", "au2", "au3", "au4", "au5",
+		"face_left", "face_top", "face_right", "face_bottom",
+		"left_x", "left_y", "left_z", "right_x", "right_y", "right_z",
+		"pupil_r"
+	};
+
+	size_t aligned(size_t bytes)
+	{
+		return (bytes + 15) & ~(size_t)15;
+	}
+
+	// Offsets of the columns inside a chunk, returns the chunk size.
+	size_t layout(UINT chunkRows, size_t* offsets)
+	{
+		size_t offset = aligned(sizeof(MetricsChunkHeader));
+		for (int c = 0; c < METRIC_COLUMN_COUNT; ++c)
+		{
+			offsets[c] = offset;
+			offset = aligned(offset + chunkRows * metricTypeSize(metricColumnType(c)));
+		}
+		return offset;
+	}
+
+	bool beforeTimestamp(int64_t timestamp, int64_t bound)
+	{
+		return timestamp < bound;
+	}
+
+	inline int popcount4(int mask)
+	{
+		return (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+	}
+
+	// lanes of v whose flags have all of required set
+	inline __m128 selected(const uint32_t* flags, __m128i required)
+	{
+		__m128i f = _mm_loadu_si128((const __m128i*)flags);
+		return _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(f, required), required));
+	}
+}
+
+const char* metricColumnName(int column)
+{
+	return column >= 0 && column < METRIC_COLUMN_COUNT ? columnNames[column] : NULL;
+}
+
+MetricColumn metricColumnByName(const std::string& name)
+{
+	for (int c = 0; c < METRIC_COLUMN_COUNT; ++c)
+	{
+		if (name == columnNames[c])
+		{
+			return (MetricColumn)c;
+		}
+	}
+	return METRIC_COLUMN_COUNT;
+}
+
+MetricType metricColumnType(int column)
+{
+	if (column == METRIC_TIMESTAMP)
+	{
+		return METRIC_TYPE_INT64;
+	}
+	return column < METRIC_FIRST_FLOAT ? METRIC_TYPE_UINT32 : METRIC_TYPE_FLOAT;
+}
+
+size_t metricTypeSize(MetricType type)
+{
+	return type == METRIC_TYPE_INT64 ? 8 : 4;
+}
+
+MetricsWriter::MetricsWriter():file(NULL), chunkBytes(0), filled(0), rows(0), chunks(0),
+	filling(0), writing(-1), running(false), failed(false), thread(NULL)
+{
+	memset(columnOffsets, 0, sizeof(columnOffsets));
+	InitializeCriticalSection(&cs);
+	InitializeConditionVariable(&changed);
+}
+
+MetricsWriter::~MetricsWriter()
+{
+	close();
+	DeleteCriticalSection(&cs);
+}
+
+bool MetricsWriter::open(const std::string& path)
+{
+	close();
+	if (!(file = fopen(path.c_str(), "wb")))
+	{
+		return false;
+	}
+	// whole chunks are written at once
+	setvbuf(file, NULL, _IONBF, 0);
+
+	chunkBytes = layout(METRICS_CHUNK_ROWS, columnOffsets);
+	MetricsFileHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = METRICS_FILE_MAGIC;
+	header.version = METRICS_FILE_VERSION;
+	header.columnCount = METRIC_COLUMN_COUNT;
+	header.chunkRows = METRICS_CHUNK_ROWS;
+	header.chunkBytes = chunkBytes;
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	header.tickFrequency = frequency.QuadPart;
+	for (int c = 0; c < METRIC_COLUMN_COUNT; ++c)
+	{
+		header.columnTypes[c] = (uint8_t)metricColumnType(c);
+	}
+	if (fwrite(&header, sizeof(header), 1, file) != 1)
+	{
+		fclose(file);
+		file = NULL;
+		return false;
+	}
+
+	for (int i = 0; i < 2; ++i)
+	{
+		buffers[i].assign(chunkBytes, 0);
+	}
+	filled = 0;
+	rows = 0;
+	chunks = 0;
+	filling = 0;
+	writing = -1;
+	failed = false;
+	running = true;
+	thread = CreateThread(NULL, 0, writerStaticThread, (PVOID)this, 0, NULL);
+	if (!thread)
+	{
+		running = false;
+		fclose(file);
+		file = NULL;
+		return false;
+	}
+	return true;
+}
+
+void MetricsWriter::close()
+{
+	if (thread)
+	{
+		if (filled)
+		{
+			handOver();
+		}
+		EnterCriticalSection(&cs);
+		running = false;
+		LeaveCriticalSection(&cs);
+		WakeAllConditionVariable(&changed);
+		WaitForSingleObject(thread, INFINITE);
+		CloseHandle(thread);
+		thread = NULL;
+	}
+	if (file)
+	{
+		failed = fclose(file) != 0 || failed;
+		file = NULL;
+	}
+}
+
+void MetricsWriter::append(const MetricsRow& row)
+{
+	if (!file)
+	{
+		return;
+	}
+	char* chunk = &buffers[filling][0];
+	MetricsChunkHeader* header = (MetricsChunkHeader*)chunk;
+	if (!filled)
+	{
+		header->firstTimestamp = row.timestamp;
+	}
+	header->lastTimestamp = row.timestamp;
+
+	((int64_t*)(chunk + columnOffsets[METRIC_TIMESTAMP]))[filled] = row.timestamp;
+	((uint32_t*)(chunk + columnOffsets[METRIC_FRAME_ID]))[filled] = row.frameId;
+	((uint32_t*)(chunk + columnOffsets[METRIC_FLAGS]))[filled] = row.flags;
+	for (int c = METRIC_FIRST_FLOAT; c < METRIC_COLUMN_COUNT; ++c)
+	{
+		((float*)(chunk + columnOffsets[c]))[filled] = row.values[c - METRIC_FIRST_FLOAT];
+	}
+	++rows;
+	if (++filled == METRICS_CHUNK_ROWS)
+	{
+		handOver();
+	}
+}
+
+void MetricsWriter::handOver()
+{
+	MetricsChunkHeader* header = (MetricsChunkHeader*)&buffers[filling][0];
+	header->magic = METRICS_CHUNK_MAGIC;
+	header->rowCount = filled;
+
+	EnterCriticalSection(&cs);
+	// only waits when the disk is slower than a chunk's worth of frames
+	while (writing >= 0)
+	{
+		SleepConditionVariableCS(&changed, &cs, INFINITE);
+	}
+	writing = filling;
+	filling ^= 1;
+	LeaveCriticalSection(&cs);
+	WakeAllConditionVariable(&changed);
+
+	// the unused tail of a partly filled chunk stays zero
+	memset(&buffers[filling][0], 0, chunkBytes);
+	filled = 0;
+	++chunks;
+}
+
+DWORD WINAPI MetricsWriter::writerThread()
+{
+	EnterCriticalSection(&cs);
+	for (;;)
+	{
+		while (running && writing < 0)
+		{
+			SleepConditionVariableCS(&changed, &cs, INFINITE);
+		}
+		if (writing < 0)
+		{
+			break;
+		}
+		std::vector<char>& buffer = buffers[writing];
+		LeaveCriticalSection(&cs);
+		bool ok = fwrite(&buffer[0], 1, buffer.size(), file) == buffer.size();
+		EnterCriticalSection(&cs);
+		failed = failed || !ok;
+		writing = -1;
+		WakeAllConditionVariable(&changed);
+	}
+	LeaveCriticalSection(&cs);
+	return 0;
+}
+
+DWORD WINAPI MetricsWriter::writerStaticThread(PVOID lpParam)
+{
+	return static_cast<MetricsWriter*>(lpParam)->writerThread();
+}
+
+void MetricsSummary::merge(const MetricsSummary& other)
+{
+	if (!other.count)
+	{
+		return;
+	}
+	if (!count)
+	{
+		*this = other;
+		return;
+	}
+	// pairwise update (Chan et al.), exact for any split into parts
+	double delta = other.mean() - mean();
+	double n = (double)count + (double)other.count;
+	m2 += other.m2 + delta * delta * ((double)count * (double)other.count / n);
+	min = (std::min)(min, other.min);
+	max = (std::max)(max, other.max);
+	count += other.count;
+	sum += other.sum;
+}
+
+double MetricsSummary::deviation() const
+{
+	if (count < 2)
+	{
+		return 0.0;
+	}
+	return m2 > 0.0 ? sqrt(m2 / count) : 0.0;
+}
+
+MetricsStore::MetricsStore():header(NULL), chunkCount(0), rowCount(0)
+{
+	memset(columnOffsets, 0, sizeof(columnOffsets));
+}
+
+bool MetricsStore::open(const std::string& path)
+{
+	close();
+	if (!file.open(path, MappedFile::Sequential) || file.bytes() < sizeof(MetricsFileHeader))
+	{
+		close();
+		return false;
+	}
+	const MetricsFileHeader* h = (const MetricsFileHeader*)file.begin();
+	bool ok = h->magic == METRICS_FILE_MAGIC && h->version == METRICS_FILE_VERSION &&
+		h->columnCount == METRIC_COLUMN_COUNT && h->chunkRows > 0 && h->chunkRows <= 1 << 20 &&
+		h->chunkBytes == layout(h->chunkRows, columnOffsets);
+	for (int c = 0; ok && c < METRIC_COLUMN_COUNT; ++c)
+	{
+		ok = h->columnTypes[c] == metricColumnType(c);
+	}
+	if (!ok)
+	{
+		close();
+		return false;
+	}
+	header = h;
+
+	// a torn chunk at the end or a damaged one ends the usable part
+	size_t chunks = (size_t)((file.bytes() - sizeof(MetricsFileHeader)) / h->chunkBytes);
+	for (chunkCount = 0; chunkCount < chunks; ++chunkCount)
+	{
+		const MetricsChunkHeader& c = chunk(chunkCount);
+		if (c.magic != METRICS_CHUNK_MAGIC || c.rowCount > h->chunkRows)
+		{
+			break;
+		}
+		rowCount += c.rowCount;
+	}
+	return true;
+}
+
+void MetricsStore::close()
+{
+	file.close();
+	header = NULL;
+	chunkCount = 0;
+	rowCount = 0;
+}
+
+int64_t MetricsStore::getFirstTimestamp() const
+{
+	for (size_t i = 0; i < chunkCount; ++i)
+	{
+		if (chunk(i).rowCount)
+		{
+			return chunk(i).firstTimestamp;
+		}
+	}
+	return 0;
+}
+
+int64_t MetricsStore::getLastTimestamp() const
+{
+	for (size_t i = chunkCount; i > 0; --i)
+	{
+		if (chunk(i - 1).rowCount)
+		{
+			return chunk(i - 1).lastTimestamp;
+		}
+	}
+	return 0;
+}
+
+bool MetricsStore::isFloat(MetricColumn column) const
+{
+	return header && column >= METRIC_FIRST_FLOAT && column < METRIC_COLUMN_COUNT;
+}
+
+void MetricsStore::window(size_t i, int64_t from, int64_t to, UINT& first, UINT& last) const
+{
+	const MetricsChunkHeader& c = chunk(i);
+	if (!c.rowCount || c.lastTimestamp < from || c.firstTimestamp >= to)
+	{
+		first = last = 0;
+		return;
+	}
+	const int64_t* t = timestamps(i);
+	first = c.firstTimestamp >= from ? 0 : (UINT)(std::lower_bound(t, t + c.rowCount, from, beforeTimestamp) - t);
+	last = c.lastTimestamp < to ? c.rowCount : (UINT)(std::lower_bound(t, t + c.rowCount, to, beforeTimestamp) - t);
+}
+
+// Masked SSE accumulation, four rows at a time; the flag test turns into a
+// lane mask so rows that do not pass cost no branch. Each chunk sums its
+// differences to its first selected value in double lanes, so neither the
+// offset of a column nor the length of a chunk costs precision.
+bool MetricsStore::summarize(MetricColumn column, const MetricsFilter& filter, MetricsSummary& summary) const
+{
+	if (!isFloat(column))
+	{
+		return false;
+	}
+	const __m128i required = _mm_set1_epi32((int)filter.requiredFlags);
+	const __m128 highest = _mm_set1_ps(FLT_MAX);
+	const __m128 lowest = _mm_set1_ps(-FLT_MAX);
+	const uint32_t req = filter.requiredFlags;
+
+	for (size_t i = 0; i < chunkCount; ++i)
+	{
+		UINT first, last;
+		window(i, filter.from, filter.to, first, last);
+		if (first >= last)
+		{
+			continue;
+		}
+		const float* v = floats(i, column);
+		const uint32_t* f = uints(i, METRIC_FLAGS);
+
+		UINT r = first;
+		while (r < last && (f[r] & req) != req)
+		{
+			++r;
+		}
+		if (r == last)
+		{
+			continue;
+		}
+		const float reference = v[r];
+		const __m128 base = _mm_set1_ps(reference);
+		__m128d sum = _mm_setzero_pd();
+		__m128d squares = _mm_setzero_pd();
+		__m128 mn = highest;
+		__m128 mx = lowest;
+		uint64_t n = 0;
+		for (r = first; r + 4 <= last; r += 4)
+		{
+			__m128 mask = selected(f + r, required);
+			__m128 x = _mm_loadu_ps(v + r);
+			__m128 d = _mm_and_ps(mask, _mm_sub_ps(x, base));
+			__m128d low = _mm_cvtps_pd(d);
+			__m128d high = _mm_cvtps_pd(_mm_movehl_ps(d, d));
+			sum = _mm_add_pd(sum, _mm_add_pd(low, high));
+			squares = _mm_add_pd(squares, _mm_add_pd(_mm_mul_pd(low, low), _mm_mul_pd(high, high)));
+			__m128 kept = _mm_and_ps(mask, x);
+			mn = _mm_min_ps(mn, _mm_or_ps(kept, _mm_andnot_ps(mask, highest)));
+			mx = _mm_max_ps(mx, _mm_or_ps(kept, _mm_andnot_ps(mask, lowest)));
+			n += popcount4(_mm_movemask_ps(mask));
+		}
+
+		double sums[2][2];
+		float lanes[2][4];
+		_mm_storeu_pd(sums[0], sum);
+		_mm_storeu_pd(sums[1], squares);
+		_mm_storeu_ps(lanes[0], mn);
+		_mm_storeu_ps(lanes[1], mx);
+		double deltaSum = sums[0][0] + sums[0][1];
+		double deltaSquares = sums[1][0] + sums[1][1];
+		MetricsSummary part;
+		part.min = FLT_MAX;
+		part.max = -FLT_MAX;
+		for (int k = 0; k < 4; ++k)
+		{
+			part.min = (std::min)(part.min, lanes[0][k]);
+			part.max = (std::max)(part.max, lanes[1][k]);
+		}
+		for (; r < last; ++r)
+		{
+			if ((f[r] & req) == req)
+			{
+				double d = (double)v[r] - reference;
+				deltaSum += d;
+				deltaSquares += d * d;
+				part.min = (std::min)(part.min, v[r]);
+				part.max = (std::max)(part.max, v[r]);
+				++n;
+			}
+		}
+		part.count = n;
+		part.sum = n * (double)reference + deltaSum;
+		part.m2 = (std::max)(deltaSquares - deltaSum * deltaSum / n, 0.0);
+		summary.merge(part);
+	}
+	return true;
+}
+
+bool MetricsStore::histogram(MetricColumn column, const MetricsFilter& filter, float lo, float hi, std::vector<uint64_t>& bins) const
+{
+	if (!isFloat(column) || bins.empty() || !(hi > lo))
+	{
+		return false;
+	}
+	const float scale = bins.size() / (hi - lo);
+	const float top = (float)(bins.size() - 1);
+	const __m128i required = _mm_set1_epi32((int)filter.requiredFlags);
+	const __m128 base = _mm_set1_ps(lo);
+	const __m128 factor = _mm_set1_ps(scale);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 ceiling = _mm_set1_ps(top);
+	const uint32_t req = filter.requiredFlags;
+
+	for (size_t i = 0; i < chunkCount; ++i)
+	{
+		UINT first, last;
+		window(i, filter.from, filter.to, first, last);
+		const float* v = floats(i, column);
+		const uint32_t* f = uints(i, METRIC_FLAGS);
+
+		UINT r = first;
+		for (; r + 4 <= last; r += 4)
+		{
+			// bin numbers for four rows, clamped while still float
+			int mask = _mm_movemask_ps(selected(f + r, required));
+			if (!mask)
+			{
+				continue;
+			}
+			__m128 x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(v + r), base), factor);
+			x = _mm_min_ps(_mm_max_ps(x, zero), ceiling);
+			int b[4];
+			_mm_storeu_si128((__m128i*)b, _mm_cvttps_epi32(x));
+			for (int k = 0; k < 4; ++k)
+			{
+				bins[b[k]] += (mask >> k) & 1;
+			}
+		}
+		for (; r < last; ++r)
+		{
+			if ((f[r] & req) == req)
+			{
+				float x = (std::min)((std::max)(0.0f, (v[r] - lo) * scale), top);
+				++bins[(size_t)x];
+			}
+		}
+	}
+	return true;
+}
+
+uint64_t MetricsStore::count(const MetricsFilter& filter) const
+{
+	uint64_t n = 0;
+	for (size_t i = 0; i < chunkCount; ++i)
+	{
+		UINT first, last;
+		window(i, filter.from, filter.to, first, last);
+		const uint32_t* f = uints(i, METRIC_FLAGS);
+		for (UINT r = first; r < last; ++r)
+		{
+			n += (f[r] & filter.requiredFlags) == filter.requiredFlags;
+		}
+	}
+	return n;
+}
@@ -0,0 +1,254 @@
+#ifndef METRICS_STORE_H
+#define METRICS_STORE_H
+
+#include "portable.h"
+#include "mappedFile.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Per frame tracking metrics (pose, AUs, face rect, pupils) kept for
+// analysis after the session. Every camera frame is one row, lost ones
+// included, so the tracking rate is a column like any other.
+//
+// The file is column oriented: rows are grouped into chunks of a fixed
+// number of rows and inside a chunk every metric is one contiguous typed
+// array. A scan over one metric reads only that metric's pages, and since
+// all chunks have the same size a chunk is found by arithmetic. Rows are
+// appended in time order, each chunk header keeps its first and last
+// timestamp so a time window skips whole chunks and finds its ends in the
+// others by binary search.
+//
+// The last chunk of a file is written partly filled when recording stops;
+// a recording that was cut short loses the rows of its unfinished chunk.
+
+#define METRICS_FILE_MAGIC		0x434d5446u		// "FTMC"
+#define METRICS_CHUNK_MAGIC		0x4b4e4843u		// "CHNK"
+#define METRICS_FILE_VERSION	1u
+#define METRICS_CHUNK_ROWS		1024			// about 34 s at 30 fps
+
+enum MetricColumn
+{
+	METRIC_TIMESTAMP,			// int64, QueryPerformanceCounter ticks
+	METRIC_FRAME_ID,			// uint32
+	METRIC_FLAGS,				// uint32, MetricFlags
+	// float from here on
+	METRIC_SCALE,
+	METRIC_PITCH,				// degrees
+	METRIC_YAW,
+	METRIC_ROLL,
+	METRIC_TX,					// m, camera space
+	METRIC_TY,
+	METRIC_TZ,
+	METRIC_AU0,					// upper lip raiser
+	METRIC_AU1,					// jaw lowerer
+	METRIC_AU2,					// lip stretcher
+	METRIC_AU3,					// brow lowerer
+	METRIC_AU4,					// lip corner depressor
+	METRIC_AU5,					// outer brow raiser
+	METRIC_FACE_LEFT,			// colour image pixels
+	METRIC_FACE_TOP,
+	METRIC_FACE_RIGHT,
+	METRIC_FACE_BOTTOM,
+	METRIC_LEFT_PUPIL_X,		// m, camera space
+	METRIC_LEFT_PUPIL_Y,
+	METRIC_LEFT_PUPIL_Z,
+	METRIC_RIGHT_PUPIL_X,
+	METRIC_RIGHT_PUPIL_Y,
+	METRIC_RIGHT_PUPIL_Z,
+	METRIC_PUPIL_R,
+	METRIC_COLUMN_COUNT
+};
+
+#define METRIC_FIRST_FLOAT	METRIC_SCALE
+#define METRIC_FLOAT_COUNT	(METRIC_COLUMN_COUNT - METRIC_FIRST_FLOAT)
+#define METRIC_MAX_AU		6
+
+enum MetricFlags
+{
+	METRIC_FLAG_TRACKED = 1,
+	METRIC_FLAG_GAZE = 2
+};
+
+enum MetricType
+{
+	METRIC_TYPE_INT64 = 1,
+	METRIC_TYPE_UINT32 = 2,
+	METRIC_TYPE_FLOAT = 3
+};
+
+// short lower case name ("yaw", "au3", "pupil_r"), NULL if out of range
+const char* metricColumnName(int column);
+// METRIC_COLUMN_COUNT if there is no such column
+MetricColumn metricColumnByName(const std::string& name);
+MetricType metricColumnType(int column);
+size_t metricTypeSize(MetricType type);
+
+// 64 bytes, followed by the chunks
+struct MetricsFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t columnCount;
+	uint32_t chunkRows;
+	uint64_t chunkBytes;			// header and columns of one chunk
+	int64_t tickFrequency;
+	uint8_t columnTypes[32];		// MetricType per column
+};
+
+// 32 bytes, followed by the columns, each chunkRows values long and starting
+// on a 16 byte boundary
+struct MetricsChunkHeader
+{
+	uint32_t magic;
+	uint32_t rowCount;
+	int64_t firstTimestamp;
+	int64_t lastTimestamp;
+	uint32_t reserved[2];
+};
+
+struct MetricsRow
+{
+	MetricsRow()
+	{
+		memset(this, 0, sizeof(*this));
+	}
+
+	float& at(MetricColumn column)	{return values[column - METRIC_FIRST_FLOAT];}
+	float at(MetricColumn column) const	{return values[column - METRIC_FIRST_FLOAT];}
+
+	int64_t timestamp;
+	uint32_t frameId;
+	uint32_t flags;
+	float values[METRIC_FLOAT_COUNT];
+};
+
+// Appends rows from the tracking thread. Rows go straight into the columns
+// of the chunk being filled; a full chunk is handed to a writer thread so
+// the tracker never waits for the disk.
+class MetricsWriter
+{
+public:
+	MetricsWriter();
+	~MetricsWriter();
+
+	bool open(const std::string& path);
+	// Writes the partly filled chunk and closes the file.
+	void close();
+	bool isOpen() const	{return file != NULL;}
+
+	void append(const MetricsRow& row);
+
+	unsigned long long getRowCount() const	{return rows;}
+	unsigned long long getBytesWritten() const	{return sizeof(MetricsFileHeader) + chunks * chunkBytes;}
+	bool hasFailed() const	{return failed;}
+
+private:
+	MetricsWriter(const MetricsWriter&);
+	MetricsWriter& operator=(const MetricsWriter&);
+
+	void handOver();
+	DWORD WINAPI writerThread();
+	static DWORD WINAPI writerStaticThread(PVOID lpParam);
+
+	FILE* file;
+	size_t chunkBytes;
+	size_t columnOffsets[METRIC_COLUMN_COUNT];
+	UINT filled;					// rows in the chunk being filled
+	unsigned long long rows;
+	unsigned long long chunks;		// handed to the writer
+
+	// double buffering between the tracker and the writer thread
+	CRITICAL_SECTION cs;
+	CONDITION_VARIABLE changed;
+	std::vector<char> buffers[2];
+	int filling;
+	int writing;		// -1 while the writer has nothing to do
+	bool running;
+	bool failed;
+	HANDLE thread;
+};
+
+// Rows of interest: a time window [from, to) in ticks and flags that must
+// all be set. The default takes everything.
+struct MetricsFilter
+{
+	MetricsFilter():from(INT64_MIN), to(INT64_MAX), requiredFlags(0)
+	{
+	}
+
+	int64_t from;
+	int64_t to;
+	uint32_t requiredFlags;
+};
+
+// Running aggregate of one metric, can be merged across chunks and files.
+// The spread is kept as squared deviations from the mean rather than a sum
+// of squares: a translation of 1.5 m that moves by 0.2 mm has a variance
+// eight orders of magnitude below its square, E[x^2] - m^2 cancels to noise.
+struct MetricsSummary
+{
+	MetricsSummary():count(0), sum(0.0), m2(0.0), min(0.0f), max(0.0f)
+	{
+	}
+
+	void merge(const MetricsSummary& other);
+	double mean() const	{return count ? sum / count : 0.0;}
+	double deviation() const;
+
+	uint64_t count;
+	double sum;
+	double m2;					// sum of squared deviations from mean()
+	float min;
+	float max;
+};
+
+// Read side, the file is memory mapped and scanned in place.
+class MetricsStore
+{
+public:
+	MetricsStore();
+
+	bool open(const std::string& path);
+	void close();
+	bool isOpen() const	{return header != NULL;}
+
+	const MetricsFileHeader* getHeader() const	{return header;}
+	size_t getChunkCount() const	{return chunkCount;}
+	unsigned long long getRowCount() const	{return rowCount;}
+	int64_t getFirstTimestamp() const;
+	int64_t getLastTimestamp() const;
+
+	const MetricsChunkHeader& chunk(size_t i) const	{return *(const MetricsChunkHeader*)(data(i));}
+	const int64_t* timestamps(size_t i) const	{return (const int64_t*)(data(i) + columnOffsets[METRIC_TIMESTAMP]);}
+	const uint32_t* uints(size_t i, MetricColumn column) const	{return (const uint32_t*)(data(i) + columnOffsets[column]);}
+	const float* floats(size_t i, MetricColumn column) const	{return (const float*)(data(i) + columnOffsets[column]);}
+
+	// Rows [first, last) of chunk i inside the time window.
+	void window(size_t i, int64_t from, int64_t to, UINT& first, UINT& last) const;
+
+	// Both add to what is passed in, so several files or calls accumulate.
+	// Only float columns can be aggregated.
+	bool summarize(MetricColumn column, const MetricsFilter& filter, MetricsSummary& summary) const;
+	// bins.size() bins over [lo, hi), values outside are clamped into the
+	// first and last bin.
+	bool histogram(MetricColumn column, const MetricsFilter& filter, float lo, float hi, std::vector<uint64_t>& bins) const;
+	// Rows that pass the filter, e.g. tracked frames with requiredFlags.
+	uint64_t count(const MetricsFilter& filter) const;
+
+private:
+	MetricsStore(const MetricsStore&);
+	MetricsStore& operator=(const MetricsStore&);
+
+	const char* data(size_t i) const	{return file.begin() + sizeof(MetricsFileHeader) + i * header->chunkBytes;}
+	bool isFloat(MetricColumn column) const;
+
+	MappedFile file;
+	const MetricsFileHeader* header;
+	size_t columnOffsets[METRIC_COLUMN_COUNT];
+	size_t chunkCount;
+	unsigned long long rowCount;
+};
+
+#endif
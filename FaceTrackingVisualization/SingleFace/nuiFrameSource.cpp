@@ -0,0 +1,106 @@
+#include "stdafx.h"
+#include "nuiFrameSource.h"
+
+HRESULT copyToImage(const BYTE* pixels, UINT stride, IFTImage* image)
+{
+	if (!pixels || !image || !image->GetBuffer())
+	{
+		return E_POINTER;
+	}
+	UINT rowBytes = image->GetStride();
+	if (stride < rowBytes)
+	{
+		return E_INVALIDARG;
+	}
+	BYTE* target = image->GetBuffer();
+	for (UINT y = 0; y < image->GetHeight(); ++y)
+	{
+		memcpy(target + y * rowBytes, pixels + (size_t)y * stride, rowBytes);
+	}
+	return S_OK;
+}
+
+NuiFrameSource::NuiFrameSource(NUI_IMAGE_TYPE depthImageType, NUI_IMAGE_RESOLUTION depthResolution, BOOL bNearMode, BOOL bFallbackToDefault,
+	NUI_IMAGE_TYPE colorImageType, NUI_IMAGE_RESOLUTION colorResolution, BOOL bSeatedSkeletonMode)
+	:depthType(depthImageType), depthRes(depthResolution), nearMode(bNearMode), fallbackToDefault(bFallbackToDefault),
+	colorType(colorImageType), colorRes(colorResolution), seatedSkeletonMode(bSeatedSkeletonMode), frameId(0)
+{
+	memset(&config, 0, sizeof(config));
+}
+
+NuiFrameSource::~NuiFrameSource()
+{
+	close();
+}
+
+HRESULT NuiFrameSource::open()
+{
+	HRESULT hr = sensor.Init(depthType, depthRes, nearMode, fallbackToDefault, colorType, colorRes, seatedSkeletonMode);
+	if (FAILED(hr))
+	{
+		sensor.Release();
+		return hr;
+	}
+	FT_CAMERA_CONFIG videoConfig;
+	hr = sensor.GetVideoConfiguration(&videoConfig);
+	if (FAILED(hr))
+	{
+		sensor.Release();
+		return hr;
+	}
+	memset(&config, 0, sizeof(config));
+	config.colorWidth = videoConfig.Width;
+	config.colorHeight = videoConfig.Height;
+	config.colorFocalLength = videoConfig.FocalLength;
+	// the tracker runs on colour alone if the depth resolution is unusual
+	FT_CAMERA_CONFIG depthConfig;
+	if (SUCCEEDED(sensor.GetDepthConfiguration(&depthConfig)))
+	{
+		config.depthWidth = depthConfig.Width;
+		config.depthHeight = depthConfig.Height;
+		config.depthFocalLength = depthConfig.FocalLength;
+	}
+	config.zoomFactor = sensor.GetZoomFactor();
+	config.viewOffsetX = sensor.GetViewOffSet()->x;
+	config.viewOffsetY = sensor.GetViewOffSet()->y;
+	frameId = 0;
+	return S_OK;
+}
+
+void NuiFrameSource::close()
+{
+	sensor.Release();
+}
+
+HRESULT NuiFrameSource::readFrame(SourceFrame& frame)
+{
+	IFTImage* video = sensor.GetVideoBuffer();
+	if (!video)
+	{
+		return E_FAIL;
+	}
+	IFTImage* depthImage = config.depthWidth ? sensor.GetDepthBuffer() : NULL;
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	frame.frameId = ++frameId;
+	frame.timestamp = now.QuadPart;
+	frame.color = video->GetBuffer();
+	frame.colorStride = video->GetStride();
+	frame.depth = depthImage ? (const uint16_t*)depthImage->GetBuffer() : NULL;
+	frame.depthStride = depthImage ? depthImage->GetStride() : 0;
+	for (UINT i = 0; i < FRAME_SOURCE_SKELETONS; ++i)
+	{
+		SourceSkeleton& s = frame.skeletons[i];
+		s.tracked = sensor.IsTracked(i);
+		FT_VECTOR3D head = sensor.HeadPoint(i);
+		FT_VECTOR3D neck = sensor.NeckPoint(i);
+		s.head[0] = head.x;
+		s.head[1] = head.y;
+		s.head[2] = head.z;
+		s.neck[0] = neck.x;
+		s.neck[1] = neck.y;
+		s.neck[2] = neck.z;
+	}
+	return S_OK;
+}
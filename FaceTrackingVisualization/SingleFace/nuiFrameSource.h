@@ -0,0 +1,44 @@
+#ifndef NUI_FRAME_SOURCE_H
+#define NUI_FRAME_SOURCE_H
+
+#include "frameSource.h"
+#include "KinectSensor.h"
+
+// The Kinect through the NUI runtime. KinectSensor keeps copying the
+// newest frames into its buffers on its own thread; readFrame() hands out
+// those buffers as they are at that moment.
+class NuiFrameSource : public FrameSource
+{
+public:
+	NuiFrameSource(NUI_IMAGE_TYPE depthType, NUI_IMAGE_RESOLUTION depthRes, BOOL bNearMode, BOOL bFallbackToDefault,
+		NUI_IMAGE_TYPE colorType, NUI_IMAGE_RESOLUTION colorRes, BOOL bSeatedSkeletonMode);
+	~NuiFrameSource();
+
+	HRESULT open();
+	void close();
+	const FrameSourceConfig& getConfig() const	{return config;}
+	HRESULT readFrame(SourceFrame& frame);
+	const char* getName() const	{return "kinect";}
+
+	KinectSensor& getSensor()	{return sensor;}
+
+private:
+	NuiFrameSource(const NuiFrameSource&);
+	NuiFrameSource& operator=(const NuiFrameSource&);
+
+	KinectSensor sensor;
+	NUI_IMAGE_TYPE depthType;
+	NUI_IMAGE_RESOLUTION depthRes;
+	BOOL nearMode;
+	BOOL fallbackToDefault;
+	NUI_IMAGE_TYPE colorType;
+	NUI_IMAGE_RESOLUTION colorRes;
+	BOOL seatedSkeletonMode;
+	FrameSourceConfig config;
+	UINT frameId;
+};
+
+// Copies rows of a source image into a tracker image of the same size.
+HRESULT copyToImage(const BYTE* pixels, UINT stride, IFTImage* image);
+
+#endif
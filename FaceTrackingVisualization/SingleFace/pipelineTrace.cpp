@@ -0,0 +1,324 @@
+#include "stdafx.h"
+#include "pipelineTrace.h"
+#include "asyncLog.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#ifdef _WIN32
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+#define TRACE_THREAD_LOCAL __thread
+#endif
+
+volatile bool PipelineTrace::enabled = false;
+
+namespace
+{
+	// the ring head is handed from the recording thread to write() as in
+	// AsyncLog, the barrier keeps the event stores before it
+	inline void storeRelease(volatile unsigned* p, unsigned v)
+	{
+#ifdef _WIN32
+		_ReadWriteBarrier();
+		*p = v;
+#else
+		__atomic_store_n(p, v, __ATOMIC_RELEASE);
+#endif
+	}
+
+	inline unsigned loadAcquire(const volatile unsigned* p)
+	{
+#ifdef _WIN32
+		unsigned v = *p;
+		_ReadWriteBarrier();
+		return v;
+#else
+		return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#endif
+	}
+
+	// written by its thread only; write() copies it while it is written and
+	// drops what the thread may have overwritten during the copy
+	struct ThreadBuffer
+	{
+		ThreadBuffer():head(0), first(0), threadId(0), name(NULL), retired(0), next(NULL) {}
+
+		TraceEvent events[PipelineTrace::EventsPerThread];
+		volatile unsigned head;		// events recorded, by all threads that had the ring
+		volatile unsigned first;	// the first event of the current thread
+		volatile DWORD threadId;
+		const char* volatile name;
+		volatile LONG retired;		// its thread ended, the next new thread takes it
+		ThreadBuffer* next;
+	};
+
+	// at thread exit, through the fiber local storage callback
+	void WINAPI retireThread(PVOID data)
+	{
+		if (data)
+		{
+			InterlockedExchange(&((ThreadBuffer*)data)->retired, 1);
+		}
+	}
+
+	struct TraceState
+	{
+		TraceState():buffers(NULL), bufferCount(0), epoch(0), reclaimed(0), dropped(0)
+		{
+			InitializeCriticalSection(&writeLock);
+			exitHook = FlsAlloc(retireThread);
+		}
+
+		// buffers are never freed, they go from thread to thread
+		PVOID volatile buffers;
+		volatile LONG bufferCount;
+		volatile LONGLONG epoch;
+		volatile LONGLONG reclaimed;	// events of ended threads lost to the next owner
+		volatile LONGLONG dropped;
+		DWORD exitHook;
+		CRITICAL_SECTION writeLock;
+	};
+
+	TraceState state;
+	TRACE_THREAD_LOCAL ThreadBuffer* threadBuffer = NULL;
+	TRACE_THREAD_LOCAL bool threadDropped = false;
+	TRACE_THREAD_LOCAL const char* threadName = NULL;
+	TRACE_THREAD_LOCAL LONGLONG threadFrame = 0;
+
+	ThreadBuffer* claimRetired()
+	{
+		for (ThreadBuffer* buffer = (ThreadBuffer*)state.buffers; buffer; buffer = buffer->next)
+		{
+			if (buffer->retired && InterlockedCompareExchange(&buffer->retired, 0, 1) == 1)
+			{
+				return buffer;
+			}
+		}
+		return NULL;
+	}
+
+	// NULL once MaxThreads rings are taken
+	ThreadBuffer* registerThread()
+	{
+		ThreadBuffer* buffer = claimRetired();
+		if (buffer)
+		{
+			// the events of the thread that ended give way, write() skips
+			// them from the moment first moves
+			unsigned head = buffer->head;
+			InterlockedExchangeAdd64(&state.reclaimed, (LONGLONG)(head - buffer->first));
+			storeRelease(&buffer->first, head);
+			buffer->threadId = GetCurrentThreadId();
+			buffer->name = threadName;
+		}
+		else
+		{
+			if (InterlockedIncrement(&state.bufferCount) > PipelineTrace::MaxThreads)
+			{
+				InterlockedDecrement(&state.bufferCount);
+				return NULL;
+			}
+			buffer = new ThreadBuffer();
+			buffer->threadId = GetCurrentThreadId();
+			buffer->name = threadName;
+			PVOID head;
+			do
+			{
+				head = state.buffers;
+				buffer->next = (ThreadBuffer*)head;
+			} while (InterlockedCompareExchangePointer(&state.buffers, buffer, head) != head);
+		}
+		if (state.exitHook != FLS_OUT_OF_INDEXES)
+		{
+			FlsSetValue(state.exitHook, buffer);
+		}
+		threadBuffer = buffer;
+		return buffer;
+	}
+
+	// the events of one ring that are still intact, oldest first
+	void copyEvents(const ThreadBuffer& buffer, LONGLONG since, std::vector<TraceEvent>& events)
+	{
+		const unsigned size = PipelineTrace::EventsPerThread;
+		events.clear();
+		unsigned owner = loadAcquire(&buffer.first);
+		unsigned head = loadAcquire(&buffer.head);
+		unsigned first = head - owner > size ? head - size : owner;
+		events.reserve(head - first);
+		for (unsigned i = first; i != head; ++i)
+		{
+			events.push_back(buffer.events[i % size]);
+		}
+		if (loadAcquire(&buffer.first) != owner)
+		{
+			// a new thread took the ring over during the copy
+			events.clear();
+			return;
+		}
+		// the thread went on recording; the slot it writes now and the ones
+		// it finished since overwrote the oldest copies
+		unsigned after = loadAcquire(&buffer.head);
+		unsigned valid = after + 1 > size ? after + 1 - size : 0;
+		size_t skip = valid > first ? (std::min)((size_t)(valid - first), events.size()) : 0;
+		size_t kept = 0;
+		for (size_t i = skip; i < events.size(); ++i)
+		{
+			if (events[i].start >= since)
+			{
+				events[kept++] = events[i];
+			}
+		}
+		events.resize(kept);
+	}
+
+	void writeString(FILE* file, const char* text)
+	{
+		fputc('"', file);
+		for (const char* c = text; *c; ++c)
+		{
+			if (*c == '"' || *c == '\\')
+			{
+				fputc('\\', file);
+			}
+			if ((unsigned char)*c >= 0x20)
+			{
+				fputc(*c, file);
+			}
+		}
+		fputc('"', file);
+	}
+}
+
+void PipelineTrace::start()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	state.epoch = now.QuadPart;
+	MemoryBarrier();
+	enabled = true;
+}
+
+void PipelineTrace::stop()
+{
+	enabled = false;
+}
+
+void PipelineTrace::setThreadName(const char* name)
+{
+	threadName = name;
+	if (threadBuffer)
+	{
+		threadBuffer->name = name;
+	}
+}
+
+void PipelineTrace::setFrame(LONGLONG frameId)
+{
+	threadFrame = frameId;
+}
+
+void PipelineTrace::complete(const char* name, LONGLONG start, LONGLONG end)
+{
+	ThreadBuffer* buffer = threadBuffer;
+	if (!buffer && (threadDropped || !(buffer = registerThread())))
+	{
+		threadDropped = true;
+		InterlockedExchangeAdd64(&state.dropped, 1);
+		return;
+	}
+	unsigned head = buffer->head;
+	TraceEvent& e = buffer->events[head % EventsPerThread];
+	e.start = start;
+	e.duration = end - start;
+	e.name = name;
+	e.frameId = threadFrame;
+	storeRelease(&buffer->head, head + 1);
+}
+
+unsigned long long PipelineTrace::getOverwritten()
+{
+	unsigned long long overwritten = (unsigned long long)state.reclaimed;
+	for (ThreadBuffer* buffer = (ThreadBuffer*)state.buffers; buffer; buffer = buffer->next)
+	{
+		unsigned recorded = loadAcquire(&buffer->head) - loadAcquire(&buffer->first);
+		overwritten += recorded > (unsigned)EventsPerThread ? recorded - EventsPerThread : 0;
+	}
+	return overwritten;
+}
+
+unsigned long long PipelineTrace::getDropped()
+{
+	return (unsigned long long)state.dropped;
+}
+
+bool PipelineTrace::write(const char* path)
+{
+	EnterCriticalSection(&state.writeLock);
+	FILE* file = fopen(path, "w");
+	if (!file)
+	{
+		LeaveCriticalSection(&state.writeLock);
+		LOG_ERROR("trace: cannot write {}", path);
+		return false;
+	}
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	const double usPerTick = 1000000.0 / frequency.QuadPart;
+	const LONGLONG epoch = state.epoch;
+	const DWORD pid = GetCurrentProcessId();
+
+	// complete ("X") events need no begin/end pairing and no sort order
+	fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":0,\"args\":{\"name\":\"tracker\"}}",
+		(unsigned long)pid);
+	std::vector<TraceEvent> events;
+	size_t written = 0;
+	for (ThreadBuffer* buffer = (ThreadBuffer*)state.buffers; buffer; buffer = buffer->next)
+	{
+		unsigned long tid = (unsigned long)buffer->threadId;
+		const char* name = buffer->name;
+		fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%lu,\"args\":{\"name\":",
+			(unsigned long)pid, tid);
+		if (name)
+		{
+			writeString(file, name);
+		}
+		else
+		{
+			fprintf(file, "\"thread %lu\"", tid);
+		}
+		fprintf(file, "}}");
+
+		copyEvents(*buffer, epoch, events);
+		for (size_t i = 0; i < events.size(); ++i)
+		{
+			const TraceEvent& e = events[i];
+			fprintf(file, ",\n{\"name\":");
+			writeString(file, e.name);
+			fprintf(file, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%lu,\"tid\":%lu", (e.start - epoch) * usPerTick,
+				e.duration * usPerTick, (unsigned long)pid, tid);
+			if (e.frameId)
+			{
+				fprintf(file, ",\"args\":{\"frame\":%lld}", (long long)e.frameId);
+			}
+			fputc('}', file);
+		}
+		written += events.size();
+	}
+	fprintf(file, "\n]}\n");
+	bool failed = ferror(file) != 0;
+	failed |= fclose(file) != 0;
+	LeaveCriticalSection(&state.writeLock);
+
+	if (failed)
+	{
+		LOG_ERROR("trace: write to {} failed", path);
+		return false;
+	}
+	LOG_INFO("trace: {} events written to {}, {} overwritten, {} dropped", (unsigned long long)written, path,
+		getOverwritten(), getDropped());
+	return true;
+}
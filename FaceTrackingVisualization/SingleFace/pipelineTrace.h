@@ -0,0 +1,109 @@
+#ifndef PIPELINE_TRACE_H
+#define PIPELINE_TRACE_H
+
+#include "portable.h"
+
+// A timeline of the pipeline threads for stalls the stage histograms cannot
+// explain, such as the tracking thread waiting on a sensor frame while the
+// render thread holds the snapshot. Every timed stage and TRACE_SCOPE
+// becomes one event with its thread and the frame that thread works on,
+// written as Chrome trace event JSON that chrome://tracing and
+// ui.perfetto.dev open directly.
+//
+// Tracing is off until start(). While off a scope costs one load and a
+// branch, so the tracer stays compiled into release builds; with
+// PIPELINE_TRACE_DISABLED defined the macros compile to nothing. While on,
+// each thread appends to a ring of its own, no lock and, after the first
+// event of a thread, no allocation. A full ring overwrites its oldest
+// events, so write() always has the last EventsPerThread events of every
+// thread, however long the run. The ring of a thread that ended goes to
+// the next new thread; at most MaxThreads rings are made, the events of
+// threads beyond that are dropped and counted.
+
+struct TraceEvent
+{
+	LONGLONG start;			// QueryPerformanceCounter
+	LONGLONG duration;
+	const char* name;		// string literal, kept as a pointer
+	LONGLONG frameId;		// 0 for none
+};
+
+class PipelineTrace
+{
+public:
+	enum
+	{
+		EventsPerThread = 1 << 15,		// 1 MB, a minute of the tracker at 30 fps
+		MaxThreads = 64
+	};
+
+	// Starts recording; events from before are left out of the next write.
+	static void start();
+	static void stop();
+	static bool isEnabled() {return enabled;}
+
+	// Writes the events in the rings now, tracing may go on meanwhile.
+	static bool write(const char* path);
+
+	// Shown for the calling thread, the name must be a string literal.
+	// Costs nothing while tracing is off, so call it at thread start.
+	static void setThreadName(const char* name);
+	// the frame the calling thread works on, attached to its next events
+	static void setFrame(LONGLONG frameId);
+
+	// an event that ran from start to end on the calling thread
+	static void complete(const char* name, LONGLONG start, LONGLONG end);
+
+	// events lost to writes that overtook a ring, or to a new thread that
+	// took over the ring of one that ended
+	static unsigned long long getOverwritten();
+	// events of threads that found all MaxThreads rings taken
+	static unsigned long long getDropped();
+
+private:
+	static volatile bool enabled;
+};
+
+// Traces the enclosing scope while tracing is on.
+class TraceScope
+{
+public:
+	explicit TraceScope(const char* scopeName):name(scopeName), start(0)
+	{
+		if (PipelineTrace::isEnabled())
+		{
+			LARGE_INTEGER now;
+			QueryPerformanceCounter(&now);
+			start = now.QuadPart;
+		}
+	}
+	~TraceScope()
+	{
+		if (start)
+		{
+			LARGE_INTEGER now;
+			QueryPerformanceCounter(&now);
+			PipelineTrace::complete(name, start, now.QuadPart);
+		}
+	}
+
+private:
+	TraceScope(const TraceScope&);
+	TraceScope& operator=(const TraceScope&);
+
+	const char* name;
+	LONGLONG start;
+};
+
+#define PIPELINE_TRACE_CONCAT2(a, b) a##b
+#define PIPELINE_TRACE_CONCAT(a, b) PIPELINE_TRACE_CONCAT2(a, b)
+
+#ifndef PIPELINE_TRACE_DISABLED
+#define TRACE_SCOPE(name)			TraceScope PIPELINE_TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_FRAME(frameId)		do { if (PipelineTrace::isEnabled()) PipelineTrace::setFrame(frameId); } while (0)
+#else
+#define TRACE_SCOPE(name)			do {} while (0)
+#define TRACE_FRAME(frameId)		do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,306 @@
+#ifndef PORTABLE_H
+#define PORTABLE_H
+
+// The Win32 subset the platform independent parts of the tracker (gaze
+// tracking, cascade cache, seqlock, result bus, GazeService) are written
+// against. On Windows this is just windows.h; elsewhere the same names are
+// mapped onto pthreads so those files build unchanged for the headless
+// service. Only the calls those files make are covered, with the Win32
+// semantics they rely on.
+
+#ifdef _WIN32
+
+#include <windows.h>
+#include <intrin.h>
+
+#else
+
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+typedef int BOOL;
+typedef long LONG;
+typedef unsigned long DWORD;
+typedef long long LONGLONG;
+typedef unsigned long long ULONGLONG;
+typedef unsigned int UINT;
+typedef unsigned char BYTE;
+typedef float FLOAT;
+typedef void* PVOID;
+typedef void* LPVOID;
+typedef void* HANDLE;
+typedef long HRESULT;
+
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+#define WINAPI
+#define INFINITE 0xFFFFFFFFu
+#define WAIT_OBJECT_0 0u
+#define WAIT_TIMEOUT 258u
+#define S_OK ((HRESULT)0)
+#define S_FALSE ((HRESULT)1)
+#define E_FAIL ((HRESULT)0x80004005L)
+#define E_INVALIDARG ((HRESULT)0x80070057L)
+#define E_OUTOFMEMORY ((HRESULT)0x8007000EL)
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+
+typedef union _LARGE_INTEGER
+{
+	struct
+	{
+		DWORD LowPart;
+		LONG HighPart;
+	};
+	LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+// interlocked operations and barriers
+
+inline LONG InterlockedIncrement(volatile LONG* p)				{return __sync_add_and_fetch(p, 1);}
+inline LONG InterlockedDecrement(volatile LONG* p)				{return __sync_sub_and_fetch(p, 1);}
+inline LONG InterlockedExchange(volatile LONG* p, LONG v)		{__sync_synchronize(); return __sync_lock_test_and_set(p, v);}
+inline LONG InterlockedExchangeAdd(volatile LONG* p, LONG v)	{return __sync_fetch_and_add(p, v);}
+inline LONG InterlockedCompareExchange(volatile LONG* p, LONG v, LONG cmp)	{return __sync_val_compare_and_swap(p, cmp, v);}
+inline LONGLONG InterlockedExchangeAdd64(volatile LONGLONG* p, LONGLONG v)	{return __sync_fetch_and_add(p, v);}
+inline LONGLONG InterlockedCompareExchange64(volatile LONGLONG* p, LONGLONG v, LONGLONG cmp)	{return __sync_val_compare_and_swap(p, cmp, v);}
+inline PVOID InterlockedCompareExchangePointer(PVOID volatile* p, PVOID v, PVOID cmp)	{return __sync_val_compare_and_swap(p, cmp, v);}
+#define MemoryBarrier() __sync_synchronize()
+#define _ReadWriteBarrier() __asm__ __volatile__("" ::: "memory")
+#define YieldProcessor() sched_yield()
+
+// time
+
+inline void Sleep(DWORD ms)
+{
+	struct timespec ts;
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+	{
+	}
+}
+
+inline BOOL QueryPerformanceFrequency(LARGE_INTEGER* frequency)
+{
+	frequency->QuadPart = 1000000000LL;
+	return TRUE;
+}
+
+inline BOOL QueryPerformanceCounter(LARGE_INTEGER* counter)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	counter->QuadPart = (LONGLONG)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+	return TRUE;
+}
+
+inline DWORD GetTickCount()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (DWORD)((ULONGLONG)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+}
+
+namespace portable
+{
+	// absolute CLOCK_REALTIME deadline ms from now, for the timed pthread waits
+	inline struct timespec deadline(DWORD ms)
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += ms / 1000;
+		ts.tv_nsec += (long)(ms % 1000) * 1000000L;
+		if (ts.tv_nsec >= 1000000000L)
+		{
+			++ts.tv_sec;
+			ts.tv_nsec -= 1000000000L;
+		}
+		return ts;
+	}
+}
+
+// locks: CRITICAL_SECTION is recursive like on Windows
+
+typedef struct
+{
+	pthread_mutex_t mutex;
+} CRITICAL_SECTION;
+
+inline void InitializeCriticalSection(CRITICAL_SECTION* cs)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&cs->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+inline void DeleteCriticalSection(CRITICAL_SECTION* cs)	{pthread_mutex_destroy(&cs->mutex);}
+inline void EnterCriticalSection(CRITICAL_SECTION* cs)	{pthread_mutex_lock(&cs->mutex);}
+inline void LeaveCriticalSection(CRITICAL_SECTION* cs)	{pthread_mutex_unlock(&cs->mutex);}
+
+typedef struct
+{
+	pthread_rwlock_t lock;
+} SRWLOCK;
+
+// Windows SRW locks need no cleanup, so neither do these
+inline void InitializeSRWLock(SRWLOCK* lock)		{pthread_rwlock_init(&lock->lock, NULL);}
+inline void AcquireSRWLockExclusive(SRWLOCK* lock)	{pthread_rwlock_wrlock(&lock->lock);}
+inline void ReleaseSRWLockExclusive(SRWLOCK* lock)	{pthread_rwlock_unlock(&lock->lock);}
+inline void AcquireSRWLockShared(SRWLOCK* lock)		{pthread_rwlock_rdlock(&lock->lock);}
+inline void ReleaseSRWLockShared(SRWLOCK* lock)		{pthread_rwlock_unlock(&lock->lock);}
+
+typedef struct
+{
+	pthread_cond_t cond;
+} CONDITION_VARIABLE;
+
+inline void InitializeConditionVariable(CONDITION_VARIABLE* cv)	{pthread_cond_init(&cv->cond, NULL);}
+inline void WakeConditionVariable(CONDITION_VARIABLE* cv)		{pthread_cond_signal(&cv->cond);}
+inline void WakeAllConditionVariable(CONDITION_VARIABLE* cv)	{pthread_cond_broadcast(&cv->cond);}
+
+// only valid with a critical section entered once, as all callers do
+inline BOOL SleepConditionVariableCS(CONDITION_VARIABLE* cv, CRITICAL_SECTION* cs, DWORD ms)
+{
+	if (ms == INFINITE)
+	{
+		return pthread_cond_wait(&cv->cond, &cs->mutex) == 0;
+	}
+	struct timespec until = portable::deadline(ms);
+	return pthread_cond_timedwait(&cv->cond, &cs->mutex, &until) == 0;
+}
+
+// threads: a HANDLE is a joinable thread that WaitForSingleObject can time out on
+
+typedef DWORD (WINAPI *LPTHREAD_START_ROUTINE)(PVOID param);
+
+namespace portable
+{
+	struct Thread
+	{
+		pthread_t thread;
+		pthread_mutex_t mutex;
+		pthread_cond_t done;
+		LPTHREAD_START_ROUTINE routine;
+		PVOID param;
+		bool finished;
+		bool joined;
+	};
+
+	inline void* threadMain(void* p)
+	{
+		Thread* t = static_cast<Thread*>(p);
+		t->routine(t->param);
+		pthread_mutex_lock(&t->mutex);
+		t->finished = true;
+		pthread_cond_broadcast(&t->done);
+		pthread_mutex_unlock(&t->mutex);
+		return NULL;
+	}
+}
+
+// the kernel thread id, what tools like perf and the trace viewers show
+inline DWORD GetCurrentThreadId()	{return (DWORD)syscall(SYS_gettid);}
+inline DWORD GetCurrentProcessId()	{return (DWORD)getpid();}
+
+// fiber local storage is used for its callback at thread exit, which is
+// what a pthread key destructor is; only called for values that are set
+#define FLS_OUT_OF_INDEXES 0xFFFFFFFFu
+typedef void (WINAPI *PFLS_CALLBACK_FUNCTION)(PVOID data);
+
+inline DWORD FlsAlloc(PFLS_CALLBACK_FUNCTION callback)
+{
+	pthread_key_t key;
+	return pthread_key_create(&key, callback) == 0 ? (DWORD)key : FLS_OUT_OF_INDEXES;
+}
+inline BOOL FlsSetValue(DWORD index, PVOID data)	{return pthread_setspecific((pthread_key_t)index, data) == 0;}
+
+inline HANDLE CreateThread(void* /*security*/, size_t /*stackSize*/, LPTHREAD_START_ROUTINE routine, PVOID param, DWORD /*flags*/, DWORD* /*threadId*/)
+{
+	portable::Thread* t = new portable::Thread;
+	pthread_mutex_init(&t->mutex, NULL);
+	pthread_cond_init(&t->done, NULL);
+	t->routine = routine;
+	t->param = param;
+	t->finished = false;
+	t->joined = false;
+	if (pthread_create(&t->thread, NULL, portable::threadMain, t) != 0)
+	{
+		pthread_cond_destroy(&t->done);
+		pthread_mutex_destroy(&t->mutex);
+		delete t;
+		return NULL;
+	}
+	return t;
+}
+
+inline DWORD WaitForSingleObject(HANDLE handle, DWORD ms)
+{
+	portable::Thread* t = static_cast<portable::Thread*>(handle);
+	pthread_mutex_lock(&t->mutex);
+	if (ms == INFINITE)
+	{
+		while (!t->finished)
+		{
+			pthread_cond_wait(&t->done, &t->mutex);
+		}
+	}
+	else
+	{
+		struct timespec until = portable::deadline(ms);
+		while (!t->finished && pthread_cond_timedwait(&t->done, &t->mutex, &until) == 0)
+		{
+		}
+	}
+	bool finished = t->finished;
+	pthread_mutex_unlock(&t->mutex);
+	if (finished && !t->joined)
+	{
+		pthread_join(t->thread, NULL);
+		t->joined = true;
+	}
+	return finished ? WAIT_OBJECT_0 : WAIT_TIMEOUT;
+}
+
+// a thread that is still running is detached, like closing its Windows handle
+inline BOOL CloseHandle(HANDLE handle)
+{
+	portable::Thread* t = static_cast<portable::Thread*>(handle);
+	if (!t)
+	{
+		return FALSE;
+	}
+	pthread_mutex_lock(&t->mutex);
+	bool finished = t->finished;
+	pthread_mutex_unlock(&t->mutex);
+	if (!t->joined)
+	{
+		if (finished)
+		{
+			pthread_join(t->thread, NULL);
+		}
+		else
+		{
+			// the thread still touches t, so it is left to leak
+			pthread_detach(t->thread);
+			return TRUE;
+		}
+	}
+	pthread_cond_destroy(&t->done);
+	pthread_mutex_destroy(&t->mutex);
+	delete t;
+	return TRUE;
+}
+
+#endif
+
+#endif
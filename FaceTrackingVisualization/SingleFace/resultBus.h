@@ -0,0 +1,388 @@
+#ifndef RESULT_BUS_H
+#define RESULT_BUS_H
+
+#include "portable.h"
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define RESULT_BUS_THREAD_LOCAL __declspec(thread)
+#else
+#define RESULT_BUS_THREAD_LOCAL __thread
+#endif
+
+namespace resultBusDetail
+{
+	// the bus and subscriber whose callbacks this thread runs, NULL on
+	// other threads
+	struct Worker
+	{
+		const void* bus;
+		PVOID subscriber;
+	};
+
+	inline Worker& currentWorker()
+	{
+		static RESULT_BUS_THREAD_LOCAL Worker worker = {NULL, NULL};
+		return worker;
+	}
+}
+
+// Fan-out of tracking results to any number of consumers, each on its own
+// thread with its own bounded queue, so a slow consumer never holds up the
+// tracker. A published result is shared by all queues (one allocation, no
+// copies) and freed when the last subscriber is done with it.
+//
+// LatestWins: a full queue drops its oldest entry, the consumer always gets
+//   the newest state (UI, avatars).
+// Lossless: a full queue makes publish() wait up to maxWaitMs for space and
+//   only then drops, counted in the stats (recorders, loggers).
+template<typename T>
+class ResultBus
+{
+public:
+	typedef std::shared_ptr<const T> ResultPtr;
+	typedef void (*CallBack)(PVOID param, const ResultPtr& result);
+
+	enum DropPolicy
+	{
+		LatestWins,
+		Lossless
+	};
+
+	struct Stats
+	{
+		unsigned long long delivered;
+		unsigned long long dropped;
+		size_t queued;
+		size_t maxQueued;
+		double averageLagMs;	// publish() to the start of the callback
+		double maxLagMs;
+	};
+
+	ResultBus()
+	{
+		InitializeSRWLock(&lock);
+		QueryPerformanceFrequency(&frequency);
+	}
+
+	~ResultBus()
+	{
+		stop();
+	}
+
+	// Returns the subscriber id, or -1 if its thread could not be started.
+	int subscribe(const char* name, CallBack callBack, PVOID param, size_t capacity, DropPolicy policy, DWORD maxWaitMs = 100)
+	{
+		Subscriber* subscriber = new Subscriber(this, name, callBack, param, capacity ? capacity : 1, policy, maxWaitMs);
+		subscriber->thread = CreateThread(NULL, 0, workerStaticThread, subscriber, 0, NULL);
+		if (!subscriber->thread)
+		{
+			delete subscriber;
+			return -1;
+		}
+		AcquireSRWLockExclusive(&lock);
+		int id = (int)subscribers.size();
+		subscriber->id = id;
+		subscribers.push_back(subscriber);
+		ReleaseSRWLockExclusive(&lock);
+		return id;
+	}
+
+	// Finishes what is queued for the subscriber, then ends its thread.
+	// From the subscriber's own callback it drops what is queued and stops
+	// the deliveries without any lock, flush() may hold the bus meanwhile;
+	// stop() or another unsubscribe() from outside joins the thread later.
+	void unsubscribe(int id)
+	{
+		const resultBusDetail::Worker& worker = resultBusDetail::currentWorker();
+		if (worker.bus == this && static_cast<Subscriber*>(worker.subscriber)->id == id)
+		{
+			static_cast<Subscriber*>(worker.subscriber)->cancel();
+			return;
+		}
+		AcquireSRWLockExclusive(&lock);
+		Subscriber* subscriber = (id >= 0 && id < (int)subscribers.size()) ? subscribers[id] : NULL;
+		if (subscriber)
+		{
+			subscribers[id] = NULL;
+		}
+		ReleaseSRWLockExclusive(&lock);
+		if (subscriber)
+		{
+			subscriber->close();
+			delete subscriber;
+		}
+	}
+
+	// Waits until every subscriber has delivered what is queued for it; the
+	// subscribers stay. The producer must not publish meanwhile, and it must
+	// not be called from a callback.
+	void flush()
+	{
+		AcquireSRWLockShared(&lock);
+		for (size_t i = 0; i < subscribers.size(); ++i)
+		{
+			if (subscribers[i])
+			{
+				subscribers[i]->waitDrained();
+			}
+		}
+		ReleaseSRWLockShared(&lock);
+	}
+
+	void stop()
+	{
+		AcquireSRWLockShared(&lock);
+		size_t count = subscribers.size();
+		ReleaseSRWLockShared(&lock);
+		for (size_t i = 0; i < count; ++i)
+		{
+			unsubscribe((int)i);
+		}
+		AcquireSRWLockExclusive(&lock);
+		subscribers.clear();
+		ReleaseSRWLockExclusive(&lock);
+	}
+
+	// Called by the producer thread. Only Lossless subscribers can make it wait.
+	void publish(const ResultPtr& result)
+	{
+		if (!result)
+		{
+			return;
+		}
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		AcquireSRWLockShared(&lock);
+		for (size_t i = 0; i < subscribers.size(); ++i)
+		{
+			if (subscribers[i])
+			{
+				subscribers[i]->push(result, now.QuadPart);
+			}
+		}
+		ReleaseSRWLockShared(&lock);
+	}
+
+	bool getStats(int id, Stats& stats) const
+	{
+		AcquireSRWLockShared(&lock);
+		Subscriber* subscriber = (id >= 0 && id < (int)subscribers.size()) ? subscribers[id] : NULL;
+		if (subscriber)
+		{
+			subscriber->getStats(stats);
+		}
+		ReleaseSRWLockShared(&lock);
+		return subscriber != NULL;
+	}
+
+	// a copy, the subscriber may be gone once the lock is released
+	std::string getName(int id) const
+	{
+		AcquireSRWLockShared(&lock);
+		std::string name = (id >= 0 && id < (int)subscribers.size() && subscribers[id]) ? subscribers[id]->name : std::string();
+		ReleaseSRWLockShared(&lock);
+		return name;
+	}
+
+	int getSubscriberCount() const
+	{
+		AcquireSRWLockShared(&lock);
+		int count = (int)subscribers.size();
+		ReleaseSRWLockShared(&lock);
+		return count;
+	}
+
+private:
+	ResultBus(const ResultBus&);
+	ResultBus& operator=(const ResultBus&);
+
+	struct Entry
+	{
+		Entry(const ResultPtr& r, LONGLONG t):result(r), ticks(t) {}
+		ResultPtr result;
+		LONGLONG ticks;
+	};
+
+	struct Subscriber
+	{
+		Subscriber(ResultBus* owner, const char* subscriberName, CallBack cb, PVOID cbParam, size_t queueCapacity, DropPolicy dropPolicy, DWORD waitMs)
+			:bus(owner), id(-1), name(subscriberName ? subscriberName : ""), callBack(cb), param(cbParam), capacity(queueCapacity),
+			policy(dropPolicy), maxWaitMs(waitMs), thread(NULL), running(true), busy(false),
+			delivered(0), dropped(0), maxQueued(0), totalLagMs(0.0), maxLagMs(0.0)
+		{
+			InitializeCriticalSection(&cs);
+			InitializeConditionVariable(&notEmpty);
+			InitializeConditionVariable(&notFull);
+			InitializeConditionVariable(&drained);
+		}
+
+		~Subscriber()
+		{
+			DeleteCriticalSection(&cs);
+		}
+
+		void push(const ResultPtr& result, LONGLONG ticks)
+		{
+			EnterCriticalSection(&cs);
+			if (!running)
+			{
+				// cancelled from its callback, waits for stop() to join it
+				LeaveCriticalSection(&cs);
+				return;
+			}
+			if (policy == Lossless)
+			{
+				DWORD start = GetTickCount();
+				DWORD waited = 0;
+				while (running && queue.size() >= capacity && waited < maxWaitMs)
+				{
+					SleepConditionVariableCS(&notFull, &cs, maxWaitMs - waited);
+					waited = GetTickCount() - start;
+				}
+			}
+			if (queue.size() >= capacity)
+			{
+				queue.pop_front();
+				++dropped;
+			}
+			queue.push_back(Entry(result, ticks));
+			maxQueued = queue.size() > maxQueued ? queue.size() : maxQueued;
+			LeaveCriticalSection(&cs);
+			WakeConditionVariable(&notEmpty);
+		}
+
+		void close()
+		{
+			EnterCriticalSection(&cs);
+			running = false;
+			LeaveCriticalSection(&cs);
+			WakeAllConditionVariable(&notEmpty);
+			WakeAllConditionVariable(&notFull);
+			if (thread)
+			{
+				WaitForSingleObject(thread, INFINITE);
+				CloseHandle(thread);
+				thread = NULL;
+			}
+		}
+
+		// the thread ends once the callback that called it returns
+		void cancel()
+		{
+			EnterCriticalSection(&cs);
+			running = false;
+			dropped += queue.size();
+			queue.clear();
+			LeaveCriticalSection(&cs);
+			WakeAllConditionVariable(&notFull);
+			WakeAllConditionVariable(&drained);
+		}
+
+		void waitDrained()
+		{
+			EnterCriticalSection(&cs);
+			while (running && (busy || !queue.empty()))
+			{
+				SleepConditionVariableCS(&drained, &cs, INFINITE);
+			}
+			LeaveCriticalSection(&cs);
+		}
+
+		void run()
+		{
+			resultBusDetail::Worker& worker = resultBusDetail::currentWorker();
+			worker.bus = bus;
+			worker.subscriber = this;
+			EnterCriticalSection(&cs);
+			for (;;)
+			{
+				while (running && queue.empty())
+				{
+					SleepConditionVariableCS(&notEmpty, &cs, INFINITE);
+				}
+				if (queue.empty())
+				{
+					break;
+				}
+				Entry entry = queue.front();
+				queue.pop_front();
+				busy = true;
+				LeaveCriticalSection(&cs);
+				WakeConditionVariable(&notFull);
+
+				LARGE_INTEGER now;
+				QueryPerformanceCounter(&now);
+				double lagMs = (now.QuadPart - entry.ticks) * 1000.0 / bus->frequency.QuadPart;
+				callBack(param, entry.result);
+				entry.result.reset();
+
+				EnterCriticalSection(&cs);
+				++delivered;
+				totalLagMs += lagMs;
+				maxLagMs = lagMs > maxLagMs ? lagMs : maxLagMs;
+				busy = false;
+				if (queue.empty())
+				{
+					WakeAllConditionVariable(&drained);
+				}
+			}
+			LeaveCriticalSection(&cs);
+			WakeAllConditionVariable(&drained);
+			worker.bus = NULL;
+			worker.subscriber = NULL;
+		}
+
+		void getStats(Stats& stats)
+		{
+			EnterCriticalSection(&cs);
+			stats.delivered = delivered;
+			stats.dropped = dropped;
+			stats.queued = queue.size();
+			stats.maxQueued = maxQueued;
+			stats.averageLagMs = delivered ? totalLagMs / delivered : 0.0;
+			stats.maxLagMs = maxLagMs;
+			LeaveCriticalSection(&cs);
+		}
+
+		ResultBus* bus;
+		int id;
+		std::string name;
+		CallBack callBack;
+		PVOID param;
+		size_t capacity;
+		DropPolicy policy;
+		DWORD maxWaitMs;
+		HANDLE thread;
+		bool running;
+		bool busy;					// a callback is running
+
+		CRITICAL_SECTION cs;
+		CONDITION_VARIABLE notEmpty;
+		CONDITION_VARIABLE notFull;
+		CONDITION_VARIABLE drained;
+		std::deque<Entry> queue;
+
+		unsigned long long delivered;
+		unsigned long long dropped;
+		size_t maxQueued;
+		double totalLagMs;
+		double maxLagMs;
+	};
+
+	static DWORD WINAPI workerStaticThread(PVOID lpParam)
+	{
+		static_cast<Subscriber*>(lpParam)->run();
+		return 0;
+	}
+
+	mutable SRWLOCK lock;
+	LARGE_INTEGER frequency;
+	std::vector<Subscriber*> subscribers;
+};
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef SEQ_LOCK_H
+#define SEQ_LOCK_H
+
+#include "portable.h"
+#include <string.h>
+
+// Single writer, any number of readers, nobody blocks. The writer makes the
+// sequence odd, copies the value and makes it even again; a reader copies
+// the value and retries if the sequence was odd or moved meanwhile. T must
+// be plain data that is safe to memcpy, and small enough to copy while the
+// writer is idle (the tracker publishes ~30 times a second).
+template<typename T>
+class SeqLock
+{
+public:
+	SeqLock():sequence(0)
+	{
+		memset(&value, 0, sizeof(T));
+	}
+
+	// only ever called from one thread
+	void write(const T& v)
+	{
+		InterlockedIncrement(&sequence);
+		_ReadWriteBarrier();
+		memcpy(&value, &v, sizeof(T));
+		MemoryBarrier();
+		InterlockedIncrement(&sequence);
+	}
+
+	// false only if every attempt overlapped a write
+	bool read(T& out, int maxAttempts = 64) const
+	{
+		for (int attempt = 0; attempt < maxAttempts; ++attempt)
+		{
+			LONG before = sequence;
+			if (before & 1)
+			{
+				YieldProcessor();
+				continue;
+			}
+			MemoryBarrier();
+			memcpy(&out, const_cast<const T*>(&value), sizeof(T));
+			MemoryBarrier();
+			if (sequence == before)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// number of completed writes
+	LONG version() const {return sequence >> 1;}
+
+private:
+	SeqLock(const SeqLock&);
+	SeqLock& operator=(const SeqLock&);
+
+	volatile LONG sequence;
+	T value;
+};
+
+#endif
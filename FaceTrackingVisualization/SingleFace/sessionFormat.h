@@ -0,0 +1,86 @@
+#ifndef SESSION_FORMAT_H
+#define SESSION_FORMAT_H
+
+#include <stdint.h>
+
+// Compact recording of a tracking session. The Candide topology and the
+// user's shape units hardly ever change, so a frame is fully described by
+// its pose, animation units and pupils: the file stores the topology once
+// in its header and then one fixed-size 96 byte record per tracked frame.
+// When the tracker refines the shape units a shape record is written in
+// between, it applies to the frames after it. Meshes are rebuilt from the
+// records on demand with the SDK's face model (SessionReader::BuildMesh).
+//
+// Fixed-width little endian fields only, free of SDK types so analysis
+// tools only need this header. Bump SESSION_FILE_VERSION whenever a record
+// changes.
+
+#define SESSION_FILE_MAGIC		0x53505446u		// "FTPS"
+#define SESSION_FILE_VERSION	1u
+#define SESSION_MAX_AU			6				// what the Kinect tracker reports
+#define SESSION_MAX_SU			16				// FACE_MAX_SU
+
+enum SessionRecordKind
+{
+	SESSION_RECORD_FRAME	= 1,
+	SESSION_RECORD_SHAPE	= 2
+};
+
+enum SessionFrameFlags
+{
+	SESSION_FRAME_GAZE		= 1		// pupils are valid
+};
+
+// 64 bytes, followed by triangleCount * 3 uint16_t vertex indices; the
+// records start at headerSize
+struct SessionFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t recordSize;
+	uint32_t headerSize;
+	uint32_t vertexCount;
+	uint32_t triangleCount;
+	uint32_t auCount;
+	uint32_t reserved0;
+	int64_t tickFrequency;			// for the record timestamps
+	float focalLength;				// colour camera, as the tracker saw it
+	uint32_t imageWidth;
+	uint32_t imageHeight;
+	uint32_t reserved[3];
+};
+
+// 80 bytes each
+struct SessionPose
+{
+	float scale;
+	float rotation[3];				// degrees: pitch, yaw, roll
+	float translation[3];			// metres, camera space
+	float au[SESSION_MAX_AU];
+	float leftPupil[3];
+	float rightPupil[3];
+	float pupilR;
+};
+
+struct SessionShape
+{
+	uint32_t suCount;
+	float su[SESSION_MAX_SU];
+	uint32_t reserved[3];
+};
+
+// 96 bytes
+struct SessionRecord
+{
+	uint16_t kind;
+	uint16_t flags;
+	uint32_t frameId;
+	int64_t timestamp;				// QueryPerformanceCounter of the tracker
+	union
+	{
+		SessionPose pose;			// SESSION_RECORD_FRAME
+		SessionShape shape;			// SESSION_RECORD_SHAPE
+	};
+};
+
+#endif
@@ -0,0 +1,237 @@
+#include "stdafx.h"
+#include "sessionIndex.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+namespace
+{
+	bool earlier(const SessionIndexEntry& a, const SessionIndexEntry& b)
+	{
+		return a.timestamp < b.timestamp;
+	}
+
+	bool entryBefore(const SessionIndexEntry& entry, int64_t timestamp)
+	{
+		return entry.timestamp < timestamp;
+	}
+
+	const SessionFileHeader* sessionHeader(const MappedFile& session)
+	{
+		if (session.bytes() < sizeof(SessionFileHeader))
+		{
+			return NULL;
+		}
+		const SessionFileHeader* header = (const SessionFileHeader*)session.begin();
+		bool ok = header->magic == SESSION_FILE_MAGIC && header->version == SESSION_FILE_VERSION &&
+			header->recordSize == sizeof(SessionRecord) &&
+			header->headerSize >= sizeof(SessionFileHeader) + (uint64_t)header->triangleCount * 3 * sizeof(uint16_t) &&
+			header->headerSize <= session.bytes();
+		return ok ? header : NULL;
+	}
+}
+
+SessionIndex::SessionIndex():header(NULL), entries(NULL), count(0)
+{
+}
+
+bool SessionIndex::collect(const MappedFile& session, SessionIndexHeader& indexHeader, std::vector<SessionIndexEntry>& list)
+{
+	const SessionFileHeader* header = sessionHeader(session);
+	if (!header)
+	{
+		return false;
+	}
+	// a recording that is still running or was cut short ends in a partial record
+	size_t records = (session.bytes() - header->headerSize) / sizeof(SessionRecord);
+	const SessionRecord* r = (const SessionRecord*)(session.begin() + header->headerSize);
+
+	list.clear();
+	list.reserve(records);
+	uint64_t shapeOffset = 0;
+	for (size_t i = 0; i < records; ++i)
+	{
+		uint64_t offset = header->headerSize + (uint64_t)i * sizeof(SessionRecord);
+		if (r[i].kind == SESSION_RECORD_SHAPE)
+		{
+			shapeOffset = offset;
+		}
+		else if (r[i].kind == SESSION_RECORD_FRAME)
+		{
+			SessionIndexEntry entry;
+			entry.timestamp = r[i].timestamp;
+			entry.offset = offset;
+			entry.shapeOffset = shapeOffset;
+			entry.frameId = r[i].frameId;
+			entry.flags = r[i].flags;
+			list.push_back(entry);
+		}
+	}
+	// recorded in order already, a stable sort costs one pass then
+	std::stable_sort(list.begin(), list.end(), earlier);
+
+	memset(&indexHeader, 0, sizeof(indexHeader));
+	indexHeader.magic = SESSION_INDEX_MAGIC;
+	indexHeader.version = SESSION_INDEX_VERSION;
+	indexHeader.entrySize = sizeof(SessionIndexEntry);
+	indexHeader.count = (uint32_t)list.size();
+	indexHeader.sessionBytes = session.bytes();
+	indexHeader.firstTimestamp = list.empty() ? 0 : list.front().timestamp;
+	indexHeader.lastTimestamp = list.empty() ? 0 : list.back().timestamp;
+	return true;
+}
+
+bool SessionIndex::build(const std::string& sessionFile, const std::string& indexFile)
+{
+	MappedFile session;
+	SessionIndexHeader indexHeader;
+	std::vector<SessionIndexEntry> list;
+	if (!session.open(sessionFile) || !collect(session, indexHeader, list))
+	{
+		return false;
+	}
+	FILE* fp = fopen(indexFile.c_str(), "wb");
+	if (!fp)
+	{
+		return false;
+	}
+	bool ok = fwrite(&indexHeader, sizeof(indexHeader), 1, fp) == 1 &&
+		(list.empty() || fwrite(&list[0], sizeof(SessionIndexEntry), list.size(), fp) == list.size());
+	ok = fclose(fp) == 0 && ok;
+	if (!ok)
+	{
+		remove(indexFile.c_str());
+	}
+	return ok;
+}
+
+bool SessionIndex::mapIndex(const std::string& indexFile)
+{
+	if (!sidecar.open(indexFile, MappedFile::Random) || sidecar.bytes() < sizeof(SessionIndexHeader))
+	{
+		sidecar.close();
+		return false;
+	}
+	const SessionIndexHeader* indexHeader = (const SessionIndexHeader*)sidecar.begin();
+	bool ok = indexHeader->magic == SESSION_INDEX_MAGIC && indexHeader->version == SESSION_INDEX_VERSION &&
+		indexHeader->entrySize == sizeof(SessionIndexEntry) &&
+		sidecar.bytes() == sizeof(SessionIndexHeader) + (size_t)indexHeader->count * sizeof(SessionIndexEntry) &&
+		indexHeader->sessionBytes == session.bytes();
+	if (!ok)
+	{
+		sidecar.close();
+		return false;
+	}
+	entries = (const SessionIndexEntry*)(indexHeader + 1);
+	count = indexHeader->count;
+	return true;
+}
+
+bool SessionIndex::open(const std::string& sessionFile)
+{
+	return open(sessionFile, defaultIndexFile(sessionFile));
+}
+
+bool SessionIndex::open(const std::string& sessionFile, const std::string& indexFile)
+{
+	close();
+	if (!session.open(sessionFile, MappedFile::Random) || !(header = sessionHeader(session)))
+	{
+		close();
+		return false;
+	}
+	if (mapIndex(indexFile))
+	{
+		return true;
+	}
+	// missing, stale or damaged
+	if (build(sessionFile, indexFile) && mapIndex(indexFile))
+	{
+		return true;
+	}
+	SessionIndexHeader indexHeader;
+	if (!collect(session, indexHeader, memoryEntries))
+	{
+		close();
+		return false;
+	}
+	entries = memoryEntries.empty() ? NULL : &memoryEntries[0];
+	count = memoryEntries.size();
+	return true;
+}
+
+void SessionIndex::close()
+{
+	sidecar.close();
+	session.close();
+	memoryEntries.clear();
+	header = NULL;
+	entries = NULL;
+	count = 0;
+}
+
+bool SessionIndex::view(size_t i, SessionFrameView& view) const
+{
+	if (i >= count)
+	{
+		return false;
+	}
+	const SessionIndexEntry& e = entries[i];
+	size_t bytes = session.bytes();
+	if (e.offset < header->headerSize || e.offset + sizeof(SessionRecord) > bytes ||
+		(e.shapeOffset && (e.shapeOffset < header->headerSize || e.shapeOffset + sizeof(SessionRecord) > bytes)))
+	{
+		return false;
+	}
+	view.entry = &e;
+	view.frame = (const SessionRecord*)(session.begin() + e.offset);
+	view.shape = e.shapeOffset ? &((const SessionRecord*)(session.begin() + e.shapeOffset))->shape : NULL;
+	return true;
+}
+
+size_t SessionIndex::seek(int64_t timestamp) const
+{
+	if (!count)
+	{
+		return 0;
+	}
+	return std::lower_bound(entries, entries + count, timestamp, entryBefore) - entries;
+}
+
+double SessionIndex::toMs(int64_t timestamp) const
+{
+	if (!count || !header || header->tickFrequency <= 0)
+	{
+		return 0.0;
+	}
+	return (timestamp - entries[0].timestamp) * 1000.0 / header->tickFrequency;
+}
+
+size_t SessionIndex::seekMs(double ms) const
+{
+	if (!count || !header || header->tickFrequency <= 0)
+	{
+		return count;
+	}
+	return seek(entries[0].timestamp + (int64_t)(ms * header->tickFrequency / 1000.0));
+}
+
+SessionCursor::SessionCursor(const SessionIndex& sessionIndex, size_t first, size_t end, uint32_t flags)
+	:index(sessionIndex), current(first), last(end < sessionIndex.size() ? end : sessionIndex.size()), requiredFlags(flags)
+{
+}
+
+bool SessionCursor::next(SessionFrameView& view)
+{
+	while (current < last)
+	{
+		const SessionIndexEntry& e = index.entry(current++);
+		// the flags are in the index, frames that do not match are never touched
+		if ((e.flags & requiredFlags) == requiredFlags && index.view(current - 1, view))
+		{
+			return true;
+		}
+	}
+	return false;
+}
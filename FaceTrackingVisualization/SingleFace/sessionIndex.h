@@ -0,0 +1,116 @@
+#ifndef SESSION_INDEX_H
+#define SESSION_INDEX_H
+
+#include "sessionFormat.h"
+#include "mappedFile.h"
+
+#include <string>
+#include <vector>
+
+// Random access into recorded sessions (see SessionRecorder) without
+// loading them. A sidecar file next to the session holds one entry per
+// frame sorted by timestamp; both files are memory mapped, a seek is a
+// binary search over the sidecar and frames are read in place from the
+// session mapping, so only the pages that are touched get loaded.
+//
+// The sidecar is rebuilt when it is missing or was made for a shorter
+// session (a recording that was still running).
+
+#define SESSION_INDEX_MAGIC		0x58495346u		// "FSIX"
+#define SESSION_INDEX_VERSION	1u
+
+// 48 bytes, followed by count entries
+struct SessionIndexHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entrySize;
+	uint32_t count;
+	uint64_t sessionBytes;			// size of the session when it was indexed
+	int64_t firstTimestamp;
+	int64_t lastTimestamp;
+	uint32_t reserved[2];
+};
+
+// 32 bytes
+struct SessionIndexEntry
+{
+	int64_t timestamp;
+	uint64_t offset;				// of the frame record in the session
+	uint64_t shapeOffset;			// of the shape record in effect, 0 for none
+	uint32_t frameId;
+	uint32_t flags;					// SessionFrameFlags
+};
+
+// Pointers into the mapped session, valid while the index is open.
+struct SessionFrameView
+{
+	const SessionIndexEntry* entry;
+	const SessionRecord* frame;
+	const SessionShape* shape;		// NULL if no shape was recorded before the frame
+};
+
+class SessionIndex
+{
+public:
+	SessionIndex();
+
+	static std::string defaultIndexFile(const std::string& sessionFile)	{return sessionFile + ".idx";}
+	// Walks the session once and writes its sidecar.
+	static bool build(const std::string& sessionFile, const std::string& indexFile);
+
+	// Maps the session and its sidecar, building the sidecar first if it is
+	// missing or stale. If it cannot be written the index is kept in memory.
+	bool open(const std::string& sessionFile);
+	bool open(const std::string& sessionFile, const std::string& indexFile);
+	void close();
+	bool isOpen() const	{return header != NULL;}
+
+	const SessionFileHeader* getHeader() const	{return header;}
+	const uint16_t* getTriangles() const	{return header ? (const uint16_t*)(header + 1) : NULL;}
+
+	size_t size() const	{return count;}
+	const SessionIndexEntry& entry(size_t i) const	{return entries[i];}
+	// false for an entry that points outside the session
+	bool view(size_t i, SessionFrameView& view) const;
+
+	// First frame at or after the timestamp, size() if there is none.
+	size_t seek(int64_t timestamp) const;
+	// Same, in ms from the first frame.
+	size_t seekMs(double ms) const;
+	double toMs(int64_t timestamp) const;
+	double getDurationMs() const	{return count ? toMs(entries[count - 1].timestamp) : 0.0;}
+
+private:
+	SessionIndex(const SessionIndex&);
+	SessionIndex& operator=(const SessionIndex&);
+
+	static bool collect(const MappedFile& session, SessionIndexHeader& indexHeader, std::vector<SessionIndexEntry>& entries);
+	bool mapIndex(const std::string& indexFile);
+
+	MappedFile session;
+	MappedFile sidecar;
+	std::vector<SessionIndexEntry> memoryEntries;		// when the sidecar could not be written
+	const SessionFileHeader* header;
+	const SessionIndexEntry* entries;
+	size_t count;
+};
+
+// Streams the frames of [first, last) that have all of requiredFlags set,
+// in timestamp order and without copying them.
+class SessionCursor
+{
+public:
+	SessionCursor(const SessionIndex& index, size_t first, size_t last, uint32_t requiredFlags = 0);
+
+	bool next(SessionFrameView& view);
+	size_t position() const	{return current;}
+
+private:
+	const SessionIndex& index;
+	size_t current;
+	size_t last;
+	uint32_t requiredFlags;
+};
+
+#endif
@@ -0,0 +1,357 @@
+#include "stdafx.h"
+#include "sessionRecorder.h"
+#include "asyncLog.h"
+
+#include <io.h>
+#include <math.h>
+#include <string.h>
+
+namespace
+{
+	// the shape units drift by tiny amounts while the tracker converges
+	const float SHAPE_EPSILON = 1e-4f;
+
+	const size_t WRITE_BUFFER_BYTES = 64 * 1024;
+
+	bool writeAll(FILE* file, const void* data, size_t bytes)
+	{
+		return fwrite(data, 1, bytes, file) == bytes;
+	}
+}
+
+SessionRecorder::SessionRecorder():bus(NULL), subscriber(-1), file(NULL), headerWritten(false), suCount(0),
+	frameCount(0), bytesWritten(0)
+{
+	memset(su, 0, sizeof(su));
+}
+
+SessionRecorder::~SessionRecorder()
+{
+	stop();
+}
+
+bool SessionRecorder::start(Bus& resultBus, const std::string& path)
+{
+	stop();
+	if (fopen_s(&file, path.c_str(), "wb") != 0 || !file)
+	{
+		file = NULL;
+		return false;
+	}
+	buffer.resize(WRITE_BUFFER_BYTES);
+	setvbuf(file, &buffer[0], _IOFBF, buffer.size());
+	headerWritten = false;
+	suCount = 0;
+	frameCount = 0;
+	bytesWritten = 0;
+
+	// a few seconds of frames may queue up behind a slow disk
+	bus = &resultBus;
+	subscriber = bus->subscribe("session recorder", onResult, this, 256, Bus::Lossless);
+	if (subscriber < 0)
+	{
+		fclose(file);
+		file = NULL;
+		bus = NULL;
+		return false;
+	}
+	return true;
+}
+
+void SessionRecorder::stop()
+{
+	if (bus)
+	{
+		// returns once the queued frames are written
+		bus->unsubscribe(subscriber);
+		bus = NULL;
+		subscriber = -1;
+	}
+	if (file)
+	{
+		fclose(file);
+		file = NULL;
+	}
+}
+
+void SessionRecorder::onResult(PVOID param, const Bus::ResultPtr& result)
+{
+	static_cast<SessionRecorder*>(param)->record(*result);
+}
+
+bool SessionRecorder::writeHeader(const TrackingSnapshot& snapshot)
+{
+	const FaceTopology* topology = snapshot.topology;
+	if (!topology)
+	{
+		return false;
+	}
+	UINT triangleCount = topology->GetTriangleCount();
+	size_t triangleBytes = (size_t)triangleCount * 3 * sizeof(uint16_t);
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+
+	SessionFileHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = SESSION_FILE_MAGIC;
+	header.version = SESSION_FILE_VERSION;
+	header.recordSize = sizeof(SessionRecord);
+	// records stay 8 byte aligned for readers that map the file
+	header.headerSize = (uint32_t)((sizeof(header) + triangleBytes + 7) & ~(size_t)7);
+	header.vertexCount = topology->GetVertexCount();
+	header.triangleCount = triangleCount;
+	header.auCount = snapshot.geometry.auCount < SESSION_MAX_AU ? snapshot.geometry.auCount : SESSION_MAX_AU;
+	header.tickFrequency = frequency.QuadPart;
+	header.focalLength = snapshot.geometry.cameraConfig.FocalLength;
+	header.imageWidth = snapshot.geometry.cameraConfig.Width;
+	header.imageHeight = snapshot.geometry.cameraConfig.Height;
+
+	std::vector<uint16_t> indices((size_t)triangleCount * 3);
+	const FT_TRIANGLE* triangles = topology->GetTriangles();
+	for (UINT t = 0; t < triangleCount; ++t)
+	{
+		indices[3 * t] = (uint16_t)triangles[t].i;
+		indices[3 * t + 1] = (uint16_t)triangles[t].j;
+		indices[3 * t + 2] = (uint16_t)triangles[t].k;
+	}
+	static const char padding[8] = {0};
+	size_t paddingBytes = header.headerSize - sizeof(header) - triangleBytes;
+	if (!writeAll(file, &header, sizeof(header)) ||
+		(triangleBytes && !writeAll(file, &indices[0], triangleBytes)) ||
+		!writeAll(file, padding, paddingBytes))
+	{
+		// the next frame writes the header again from the start; if the
+		// partial one cannot be taken back the recording ends here
+		if (_fseeki64(file, 0, SEEK_SET) != 0 || _chsize_s(_fileno(file), 0) != 0)
+		{
+			LOG_ERROR("session recorder: header write failed, recording stopped");
+			fclose(file);
+			file = NULL;
+		}
+		return false;
+	}
+	bytesWritten += header.headerSize;
+	return true;
+}
+
+void SessionRecorder::writeShape(const TrackingSnapshot& snapshot)
+{
+	const FaceGeometry& geometry = snapshot.geometry;
+	UINT count = geometry.suCount < SESSION_MAX_SU ? geometry.suCount : SESSION_MAX_SU;
+	bool changed = count != suCount;
+	for (UINT i = 0; i < count && !changed; ++i)
+	{
+		changed = fabs(geometry.su[i] - su[i]) > SHAPE_EPSILON;
+	}
+	if (!changed)
+	{
+		return;
+	}
+	suCount = count;
+	memcpy(su, geometry.su, count * sizeof(FLOAT));
+
+	SessionRecord r;
+	memset(&r, 0, sizeof(r));
+	r.kind = SESSION_RECORD_SHAPE;
+	r.frameId = snapshot.frameId;
+	r.timestamp = snapshot.timestamp;
+	r.shape.suCount = count;
+	memcpy(r.shape.su, geometry.su, count * sizeof(float));
+	if (writeAll(file, &r, sizeof(r)))
+	{
+		bytesWritten += sizeof(r);
+	}
+}
+
+void SessionRecorder::record(const TrackingSnapshot& snapshot)
+{
+	if (!file || !snapshot.tracked || !snapshot.geometry.valid)
+	{
+		return;
+	}
+	// the topology is only known once the tracker found a face
+	if (!headerWritten && !(headerWritten = writeHeader(snapshot)))
+	{
+		return;
+	}
+	writeShape(snapshot);
+
+	const FaceGeometry& geometry = snapshot.geometry;
+	SessionRecord r;
+	memset(&r, 0, sizeof(r));
+	r.kind = SESSION_RECORD_FRAME;
+	r.flags = snapshot.gazeValid ? SESSION_FRAME_GAZE : 0;
+	r.frameId = snapshot.frameId;
+	r.timestamp = snapshot.timestamp;
+	r.pose.scale = geometry.scale;
+	for (int i = 0; i < 3; ++i)
+	{
+		r.pose.rotation[i] = geometry.rotation[i];
+		r.pose.translation[i] = geometry.translation[i];
+	}
+	UINT auCount = geometry.auCount < SESSION_MAX_AU ? geometry.auCount : SESSION_MAX_AU;
+	memcpy(r.pose.au, geometry.au, auCount * sizeof(float));
+	if (snapshot.gazeValid)
+	{
+		r.pose.leftPupil[0] = snapshot.leftPupil.x;
+		r.pose.leftPupil[1] = snapshot.leftPupil.y;
+		r.pose.leftPupil[2] = snapshot.leftPupil.z;
+		r.pose.rightPupil[0] = snapshot.rightPupil.x;
+		r.pose.rightPupil[1] = snapshot.rightPupil.y;
+		r.pose.rightPupil[2] = snapshot.rightPupil.z;
+		r.pose.pupilR = snapshot.pupilR;
+	}
+	if (writeAll(file, &r, sizeof(r)))
+	{
+		bytesWritten += sizeof(r);
+		frameCount = frameCount + 1;
+	}
+}
+
+SessionReader::SessionReader()
+{
+	memset(&header, 0, sizeof(header));
+}
+
+void SessionReader::close()
+{
+	memset(&header, 0, sizeof(header));
+	triangles.clear();
+	records.clear();
+	frames.clear();
+}
+
+bool SessionReader::open(const std::string& path)
+{
+	close();
+	FILE* file = NULL;
+	if (fopen_s(&file, path.c_str(), "rb") != 0 || !file)
+	{
+		return false;
+	}
+	bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+		header.magic == SESSION_FILE_MAGIC && header.version == SESSION_FILE_VERSION &&
+		header.recordSize == sizeof(SessionRecord);
+	// 64 bit offsets, a long recording passes 2 GB
+	int64_t end = ok && _fseeki64(file, 0, SEEK_END) == 0 ? _ftelli64(file) : -1;
+	// the triangles are counted by the file, they have to fit in its header
+	// and the header in the file before anything is allocated for them
+	ok = ok && end >= (int64_t)header.headerSize &&
+		header.headerSize >= sizeof(header) + (uint64_t)header.triangleCount * 3 * sizeof(uint16_t);
+	if (ok && header.triangleCount)
+	{
+		triangles.resize((size_t)header.triangleCount * 3);
+		ok = _fseeki64(file, sizeof(header), SEEK_SET) == 0 &&
+			fread(&triangles[0], sizeof(uint16_t), triangles.size(), file) == triangles.size();
+	}
+	if (ok)
+	{
+		// a recording cut short by a crash ends in a partial record, ignore it
+		size_t count = end > (int64_t)header.headerSize ? (size_t)((end - header.headerSize) / sizeof(SessionRecord)) : 0;
+		records.resize(count);
+		ok = _fseeki64(file, header.headerSize, SEEK_SET) == 0 &&
+			(count == 0 || fread(&records[0], sizeof(SessionRecord), count, file) == count);
+	}
+	fclose(file);
+	if (!ok)
+	{
+		close();
+		return false;
+	}
+
+	int shape = -1;
+	frames.reserve(records.size());
+	for (UINT i = 0; i < records.size(); ++i)
+	{
+		if (records[i].kind == SESSION_RECORD_SHAPE)
+		{
+			shape = (int)i;
+		}
+		else if (records[i].kind == SESSION_RECORD_FRAME)
+		{
+			FrameEntry entry = {i, shape};
+			frames.push_back(entry);
+		}
+	}
+	return true;
+}
+
+const SessionRecord* SessionReader::getFrame(UINT index) const
+{
+	return index < frames.size() ? &records[frames[index].record] : NULL;
+}
+
+const SessionShape* SessionReader::getShape(UINT index) const
+{
+	return index < frames.size() && frames[index].shape >= 0 ? &records[frames[index].shape].shape : NULL;
+}
+
+HRESULT SessionReader::BuildMesh(IFTModel* model, UINT index, FT_VECTOR3D* vertices, UINT vertexCount) const
+{
+	const SessionRecord* frame = getFrame(index);
+	const SessionShape* shape = getShape(index);
+	if (!model || !vertices)
+	{
+		return E_POINTER;
+	}
+	if (!frame || !shape)
+	{
+		return E_INVALIDARG;
+	}
+	UINT numSU = model->GetSUCount();
+	UINT numAU = model->GetAUCount();
+	if (numSU > SESSION_MAX_SU || numAU > SESSION_MAX_AU || vertexCount < model->GetVertexCount())
+	{
+		return E_UNEXPECTED;
+	}
+
+	// units the recording does not have stay neutral
+	FLOAT suValues[SESSION_MAX_SU] = {0};
+	FLOAT auValues[SESSION_MAX_AU] = {0};
+	memcpy(suValues, shape->su, (shape->suCount < numSU ? shape->suCount : numSU) * sizeof(FLOAT));
+	memcpy(auValues, frame->pose.au, (header.auCount < numAU ? header.auCount : numAU) * sizeof(FLOAT));
+	FLOAT rotation[3] = {frame->pose.rotation[0], frame->pose.rotation[1], frame->pose.rotation[2]};
+	FLOAT translation[3] = {frame->pose.translation[0], frame->pose.translation[1], frame->pose.translation[2]};
+	return model->Get3DShape(suValues, numSU, auValues, numAU, frame->pose.scale, rotation, translation,
+		vertices, model->GetVertexCount());
+}
+
+bool SessionReader::WriteObj(const std::string& path, UINT index, const FT_VECTOR3D* vertices) const
+{
+	const SessionRecord* frame = getFrame(index);
+	FILE* fobj = NULL;
+	if (!frame || !vertices || fopen_s(&fobj, path.c_str(), "w") != 0 || !fobj)
+	{
+		return false;
+	}
+	UINT vertexCount = header.vertexCount;
+	// what open() read, never more than the header claims
+	UINT triangleCount = (UINT)(triangles.size() / 3);
+	bool pupils = (frame->flags & SESSION_FRAME_GAZE) != 0;
+	fprintf(fobj, "# frame %u, %u vertices, %u faces\n", frame->frameId, vertexCount, triangleCount);
+	for (UINT vi = 0; vi < vertexCount; ++vi)
+	{
+		fprintf(fobj, "v %f %f %f\n", vertices[vi].x, vertices[vi].y, vertices[vi].z);
+	}
+	if (pupils)
+	{
+		const float* pupil[2] = {frame->pose.leftPupil, frame->pose.rightPupil};
+		for (int p = 0; p < 2; ++p)
+		{
+			fprintf(fobj, "v %f %f %f\n", pupil[p][0] + 0.05, pupil[p][1], pupil[p][2]);
+			fprintf(fobj, "v %f %f %f\n", pupil[p][0] - 0.05, pupil[p][1], pupil[p][2]);
+			fprintf(fobj, "v %f %f %f\n", pupil[p][0], pupil[p][1] + 0.08, pupil[p][2]);
+		}
+	}
+	for (UINT ti = 0; ti < triangleCount; ++ti)
+	{
+		fprintf(fobj, "f %u %u %u\n", triangles[3 * ti] + 1u, triangles[3 * ti + 1] + 1u, triangles[3 * ti + 2] + 1u);
+	}
+	if (pupils)
+	{
+		fprintf(fobj, "f %u %u %u\n", vertexCount + 1, vertexCount + 2, vertexCount + 3);
+		fprintf(fobj, "f %u %u %u\n", vertexCount + 4, vertexCount + 5, vertexCount + 6);
+	}
+	return fclose(fobj) == 0;
+}
@@ -0,0 +1,88 @@
+#ifndef SESSION_RECORDER_H
+#define SESSION_RECORDER_H
+
+#include "sessionFormat.h"
+#include "trackingSnapshot.h"
+#include "resultBus.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Subscribes to the tracker's result bus without loss; the bus thread of
+// the subscription does the encoding and the file writes, the tracking
+// thread only hands over the snapshot.
+class SessionRecorder
+{
+public:
+	typedef ResultBus<TrackingSnapshot> Bus;
+
+	SessionRecorder();
+	~SessionRecorder();
+
+	bool start(Bus& bus, const std::string& path);
+	// Writes what is still queued and closes the file.
+	void stop();
+	bool isRecording() const	{return file != NULL;}
+
+	UINT getFrameCount() const	{return frameCount;}
+	unsigned long long getBytesWritten() const	{return bytesWritten;}
+
+private:
+	SessionRecorder(const SessionRecorder&);
+	SessionRecorder& operator=(const SessionRecorder&);
+
+	static void onResult(PVOID param, const Bus::ResultPtr& result);
+	void record(const TrackingSnapshot& snapshot);
+	bool writeHeader(const TrackingSnapshot& snapshot);
+	void writeShape(const TrackingSnapshot& snapshot);
+
+	Bus* bus;
+	int subscriber;
+	FILE* file;
+	std::vector<char> buffer;
+	bool headerWritten;
+	UINT suCount;
+	FLOAT su[SESSION_MAX_SU];
+	volatile UINT frameCount;
+	unsigned long long bytesWritten;
+};
+
+// Loads a recorded session into memory, about 10 MB per hour at 30 fps.
+class SessionReader
+{
+public:
+	SessionReader();
+
+	bool open(const std::string& path);
+	void close();
+
+	const SessionFileHeader& getHeader() const	{return header;}
+	const uint16_t* getTriangles() const	{return triangles.empty() ? NULL : &triangles[0];}
+
+	UINT getFrameCount() const	{return (UINT)frames.size();}
+	// NULL past the end
+	const SessionRecord* getFrame(UINT index) const;
+	// shape units in effect for the frame, NULL if none was recorded before it
+	const SessionShape* getShape(UINT index) const;
+
+	// Rebuilds the frame's 3D vertices with the face model of a tracker
+	// (IFTFaceTracker::GetShapeModel); vertexCount is at least the header's.
+	HRESULT BuildMesh(IFTModel* model, UINT index, FT_VECTOR3D* vertices, UINT vertexCount) const;
+	// Wavefront OBJ of a rebuilt mesh, with a small marker triangle on each pupil.
+	bool WriteObj(const std::string& path, UINT index, const FT_VECTOR3D* vertices) const;
+
+private:
+	struct FrameEntry
+	{
+		UINT record;
+		int shape;		// record index, -1 for none
+	};
+
+	SessionFileHeader header;
+	std::vector<uint16_t> triangles;
+	std::vector<SessionRecord> records;
+	std::vector<FrameEntry> frames;
+};
+
+#endif
@@ -0,0 +1,405 @@
+#include "stdafx.h"
+#include "sharedResultRing.h"
+
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// A named block of shared memory. The producer creates it, readers map an
+// existing one read-only.
+class SharedMemoryView
+{
+public:
+#ifdef _WIN32
+	SharedMemoryView():mapping(NULL), data(NULL), size(0) {}
+	~SharedMemoryView()
+	{
+		if (data) UnmapViewOfFile(data);
+		if (mapping) CloseHandle(mapping);
+	}
+
+	bool create(const std::string& name, size_t bytes)
+	{
+		// pagefile backed, gone once the last process closes its handle
+		mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, (DWORD)bytes, ("Local\\" + name).c_str());
+		if (!mapping)
+			return false;
+		data = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, bytes);
+		size = bytes;
+		return data != NULL;
+	}
+
+	bool open(const std::string& name)
+	{
+		mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, ("Local\\" + name).c_str());
+		if (!mapping)
+			return false;
+		data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+		if (!data)
+			return false;
+		MEMORY_BASIC_INFORMATION info;
+		size = VirtualQuery(data, &info, sizeof(info)) ? info.RegionSize : 0;
+		return true;
+	}
+#else
+	SharedMemoryView():owner(false), data(NULL), size(0) {}
+	~SharedMemoryView()
+	{
+		if (data) munmap(data, size);
+		// readers that are still attached keep their mapping
+		if (owner) shm_unlink(shmName.c_str());
+	}
+
+	bool create(const std::string& name, size_t bytes)
+	{
+		shmName = "/" + name;
+		int fd = shm_open(shmName.c_str(), O_RDWR | O_CREAT, 0644);
+		if (fd < 0)
+			return false;
+		owner = true;
+		// readers of an earlier producer may still map the old size, the
+		// block only grows so none of their pages goes away
+		struct stat st;
+		if (fstat(fd, &st) != 0)
+		{
+			::close(fd);
+			return false;
+		}
+		if ((size_t)st.st_size < bytes && ftruncate(fd, (off_t)bytes) != 0)
+		{
+			::close(fd);
+			return false;
+		}
+		void* view = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (view == MAP_FAILED)
+			return false;
+		data = view;
+		size = bytes;
+		return true;
+	}
+
+	bool open(const std::string& name)
+	{
+		int fd = shm_open(("/" + name).c_str(), O_RDONLY, 0);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		void* view = fstat(fd, &st) == 0 && st.st_size > 0 ? mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+		::close(fd);
+		if (view == MAP_FAILED)
+			return false;
+		data = view;
+		size = (size_t)st.st_size;
+		return true;
+	}
+#endif
+
+	void* begin() const {return data;}
+	size_t bytes() const {return size;}
+
+private:
+#ifdef _WIN32
+	HANDLE mapping;
+#else
+	std::string shmName;
+	bool owner;
+#endif
+	void* data;
+	size_t size;
+};
+
+namespace
+{
+	uint32_t currentProcessId()
+	{
+#ifdef _WIN32
+		return (uint32_t)GetCurrentProcessId();
+#else
+		return (uint32_t)getpid();
+#endif
+	}
+
+	// start time, process and ring address mixed (splitmix64), so a
+	// restarted producer differs even with a reused pid
+	uint64_t newSessionId(const void* ring)
+	{
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		uint64_t x = (uint64_t)now.QuadPart ^ ((uint64_t)currentProcessId() << 32) ^ (uint64_t)(size_t)ring;
+		x += 0x9e3779b97f4a7c15ull;
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+		x ^= x >> 31;
+		return x ? x : 1;
+	}
+}
+
+SharedResultRing::SharedResultRing():view(NULL), header(NULL), slots(NULL), sequence(0)
+{
+}
+
+SharedResultRing::~SharedResultRing()
+{
+	close();
+}
+
+bool SharedResultRing::create(const std::string& name, uint32_t capacity)
+{
+	close();
+	if (name.empty() || capacity < 2)
+	{
+		return false;
+	}
+
+	view = new SharedMemoryView();
+	if (!view->create(name, sizeof(SharedRingHeader) + capacity * sizeof(SharedRingSlot)))
+	{
+		close();
+		return false;
+	}
+	header = (SharedRingHeader*)view->begin();
+	slots = (SharedRingSlot*)(header + 1);
+
+	// the name may still be mapped by readers of an earlier producer: hide the
+	// header while the slots are reset, readers resync on the new sessionId
+	header->magic = 0;
+	MemoryBarrier();
+	for (uint32_t i = 0; i < capacity; ++i)
+	{
+		slots[i].sequence = 0;
+	}
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	header->version = SHARED_RING_VERSION;
+	header->recordSize = sizeof(SharedTrackingRecord);
+	header->capacity = capacity;
+	header->tickFrequency = frequency.QuadPart;
+	header->lastSequence = 0;
+	header->producerId = currentProcessId();
+	header->sessionId = newSessionId(this);
+	MemoryBarrier();
+	header->magic = SHARED_RING_MAGIC;
+	sequence = 0;
+	return true;
+}
+
+void SharedResultRing::close()
+{
+	if (header)
+	{
+		header->magic = 0;
+	}
+	delete view;
+	view = NULL;
+	header = NULL;
+	slots = NULL;
+}
+
+void SharedResultRing::publish(const SharedTrackingRecord& record)
+{
+	if (!header)
+	{
+		return;
+	}
+	uint32_t n = ++sequence;
+	SharedRingSlot& slot = slots[(n - 1) % header->capacity];
+	slot.sequence = 2 * n - 1;
+	MemoryBarrier();
+	memcpy((void*)&slot.record, &record, sizeof(record));
+	MemoryBarrier();
+	slot.sequence = 2 * n;
+	header->lastSequence = n;
+}
+
+SharedResultReader::SharedResultReader():view(NULL), header(NULL), slots(NULL), sessionId(0), rejectedSession(0),
+	capacity(0), nextSequence(1), lost(0), reopenTick(0)
+{
+}
+
+SharedResultReader::~SharedResultReader()
+{
+	close();
+}
+
+bool SharedResultReader::open(const std::string& name)
+{
+	close();
+	ringName = name;
+	view = new SharedMemoryView();
+	if (!view->open(name) || view->bytes() < sizeof(SharedRingHeader))
+	{
+		close();
+		return false;
+	}
+	header = (const SharedRingHeader*)view->begin();
+	slots = (const SharedRingSlot*)(header + 1);
+	rejectedSession = 0;
+	lost = 0;
+	if (header->magic != SHARED_RING_MAGIC || !attach(false))
+	{
+		close();
+		return false;
+	}
+	return true;
+}
+
+// Takes on the producer whose header is mapped now. Its fields are read
+// between two looks at magic and sessionId, so a header a new producer is
+// rewriting meanwhile is not taken. A ring larger than the mapping is
+// mapped again once, one that still does not fit is rejected.
+bool SharedResultReader::attach(bool fromStart)
+{
+	for (int attempt = 0; attempt < 2; ++attempt)
+	{
+		uint64_t session = header->sessionId;
+		MemoryBarrier();
+		bool compatible = header->version == SHARED_RING_VERSION && header->recordSize == sizeof(SharedTrackingRecord);
+		uint32_t ringCapacity = header->capacity;
+		uint32_t last = header->lastSequence;
+		MemoryBarrier();
+		if (header->magic != SHARED_RING_MAGIC || header->sessionId != session || session == rejectedSession)
+		{
+			return false;
+		}
+		if (!compatible || ringCapacity < 2)
+		{
+			rejectedSession = session;
+			return false;
+		}
+		if (sizeof(SharedRingHeader) + (uint64_t)ringCapacity * sizeof(SharedRingSlot) <= view->bytes())
+		{
+			sessionId = session;
+			capacity = ringCapacity;
+			nextSequence = fromStart ? 1 : last + 1;
+			return true;
+		}
+		// a new producer made the block larger, or on Linux a new block
+		if (attempt > 0 || !reopen())
+		{
+			rejectedSession = session;
+			return false;
+		}
+	}
+	return false;
+}
+
+// Maps the block the name refers to now, the old mapping stays if the name
+// cannot be opened again.
+bool SharedResultReader::reopen()
+{
+	SharedMemoryView* current = new SharedMemoryView();
+	if (!current->open(ringName) || current->bytes() < sizeof(SharedRingHeader))
+	{
+		delete current;
+		return false;
+	}
+	delete view;
+	view = current;
+	header = (const SharedRingHeader*)view->begin();
+	slots = (const SharedRingSlot*)(header + 1);
+	return true;
+}
+
+void SharedResultReader::close()
+{
+	delete view;
+	view = NULL;
+	header = NULL;
+	slots = NULL;
+	sessionId = 0;
+	capacity = 0;
+}
+
+bool SharedResultReader::readSlot(uint32_t n, SharedTrackingRecord& record) const
+{
+	const SharedRingSlot& slot = slots[(n - 1) % capacity];
+	uint32_t before = slot.sequence;
+	if (before != 2 * n)
+	{
+		return false;
+	}
+	MemoryBarrier();
+	memcpy(&record, (const void*)&slot.record, sizeof(record));
+	MemoryBarrier();
+	return slot.sequence == before;
+}
+
+bool SharedResultReader::next(SharedTrackingRecord& record)
+{
+	if (!header)
+	{
+		return false;
+	}
+	if (header->magic != SHARED_RING_MAGIC)
+	{
+		// the producer closed, look for the next one once a second
+		DWORD now = GetTickCount();
+		if (now - reopenTick < 1000)
+		{
+			return false;
+		}
+		reopenTick = now;
+		if (!reopen() || header->magic != SHARED_RING_MAGIC)
+		{
+			return false;
+		}
+	}
+	if (header->sessionId != sessionId && !attach(true))
+	{
+		// a new producer is taking over the name or its ring does not fit
+		return false;
+	}
+
+	for (int attempt = 0; attempt < 4; ++attempt)
+	{
+		uint32_t last = header->lastSequence;
+		if ((int32_t)(last - nextSequence) < 0)
+		{
+			return false;
+		}
+		// the oldest slot may be the one being overwritten right now
+		uint32_t available = last - nextSequence + 1;
+		if (available > capacity - 1)
+		{
+			uint32_t skip = available - (capacity - 1);
+			lost += skip;
+			nextSequence += skip;
+		}
+		if (readSlot(nextSequence, record))
+		{
+			++nextSequence;
+			return true;
+		}
+		// overwritten while copying, it is gone
+		++lost;
+		++nextSequence;
+	}
+	return false;
+}
+
+bool SharedResultReader::latest(SharedTrackingRecord& record) const
+{
+	// a producer next() has not attached to yet may have another capacity
+	if (!header || header->magic != SHARED_RING_MAGIC || header->sessionId != sessionId)
+	{
+		return false;
+	}
+	for (int attempt = 0; attempt < 4; ++attempt)
+	{
+		uint32_t last = header->lastSequence;
+		if (last == 0)
+		{
+			return false;
+		}
+		if (readSlot(last, record))
+		{
+			return true;
+		}
+	}
+	return false;
+}
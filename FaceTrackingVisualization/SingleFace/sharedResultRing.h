@@ -0,0 +1,147 @@
+#ifndef SHARED_RESULT_RING_H
+#define SHARED_RESULT_RING_H
+
+#include "portable.h"
+
+#include <stdint.h>
+#include <string>
+
+// Tracking results for other processes (UI, analytics, loggers) through a
+// named shared memory ring: one producer, any number of readers. Readers
+// only map the memory read-only, so they can attach, lag or die without the
+// tracker noticing. Each slot carries a sequence number that is odd while
+// the producer writes it; a reader copies the slot and keeps the copy only
+// if the number was even, unchanged and the one it expected, so reads never
+// wait. A reader that falls more than the capacity behind skips ahead and
+// counts the records it lost.
+//
+// A producer that restarts under the same name gets a new session id and
+// may use another capacity; readers resync on the id and check the new
+// ring against the memory they have mapped before touching a slot. A
+// reader whose producer has closed maps the name again now and then, on
+// Linux the next producer's block is a new one.
+//
+// The layout is fixed-width and free of SDK types so consumers only need
+// this header. Bump SHARED_RING_VERSION whenever a record field changes.
+
+#define SHARED_RING_MAGIC		0x52544346u		// "FCTR"
+#define SHARED_RING_VERSION		2u
+#define SHARED_RING_MAX_VERTICES	121
+#define SHARED_RING_MAX_AU		16
+
+enum SharedRecordFlags
+{
+	SHARED_RECORD_TRACKED	= 1,
+	SHARED_RECORD_GAZE		= 2		// pupils are valid
+};
+
+// 1624 bytes, no padding
+struct SharedTrackingRecord
+{
+	uint32_t frameId;
+	uint32_t userId;				// skeleton slot for multi face trackers, 0 otherwise
+	int64_t timestamp;				// producer's QueryPerformanceCounter, see SharedRingHeader::tickFrequency
+	uint32_t flags;
+	float scale;
+	float rotation[3];				// degrees: pitch, yaw, roll
+	float translation[3];			// metres, camera space
+	int32_t faceRect[4];			// left, top, right, bottom in colour pixels
+	uint32_t auCount;
+	float au[SHARED_RING_MAX_AU];
+	uint32_t vertexCount;
+	float vertices[SHARED_RING_MAX_VERTICES][3];
+	float leftPupil[3];
+	float rightPupil[3];
+	float pupilRadius;
+	uint32_t reserved[2];
+};
+
+// at the start of the shared block, followed by capacity slots
+struct SharedRingHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t recordSize;
+	uint32_t capacity;
+	int64_t tickFrequency;
+	volatile uint32_t lastSequence;	// last completed record, 0 before the first
+	uint32_t producerId;			// process id, for display only
+	uint64_t sessionId;				// never 0, new with every create(), pids get reused
+	uint32_t reserved[6];
+};
+
+struct SharedRingSlot
+{
+	volatile uint32_t sequence;		// 2n - 1 while record n is written, 2n once it is complete
+	uint32_t reserved;
+	SharedTrackingRecord record;
+};
+
+class SharedMemoryView;
+
+// Producer side, owned by the tracking thread.
+class SharedResultRing
+{
+public:
+	SharedResultRing();
+	~SharedResultRing();
+
+	// name is a plain identifier ("FaceTracking"), capacity a few seconds of frames
+	bool create(const std::string& name, uint32_t capacity);
+	void close();
+	bool isOpen() const	{return header != NULL;}
+
+	// never blocks, overwrites the oldest slot
+	void publish(const SharedTrackingRecord& record);
+
+private:
+	SharedResultRing(const SharedResultRing&);
+	SharedResultRing& operator=(const SharedResultRing&);
+
+	SharedMemoryView* view;
+	SharedRingHeader* header;
+	SharedRingSlot* slots;
+	uint32_t sequence;
+};
+
+// Consumer side, one per reading thread.
+class SharedResultReader
+{
+public:
+	SharedResultReader();
+	~SharedResultReader();
+
+	// Starts after the newest record, i.e. only sees what is published from now on.
+	bool open(const std::string& name);
+	void close();
+	bool isOpen() const	{return header != NULL;}
+
+	// Next record in order; false when there is nothing new yet.
+	bool next(SharedTrackingRecord& record);
+	// Newest record regardless of what was read before; false before the first one.
+	bool latest(SharedTrackingRecord& record) const;
+
+	uint64_t getLost() const	{return lost;}
+	int64_t getTickFrequency() const	{return header ? header->tickFrequency : 0;}
+
+private:
+	SharedResultReader(const SharedResultReader&);
+	SharedResultReader& operator=(const SharedResultReader&);
+
+	bool readSlot(uint32_t sequence, SharedTrackingRecord& record) const;
+	bool attach(bool fromStart);
+	bool reopen();
+
+	std::string ringName;
+	SharedMemoryView* view;
+	const SharedRingHeader* header;
+	const SharedRingSlot* slots;
+	uint64_t sessionId;
+	uint64_t rejectedSession;		// does not fit the mapping, not retried
+	uint32_t capacity;				// of sessionId, checked against the mapping
+	uint32_t nextSequence;
+	uint64_t lost;
+	DWORD reopenTick;				// last reopen() while the producer was gone
+};
+
+#endif
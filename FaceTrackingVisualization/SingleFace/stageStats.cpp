@@ -0,0 +1,355 @@
+#include "stdafx.h"
+#include "stageStats.h"
+#include "asyncLog.h"
+
+#include <string.h>
+
+namespace
+{
+	// zero initialized before any code runs, recording needs no setup
+	LatencyHistogram stageHistograms[STAGE_COUNT];
+	volatile LONG counterValues[COUNTER_COUNT];
+
+	const char* const kStageNames[STAGE_COUNT] =
+	{
+		"sensor depth",
+		"sensor colour",
+		"sensor skeleton",
+		"frame",
+		"frame read",
+		"face track",
+		"submit",
+		"gaze",
+		"gaze detect",
+		"gaze eye",
+		"publish",
+		"render"
+	};
+
+	const char* const kCounterNames[COUNTER_COUNT] =
+	{
+		"sensor depth",
+		"sensor colour",
+		"sensor skeleton",
+		"frames",
+		"read failed",
+		"tracked",
+		"lost",
+		"gaze faces",
+		"gaze misses"
+	};
+
+	int highestBit(unsigned long long v)
+	{
+		int bit = 0;
+		for (int shift = 32; shift; shift >>= 1)
+		{
+			if (v >> shift)
+			{
+				v >>= shift;
+				bit += shift;
+			}
+		}
+		return bit;
+	}
+
+	double ticksToMs(double ticks, LONGLONG tickFrequency)
+	{
+		return tickFrequency > 0 ? ticks * 1000.0 / tickFrequency : 0.0;
+	}
+
+	struct DumpState
+	{
+		CRITICAL_SECTION cs;
+		CONDITION_VARIABLE wake;
+		HANDLE thread;
+		DWORD intervalMs;
+		bool running;
+	};
+
+	DumpState dump;
+
+	DWORD WINAPI dumpThread(PVOID)
+	{
+		AsyncLog::setThreadName("stats");
+		StageStatsSnapshot* last = new StageStatsSnapshot;
+		StageStatsSnapshot* now = new StageStatsSnapshot;
+		StageStats::snapshot(*last);
+
+		EnterCriticalSection(&dump.cs);
+		while (dump.running)
+		{
+			DWORD start = GetTickCount();
+			DWORD waited = 0;
+			while (dump.running && waited < dump.intervalMs)
+			{
+				SleepConditionVariableCS(&dump.wake, &dump.cs, dump.intervalMs - waited);
+				waited = GetTickCount() - start;
+			}
+			if (!dump.running)
+				break;
+			LeaveCriticalSection(&dump.cs);
+
+			StageStats::snapshot(*now);
+			StageStats::log(*now, last);
+			StageStatsSnapshot* swap = last;
+			last = now;
+			now = swap;
+
+			EnterCriticalSection(&dump.cs);
+		}
+		LeaveCriticalSection(&dump.cs);
+
+		StageStats::snapshot(*now);
+		StageStats::log(*now, NULL);
+		delete last;
+		delete now;
+		return 0;
+	}
+}
+
+int LatencyHistogram::bucketOf(LONGLONG ticks)
+{
+	if (ticks < 2 * SubBuckets)
+	{
+		return ticks < 0 ? 0 : (int)ticks;
+	}
+	// the top SubBits + 1 bits pick the bucket, the bits below are dropped
+	int shift = highestBit((unsigned long long)ticks) - SubBits;
+	if (shift + 1 >= Bands)
+	{
+		return Buckets - 1;
+	}
+	return (shift + 1) * SubBuckets + (int)(ticks >> shift) - SubBuckets;
+}
+
+LONGLONG LatencyHistogram::bucketLow(int bucket)
+{
+	if (bucket < 2 * SubBuckets)
+	{
+		return bucket;
+	}
+	int shift = bucket / SubBuckets - 1;
+	return (LONGLONG)(SubBuckets + bucket % SubBuckets) << shift;
+}
+
+LONGLONG LatencyHistogram::bucketHigh(int bucket)
+{
+	if (bucket < 2 * SubBuckets)
+	{
+		return bucket + 1;
+	}
+	int shift = bucket / SubBuckets - 1;
+	return bucketLow(bucket) + ((LONGLONG)1 << shift);
+}
+
+void LatencyHistogram::record(LONGLONG ticks)
+{
+	if (ticks < 0)
+	{
+		ticks = 0;
+	}
+	InterlockedIncrement(&buckets[bucketOf(ticks)]);
+	InterlockedExchangeAdd64(&sumTicks, ticks);
+	LONGLONG seen = maxTicks;
+	while (ticks > seen)
+	{
+		LONGLONG previous = InterlockedCompareExchange64(&maxTicks, ticks, seen);
+		if (previous == seen)
+		{
+			break;
+		}
+		seen = previous;
+	}
+}
+
+void LatencyCounts::read(const LatencyHistogram& histogram)
+{
+	for (int i = 0; i < LatencyHistogram::Buckets; ++i)
+	{
+		buckets[i] = histogram.buckets[i];
+	}
+	// 64 bit reads are not atomic on 32 bit builds, a no-op exchange is
+	LatencyHistogram& h = const_cast<LatencyHistogram&>(histogram);
+	sumTicks = InterlockedCompareExchange64(&h.sumTicks, 0, 0);
+	maxTicks = InterlockedCompareExchange64(&h.maxTicks, 0, 0);
+}
+
+void LatencyCounts::subtract(const LatencyCounts& earlier)
+{
+	for (int i = 0; i < LatencyHistogram::Buckets; ++i)
+	{
+		buckets[i] -= earlier.buckets[i];
+	}
+	sumTicks -= earlier.sumTicks;
+}
+
+void LatencyCounts::summarize(LONGLONG tickFrequency, LatencySummary& summary) const
+{
+	memset(&summary, 0, sizeof(summary));
+	int highest = -1;
+	for (int i = 0; i < LatencyHistogram::Buckets; ++i)
+	{
+		if (buckets[i] > 0)
+		{
+			summary.count += buckets[i];
+			highest = i;
+		}
+	}
+	if (!summary.count)
+	{
+		return;
+	}
+	LONGLONG maxValue = LatencyHistogram::bucketHigh(highest) - 1;
+	if (maxTicks < maxValue)
+	{
+		maxValue = maxTicks;
+	}
+	summary.meanMs = ticksToMs((double)sumTicks / summary.count, tickFrequency);
+	summary.maxMs = ticksToMs((double)maxValue, tickFrequency);
+
+	// the middle of the bucket the rank falls into, never above the max
+	const double quantiles[3] = {0.5, 0.9, 0.99};
+	double* results[3] = {&summary.p50Ms, &summary.p90Ms, &summary.p99Ms};
+	int q = 0;
+	LONG seen = 0;
+	for (int i = 0; i <= highest && q < 3; ++i)
+	{
+		seen += buckets[i] > 0 ? buckets[i] : 0;
+		while (q < 3 && seen >= quantiles[q] * summary.count)
+		{
+			LONGLONG low = LatencyHistogram::bucketLow(i);
+			LONGLONG value = low + (LatencyHistogram::bucketHigh(i) - 1 - low) / 2;
+			*results[q++] = ticksToMs((double)(value < maxValue ? value : maxValue), tickFrequency);
+		}
+	}
+}
+
+void StageStatsSnapshot::subtract(const StageStatsSnapshot& earlier)
+{
+	for (int i = 0; i < STAGE_COUNT; ++i)
+	{
+		stages[i].subtract(earlier.stages[i]);
+	}
+	for (int i = 0; i < COUNTER_COUNT; ++i)
+	{
+		counters[i] -= earlier.counters[i];
+	}
+}
+
+double StageStatsSnapshot::seconds(const StageStatsSnapshot& earlier) const
+{
+	return tickFrequency > 0 ? (double)(timestamp - earlier.timestamp) / tickFrequency : 0.0;
+}
+
+void StageStats::record(TrackingStage stage, LONGLONG ticks)
+{
+	stageHistograms[stage].record(ticks);
+}
+
+void StageStats::count(TrackingCounter counter, LONG n)
+{
+	InterlockedExchangeAdd(&counterValues[counter], n);
+}
+
+void StageStats::snapshot(StageStatsSnapshot& snapshot)
+{
+	LARGE_INTEGER now, frequency;
+	QueryPerformanceCounter(&now);
+	QueryPerformanceFrequency(&frequency);
+	snapshot.timestamp = now.QuadPart;
+	snapshot.tickFrequency = frequency.QuadPart;
+	for (int i = 0; i < STAGE_COUNT; ++i)
+	{
+		snapshot.stages[i].read(stageHistograms[i]);
+	}
+	for (int i = 0; i < COUNTER_COUNT; ++i)
+	{
+		snapshot.counters[i] = counterValues[i];
+	}
+}
+
+const char* StageStats::stageName(TrackingStage stage)
+{
+	return stage >= 0 && stage < STAGE_COUNT ? kStageNames[stage] : "unknown";
+}
+
+const char* StageStats::counterName(TrackingCounter counter)
+{
+	return counter >= 0 && counter < COUNTER_COUNT ? kCounterNames[counter] : "unknown";
+}
+
+void StageStats::log(const StageStatsSnapshot& now, const StageStatsSnapshot* earlier)
+{
+	StageStatsSnapshot* delta = new StageStatsSnapshot(now);
+	if (earlier)
+	{
+		delta->subtract(*earlier);
+		double seconds = now.seconds(*earlier);
+		LOG_INFO("stage stats, last {} s: {} frames/s", seconds,
+			seconds > 0.0 ? delta->counters[COUNTER_FRAMES] / seconds : 0.0);
+	}
+	else
+	{
+		LOG_INFO("stage stats, totals");
+	}
+
+	for (int i = 0; i < STAGE_COUNT; ++i)
+	{
+		LatencySummary s;
+		delta->stages[i].summarize(delta->tickFrequency, s);
+		if (s.count)
+		{
+			LOG_INFO("  {}: {} x, mean {} ms, p50 {} ms, p99 {} ms, max {} ms", kStageNames[i], s.count,
+				s.meanMs, s.p50Ms, s.p99Ms, s.maxMs);
+		}
+	}
+	const LONGLONG* c = delta->counters;
+	LOG_INFO("  frames {}, read failed {}, tracked {}, lost {}, gaze faces {}, gaze misses {}",
+		c[COUNTER_FRAMES], c[COUNTER_READ_FAILED], c[COUNTER_TRACKED], c[COUNTER_LOST],
+		c[COUNTER_GAZE_FACES], c[COUNTER_GAZE_MISSES]);
+	if (c[COUNTER_SENSOR_COLOR] || c[COUNTER_SENSOR_DEPTH])
+	{
+		// the tracker takes the latest sensor frame, the rest are never read
+		LONGLONG unread = c[COUNTER_SENSOR_COLOR] - c[COUNTER_FRAMES];
+		LOG_INFO("  sensor colour {}, depth {}, skeleton {}, unread {}", c[COUNTER_SENSOR_COLOR],
+			c[COUNTER_SENSOR_DEPTH], c[COUNTER_SENSOR_SKELETON], unread > 0 ? unread : 0);
+	}
+	delete delta;
+}
+
+bool StageStats::startDump(DWORD intervalMs)
+{
+	if (dump.thread || !intervalMs)
+	{
+		return false;
+	}
+	InitializeCriticalSection(&dump.cs);
+	InitializeConditionVariable(&dump.wake);
+	dump.intervalMs = intervalMs;
+	dump.running = true;
+	dump.thread = CreateThread(NULL, 0, dumpThread, NULL, 0, NULL);
+	if (!dump.thread)
+	{
+		dump.running = false;
+		DeleteCriticalSection(&dump.cs);
+		return false;
+	}
+	return true;
+}
+
+void StageStats::stopDump()
+{
+	if (!dump.thread)
+	{
+		return;
+	}
+	EnterCriticalSection(&dump.cs);
+	dump.running = false;
+	WakeConditionVariable(&dump.wake);
+	LeaveCriticalSection(&dump.cs);
+	WaitForSingleObject(dump.thread, INFINITE);
+	CloseHandle(dump.thread);
+	dump.thread = NULL;
+	DeleteCriticalSection(&dump.cs);
+}
@@ -0,0 +1,177 @@
+#ifndef STAGE_STATS_H
+#define STAGE_STATS_H
+
+#include "portable.h"
+#include "pipelineTrace.h"
+
+// Where the time of a frame goes. Every stage of the pipeline is timed with
+// a scoped StageTimer into a histogram of its own and the events the stages
+// see are counted, so a slow frame can be put down to the sensor, the
+// FaceTrack SDK, the face detector, the pupil voting or the render.
+//
+// Recording takes two QueryPerformanceCounter reads and a few interlocked
+// adds, no lock and no allocation; any thread may record. StageStats::
+// snapshot() copies everything for reports, and the periodic dump logs
+// what happened since the last one. With STAGE_STATS_DISABLED defined the
+// STAGE_TIMER and STAGE_COUNTER macros compile to nothing.
+//
+// While PipelineTrace is on every stage timer also becomes a trace event
+// named after its stage, from the same two counter reads.
+
+enum TrackingStage
+{
+	STAGE_SENSOR_DEPTH,			// KinectSensor thread, depth frame copied out
+	STAGE_SENSOR_COLOR,
+	STAGE_SENSOR_SKELETON,
+	STAGE_FRAME,				// one pass of the tracking loop, all below
+	STAGE_FRAME_READ,			// FrameSource::readFrame plus the copy into the SDK images
+	STAGE_FACE_TRACK,			// IFTFaceTracker Start/ContinueTracking
+	STAGE_SUBMIT,				// geometry, gaze and the face mapping of a tracked frame
+	STAGE_GAZE,					// GazeTracking::analyze
+	STAGE_GAZE_DETECT,			// face detection, waiting for the cascade included
+	STAGE_GAZE_EYE,				// pupil voting, one eye
+	STAGE_PUBLISH,				// snapshot, result bus, shared ring and metrics
+	STAGE_RENDER,				// window paint
+	STAGE_COUNT
+};
+
+enum TrackingCounter
+{
+	COUNTER_SENSOR_DEPTH,		// frames the sensor delivered
+	COUNTER_SENSOR_COLOR,
+	COUNTER_SENSOR_SKELETON,
+	COUNTER_FRAMES,				// frames the tracker read
+	COUNTER_READ_FAILED,		// no frame from the source this pass
+	COUNTER_TRACKED,			// face tracked by the SDK
+	COUNTER_LOST,
+	COUNTER_GAZE_FACES,			// analyze() found a face
+	COUNTER_GAZE_MISSES,
+	COUNTER_COUNT
+};
+
+// Latency histogram in QueryPerformanceCounter ticks with log-linear
+// buckets, as in HDR histograms: values below 2 * SubBuckets have a bucket
+// each, above that every power of two is split into SubBuckets equal
+// buckets, so any value is kept to within 1 / SubBuckets (6%). Values
+// beyond 2^43 ticks, minutes even at GHz counter rates, share the last.
+// Plain data and all zero when empty, so static instances need no
+// constructor.
+struct LatencyHistogram
+{
+	enum
+	{
+		SubBits = 4,
+		SubBuckets = 1 << SubBits,
+		Bands = 40,
+		Buckets = Bands * SubBuckets
+	};
+
+	void record(LONGLONG ticks);
+
+	static int bucketOf(LONGLONG ticks);
+	static LONGLONG bucketLow(int bucket);
+	static LONGLONG bucketHigh(int bucket);		// exclusive
+
+	volatile LONG buckets[Buckets];
+	volatile LONGLONG sumTicks;
+	volatile LONGLONG maxTicks;
+};
+
+struct LatencySummary
+{
+	LONG count;
+	double meanMs;
+	double p50Ms;
+	double p90Ms;
+	double p99Ms;
+	double maxMs;
+};
+
+// Copy of one histogram. The copy is not atomic as a whole; a record that
+// lands while it is taken may be in the buckets but not yet in the sum.
+struct LatencyCounts
+{
+	void read(const LatencyHistogram& histogram);
+	// leaves what was recorded after earlier was read; maxTicks stays the
+	// all-time one, summarize() caps it at the highest bucket left
+	void subtract(const LatencyCounts& earlier);
+	void summarize(LONGLONG tickFrequency, LatencySummary& summary) const;
+
+	LONG buckets[LatencyHistogram::Buckets];
+	LONGLONG sumTicks;
+	LONGLONG maxTicks;
+};
+
+struct StageStatsSnapshot
+{
+	LONGLONG timestamp;			// QueryPerformanceCounter
+	LONGLONG tickFrequency;
+	LatencyCounts stages[STAGE_COUNT];
+	LONGLONG counters[COUNTER_COUNT];
+
+	// what happened between earlier and this one
+	void subtract(const StageStatsSnapshot& earlier);
+	double seconds(const StageStatsSnapshot& earlier) const;
+};
+
+class StageStats
+{
+public:
+	static void record(TrackingStage stage, LONGLONG ticks);
+	static void count(TrackingCounter counter, LONG n = 1);
+
+	// the snapshot is about 30 KB, keep it off small stacks
+	static void snapshot(StageStatsSnapshot& snapshot);
+
+	static const char* stageName(TrackingStage stage);
+	static const char* counterName(TrackingCounter counter);
+
+	// Logs one line per stage that ran and the counters, for the interval
+	// between earlier and now, or since the start without earlier.
+	static void log(const StageStatsSnapshot& now, const StageStatsSnapshot* earlier);
+
+	// Logs the last interval every intervalMs on a thread of its own, and
+	// the totals once more when stopped.
+	static bool startDump(DWORD intervalMs);
+	static void stopDump();
+};
+
+// Times the enclosing scope into a stage.
+class StageTimer
+{
+public:
+	explicit StageTimer(TrackingStage timedStage):stage(timedStage)
+	{
+		QueryPerformanceCounter(&start);
+	}
+	~StageTimer()
+	{
+		LARGE_INTEGER end;
+		QueryPerformanceCounter(&end);
+		StageStats::record(stage, end.QuadPart - start.QuadPart);
+		if (PipelineTrace::isEnabled())
+		{
+			PipelineTrace::complete(StageStats::stageName(stage), start.QuadPart, end.QuadPart);
+		}
+	}
+
+private:
+	StageTimer(const StageTimer&);
+	StageTimer& operator=(const StageTimer&);
+
+	TrackingStage stage;
+	LARGE_INTEGER start;
+};
+
+#define STAGE_STATS_CONCAT2(a, b) a##b
+#define STAGE_STATS_CONCAT(a, b) STAGE_STATS_CONCAT2(a, b)
+
+#ifndef STAGE_STATS_DISABLED
+#define STAGE_TIMER(stage)			StageTimer STAGE_STATS_CONCAT(stageTimer, __LINE__)(stage)
+#define STAGE_COUNTER(counter)		StageStats::count(counter)
+#else
+#define STAGE_TIMER(stage)			do {} while (0)
+#define STAGE_COUNTER(counter)		do {} while (0)
+#endif
+
+#endif
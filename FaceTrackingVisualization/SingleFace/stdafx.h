@@ -6,6 +6,7 @@
 
 #pragma once
 
+#ifdef _WIN32
 #include "targetver.h"
 
 #ifndef WIN32_LEAN_AND_MEAN
@@ -22,4 +23,12 @@
 #include <malloc.h>
 #include <memory.h>
 #include <crtdbg.h>
+#else
+// only the platform independent sources (gaze tracking, GazeService) are
+// built outside Windows
+#include "portable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#endif
 
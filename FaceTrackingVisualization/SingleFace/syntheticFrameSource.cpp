@@ -0,0 +1,193 @@
+#include "stdafx.h"
+#include "syntheticFrameSource.h"
+
+#include <math.h>
+
+namespace
+{
+	const UINT kColorWidth = 640;
+	const UINT kColorHeight = 480;
+	const UINT kDepthWidth = 320;
+	const UINT kDepthHeight = 240;
+	const float kColorFocalLength = 531.15f;		// NUI_CAMERA_COLOR_NOMINAL_FOCAL_LENGTH_IN_PIXELS
+	const float kDepthFocalLength = 285.63f;		// NUI_CAMERA_DEPTH_NOMINAL_FOCAL_LENGTH_IN_PIXELS
+	const uint16_t kBackgroundMm = 2500;
+
+	// Fills an ellipse in a B8G8R8X8 image; shade darkens it towards the rim.
+	void fillEllipse(BYTE* image, UINT width, UINT height, double cx, double cy, double rx, double ry,
+		BYTE b, BYTE g, BYTE r, bool shade)
+	{
+		int y0 = (int)floor(cy - ry), y1 = (int)ceil(cy + ry);
+		int x0 = (int)floor(cx - rx), x1 = (int)ceil(cx + rx);
+		for (int y = y0 < 0 ? 0 : y0; y <= y1 && y < (int)height; ++y)
+		{
+			double dy = (y - cy) / ry;
+			BYTE* row = image + (size_t)y * width * 4;
+			for (int x = x0 < 0 ? 0 : x0; x <= x1 && x < (int)width; ++x)
+			{
+				double dx = (x - cx) / rx;
+				double d = dx * dx + dy * dy;
+				if (d <= 1.0)
+				{
+					double f = shade ? 1.0 - 0.3 * d : 1.0;
+					row[x * 4] = (BYTE)(b * f);
+					row[x * 4 + 1] = (BYTE)(g * f);
+					row[x * 4 + 2] = (BYTE)(r * f);
+				}
+			}
+		}
+	}
+}
+
+SyntheticFrameSource::SyntheticFrameSource(UINT frameCount, DWORD intervalMs, UINT randomSeed)
+	:frames(frameCount), frameIntervalMs(intervalMs), seed(randomSeed), random(randomSeed), frameId(0), nextFrameTick(0)
+{
+	memset(&config, 0, sizeof(config));
+	memset(&skeleton, 0, sizeof(skeleton));
+}
+
+HRESULT SyntheticFrameSource::open()
+{
+	config.colorWidth = kColorWidth;
+	config.colorHeight = kColorHeight;
+	config.colorFocalLength = kColorFocalLength;
+	config.depthWidth = kDepthWidth;
+	config.depthHeight = kDepthHeight;
+	config.depthFocalLength = kDepthFocalLength;
+	config.zoomFactor = 1.0f;
+
+	// a wall with a vertical gradient, drawn once
+	background.resize(kColorWidth * kColorHeight * 4);
+	for (UINT y = 0; y < kColorHeight; ++y)
+	{
+		BYTE level = (BYTE)(150 - 60 * y / kColorHeight);
+		for (UINT x = 0; x < kColorWidth; ++x)
+		{
+			BYTE* p = &background[(y * kColorWidth + x) * 4];
+			p[0] = (BYTE)(level + 20);
+			p[1] = level;
+			p[2] = (BYTE)(level - 10);
+			p[3] = 0;
+		}
+	}
+	color.resize(background.size());
+	depth.resize(kDepthWidth * kDepthHeight);
+	random = seed;
+	frameId = 0;
+	nextFrameTick = GetTickCount();
+	return S_OK;
+}
+
+void SyntheticFrameSource::close()
+{
+	background.clear();
+	color.clear();
+	depth.clear();
+}
+
+void SyntheticFrameSource::render(double t)
+{
+	// head pose in camera space, the face size follows the distance
+	double phase = seed * 0.37;
+	double z = 0.8 + 0.15 * sin(0.4 * t + phase);
+	double cx = kColorWidth / 2 + 90.0 * sin(0.7 * t + phase);
+	double cy = kColorHeight / 2 + 45.0 * sin(1.1 * t);
+	double rx = 55.0 * 0.8 / z;
+	double ry = 72.0 * 0.8 / z;
+
+	memcpy(&color[0], &background[0], color.size());
+	BYTE* image = &color[0];
+	fillEllipse(image, kColorWidth, kColorHeight, cx, cy + 2.4 * ry, 2.2 * rx, 1.3 * ry, 90, 60, 50, false);		// shoulders
+	fillEllipse(image, kColorWidth, kColorHeight, cx, cy, rx, ry, 120, 160, 215, true);
+	double gazeX = 0.1 * rx * sin(2.3 * t);
+	double gazeY = 0.04 * ry * cos(1.7 * t);
+	for (int side = -1; side <= 1; side += 2)
+	{
+		double ex = cx + side * 0.38 * rx;
+		double ey = cy - 0.2 * ry;
+		fillEllipse(image, kColorWidth, kColorHeight, ex, ey - 0.16 * ry, 0.26 * rx, 0.03 * ry, 50, 60, 80, false);	// brow
+		fillEllipse(image, kColorWidth, kColorHeight, ex, ey, 0.22 * rx, 0.1 * ry, 235, 235, 235, false);
+		fillEllipse(image, kColorWidth, kColorHeight, ex + gazeX, ey + gazeY, 0.09 * rx, 0.09 * rx, 70, 60, 40, false);
+		fillEllipse(image, kColorWidth, kColorHeight, ex + gazeX, ey + gazeY, 0.04 * rx, 0.04 * rx, 15, 15, 15, false);
+	}
+	fillEllipse(image, kColorWidth, kColorHeight, cx, cy + 0.45 * ry, 0.35 * rx, 0.06 * ry, 60, 60, 140, false);
+
+	// the depth camera sees the same scene at half the resolution; the head
+	// bulges towards the camera, the shoulders sit a little behind it
+	double dcx = cx / 2, dcy = cy / 2, drx = rx / 2, dry = ry / 2;
+	double headMm = z * 1000.0;
+	for (UINT y = 0; y < kDepthHeight; ++y)
+	{
+		uint16_t* row = &depth[y * kDepthWidth];
+		for (UINT x = 0; x < kDepthWidth; ++x)
+		{
+			random = random * 1664525u + 1013904223u;
+			int noise = (int)(random >> 30) - 1;
+			double hx = (x - dcx) / drx, hy = (y - dcy) / dry;
+			double head = hx * hx + hy * hy;
+			double sx = (x - dcx) / (2.2 * drx), sy = (y - dcy - 2.4 * dry) / (1.3 * dry);
+			UINT mm = kBackgroundMm;
+			UINT player = 0;
+			if (head <= 1.0)
+			{
+				mm = (UINT)(headMm - 60.0 * sqrt(1.0 - head));
+				player = 1;
+			}
+			else if (sx * sx + sy * sy <= 1.0)
+			{
+				mm = (UINT)(headMm + 50.0);
+				player = 1;
+			}
+			row[x] = (uint16_t)(((mm + noise) << 3) | player);
+		}
+	}
+
+	// NUI skeleton space: x right, y up, z away from the camera
+	skeleton.tracked = true;
+	skeleton.head[0] = (float)((cx - kColorWidth / 2) * z / kColorFocalLength);
+	skeleton.head[1] = (float)(-(cy - kColorHeight / 2) * z / kColorFocalLength);
+	skeleton.head[2] = (float)z;
+	skeleton.neck[0] = skeleton.head[0];
+	skeleton.neck[1] = skeleton.head[1] - 0.22f;
+	skeleton.neck[2] = skeleton.head[2] + 0.02f;
+}
+
+HRESULT SyntheticFrameSource::readFrame(SourceFrame& frame)
+{
+	if (color.empty())
+	{
+		return E_FAIL;
+	}
+	if (frames && frameId >= frames)
+	{
+		return S_FALSE;
+	}
+	if (frameIntervalMs)
+	{
+		LONG wait = (LONG)(nextFrameTick - GetTickCount());
+		if (wait > 0)
+		{
+			Sleep((DWORD)wait);
+		}
+		else
+		{
+			// fell behind, do not try to catch up with a burst
+			nextFrameTick = GetTickCount();
+		}
+		nextFrameTick += frameIntervalMs;
+	}
+	// scene time follows the frame count, not the clock, so every run is the same
+	render(frameId / 30.0);
+
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	frame.frameId = ++frameId;
+	frame.timestamp = now.QuadPart;
+	frame.color = &color[0];
+	frame.colorStride = kColorWidth * 4;
+	frame.depth = &depth[0];
+	frame.depthStride = kDepthWidth * sizeof(uint16_t);
+	memset(frame.skeletons, 0, sizeof(frame.skeletons));
+	frame.skeletons[0] = skeleton;
+	return S_OK;
+}
@@ -0,0 +1,42 @@
+#ifndef SYNTHETIC_FRAME_SOURCE_H
+#define SYNTHETIC_FRAME_SOURCE_H
+
+#include "frameSource.h"
+
+#include <vector>
+
+// A generated scene in the Kinect's default formats: a face drifting on a
+// slow Lissajous path in front of a flat background, with eyes looking
+// around, the matching head blob in the depth image (player 1) and a
+// tracked skeleton. The same seed always gives the same frames, so load
+// tests and benchmarks are repeatable on machines without a sensor.
+class SyntheticFrameSource : public FrameSource
+{
+public:
+	// frames 0 runs until closed; frameIntervalMs 0 generates as fast as
+	// frames are read, 33 behaves like the camera at 30 fps.
+	explicit SyntheticFrameSource(UINT frames = 0, DWORD frameIntervalMs = 0, UINT seed = 1);
+
+	HRESULT open();
+	void close();
+	const FrameSourceConfig& getConfig() const	{return config;}
+	HRESULT readFrame(SourceFrame& frame);
+	const char* getName() const	{return "synthetic";}
+
+private:
+	void render(double t);
+
+	UINT frames;
+	DWORD frameIntervalMs;
+	UINT seed;
+	UINT random;
+	FrameSourceConfig config;
+	std::vector<BYTE> background;
+	std::vector<BYTE> color;
+	std::vector<uint16_t> depth;
+	SourceSkeleton skeleton;
+	UINT frameId;
+	DWORD nextFrameTick;
+};
+
+#endif
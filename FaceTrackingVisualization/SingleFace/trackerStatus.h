@@ -0,0 +1,49 @@
+#ifndef TRACKER_STATUS_H
+#define TRACKER_STATUS_H
+
+// State of a tracking core (FTHelper, FTHelper2, GazeService). Start-up
+// failures stop the tracking thread, its exit code is the same value.
+enum TrackerStatus
+{
+	TRACKER_NOT_STARTED = 0,
+	TRACKER_STARTING,
+	TRACKER_RUNNING,
+	TRACKER_STOPPED,
+	TRACKER_INVALID_ARGUMENT,
+	TRACKER_SENSOR_FAILED,			// Kinect runtime or frame source could not be opened
+	TRACKER_OUT_OF_MEMORY,
+	TRACKER_CREATE_FAILED,			// FTCreateFaceTracker
+	TRACKER_INIT_FAILED,			// IFTFaceTracker::Initialize, usually missing FaceTrackData.dll
+	TRACKER_RESULT_FAILED,			// IFTFaceTracker::CreateFTResult
+	TRACKER_IMAGE_FAILED,			// colour or depth buffer allocation
+	TRACKER_CASCADE_FAILED,			// face cascade could not be loaded
+	TRACKER_SOURCE_FINISHED			// a file based source reached its end
+};
+
+inline const char* trackerStatusName(TrackerStatus status)
+{
+	switch (status)
+	{
+	case TRACKER_NOT_STARTED:		return "not started";
+	case TRACKER_STARTING:			return "starting";
+	case TRACKER_RUNNING:			return "running";
+	case TRACKER_STOPPED:			return "stopped";
+	case TRACKER_INVALID_ARGUMENT:	return "invalid argument";
+	case TRACKER_SENSOR_FAILED:		return "sensor failed";
+	case TRACKER_OUT_OF_MEMORY:		return "out of memory";
+	case TRACKER_CREATE_FAILED:		return "face tracker creation failed";
+	case TRACKER_INIT_FAILED:		return "face tracker initialization failed";
+	case TRACKER_RESULT_FAILED:		return "face tracker result creation failed";
+	case TRACKER_IMAGE_FAILED:		return "image allocation failed";
+	case TRACKER_CASCADE_FAILED:	return "cascade load failed";
+	case TRACKER_SOURCE_FINISHED:	return "source finished";
+	}
+	return "unknown";
+}
+
+inline bool trackerStatusIsError(TrackerStatus status)
+{
+	return status >= TRACKER_INVALID_ARGUMENT && status != TRACKER_SOURCE_FINISHED;
+}
+
+#endif
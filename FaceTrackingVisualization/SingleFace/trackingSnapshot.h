@@ -0,0 +1,28 @@
+#ifndef TRACKING_SNAPSHOT_H
+#define TRACKING_SNAPSHOT_H
+
+#include "faceGeometry.h"
+
+// Everything a reader outside the tracking thread may look at, published as
+// one unit after each camera frame (see FTHelper::GetSnapshot).
+struct TrackingSnapshot
+{
+	TrackingSnapshot()
+	{
+		memset(this, 0, sizeof(*this));
+	}
+
+	bool tracked;					// false: face lost, geometry is from the last good frame
+	UINT frameId;					// camera frames processed, counts lost frames too
+	LONGLONG timestamp;				// QueryPerformanceCounter at publication
+
+	const FaceTopology* topology;	// process lifetime, NULL before the first face
+	FaceGeometry geometry;
+
+	bool gazeValid;
+	FT_VECTOR3D leftPupil;
+	FT_VECTOR3D rightPupil;
+	float pupilR;
+};
+
+#endif